@@ -0,0 +1,340 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <csignal>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "corpus.hpp"
+#include "genesis.hpp"
+#include "protocol.hpp"
+
+// Microbenchmarks for every stage of the compiler plus the io.asm runtime.
+// Output is one fixed-width line per benchmark in a fixed order so that two runs
+// can be compared with a plain diff. Timings are the median of the repetitions.
+
+struct BenchResult {
+    std::string name;
+    size_t reps;
+    double ns_per_op;
+    double mb_per_s; // 0 when the benchmark has no meaningful byte count
+    double stmts_per_s = 0; // parser throughput, only for the parse rows
+};
+
+struct BenchConfig {
+    size_t reps = 15;
+    size_t size = 2000;
+    std::string filter;
+    bool runtime = true;
+};
+
+double median(std::vector<double> samples) {
+    std::ranges::sort(samples);
+    return samples[samples.size() / 2];
+}
+
+// Times `op` `reps` times; `setup` runs before each repetition outside of the timed region.
+template <typename Setup, typename Op>
+double time_median_ns(const size_t reps, Setup &&setup, Op &&op) {
+    std::vector<double> samples;
+    for (size_t i = 0; i < reps; i++) {
+        setup();
+        const auto start = std::chrono::steady_clock::now();
+        op();
+        const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        samples.push_back(elapsed.count());
+    }
+    return median(samples);
+}
+
+// Statements in `stmts` including the ones nested in scopes, branches and functions.
+size_t count_stmts(const std::vector<NodeStmt *> &stmts) { // NOLINT(*-no-recursion)
+    size_t count = stmts.size();
+    for (const NodeStmt *stmt: stmts) {
+        std::visit([&]<typename Node>(const Node *node) {
+            if constexpr (std::is_same_v<Node, NodeScope>) {
+                count += count_stmts(node->stmts);
+            } else if constexpr (std::is_same_v<Node, NodeStmtWhile> || std::is_same_v<Node, NodeStmtFn>) {
+                count += count_stmts(node->scope->stmts);
+            } else if constexpr (std::is_same_v<Node, NodeStmtIf>) {
+                count += count_stmts(node->scope->stmts);
+                std::optional<NodeIfPred *> pred = node->pred;
+                while (pred.has_value()) {
+                    if (const auto *elif = std::get_if<NodeIfPredElif *>(&pred.value()->var)) {
+                        count += count_stmts((*elif)->scope->stmts);
+                        pred = (*elif)->pred;
+                    } else {
+                        count += count_stmts(std::get<NodeIfPredElse *>(pred.value()->var)->scope->stmts);
+                        pred.reset();
+                    }
+                }
+            }
+        }, stmt->var);
+    }
+    return count;
+}
+
+void bench_pipeline(const BenchConfig &config, std::vector<BenchResult> &results) {
+    CorpusGenerator corpus;
+    for (const std::string &shape: CorpusGenerator::shapes()) {
+        const std::string src = corpus.generate(shape, config.size);
+        const double mb = static_cast<double>(src.size()) / 1e6;
+
+        Diagnostics diagnostics;
+        const std::vector<Token> tokens = Tokenizer(src, diagnostics).tokenize();
+
+        if (("tokenize/" + shape).find(config.filter) != std::string::npos) {
+            const double ns = time_median_ns(config.reps, [] {}, [&] {
+                Tokenizer tokenizer(src, diagnostics);
+                const auto result = tokenizer.tokenize();
+                asm volatile("" : : "g"(result.data()) : "memory");
+            });
+            results.push_back({"tokenize/" + shape, config.reps, ns, mb / (ns / 1e9)});
+        }
+
+        if (("parse/" + shape).find(config.filter) != std::string::npos) {
+            Parser counter(tokens, diagnostics);
+            const size_t stmts = count_stmts(counter.parse_prog().value().stmts);
+            std::vector<Token> input;
+            const double ns = time_median_ns(config.reps, [&] { input = tokens; }, [&] {
+                Parser parser(std::move(input), diagnostics);
+                const auto prog = parser.parse_prog();
+                asm volatile("" : : "g"(&prog) : "memory");
+            });
+            results.push_back({"parse/" + shape, config.reps, ns, mb / (ns / 1e9),
+                               static_cast<double>(stmts) / (ns / 1e9)});
+        }
+
+        if (("generate/" + shape).find(config.filter) != std::string::npos) {
+            Parser parser(tokens, diagnostics);
+            const NodeProg prog = parser.parse_prog().value();
+            const double ns = time_median_ns(config.reps, [] {}, [&] {
+                Generator generator(prog, diagnostics);
+                const std::string out = generator.gen_prog();
+                asm volatile("" : : "g"(out.data()) : "memory");
+            });
+            results.push_back({"generate/" + shape, config.reps, ns, mb / (ns / 1e9)});
+        }
+    }
+}
+
+// The sequential tokenizer against tokenize_parallel on one core per chunk, on a
+// source large enough to be split.
+void bench_tokenize_parallel(const BenchConfig &config, std::vector<BenchResult> &results) {
+    std::vector<size_t> thread_counts = {1};
+    if (const size_t threads = std::thread::hardware_concurrency(); threads > 1) {
+        thread_counts.push_back(threads);
+    }
+    std::erase_if(thread_counts, [&](const size_t threads) {
+        return ("tokenize-large/" + std::to_string(threads) + "-thread").find(config.filter) == std::string::npos;
+    });
+    if (thread_counts.empty()) {
+        return;
+    }
+    CorpusGenerator corpus;
+    const std::string src = corpus.generate("mixed", config.size * 64);
+    const double mb = static_cast<double>(src.size()) / 1e6;
+    Diagnostics diagnostics;
+    for (const size_t threads: thread_counts) {
+        const double ns = time_median_ns(config.reps, [] {}, [&] {
+            Tokenizer tokenizer(src, diagnostics);
+            const auto result = tokenizer.tokenize_parallel(threads);
+            asm volatile("" : : "g"(result.data()) : "memory");
+        });
+        results.push_back({"tokenize-large/" + std::to_string(threads) + "-thread", config.reps, ns, mb / (ns / 1e9)});
+    }
+}
+
+// In-process compiles through libgenesis of a snippet the size services send,
+// with a small arena so that no compile has to map fresh pages.
+void bench_library(const BenchConfig &config, std::vector<BenchResult> &results) {
+    if (std::string("library/snippet").find(config.filter) == std::string::npos) {
+        return;
+    }
+    const std::string snippet = "fn square(x) {\n    return x * x;\n}\nlet i = 0;\nlet n = 0;\ninput(n);\n"
+                                "while (i < n) {\n    print(square(i) + n);\n    i = i + 1;\n}\n";
+    GenesisOptions options;
+    options.arena_bytes = 64 * 1024;
+    constexpr size_t compiles = 100;
+    const double ns = time_median_ns(config.reps, [] {}, [&] {
+        for (size_t i = 0; i < compiles; i++) {
+            const Compilation compilation = genesis_compile(snippet, options);
+            asm volatile("" : : "g"(compilation.asm_text().data()) : "memory");
+        }
+    });
+    const double mb = static_cast<double>(snippet.size()) / 1e6;
+    results.push_back({"library/snippet", config.reps, ns / compiles, mb / (ns / compiles / 1e9)});
+}
+
+// Starts `argv` with stdout and stderr sent to /dev/null; -1 if it could not be started.
+pid_t spawn_quiet(const std::vector<std::string> &argv) {
+    std::vector<char *> args;
+    for (const std::string &arg: argv) {
+        args.push_back(const_cast<char *>(arg.c_str()));
+    }
+    args.push_back(nullptr);
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    pid_t pid;
+    const int status = posix_spawn(&pid, args[0], &actions, nullptr, args.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    return status == 0 ? pid : -1;
+}
+
+int run_quiet(const std::vector<std::string> &argv) {
+    const pid_t pid = spawn_quiet(argv);
+    int status = -1;
+    if (pid > 0) {
+        waitpid(pid, &status, 0);
+    }
+    return status;
+}
+
+// Latency of one small compile to asm: a fresh `geny -S` process against a request
+// to a warm `geny --serve`, once through geny_client and once from this process.
+// Needs geny and geny_client next to the benchmark binary.
+void bench_server(const BenchConfig &config, std::vector<BenchResult> &results) {
+    const std::vector<std::string> names = {"server/cold-process", "server/client-process", "server/request"};
+    if (std::ranges::none_of(names, [&](const std::string &name) { return name.find(config.filter) != std::string::npos; })) {
+        return;
+    }
+    if (access("./geny", X_OK) != 0 || access("./geny_client", X_OK) != 0) {
+        std::cerr << "geny or geny_client not built, skipping server benchmarks" << std::endl;
+        return;
+    }
+    const std::string snippet = "fn square(x) {\n    return x * x;\n}\nlet i = 0;\nlet n = 0;\ninput(n);\n"
+                                "while (i < n) {\n    print(square(i) + n);\n    i = i + 1;\n}\n";
+    std::fstream("bench_server.gn", std::ios::out) << snippet;
+    const std::string socket_path = "bench_server.sock";
+    const pid_t server = spawn_quiet({"./geny", "--serve=" + socket_path, "--workers=2"});
+    if (server < 0) {
+        return;
+    }
+    for (int i = 0; i < 200 && access(socket_path.c_str(), F_OK) != 0; i++) {
+        usleep(10000);
+    }
+
+    const auto run = [&](const std::string &name, const auto &op) {
+        if (("server/" + name).find(config.filter) == std::string::npos) {
+            return;
+        }
+        const double ns = time_median_ns(config.reps, [] {}, op);
+        results.push_back({"server/" + name, config.reps, ns, 0});
+    };
+    run("cold-process", [] { (void) run_quiet({"./geny", "-S", "--no-cache", "bench_server.gn"}); });
+    run("client-process", [&] {
+        (void) run_quiet({"./geny_client", "--socket=" + socket_path, "-o", "bench_server.asm", "bench_server.gn"});
+    });
+    const ServeRequest request {.emit = Emit::asm_text, .path = "bench_server.gn", .options = {}, .source = snippet};
+    run("request", [&] {
+        const std::optional<ServeResponse> response = protocol::compile(socket_path, request);
+        asm volatile("" : : "g"(&response) : "memory");
+    });
+
+    kill(server, SIGTERM);
+    waitpid(server, nullptr, 0);
+}
+
+// The runtime routines can only be measured inside a compiled program, so these
+// build one with nasm and ld and time whole process runs, divided by the call count.
+void bench_runtime(const BenchConfig &config, std::vector<BenchResult> &results) {
+    if (system("command -v nasm > /dev/null && command -v ld > /dev/null") != 0) {
+        std::cerr << "nasm or ld not found, skipping runtime benchmarks" << std::endl;
+        return;
+    }
+    constexpr size_t calls = 100000;
+    const auto build = [](const std::string &name, const std::string &src) {
+        Diagnostics diagnostics;
+        const std::vector<Token> tokens = Tokenizer(src, diagnostics).tokenize();
+        Parser parser(tokens, diagnostics);
+        Generator generator(parser.parse_prog().value(), diagnostics);
+        std::fstream(name + ".asm", std::ios::out) << generator.gen_prog();
+        const std::string cmd = "nasm -f elf64 ../io.asm -o bench_io.o && nasm -f elf64 " + name + ".asm -o " + name
+                                + ".o && ld " + genesis_link_flags(false) + " -o " + name + " " + name + ".o bench_io.o";
+        return system(cmd.c_str()) == 0;
+    };
+    const auto run = [&](const std::string &name, const std::string &cmd) {
+        if (("runtime/" + name).find(config.filter) == std::string::npos) {
+            return;
+        }
+        const double ns = time_median_ns(config.reps, [] {}, [&] { (void) system(cmd.c_str()); });
+        results.push_back({"runtime/" + name, config.reps, ns / calls, 0});
+    };
+
+    std::stringstream loop;
+    loop << "let i = 0;\nwhile (i < " << calls << ") {\n    print(i * 1234567);\n    i = i + 1;\n}\n";
+    if (build("bench_print", loop.str())) {
+        run("print_int", "./bench_print > /dev/null");
+    }
+
+    std::stringstream input_loop;
+    input_loop << "let i = 0;\nlet n = 0;\nwhile (i < " << calls << ") {\n    input(n);\n    i = i + 1;\n}\n";
+    if (build("bench_input", input_loop.str())) {
+        // input_int issues one read() per call however much the pipe holds, so this measures the per-call cost
+        run("input_int", "yes 1234567 | head -n " + std::to_string(calls) + " | ./bench_input");
+    }
+}
+
+void print_results(const std::vector<BenchResult> &results) {
+    std::cout << "# genesis bench " << GENESIS_VERSION << "\n";
+    std::cout << std::left << std::setw(28) << "benchmark" << std::right << std::setw(8) << "reps"
+            << std::setw(16) << "ns/op" << std::setw(12) << "MB/s" << "\n";
+    std::cout << std::fixed;
+    for (const auto &[name, reps, ns_per_op, mb_per_s, stmts_per_s]: results) {
+        std::cout << std::left << std::setw(28) << name << std::right << std::setw(8) << reps
+                << std::setw(16) << std::setprecision(1) << ns_per_op << std::setw(12);
+        if (mb_per_s > 0) {
+            std::cout << std::setprecision(2) << mb_per_s;
+        } else {
+            std::cout << "-";
+        }
+        if (stmts_per_s > 0) {
+            std::cout << "  " << std::setprecision(0) << stmts_per_s << " stmts/s";
+        }
+        std::cout << "\n";
+    }
+}
+
+int main(int argc, char *argv[]) {
+    BenchConfig config;
+    for (int i = 1; i < argc; i++) {
+        const std::string_view arg = argv[i];
+        if (arg.starts_with("--reps=")) {
+            config.reps = std::max<size_t>(1, std::stoul(std::string(arg.substr(7))));
+        } else if (arg.starts_with("--size=")) {
+            config.size = std::stoul(std::string(arg.substr(7)));
+        } else if (arg.starts_with("--filter=")) {
+            config.filter = arg.substr(9);
+        } else if (arg == "--no-runtime") {
+            config.runtime = false;
+        } else {
+            std::cerr << "usage: geny_bench [--reps=N] [--size=N] [--filter=substr] [--no-runtime]" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::vector<BenchResult> results;
+    bench_pipeline(config, results);
+    bench_tokenize_parallel(config, results);
+    bench_library(config, results);
+    bench_server(config, results);
+    if (config.runtime) {
+        bench_runtime(config, results);
+    }
+    print_results(results);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Deterministic generator for large `.gn` programs. The same (shape, size, seed)
+// always yields byte-identical source, so benchmark inputs never drift between
+// commits. Every program it emits is valid: identifiers are declared before use,
+// never redeclared in a visible scope, and no division has a zero divisor.
+class CorpusGenerator {
+public:
+    explicit CorpusGenerator(const uint64_t seed = 0x9e3779b97f4a7c15)
+        : m_state(seed == 0 ? 1 : seed) {
+    }
+
+    static std::vector<std::string> shapes() {
+        return {"comments", "deep_expr", "elif_chain", "many_vars", "mixed", "nested_while"};
+    }
+
+    // `size` scales the number of statements; every shape yields roughly 50-150 KiB at size 2000.
+    std::string generate(const std::string &shape, const size_t size) {
+        m_out.str({});
+        m_var_count = 0;
+        if (shape == "comments") {
+            gen_comments(size);
+        } else if (shape == "deep_expr") {
+            gen_deep_expr(size / 4);
+        } else if (shape == "elif_chain") {
+            gen_elif_chain(size);
+        } else if (shape == "many_vars") {
+            gen_many_vars(size);
+        } else if (shape == "nested_while") {
+            gen_nested_while(size / 4);
+        } else {
+            gen_comments(size / 4);
+            gen_many_vars(size);
+            gen_deep_expr(size / 16);
+            gen_elif_chain(size / 4);
+            gen_nested_while(size / 16);
+        }
+        m_out << "exit(0);\n";
+        return m_out.str();
+    }
+
+private:
+    // xorshift64*, fully specified so output does not depend on the standard library
+    uint64_t next() {
+        m_state ^= m_state >> 12;
+        m_state ^= m_state << 25;
+        m_state ^= m_state >> 27;
+        return m_state * 0x2545f4914f6cdd1d;
+    }
+
+    uint64_t next(const uint64_t bound) {
+        return next() % bound;
+    }
+
+    std::string fresh_var() {
+        return "v" + std::to_string(m_var_count++);
+    }
+
+    // A random expression over `vars` with nesting `depth`; divisors are always non-zero literals.
+    void expr(const std::vector<std::string> &vars, const int depth) { // NOLINT(*-no-recursion)
+        if (depth <= 0 || next(4) == 0) {
+            if (!vars.empty() && next(2) == 0) {
+                m_out << vars[next(vars.size())];
+            } else {
+                m_out << next(1000);
+            }
+            return;
+        }
+        static constexpr const char *ops[] = {" + ", " - ", " * ", " / "};
+        const char *op = ops[next(4)];
+        m_out << "(";
+        expr(vars, depth - 1);
+        m_out << op;
+        if (op[1] == '/') {
+            m_out << next(9) + 1;
+        } else {
+            expr(vars, depth - 1);
+        }
+        m_out << ")";
+    }
+
+    void gen_comments(const size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            if (next(2) == 0) {
+                m_out << "// line comment " << next() << " with some padding text to skip over\n";
+            } else {
+                m_out << "/* block comment " << next() << "\n   spanning lines ( ) { } ; == */\n";
+            }
+        }
+    }
+
+    void gen_deep_expr(const size_t count) {
+        std::vector<std::string> vars;
+        for (size_t i = 0; i < count; i++) {
+            const std::string name = fresh_var();
+            m_out << "let " << name << " = ";
+            expr(vars, 10);
+            m_out << ";\n";
+            vars.push_back(name);
+        }
+    }
+
+    void gen_elif_chain(const size_t count) {
+        const std::string x = fresh_var();
+        const std::string result = fresh_var();
+        m_out << "let " << x << " = " << next(count + 1) << ";\n";
+        m_out << "let " << result << " = 0;\n";
+        m_out << "if (" << x << " == 0) {\n    " << result << " = 1;\n}";
+        for (size_t i = 1; i < count; i++) {
+            m_out << "elif (" << x << " == " << i << ") {\n    " << result << " = " << result << " + " << i
+                    << ";\n}";
+        }
+        m_out << "else {\n    " << result << " = 0;\n}\n";
+    }
+
+    void gen_many_vars(const size_t count) {
+        std::vector<std::string> vars;
+        for (size_t i = 0; i < count; i++) {
+            const std::string name = fresh_var();
+            m_out << "let " << name << " = ";
+            expr(vars, 2);
+            m_out << ";\n";
+            vars.push_back(name);
+            if (vars.size() > 1 && next(4) == 0) {
+                m_out << vars[next(vars.size())] << " = ";
+                expr(vars, 2);
+                m_out << ";\n";
+            }
+        }
+    }
+
+    void gen_nested_while(const size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            const std::string acc = fresh_var();
+            m_out << "let " << acc << " = 0;\n";
+            loop(acc, 3, 0);
+        }
+    }
+
+    void loop(const std::string &acc, const int depth, const int indent) { // NOLINT(*-no-recursion)
+        const std::string pad(indent * 4, ' ');
+        const std::string i = fresh_var();
+        m_out << pad << "let " << i << " = 0;\n";
+        m_out << pad << "while (" << i << " < " << next(8) + 2 << ") {\n";
+        if (depth > 1) {
+            loop(acc, depth - 1, indent + 1);
+        }
+        m_out << pad << "    " << acc << " = " << acc << " + " << i << " * " << next(10) << ";\n";
+        m_out << pad << "    " << i << " = " << i << " + 1;\n";
+        m_out << pad << "}\n";
+    }
+
+    uint64_t m_state;
+    std::stringstream m_out;
+    size_t m_var_count = 0;
+};
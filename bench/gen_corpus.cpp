@@ -0,0 +1,19 @@
+#include <iostream>
+#include <string>
+
+#include "corpus.hpp"
+
+int main(int argc, char *argv[]) {
+    if (argc < 3 || argc > 4) {
+        std::cerr << "usage: geny_corpus <shape> <size> [seed]" << std::endl;
+        std::cerr << "shapes:";
+        for (const std::string &shape: CorpusGenerator::shapes()) {
+            std::cerr << " " << shape;
+        }
+        std::cerr << std::endl;
+        return EXIT_FAILURE;
+    }
+    CorpusGenerator corpus = argc == 4 ? CorpusGenerator(std::stoull(argv[3])) : CorpusGenerator();
+    std::cout << corpus.generate(argv[1], std::stoul(argv[2]));
+    return EXIT_SUCCESS;
+}
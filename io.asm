@@ -1,147 +1,819 @@
 global print_int
 global input_int
-section .data
-    digit_str db "0123456789", 0    ; For conversion reference (if needed)
-    zero_msg  db "0", 0             ; Message for printing zero
-    minus_msg db "-", 0            ; Minus sign for negative numbers
-    newline db 10, 0
+global input_ints
+global print_ints
+global prof_dump
+global bounds_fail
+global print_text
+global par_for
+
+PAR_STACK_BYTES equ 8 << 20         ; Worker stack, aligned to its size
+PAR_MAX_WORKERS equ 64
 
+; Every routine and every piece of data is in a section of its own, so that
+; `ld --gc-sections` links only what the program's calls actually reach.
+section .rodata.digit_str progbits alloc noexec nowrite align=1
+    digit_str db "0123456789", 0    ; For conversion reference (if needed)
+section .rodata.digit_pairs progbits alloc noexec nowrite align=1
+    digit_pairs db "00010203040506070809101112131415161718192021222324252627282930313233343536373839404142434445464748495051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899"
+section .rodata.bounds_msg progbits alloc noexec nowrite align=1
+    bounds_msg db "index out of bounds", 10
+    bounds_len equ $ - bounds_msg
 
-section .bss
-    out_buffer resb 32              ; Buffer for number-to-string conversion
-    in_buffer  resb 32              ; Buffer for reading input
 
-section .text
+section .bss.in_stream nobits alloc noexec write align=8
+    in_stream  resb 4096            ; Buffered STDIN, shared by input_int and input_ints
+    in_pos     resq 1               ; Next unread byte in in_stream
+    in_end     resq 1               ; End of the valid bytes in in_stream
+section .bss.par_state nobits alloc noexec write align=8
+    par_active     resd 1           ; Nonzero while worker threads run a loop
+    par_generation resd 1           ; Bumped for every loop, workers wait on it
+    par_pending    resd 1           ; Workers still busy with the current loop
+    par_pad        resd 1
+    par_workers    resq 1           ; Threads in the pool, 0 until the first loop
+    par_count      resq 1           ; Iterations of the current loop
+    par_chunk      resq 1           ; Iterations per chunk
+    par_nchunks    resq 1
+    par_next       resq 1           ; Next chunk to claim
+    par_body       resq 1
+    par_frame      resq 1
+    par_records    resq 1           ; Output of every chunk: address, length, capacity
+section .bss.prof_buffer nobits alloc noexec write align=8
+    prof_buffer resb 4096           ; Output buffer for prof_dump
+    prof_digits resb 24             ; Scratch space for number formatting
 
 
 ; print_int: Print the integer in RDI
 ; Expected:
 ;   RDI - integer to print
 ; Uses:
-;   RAX, RBX, RCX, RDX, RSI, RDI (clobbered), returns normally.
+;   RAX, RCX, RDX, RSI, RDI, R8, R9, R10, R11 (clobbered), returns normally.
+section .text.print_int progbits alloc exec nowrite align=16
 print_int:
-    push rbp
-    mov rbp, rsp
-    sub rsp, 32               ; Reserve some stack space
+    push rbx
+    sub rsp, 32               ; '-', 20 digits and the newline
+    mov rax, rdi
+    mov rbx, rsp
+    call format_int
+    mov rsi, rsp
+    mov rdx, rbx
+    sub rdx, rsi
+    call out_write
+    add rsp, 32
+    pop rbx
+    ret
+
+
+; print_text: Writes output the compiler already formatted, such as everything a
+; loop evaluated at compile time prints.
+; Expected:
+;   RDI - address of the text
+;   RSI - length in bytes
+; Uses:
+;   RAX, RCX, RDX, RSI, RDI, R8, R9, R10, R11 (clobbered), returns normally.
+section .text.print_text progbits alloc exec nowrite align=16
+print_text:
+    mov rdx, rsi
+    mov rsi, rdi
+    jmp out_write
 
-    mov rbx, rdi              ; Store original value in RBX
-    ; Check if number is zero
-    cmp rbx, 0
-    jne .convert_number
 
-    ; If zero, write the "0" message.
-    mov rax, 1                ; sys_write system call number
-    mov rdi, 1                ; File descriptor: stdout
-    lea rsi, [rel zero_msg]   ; Address of zero_msg
-    mov rdx, 1                ; Write 1 byte ("0")
+; out_write: Writes output to STDOUT. On a worker thread of a parallel loop the
+; bytes are appended to the output of the chunk being run instead, which
+; par_for writes out in iteration order once every chunk is done.
+; Expected:
+;   RSI - address of the bytes
+;   RDX - number of bytes
+; Uses:
+;   RAX, RCX, RDX, RSI, RDI, R8, R9, R10, R11 (clobbered), returns normally.
+section .text.out_write progbits alloc exec nowrite align=16
+out_write:
+    cmp dword [rel par_active], 0
+    jne .capture
+.write:
+    test rdx, rdx
+    jz .done
+    mov rax, 1                ; sys_write
+    mov rdi, 1                ; stdout
     syscall
-    jmp .done
+    test rax, rax
+    jle .done                 ; Give up on errors
+    add rsi, rax              ; Short write, continue after what got out
+    sub rdx, rax
+    jmp .write
+.done:
+    ret
 
-.convert_number:
-    ; If negative, print '-' and negate number
-    mov rax, rbx
-    cmp rax, 0
-    jge .convert_digits
-    ; Print '-' sign
-    mov rax, 1
-    mov rdi, 1
-    lea rsi, [rel minus_msg]
-    mov rdx, 1
+.capture:
+    push rbx
+    mov rbx, rsp
+    and rbx, -PAR_STACK_BYTES
+    mov rbx, [rbx]            ; Output record of the chunk, see par_worker
+    mov rcx, [rbx + 8]
+    add rcx, rdx              ; Length needed
+    cmp rcx, [rbx + 16]
+    jbe .append
+    push rsi
+    push rdx
+    lea r9, [rcx + rcx]       ; Grow to twice that, at least a page
+    mov eax, 4096
+    cmp r9, rax
+    cmovb r9, rax
+    mov rdi, [rbx]
+    test rdi, rdi
+    jz .map
+    mov rsi, [rbx + 16]
+    mov rdx, r9
+    mov r10, 1                ; MREMAP_MAYMOVE
+    mov rax, 25               ; sys_mremap
+    syscall
+    jmp .grown
+.map:
+    mov rsi, r9
+    mov rdx, 3                ; PROT_READ | PROT_WRITE
+    mov r10, 0x22             ; MAP_PRIVATE | MAP_ANONYMOUS
+    mov r8, -1
+    push r9
+    xor r9, r9
+    mov rax, 9                ; sys_mmap
     syscall
-    neg rbx                 ; Convert to positive
+    pop r9
+.grown:
+    mov [rbx], rax
+    mov [rbx + 16], r9
+    pop rdx
+    pop rsi
+.append:
+    mov rdi, [rbx]
+    add rdi, [rbx + 8]
+    add [rbx + 8], rdx
+    mov rcx, rdx
+    rep movsb
+    pop rbx
+    ret
 
-.convert_digits:
-    ; Initialize pointer to end of out_buffer.
-    lea rdi, [rel out_buffer + 32]
-    xor rcx, rcx            ; Digit count = 0
 
-.convert_loop:
-    ; Divide rbx by 10 repeatedly
-    xor rdx, rdx            ; Clear RDX before division
-    mov rax, rbx
-    mov r8, 10
-    div r8                  ; After division: RAX = quotient, RDX = remainder
-    ; Convert remainder to ASCII character
-    add rdx, '0'
-    dec rdi                 ; Move pointer backwards
-    mov [rdi], dl           ; Store the digit
-    inc rcx                 ; Increase digit count
-    mov rbx, rax            ; Update number (quotient)
-    cmp rbx, 0
-    jne .convert_loop
+; input_int: Reads the next whitespace separated integer from STDIN.
+; Input is buffered, so values can share a line and scalar reads can be
+; mixed freely with input_ints.
+; Returns:
+;   RAX contains the converted integer, 0 at end of input
+; Uses:
+;   RAX, RCX, RDX, RSI, RDI, R8, R9, R10, R11 (clobbered), returns normally.
+section .text.input_int progbits alloc exec nowrite align=16
+input_int:
+    mov r8, [rel in_pos]       ; Read position
+    mov r9, [rel in_end]       ; End of buffered input
+    xor r10d, r10d             ; Sign, 1 if negative
 
-    ; --- After finishing conversion loop, RDI holds pointer to the start of our digit string ---
-    mov rsi, rdi            ; Save the pointer to our string in RSI
-    mov rax, 1              ; sys_write
-    mov rdi, 1              ; STDOUT file descriptor (1)
-    mov rdx, rcx            ; Number of bytes to write (number of digits)
+.skip_space:
+    cmp r8, r9
+    jb .check_space
+    call in_fill
+    cmp r8, r9
+    je .eof
+.check_space:
+    movzx eax, byte [r8]
+    cmp al, ' '
+    je .next_space
+    cmp al, 9                  ; '\t' up to '\r'
+    jb .check_sign
+    cmp al, 13
+    ja .check_sign
+.next_space:
+    inc r8
+    jmp .skip_space
+
+.check_sign:
+    xor eax, eax               ; Accumulator
+    movzx edx, byte [r8]
+    cmp dl, '-'
+    jne .check_plus
+    mov r10d, 1
+    inc r8
+    jmp .parse_digits
+.check_plus:
+    cmp dl, '+'
+    jne .parse_digits
+    inc r8
+
+.parse_digits:
+    mov rcx, r9
+    sub rcx, r8
+    cmp rcx, 8
+    jb .parse_tail
+    ; Eight bytes at once: they are all digits iff no byte has its top bit set
+    ; after subtracting '0' (catches bytes below '0') or adding 0x46 (above '9').
+    mov rdx, [r8]
+    mov rdi, rdx
+    mov rsi, 0x3030303030303030
+    sub rdx, rsi
+    mov rsi, 0x4646464646464646
+    add rdi, rsi
+    or rdi, rdx
+    mov rsi, 0x8080808080808080
+    test rdi, rsi
+    jnz .parse_digit
+    ; Combine neighbouring digits into 2, then 4, then 8 digit numbers.
+    ; The first digit sits in the lowest byte and is the most significant.
+    lea rdi, [rdx + rdx * 4]
+    add rdi, rdi
+    shr rdx, 8
+    add rdx, rdi
+    mov rsi, 0x00FF00FF00FF00FF
+    and rdx, rsi
+    imul rdi, rdx, 100
+    shr rdx, 16
+    add rdx, rdi
+    mov rsi, 0x0000FFFF0000FFFF
+    and rdx, rsi
+    imul rdi, rdx, 10000
+    shr rdx, 32
+    add rdx, rdi
+    mov edx, edx
+    imul rax, rax, 100000000
+    add rax, rdx
+    add r8, 8
+    jmp .parse_digits
+
+.parse_tail:
+    cmp r8, r9
+    jb .parse_digit
+    push rax
+    call in_fill
+    pop rax
+    cmp r8, r9
+    je .apply_sign             ; Input ended right after the digits
+.parse_digit:
+    movzx edx, byte [r8]
+    sub edx, '0'
+    cmp edx, 9
+    ja .end_number
+    imul rax, rax, 10
+    add rax, rdx
+    inc r8
+    jmp .parse_digits
+
+.end_number:
+    inc r8                     ; Consume the terminator
+.apply_sign:
+    test r10d, r10d
+    jz .done
+    neg rax
+.done:
+    mov [rel in_pos], r8
+    mov [rel in_end], r9
+    ret
+
+.eof:
+    xor eax, eax
+    jmp .done
+
+
+; in_fill: Refills in_stream from STDIN.
+; Returns:
+;   R8 - start of the new data, R9 - its end (equal to R8 at end of input)
+; Uses:
+;   RAX, RCX, RDX, RSI, RDI, R11 (clobbered), returns normally.
+section .text.in_fill progbits alloc exec nowrite align=16
+in_fill:
+    mov rax, 0                 ; sys_read
+    mov rdi, 0
+    lea rsi, [rel in_stream]
+    mov rdx, 4096
     syscall
+    lea r8, [rel in_stream]
+    mov r9, r8
+    test rax, rax
+    jle .done
+    add r9, rax
+.done:
+    ret
+
+
+; input_ints: Fills an array with integers read from STDIN.
+; Expected:
+;   RDI - address of the first element
+;   RSI - number of elements
+; Uses:
+;   RAX, RCX, RDX, RSI, RDI, R8, R9, R10, R11 (clobbered), returns normally.
+section .text.input_ints progbits alloc exec nowrite align=16
+input_ints:
+    push r12
+    push r13
+    mov r12, rdi               ; Current element
+    mov r13, rsi               ; Elements left
+.next:
+    test r13, r13
+    jz .done
+    call input_int
+    mov [r12], rax
+    add r12, 8
+    dec r13
+    jmp .next
+.done:
+    pop r13
+    pop r12
+    ret
+
+
+; print_ints: Prints every element of an array on its own line, formatting
+; all of them into a buffer on the stack and writing it with as few syscalls
+; as possible.
+; Expected:
+;   RDI - address of the first element
+;   RSI - number of elements
+; Uses:
+;   RAX, RCX, RDX, RSI, RDI, R8, R9, R10, R11 (clobbered), returns normally.
+section .text.print_ints progbits alloc exec nowrite align=16
+print_ints:
+    push rbx
+    push r12
+    push r13
+    push r14
+    sub rsp, 4096
+    mov r14, rsp               ; Buffer
+    mov r12, rdi               ; Current element
+    mov r13, rsi               ; Elements left
+    mov rbx, r14               ; Write cursor
+
+.next:
+    test r13, r13
+    jz .flush
+    ; Flush first if a worst case line ('-', 20 digits, newline) might not fit
+    lea rax, [r14 + 4096 - 24]
+    cmp rbx, rax
+    jb .format
+    call .write_stream
+.format:
+    mov rax, [r12]
+    call format_int
+    add r12, 8
+    dec r13
+    jmp .next
+
+.flush:
+    call .write_stream
+    add rsp, 4096
+    pop r14
+    pop r13
+    pop r12
+    pop rbx
+    ret
 
-    ; Write the newline character
-    mov rax, 1              ; sys_write
-    mov rdi, 1              ; stdout file descriptor
-    lea rsi, [rel newline]  ; Load the address of the newline character into RSI
-    mov rdx, 1              ; Writing one byte
+; Writes [R14, RBX) and rewinds RBX
+.write_stream:
+    mov rsi, r14
+    mov rdx, rbx
+    sub rdx, rsi
+    jz .written
+    call out_write
+    mov rbx, r14
+.written:
+    ret
+
+
+; format_int: Appends the signed decimal form of RAX and a newline at RBX.
+; Digits are produced two at a time from digit_pairs, dividing by 100 with a
+; multiply by its reciprocal instead of div.
+; Returns:
+;   RBX advanced past the newline
+; Uses:
+;   RAX, RCX, RDX, RSI, RDI, R8 (clobbered), returns normally.
+section .text.format_int progbits alloc exec nowrite align=16
+format_int:
+    test rax, rax
+    jns .positive
+    mov byte [rbx], '-'
+    inc rbx
+    neg rax                    ; INT64_MIN stays put, which is right as unsigned
+.positive:
+    sub rsp, 24                ; Digits, written backwards
+    lea rdi, [rsp + 24]
+    lea rsi, [rel digit_pairs]
+.pair:
+    cmp rax, 100
+    jb .last
+    mov r8, rax
+    shr rax, 2                 ; rdx = rax / 100
+    mov rdx, 0x28F5C28F5C28F5C3
+    mul rdx
+    shr rdx, 2
+    imul rax, rdx, 100
+    sub r8, rax                ; Remainder
+    mov rax, rdx
+    movzx ecx, word [rsi + r8 * 2]
+    sub rdi, 2
+    mov [rdi], cx
+    jmp .pair
+.last:
+    cmp rax, 10
+    jb .one
+    movzx ecx, word [rsi + rax * 2]
+    sub rdi, 2
+    mov [rdi], cx
+    jmp .copy
+.one:
+    add al, '0'
+    dec rdi
+    mov [rdi], al
+.copy:
+    lea rcx, [rsp + 24]
+    sub rcx, rdi               ; Digit count
+    mov rsi, rdi
+    mov rdi, rbx
+    rep movsb
+    mov byte [rdi], 10
+    lea rbx, [rdi + 1]
+    add rsp, 24
+    ret
+
+
+; prof_dump: Write the counters of an instrumented program to a file,
+; one "<line> <kind> <count>" record per line.
+; Expected:
+;   RDI - site table, three qwords per site: source line, kind string, kind length
+;   RSI - counter array, one qword per site
+;   RDX - number of sites
+;   RCX - null terminated path of the profile file
+; Uses:
+;   RAX, RCX, RDX, RSI, RDI, R8, R11 (clobbered), returns normally.
+section .text.prof_dump progbits alloc exec nowrite align=16
+prof_dump:
+    push rbx
+    push r12
+    push r13
+    push r14
+    push r15
+    mov r12, rdi               ; Current site
+    mov r13, rsi               ; Current counter
+    mov r14, rdx               ; Sites left
+
+    ; open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)
+    mov rax, 2
+    mov rdi, rcx
+    mov rsi, 0x241
+    mov rdx, 420
     syscall
+    test rax, rax
+    js .done
+    mov r15, rax               ; File descriptor
+    lea rbx, [rel prof_buffer] ; Write cursor
 
+.site_loop:
+    test r14, r14
+    jz .flush
+    ; Flush first if a worst case record (2 * 20 digits + kind + 3) might not fit
+    lea rax, [rel prof_buffer + 4096 - 128]
+    cmp rbx, rax
+    jb .format_site
+    call .write_buffer
 
+.format_site:
+    mov rax, [r12]             ; Source line
+    call .format_uint
+    mov byte [rbx], ' '
+    inc rbx
+    mov rsi, [r12 + 8]         ; Kind string
+    mov rcx, [r12 + 16]        ; Kind length
+    mov rdi, rbx
+    rep movsb
+    mov rbx, rdi
+    mov byte [rbx], ' '
+    inc rbx
+    mov rax, [r13]             ; Execution count
+    call .format_uint
+    mov byte [rbx], 10
+    inc rbx
+    add r12, 24
+    add r13, 8
+    dec r14
+    jmp .site_loop
+
+.flush:
+    call .write_buffer
+    mov rax, 3                 ; sys_close
+    mov rdi, r15
+    syscall
 
 .done:
-    leave
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop rbx
+    ret
+
+; Writes [prof_buffer, RBX) to the profile file and rewinds RBX
+.write_buffer:
+    lea rsi, [rel prof_buffer]
+    mov rdx, rbx
+    sub rdx, rsi
+    mov rax, 1                 ; sys_write
+    mov rdi, r15
+    syscall
+    lea rbx, [rel prof_buffer]
     ret
 
+; Appends the unsigned decimal digits of RAX at RBX and advances RBX
+.format_uint:
+    lea rdi, [rel prof_digits + 24]
+    mov rcx, rdi
+    mov r8, 10
+.format_digit:
+    xor rdx, rdx
+    div r8
+    add dl, '0'
+    dec rdi
+    mov [rdi], dl
+    test rax, rax
+    jnz .format_digit
+    mov rsi, rdi
+    sub rcx, rdi               ; Digit count
+    mov rdi, rbx
+    rep movsb
+    mov rbx, rdi
+    ret
 
-; input_int: Reads an integer from STDIN
-; Returns:
-;   RAX contains the converted integer
-input_int:
+
+; bounds_fail: Reports an array index outside of its array and exits with status 1.
+; Reached by a jump from the bounds check, never returns.
+section .text.bounds_fail progbits alloc exec nowrite align=16
+bounds_fail:
+    mov rax, 1                 ; write(stderr, bounds_msg, bounds_len)
+    mov rdi, 2
+    lea rsi, [rel bounds_msg]
+    mov rdx, bounds_len
+    syscall
+    mov rax, 231               ; exit_group(1), ends the worker threads too
+    mov rdi, 1
+    syscall
+
+
+; par_for: Runs the iterations [0, RDI) of a `parallel while` on the worker
+; threads. Chunks of iterations are claimed from a shared counter, so threads
+; that finish early take over the rest. Output printed by a chunk is kept
+; and written in iteration order once the loop is done. Runs the whole range
+; on the calling thread when there is one CPU or when called from a worker.
+; Expected:
+;   RDI - number of iterations
+;   RSI - loop body, called with RDI = first and RSI = end iteration of a chunk
+;         and RBP = RDX
+;   RDX - frame of the loop's function
+;   RCX - number of threads, 0 for one per CPU the process may run on
+; Uses:
+;   RAX, RCX, RDX, RSI, RDI, R8, R9, R10, R11 (clobbered), returns normally.
+section .text.par_for progbits alloc exec nowrite align=16
+par_for:
+    push rbx
+    push r12
+    push r13
+    push r14
+    push r15
     push rbp
-    mov rbp, rsp
-    sub rsp, 32                ; Reserve some space
+    mov r12, rdi               ; Iterations
+    mov r13, rsi               ; Body
+    mov rbp, rdx               ; Frame
+    test r12, r12
+    jz .done
+    cmp dword [rel par_active], 0
+    jne .inline                ; Already on a worker
+    mov rax, [rel par_workers]
+    test rax, rax
+    jnz .started
+    call par_start
+.started:
+    cmp rax, 1
+    jbe .inline
 
-    ; Read from STDIN into in_buffer (max 32 bytes)
-    mov rax, 0                 ; sys_read system call number
-    mov rdi, 0                 ; File descriptor: STDIN
-    lea rsi, [rel in_buffer]
-    mov rdx, 32                ; Maximum bytes to read
+    mov [rel par_count], r12
+    mov [rel par_body], r13
+    mov [rel par_frame], rbp
+    ; About eight chunks per worker
+    mov rcx, rax
+    shl rcx, 3
+    mov rax, r12
+    xor edx, edx
+    div rcx
+    test rax, rax
+    jnz .chunked
+    mov eax, 1
+.chunked:
+    mov [rel par_chunk], rax
+    mov rcx, rax
+    lea rax, [r12 + rcx - 1]
+    xor edx, edx
+    div rcx
+    mov [rel par_nchunks], rax
+    mov r14, rax               ; Chunks
+    lea r15, [rax + rax * 2]
+    shl r15, 3                 ; Bytes of the output records
+    xor edi, edi               ; mmap(0, r15, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)
+    mov rsi, r15
+    mov rdx, 3
+    mov r10, 0x22
+    mov r8, -1
+    xor r9, r9
+    mov rax, 9
+    syscall
+    mov [rel par_records], rax
+    mov qword [rel par_next], 0
+    mov eax, [rel par_workers]
+    mov [rel par_pending], eax
+    mov dword [rel par_active], 1
+    lock inc dword [rel par_generation]
+    lea rdi, [rel par_generation] ; futex(&par_generation, FUTEX_WAKE_PRIVATE, INT_MAX)
+    mov esi, 129
+    mov edx, 0x7FFFFFFF
+    mov eax, 202
     syscall
 
-    ; At this point, RAX contains the number of bytes read (ignored here)
-    ; Begin converting the input string in in_buffer to an integer.
-    lea rsi, [rel in_buffer]   ; Pointer to the input buffer
-    xor rax, rax               ; Clear accumulator (will hold the integer)
-    mov bl, 1                  ; Assume positive integer (BL = sign multiplier)
+.wait:
+    mov edx, [rel par_pending]
+    test edx, edx
+    jz .joined
+    lea rdi, [rel par_pending] ; futex(&par_pending, FUTEX_WAIT_PRIVATE, edx)
+    mov esi, 128
+    xor r10, r10
+    mov eax, 202
+    syscall
+    jmp .wait
 
-    ; Check for optional sign at beginning
-    mov cl, byte [rsi]
-    cmp cl, '-'
-    jne .check_plus
-    mov bl, -1
-    inc rsi
-    jmp .parse_digits
+.joined:
+    mov dword [rel par_active], 0
+    mov rbx, [rel par_records]
+.flush:
+    test r14, r14
+    jz .unmap
+    mov rsi, [rbx]
+    test rsi, rsi
+    jz .next_record            ; The chunk printed nothing
+    mov rdx, [rbx + 8]
+    call out_write
+    mov rdi, [rbx]             ; munmap(buffer, capacity)
+    mov rsi, [rbx + 16]
+    mov eax, 11
+    syscall
+.next_record:
+    add rbx, 24
+    dec r14
+    jmp .flush
+.unmap:
+    mov rdi, [rel par_records]
+    mov rsi, r15
+    mov eax, 11
+    syscall
+    jmp .done
 
-.check_plus:
-    cmp cl, '+'
-    jne .parse_digits
-    inc rsi
+.inline:
+    xor edi, edi
+    mov rsi, r12
+    call r13
 
-.parse_digits:
-    mov cl, byte [rsi]      ; load the character into CL
-    cmp cl, '0'
-    jb .done_parse
-    cmp cl, '9'
-    ja .done_parse
-    imul rax, rax, 10       ; multiply the accumulator by 10
-    movzx rcx, cl           ; move the character to RCX, zero extended
-    sub rcx, '0'            ; convert ASCII to numeric digit
-    add rax, rcx            ; add the digit to the accumulator
+.done:
+    pop rbp
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop rbx
+    ret
+
+
+; par_start: Starts the worker threads, RCX of them or one per CPU the
+; process may run on when RCX is 0. Every worker gets a stack of
+; PAR_STACK_BYTES aligned to its size, so the worker finds its descriptor at
+; the bottom by masking RSP: the output record of its chunk, then the last
+; loop it saw.
+; Returns:
+;   RAX - number of workers, 1 when the loops run on the calling thread
+; Uses:
+;   RAX, RCX, RDX, RSI, RDI, R8, R9, R10, R11, RBX, R14, R15 (clobbered), returns normally.
+section .text.par_start progbits alloc exec nowrite align=16
+par_start:
+    mov r14, rcx
+    test r14, r14
+    jnz .counted
+    sub rsp, 128               ; sched_getaffinity(0, 128, rsp)
+    xor edi, edi
+    mov esi, 128
+    mov rdx, rsp
+    mov eax, 204
+    syscall
+    xor r14, r14
+    test rax, rax
+    jle .mask_done
+    xor esi, esi
+.mask_byte:
+    movzx edx, byte [rsp + rsi]
+.mask_bit:
+    test edx, edx
+    jz .mask_next
+    lea r8d, [rdx - 1]
+    and edx, r8d               ; Clear the lowest set bit
+    inc r14
+    jmp .mask_bit
+.mask_next:
     inc rsi
-    jmp .parse_digits
+    cmp rsi, rax
+    jb .mask_byte
+.mask_done:
+    add rsp, 128
+.counted:
+    mov eax, PAR_MAX_WORKERS
+    cmp r14, rax
+    cmova r14, rax
+    xor r15, r15               ; Workers started
+    cmp r14, 1
+    jbe .started
 
+.spawn:
+    xor edi, edi               ; mmap(0, 2 * PAR_STACK_BYTES, ...), aligned below
+    mov rsi, 2 * PAR_STACK_BYTES
+    mov rdx, 3
+    mov r10, 0x22
+    mov r8, -1
+    xor r9, r9
+    mov rax, 9
+    syscall
+    test rax, rax
+    js .started
+    lea rbx, [rax + PAR_STACK_BYTES - 1]
+    and rbx, -PAR_STACK_BYTES  ; Descriptor
+    mov eax, [rel par_generation]
+    mov [rbx + 8], rax
+    ; clone(CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_SIGHAND | CLONE_THREAD | CLONE_SYSVSEM, stack top)
+    mov edi, 0x50F00
+    lea rsi, [rbx + PAR_STACK_BYTES - 16]
+    xor edx, edx
+    xor r10, r10
+    xor r8, r8
+    mov eax, 56
+    syscall
+    test rax, rax
+    jz par_worker              ; The new thread
+    js .started
+    inc r15
+    cmp r15, r14
+    jb .spawn
 
-.done_parse:
-    ; Apply sign
-    imul rax, rbx            ; Multiply by 1 or -1
-    leave
+.started:
+    test r15, r15
+    jnz .pool
+    mov r15, 1
+.pool:
+    mov [rel par_workers], r15
+    mov rax, r15
     ret
 
+
+; par_worker: Body of a worker thread. Sleeps until par_for starts a loop,
+; then runs chunks until none are left. Never returns.
+section .text.par_worker progbits alloc exec nowrite align=16
+par_worker:
+    mov rbx, rsp
+    and rbx, -PAR_STACK_BYTES  ; Descriptor
+.sleep:
+    mov edx, [rbx + 8]
+    cmp [rel par_generation], edx
+    jne .wake
+    lea rdi, [rel par_generation] ; futex(&par_generation, FUTEX_WAIT_PRIVATE, seen)
+    mov esi, 128
+    xor r10, r10
+    mov eax, 202
+    syscall
+    jmp .sleep
+.wake:
+    mov eax, [rel par_generation]
+    mov [rbx + 8], rax
+
+.claim:
+    mov eax, 1
+    lock xadd [rel par_next], rax
+    cmp rax, [rel par_nchunks]
+    jae .finished
+    lea rcx, [rax + rax * 2]
+    mov rdx, [rel par_records]
+    lea rdx, [rdx + rcx * 8]
+    mov [rbx], rdx             ; Where out_write puts the chunk's output
+    mov rdi, rax
+    imul rdi, [rel par_chunk]
+    mov rsi, rdi
+    add rsi, [rel par_chunk]
+    cmp rsi, [rel par_count]
+    cmova rsi, [rel par_count]
+    mov rbp, [rel par_frame]
+    push rbx
+    call [rel par_body]
+    pop rbx
+    jmp .claim
+
+.finished:
+    lock dec dword [rel par_pending]
+    jnz .sleep
+    lea rdi, [rel par_pending] ; futex(&par_pending, FUTEX_WAKE_PRIVATE, 1)
+    mov esi, 129
+    mov edx, 1
+    mov eax, 202
+    syscall
+    jmp .sleep
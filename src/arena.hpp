@@ -2,14 +2,27 @@
 
 #include <cstddef>
 #include <memory>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
+// Where an arena gets its memory from, for embedders with their own allocators.
+// Without hooks it uses new[] and delete[].
+struct ArenaHooks {
+    void* (*allocate)(size_t num_bytes, void* user) = nullptr;
+    void (*deallocate)(void* block, size_t num_bytes, void* user) = nullptr;
+    void* user = nullptr;
+};
+
+// Bump allocator for AST nodes. Nodes owning heap memory (strings in tokens,
+// statement vectors) are destroyed with the arena, in reverse order.
 class ArenaAllocator {
 public:
-    explicit ArenaAllocator(const size_t max_num_bytes)
+    explicit ArenaAllocator(const size_t max_num_bytes, const ArenaHooks hooks = {})
         : m_size { max_num_bytes }
-        , m_buffer { new std::byte[max_num_bytes] }
+        , m_buffer { acquire(max_num_bytes, hooks) }
         , m_offset { m_buffer }
+        , m_hooks { hooks }
     {
     }
 
@@ -20,7 +33,11 @@ public:
         : m_size { std::exchange(other.m_size, 0) }
         , m_buffer { std::exchange(other.m_buffer, nullptr) }
         , m_offset { std::exchange(other.m_offset, nullptr) }
+        , m_num_allocs { std::exchange(other.m_num_allocs, 0) }
+        , m_hooks { other.m_hooks }
+        , m_destructors { std::move(other.m_destructors) }
     {
+        other.m_destructors.clear();
     }
 
     ArenaAllocator& operator=(ArenaAllocator&& other) noexcept
@@ -28,6 +45,9 @@ public:
         std::swap(m_size, other.m_size);
         std::swap(m_buffer, other.m_buffer);
         std::swap(m_offset, other.m_offset);
+        std::swap(m_num_allocs, other.m_num_allocs);
+        std::swap(m_hooks, other.m_hooks);
+        std::swap(m_destructors, other.m_destructors);
         return *this;
     }
 
@@ -41,6 +61,7 @@ public:
             throw std::bad_alloc {};
         }
         m_offset = static_cast<std::byte*>(aligned_address) + sizeof(T);
+        m_num_allocs++;
         return static_cast<T*>(aligned_address);
     }
 
@@ -48,16 +69,83 @@ public:
     [[nodiscard]] T* emplace(Args&&... args)
     {
         const auto allocated_memory = alloc<T>();
-        return new (allocated_memory) T { std::forward<Args>(args)... };
+        T* object = new (allocated_memory) T { std::forward<Args>(args)... };
+        if constexpr (!std::is_trivially_destructible_v<T>) {
+            m_destructors.push_back({ object, [](void* pointer) { static_cast<T*>(pointer)->~T(); } });
+        }
+        return object;
+    }
+
+    // A point to roll the arena back to, see release().
+    struct Mark {
+        std::byte* offset;
+        size_t num_allocs;
+        size_t num_destructors;
+    };
+
+    [[nodiscard]] Mark mark() const
+    {
+        return { m_offset, m_num_allocs, m_destructors.size() };
+    }
+
+    // Destroys every node allocated since `mark` and reuses its memory.
+    void release(const Mark mark)
+    {
+        while (m_destructors.size() > mark.num_destructors) {
+            m_destructors.back().destroy(m_destructors.back().object);
+            m_destructors.pop_back();
+        }
+        m_offset = mark.offset;
+        m_num_allocs = mark.num_allocs;
+    }
+
+    [[nodiscard]] size_t bytes_used() const
+    {
+        return static_cast<size_t>(m_offset - m_buffer);
+    }
+
+    [[nodiscard]] size_t num_allocs() const
+    {
+        return m_num_allocs;
     }
 
     ~ArenaAllocator()
     {
-        delete[] m_buffer;
+        for (auto it = m_destructors.rbegin(); it != m_destructors.rend(); ++it) {
+            it->destroy(it->object);
+        }
+        if (m_buffer == nullptr) {
+            return;
+        }
+        if (m_hooks.deallocate != nullptr) {
+            m_hooks.deallocate(m_buffer, m_size, m_hooks.user);
+        } else if (m_hooks.allocate == nullptr) {
+            delete[] m_buffer;
+        }
     }
 
 private:
+    struct Destructor {
+        void* object;
+        void (*destroy)(void*);
+    };
+
+    static std::byte* acquire(const size_t num_bytes, const ArenaHooks& hooks)
+    {
+        if (hooks.allocate == nullptr) {
+            return new std::byte[num_bytes];
+        }
+        const auto block = static_cast<std::byte*>(hooks.allocate(num_bytes, hooks.user));
+        if (block == nullptr) {
+            throw std::bad_alloc {};
+        }
+        return block;
+    }
+
     size_t m_size;
     std::byte* m_buffer;
     std::byte* m_offset;
+    size_t m_num_allocs = 0;
+    ArenaHooks m_hooks;
+    std::vector<Destructor> m_destructors;
 };
\ No newline at end of file
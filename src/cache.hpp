@@ -0,0 +1,136 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <unistd.h>
+
+// Content addressed store for finished executables. Every entry is a single file
+// named after the hash of everything that went into building it. Writers publish
+// entries with rename(), so parallel jobs sharing a directory never observe a
+// partially written binary, and readers bump the mtime so eviction is LRU.
+class CompileCache {
+public:
+    CompileCache(std::filesystem::path dir, const uintmax_t max_num_bytes)
+        : m_dir(std::move(dir))
+          , m_max_num_bytes(max_num_bytes) {
+        std::error_code ec;
+        std::filesystem::create_directories(m_dir, ec);
+        m_enabled = !ec;
+    }
+
+    // 128 bit FNV-1a over every input, each part prefixed with its length so that
+    // moving bytes from one part into another changes the key.
+    [[nodiscard]] static std::string make_key(const std::vector<std::string_view> &parts) {
+        unsigned __int128 hash = (static_cast<unsigned __int128>(0x6c62272e07bb0142) << 64) | 0x62b821756295c58d;
+        const unsigned __int128 prime = (static_cast<unsigned __int128>(0x0000000001000000) << 64) | 0x000000000000013B;
+        const auto mix = [&](const std::string_view bytes) {
+            for (const char c: bytes) {
+                hash ^= static_cast<unsigned char>(c);
+                hash *= prime;
+            }
+        };
+        for (const std::string_view part: parts) {
+            mix(std::to_string(part.size()));
+            mix(":");
+            mix(part);
+        }
+        static constexpr char hex[] = "0123456789abcdef";
+        std::string key(32, '0');
+        for (int i = 31; i >= 0; i--) {
+            key[i] = hex[static_cast<int>(hash & 0xf)];
+            hash >>= 4;
+        }
+        return key;
+    }
+
+    // Copies the cached executable for `key` to `dest`. Returns false on a miss.
+    bool fetch(const std::string &key, const std::filesystem::path &dest) const {
+        if (!m_enabled) {
+            return false;
+        }
+        std::error_code ec;
+        const std::filesystem::path entry = m_dir / key;
+        const std::filesystem::path tmp = temp_path(dest.parent_path().empty() ? "." : dest.parent_path());
+        std::filesystem::copy_file(entry, tmp, std::filesystem::copy_options::overwrite_existing, ec);
+        if (ec) {
+            return false;
+        }
+        std::filesystem::rename(tmp, dest, ec);
+        if (ec) {
+            std::filesystem::remove(tmp, ec);
+            return false;
+        }
+        std::filesystem::last_write_time(entry, std::filesystem::file_time_type::clock::now(), ec);
+        return true;
+    }
+
+    // Publishes `artifact` under `key`, then trims the cache back under its size limit.
+    void store(const std::string &key, const std::filesystem::path &artifact) const {
+        if (!m_enabled) {
+            return;
+        }
+        std::error_code ec;
+        const std::filesystem::path tmp = temp_path(m_dir);
+        std::filesystem::copy_file(artifact, tmp, std::filesystem::copy_options::overwrite_existing, ec);
+        if (!ec) {
+            std::filesystem::rename(tmp, m_dir / key, ec);
+        }
+        if (ec) {
+            std::filesystem::remove(tmp, ec);
+            return;
+        }
+        evict();
+    }
+
+private:
+    struct Entry {
+        std::filesystem::path path;
+        std::filesystem::file_time_type last_used;
+        uintmax_t size;
+    };
+
+    void evict() const {
+        std::error_code ec;
+        std::vector<Entry> entries;
+        uintmax_t total = 0;
+        for (const auto &file: std::filesystem::directory_iterator(m_dir, ec)) {
+            if (!file.is_regular_file(ec) || file.path().filename().string().starts_with(".tmp")) {
+                continue;
+            }
+            const uintmax_t size = file.file_size(ec);
+            if (ec) {
+                continue;
+            }
+            entries.push_back({.path = file.path(), .last_used = file.last_write_time(ec), .size = size});
+            total += size;
+        }
+        if (total <= m_max_num_bytes) {
+            return;
+        }
+        std::ranges::sort(entries, {}, &Entry::last_used);
+        for (const Entry &entry: entries) {
+            if (total <= m_max_num_bytes) {
+                break;
+            }
+            // another job may have evicted it already, that still frees the space
+            std::filesystem::remove(entry.path, ec);
+            total -= entry.size;
+        }
+    }
+
+    [[nodiscard]] static std::filesystem::path temp_path(const std::filesystem::path &dir) {
+        static std::mt19937_64 rng(std::random_device{}() ^ static_cast<uint64_t>(getpid()));
+        return dir / (".tmp." + std::to_string(getpid()) + "." + std::to_string(rng()));
+    }
+
+    std::filesystem::path m_dir;
+    uintmax_t m_max_num_bytes;
+    bool m_enabled = false;
+};
@@ -0,0 +1,75 @@
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include <sys/stat.h>
+
+#include "protocol.hpp"
+
+// geny_client: sends one source file to a running `geny --serve` and writes
+// what comes back. Flags it does not know are compile options for the server.
+
+void print_client_usage() {
+    std::cerr << "usage: geny_client [--socket=<path>] [--emit=asm|obj|exe] [-o <file>] [compile options] <input.gn>"
+            << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    std::string socket_path = default_socket_path();
+    std::string output_path;
+    ServeRequest request;
+    for (int i = 1; i < argc; i++) {
+        const std::string_view arg = argv[i];
+        if (arg.starts_with("--socket=")) {
+            socket_path = arg.substr(std::string_view("--socket=").size());
+        } else if (arg.starts_with("--emit=")) {
+            const std::optional<Emit> emit = protocol::parse_emit(arg.substr(std::string_view("--emit=").size()));
+            if (!emit.has_value()) {
+                print_client_usage();
+                return EXIT_FAILURE;
+            }
+            request.emit = emit.value();
+        } else if (arg == "-o" && i + 1 < argc) {
+            output_path = argv[++i];
+        } else if (arg.starts_with("-")) {
+            request.options.emplace_back(arg);
+        } else if (request.path.empty()) {
+            request.path = arg;
+        } else {
+            print_client_usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (request.path.empty()) {
+        print_client_usage();
+        return EXIT_FAILURE;
+    }
+    if (output_path.empty()) {
+        output_path = request.emit == Emit::asm_text ? "out.asm" : request.emit == Emit::object ? "out.o" : "out";
+    }
+
+    std::ifstream input(request.path, std::ios::binary);
+    if (!input) {
+        std::cerr << "geny_client: cannot read " << request.path << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::stringstream source;
+    source << input.rdbuf();
+    request.source = source.str();
+
+    const std::optional<ServeResponse> response = protocol::compile(socket_path, request);
+    if (!response.has_value()) {
+        std::cerr << "geny_client: no server answering on " << socket_path << " (start one with geny --serve)"
+                << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cerr << response->diagnostics;
+    if (response->status != ServeStatus::ok) {
+        return static_cast<int>(response->status);
+    }
+    std::ofstream(output_path, std::ios::binary) << response->output;
+    if (request.emit == Emit::executable) {
+        chmod(output_path.c_str(), 0755);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,960 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <optional>
+#include <set>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "parser.hpp"
+
+// Variables are identified by name throughout. A name can only be reused once
+// the previous variable of that name went out of scope, and every use of the new
+// one is preceded by its own `let`, so merging them never mixes up two live values.
+
+// Calls are the only expressions with side effects.
+inline bool has_call(const NodeExpr *expr) { // NOLINT(*-no-recursion)
+    if (const auto bin_expr = std::get_if<NodeBinExpr *>(&expr->var)) {
+        const auto [lhs, rhs] = bin_operands(*bin_expr);
+        return has_call(lhs) || has_call(rhs);
+    }
+    const NodeTerm *term = std::get<NodeTerm *>(expr->var);
+    if (const auto paren = std::get_if<NodeTermParen *>(&term->var)) {
+        return has_call((*paren)->expr);
+    }
+    if (const auto index = std::get_if<NodeTermIndex *>(&term->var)) {
+        return has_call((*index)->index);
+    }
+    return std::holds_alternative<NodeTermCall *>(term->var);
+}
+
+// Names of the variables and arrays `expr` reads.
+inline void collect_uses(const NodeExpr *expr, std::set<std::string> &uses) { // NOLINT(*-no-recursion)
+    if (const auto bin_expr = std::get_if<NodeBinExpr *>(&expr->var)) {
+        const auto [lhs, rhs] = bin_operands(*bin_expr);
+        collect_uses(lhs, uses);
+        collect_uses(rhs, uses);
+        return;
+    }
+    const NodeTerm *term = std::get<NodeTerm *>(expr->var);
+    if (const auto ident = std::get_if<NodeTermIdent *>(&term->var)) {
+        uses.insert((*ident)->ident.value.value());
+    } else if (const auto paren = std::get_if<NodeTermParen *>(&term->var)) {
+        collect_uses((*paren)->expr, uses);
+    } else if (const auto index = std::get_if<NodeTermIndex *>(&term->var)) {
+        uses.insert((*index)->ident.value.value());
+        collect_uses((*index)->index, uses);
+    } else if (const auto call = std::get_if<NodeTermCall *>(&term->var)) {
+        for (const NodeExpr *arg: (*call)->args) {
+            collect_uses(arg, uses);
+        }
+    }
+}
+
+// Calls in `expr`, those in arguments included.
+inline void collect_calls(const NodeExpr *expr, std::vector<const NodeTermCall *> &calls) { // NOLINT(*-no-recursion)
+    if (const auto bin_expr = std::get_if<NodeBinExpr *>(&expr->var)) {
+        const auto [lhs, rhs] = bin_operands(*bin_expr);
+        collect_calls(lhs, calls);
+        collect_calls(rhs, calls);
+        return;
+    }
+    const NodeTerm *term = std::get<NodeTerm *>(expr->var);
+    if (const auto paren = std::get_if<NodeTermParen *>(&term->var)) {
+        collect_calls((*paren)->expr, calls);
+    } else if (const auto index = std::get_if<NodeTermIndex *>(&term->var)) {
+        collect_calls((*index)->index, calls);
+    } else if (const auto call = std::get_if<NodeTermCall *>(&term->var)) {
+        calls.push_back(*call);
+        for (const NodeExpr *arg: (*call)->args) {
+            collect_calls(arg, calls);
+        }
+    }
+}
+
+// Calls a statement makes itself, in the conditions of an if or while but not in
+// their blocks.
+inline std::vector<const NodeTermCall *> stmt_calls(const NodeStmt *stmt) {
+    std::vector<const NodeTermCall *> calls;
+    if (const auto call = std::get_if<NodeStmtCall *>(&stmt->var)) {
+        calls.push_back((*call)->call);
+        for (const NodeExpr *arg: (*call)->call->args) {
+            collect_calls(arg, calls);
+        }
+    } else if (const auto stmt_while = std::get_if<NodeStmtWhile *>(&stmt->var)) {
+        collect_calls((*stmt_while)->condition, calls);
+    } else if (const auto stmt_if = std::get_if<NodeStmtIf *>(&stmt->var)) {
+        collect_calls((*stmt_if)->expr, calls);
+        std::optional<NodeIfPred *> pred = (*stmt_if)->pred;
+        while (pred.has_value()) {
+            const auto elif = std::get_if<NodeIfPredElif *>(&pred.value()->var);
+            if (elif == nullptr) {
+                break;
+            }
+            collect_calls((*elif)->expr, calls);
+            pred = (*elif)->pred;
+        }
+    } else if (const auto assign_index = std::get_if<NodeStmtAssignIndex *>(&stmt->var)) {
+        collect_calls((*assign_index)->index, calls);
+        collect_calls((*assign_index)->expr, calls);
+    } else {
+        std::visit([&]<typename T>(const T *node) {
+            if constexpr (std::is_same_v<T, NodeStmtExit> || std::is_same_v<T, NodeStmtLet>
+                          || std::is_same_v<T, NodeStmtAssign> || std::is_same_v<T, NodeStmtPrint>
+                          || std::is_same_v<T, NodeStmtReturn>) {
+                collect_calls(node->expr, calls);
+            }
+        }, stmt->var);
+    }
+    return calls;
+}
+
+// Variable a statement writes as a whole, if any. Array element stores are not
+// definitions of the array.
+inline std::optional<std::string> stmt_def(const NodeStmt *stmt) {
+    if (const auto let = std::get_if<NodeStmtLet *>(&stmt->var)) {
+        return (*let)->ident.value.value();
+    }
+    if (const auto assign = std::get_if<NodeStmtAssign *>(&stmt->var)) {
+        return (*assign)->ident.value.value();
+    }
+    if (const auto input = std::get_if<NodeStmtInput *>(&stmt->var)) {
+        return (*input)->ident.value.value();
+    }
+    if (const auto let_array = std::get_if<NodeStmtLetArray *>(&stmt->var)) {
+        return (*let_array)->ident.value.value();
+    }
+    return {};
+}
+
+// Names a simple statement reads.
+inline std::set<std::string> stmt_uses(const NodeStmt *stmt) {
+    struct UseVisitor {
+        std::set<std::string> &uses;
+
+        void operator()(const NodeStmtExit *stmt_exit) const {
+            collect_uses(stmt_exit->expr, uses);
+        }
+
+        void operator()(const NodeStmtLet *stmt_let) const {
+            collect_uses(stmt_let->expr, uses);
+        }
+
+        void operator()(const NodeStmtAssign *stmt_assign) const {
+            collect_uses(stmt_assign->expr, uses);
+        }
+
+        void operator()(const NodeStmtAssignIndex *stmt_assign) const {
+            uses.insert(stmt_assign->ident.value.value());
+            collect_uses(stmt_assign->index, uses);
+            collect_uses(stmt_assign->expr, uses);
+        }
+
+        void operator()(const NodeStmtPrint *stmt_print) const {
+            collect_uses(stmt_print->expr, uses);
+        }
+
+        void operator()(const NodeStmtReturn *stmt_return) const {
+            collect_uses(stmt_return->expr, uses);
+        }
+
+        void operator()(const NodeStmtCall *stmt_call) const {
+            for (const NodeExpr *arg: stmt_call->call->args) {
+                collect_uses(arg, uses);
+            }
+        }
+
+        void operator()(const NodeStmtInput *) const {
+        }
+
+        void operator()(const NodeStmtPrintText *) const {
+        }
+
+        void operator()(const NodeStmtLetArray *) const {
+        }
+
+        void operator()(const NodeStmtFn *) const {
+        }
+
+        void operator()(const NodeScope *) const {
+        }
+
+        void operator()(const NodeStmtIf *) const {
+        }
+
+        void operator()(const NodeStmtWhile *) const {
+        }
+    };
+
+    std::set<std::string> uses;
+    std::visit(UseVisitor{.uses = uses}, stmt->var);
+    return uses;
+}
+
+// Number of statements in `stmts`, nested ones included, that assign `var` as a whole.
+inline size_t count_defs(const std::vector<NodeStmt *> &stmts, const std::string &var) { // NOLINT(*-no-recursion)
+    size_t count = 0;
+    for (const NodeStmt *stmt: stmts) {
+        if (stmt_def(stmt) == var) {
+            count++;
+        } else if (const auto scope = std::get_if<NodeScope *>(&stmt->var)) {
+            count += count_defs((*scope)->stmts, var);
+        } else if (const auto stmt_while = std::get_if<NodeStmtWhile *>(&stmt->var)) {
+            count += count_defs((*stmt_while)->scope->stmts, var);
+        } else if (const auto stmt_if = std::get_if<NodeStmtIf *>(&stmt->var)) {
+            count += count_defs((*stmt_if)->scope->stmts, var);
+            std::optional<NodeIfPred *> pred = (*stmt_if)->pred;
+            while (pred.has_value()) {
+                if (const auto elif = std::get_if<NodeIfPredElif *>(&pred.value()->var)) {
+                    count += count_defs((*elif)->scope->stmts, var);
+                    pred = (*elif)->pred;
+                } else {
+                    count += count_defs(std::get<NodeIfPredElse *>(pred.value()->var)->scope->stmts, var);
+                    pred.reset();
+                }
+            }
+        }
+    }
+    return count;
+}
+
+// Whether `stmts` keep to the naming rule above given the names in `visible`:
+// no `let` reuses a name still in scope and every name read or written is
+// declared. The generator reports the programs that break it.
+inline bool well_scoped(const std::vector<NodeStmt *> &stmts, std::set<std::string> visible) { // NOLINT(*-no-recursion)
+    const auto declared = [&visible](const std::set<std::string> &names) {
+        return std::ranges::all_of(names, [&visible](const std::string &name) { return visible.contains(name); });
+    };
+    const auto reads = [](const NodeExpr *expr) {
+        std::set<std::string> uses;
+        collect_uses(expr, uses);
+        return uses;
+    };
+    for (const NodeStmt *stmt: stmts) {
+        if (const auto fn = std::get_if<NodeStmtFn *>(&stmt->var)) {
+            // a function sees its parameters only
+            std::set<std::string> params;
+            for (const Token &param: (*fn)->params) {
+                if (!params.insert(param.value.value()).second) {
+                    return false;
+                }
+            }
+            if (!well_scoped((*fn)->scope->stmts, std::move(params))) {
+                return false;
+            }
+        } else if (const auto scope = std::get_if<NodeScope *>(&stmt->var)) {
+            if (!well_scoped((*scope)->stmts, visible)) {
+                return false;
+            }
+        } else if (const auto stmt_while = std::get_if<NodeStmtWhile *>(&stmt->var)) {
+            if (!declared(reads((*stmt_while)->condition)) || !well_scoped((*stmt_while)->scope->stmts, visible)) {
+                return false;
+            }
+        } else if (const auto stmt_if = std::get_if<NodeStmtIf *>(&stmt->var)) {
+            if (!declared(reads((*stmt_if)->expr)) || !well_scoped((*stmt_if)->scope->stmts, visible)) {
+                return false;
+            }
+            std::optional<NodeIfPred *> pred = (*stmt_if)->pred;
+            while (pred.has_value()) {
+                if (const auto elif = std::get_if<NodeIfPredElif *>(&pred.value()->var)) {
+                    if (!declared(reads((*elif)->expr)) || !well_scoped((*elif)->scope->stmts, visible)) {
+                        return false;
+                    }
+                    pred = (*elif)->pred;
+                } else {
+                    if (!well_scoped(std::get<NodeIfPredElse *>(pred.value()->var)->scope->stmts, visible)) {
+                        return false;
+                    }
+                    pred.reset();
+                }
+            }
+        } else if (!declared(stmt_uses(stmt))) {
+            return false;
+        } else if (const auto def = stmt_def(stmt)) {
+            const bool is_let = std::holds_alternative<NodeStmtLet *>(stmt->var)
+                                || std::holds_alternative<NodeStmtLetArray *>(stmt->var);
+            if (is_let != !visible.contains(def.value())) {
+                return false;
+            }
+            visible.insert(def.value());
+        }
+    }
+    return true;
+}
+
+// A straight run of simple statements, optionally ending in a two-way branch on
+// `cond`: succs[0] is taken when it is non-zero, succs[1] otherwise.
+struct BasicBlock {
+    std::vector<const NodeStmt *> stmts;
+    const NodeExpr *cond = nullptr;
+    std::vector<size_t> succs;
+    std::vector<size_t> preds;
+};
+
+// Control flow graph of one body, the main program or a function. `if` chains
+// and `while` loops are split into blocks, nested `fn` declarations are not part
+// of it. Code after `exit` or `return` lands in blocks without predecessors.
+class ControlFlowGraph {
+public:
+    explicit ControlFlowGraph(const std::vector<NodeStmt *> &stmts) {
+        m_entry = new_block();
+        m_exit = new_block();
+        add_edge(build(stmts, m_entry), m_exit);
+    }
+
+    [[nodiscard]] const std::vector<BasicBlock> &blocks() const {
+        return m_blocks;
+    }
+
+    [[nodiscard]] size_t entry() const {
+        return m_entry;
+    }
+
+    [[nodiscard]] size_t exit() const {
+        return m_exit;
+    }
+
+    // Block in which `stmt` starts executing.
+    [[nodiscard]] size_t block_of(const NodeStmt *stmt) const {
+        return m_stmt_blocks.at(stmt);
+    }
+
+    // Block ending in the branch on an `if`/`elif`/`while` condition.
+    [[nodiscard]] size_t cond_block(const NodeExpr *cond) const {
+        return m_cond_blocks.at(cond);
+    }
+
+private:
+    size_t new_block() {
+        m_blocks.emplace_back();
+        return m_blocks.size() - 1;
+    }
+
+    void add_edge(const size_t from, const size_t to) {
+        m_blocks[from].succs.push_back(to);
+        m_blocks[to].preds.push_back(from);
+    }
+
+    void branch(const size_t block, const NodeExpr *cond) {
+        m_blocks[block].cond = cond;
+        m_cond_blocks[cond] = block;
+    }
+
+    // Appends `stmts` starting in `current` and returns the block control leaves from.
+    size_t build(const std::vector<NodeStmt *> &stmts, size_t current) { // NOLINT(*-no-recursion)
+        for (const NodeStmt *stmt: stmts) {
+            m_stmt_blocks[stmt] = current;
+            if (const auto stmt_if = std::get_if<NodeStmtIf *>(&stmt->var)) {
+                const size_t join = new_block();
+                branch(current, (*stmt_if)->expr);
+                const size_t taken = new_block();
+                add_edge(current, taken);
+                add_edge(build((*stmt_if)->scope->stmts, taken), join);
+                size_t not_taken = new_block();
+                add_edge(current, not_taken);
+                std::optional<NodeIfPred *> pred = (*stmt_if)->pred;
+                while (pred.has_value()) {
+                    if (const auto elif = std::get_if<NodeIfPredElif *>(&pred.value()->var)) {
+                        branch(not_taken, (*elif)->expr);
+                        const size_t elif_taken = new_block();
+                        add_edge(not_taken, elif_taken);
+                        add_edge(build((*elif)->scope->stmts, elif_taken), join);
+                        const size_t next = new_block();
+                        add_edge(not_taken, next);
+                        not_taken = next;
+                        pred = (*elif)->pred;
+                    } else {
+                        const NodeIfPredElse *else_ = std::get<NodeIfPredElse *>(pred.value()->var);
+                        not_taken = build(else_->scope->stmts, not_taken);
+                        pred.reset();
+                    }
+                }
+                add_edge(not_taken, join);
+                current = join;
+            } else if (const auto stmt_while = std::get_if<NodeStmtWhile *>(&stmt->var)) {
+                const size_t header = new_block();
+                add_edge(current, header);
+                branch(header, (*stmt_while)->condition);
+                const size_t body = new_block();
+                add_edge(header, body);
+                const size_t after = new_block();
+                add_edge(header, after);
+                add_edge(build((*stmt_while)->scope->stmts, body), header);
+                current = after;
+            } else if (const auto scope = std::get_if<NodeScope *>(&stmt->var)) {
+                current = build((*scope)->stmts, current);
+            } else if (std::holds_alternative<NodeStmtExit *>(stmt->var)
+                       || std::holds_alternative<NodeStmtReturn *>(stmt->var)) {
+                m_blocks[current].stmts.push_back(stmt);
+                add_edge(current, m_exit);
+                current = new_block();
+            } else if (!std::holds_alternative<NodeStmtFn *>(stmt->var)) {
+                m_blocks[current].stmts.push_back(stmt);
+            }
+        }
+        return current;
+    }
+
+    std::vector<BasicBlock> m_blocks;
+    size_t m_entry = 0;
+    size_t m_exit = 0;
+    std::map<const NodeStmt *, size_t> m_stmt_blocks;
+    std::map<const NodeExpr *, size_t> m_cond_blocks;
+};
+
+enum class Direction {
+    forward,
+    backward,
+};
+
+using BitSet = std::vector<bool>;
+
+struct BitVectorSolution {
+    std::vector<BitSet> in;
+    std::vector<BitSet> out;
+};
+
+// Solves a gen/kill problem with union as the meet by iterating to a fixpoint.
+// `boundary` is the value flowing into the entry (forward) or out of the exit (backward).
+inline BitVectorSolution solve_gen_kill(const ControlFlowGraph &cfg, const Direction direction,
+                                        const std::vector<BitSet> &gen, const std::vector<BitSet> &kill,
+                                        const BitSet &boundary) {
+    const std::vector<BasicBlock> &blocks = cfg.blocks();
+    const size_t width = boundary.size();
+    BitVectorSolution solution{
+        .in = std::vector(blocks.size(), BitSet(width)),
+        .out = std::vector(blocks.size(), BitSet(width)),
+    };
+    const bool forward = direction == Direction::forward;
+    // `before` is what the block receives, `after` what it passes on
+    std::vector<BitSet> &before = forward ? solution.in : solution.out;
+    std::vector<BitSet> &after = forward ? solution.out : solution.in;
+    before[forward ? cfg.entry() : cfg.exit()] = boundary;
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 0; i < blocks.size(); i++) {
+            const size_t b = forward ? i : blocks.size() - 1 - i;
+            BitSet merged = b == (forward ? cfg.entry() : cfg.exit()) ? boundary : BitSet(width);
+            for (const size_t other: forward ? blocks[b].preds : blocks[b].succs) {
+                for (size_t bit = 0; bit < width; bit++) {
+                    if (after[other][bit]) {
+                        merged[bit] = true;
+                    }
+                }
+            }
+            BitSet result(width);
+            for (size_t bit = 0; bit < width; bit++) {
+                result[bit] = gen[b][bit] || (merged[bit] && !kill[b][bit]);
+            }
+            if (result != after[b] || merged != before[b]) {
+                before[b] = std::move(merged);
+                after[b] = std::move(result);
+                changed = true;
+            }
+        }
+    }
+    return solution;
+}
+
+// Which assignments of each variable may reach each block. Parameters count as
+// definitions at the entry, with a null statement.
+class ReachingDefinitions {
+public:
+    struct Def {
+        const NodeStmt *stmt;
+        std::string var;
+        size_t block;
+    };
+
+    ReachingDefinitions(const ControlFlowGraph &cfg, const std::vector<Token> &params) {
+        const std::vector<BasicBlock> &blocks = cfg.blocks();
+        for (const Token &param: params) {
+            m_defs.push_back({.stmt = nullptr, .var = param.value.value(), .block = cfg.entry()});
+        }
+        for (size_t b = 0; b < blocks.size(); b++) {
+            for (const NodeStmt *stmt: blocks[b].stmts) {
+                if (const auto var = stmt_def(stmt)) {
+                    m_defs.push_back({.stmt = stmt, .var = var.value(), .block = b});
+                }
+            }
+        }
+
+        std::vector gen(blocks.size(), BitSet(m_defs.size()));
+        std::vector kill(blocks.size(), BitSet(m_defs.size()));
+        BitSet boundary(m_defs.size());
+        for (size_t d = 0; d < m_defs.size(); d++) {
+            if (m_defs[d].stmt == nullptr) {
+                boundary[d] = true;
+            }
+        }
+        for (size_t b = 0; b < blocks.size(); b++) {
+            for (const NodeStmt *stmt: blocks[b].stmts) {
+                const auto var = stmt_def(stmt);
+                if (!var.has_value()) {
+                    continue;
+                }
+                for (size_t d = 0; d < m_defs.size(); d++) {
+                    if (m_defs[d].var == var.value()) {
+                        gen[b][d] = m_defs[d].stmt == stmt;
+                        kill[b][d] = m_defs[d].stmt != stmt;
+                    }
+                }
+            }
+        }
+        m_in = solve_gen_kill(cfg, Direction::forward, gen, kill, boundary).in;
+    }
+
+    // Definitions of `var` that may reach the start of `block`.
+    [[nodiscard]] std::vector<const Def *> reaching(const size_t block, const std::string &var) const {
+        std::vector<const Def *> defs;
+        for (size_t d = 0; d < m_defs.size(); d++) {
+            if (m_in[block][d] && m_defs[d].var == var) {
+                defs.push_back(&m_defs[d]);
+            }
+        }
+        return defs;
+    }
+
+private:
+    std::vector<Def> m_defs;
+    std::vector<BitSet> m_in;
+};
+
+// Which variables may still be read after each point of the graph.
+class Liveness {
+public:
+    explicit Liveness(const ControlFlowGraph &cfg)
+        : m_cfg(cfg) {
+        const std::vector<BasicBlock> &blocks = cfg.blocks();
+        for (const BasicBlock &block: blocks) {
+            for (const NodeStmt *stmt: block.stmts) {
+                if (const auto var = stmt_def(stmt)) {
+                    index_of(var.value());
+                }
+                for (const std::string &use: stmt_uses(stmt)) {
+                    index_of(use);
+                }
+            }
+            if (block.cond != nullptr) {
+                std::set<std::string> uses;
+                collect_uses(block.cond, uses);
+                for (const std::string &use: uses) {
+                    index_of(use);
+                }
+            }
+        }
+
+        std::vector gen(blocks.size(), BitSet(m_vars.size()));
+        std::vector kill(blocks.size(), BitSet(m_vars.size()));
+        for (size_t b = 0; b < blocks.size(); b++) {
+            BitSet live = block_end(b, BitSet(m_vars.size()));
+            // uses not preceded by a definition in the block are upward exposed
+            for (size_t i = blocks[b].stmts.size(); i > 0; i--) {
+                step_back(blocks[b].stmts[i - 1], live, &kill[b]);
+            }
+            gen[b] = live;
+        }
+        m_out = solve_gen_kill(cfg, Direction::backward, gen, kill, BitSet(m_vars.size())).out;
+    }
+
+    // Whether `var` may be read after statement `index` of `block` before being redefined.
+    [[nodiscard]] bool live_after(const size_t block, const size_t index, const std::string &var) const {
+        const auto it = m_indices.find(var);
+        if (it == m_indices.end()) {
+            return false;
+        }
+        const std::vector<const NodeStmt *> &stmts = m_cfg.blocks()[block].stmts;
+        BitSet live = block_end(block, m_out[block]);
+        for (size_t i = stmts.size(); i > index + 1; i--) {
+            step_back(stmts[i - 1], live, nullptr);
+        }
+        return live[it->second];
+    }
+
+private:
+    size_t index_of(const std::string &var) {
+        const auto [it, inserted] = m_indices.try_emplace(var, m_vars.size());
+        if (inserted) {
+            m_vars.push_back(var);
+        }
+        return it->second;
+    }
+
+    // Live set right before the branch at the end of `block`.
+    [[nodiscard]] BitSet block_end(const size_t block, BitSet live) const {
+        if (const NodeExpr *cond = m_cfg.blocks()[block].cond) {
+            std::set<std::string> uses;
+            collect_uses(cond, uses);
+            for (const std::string &use: uses) {
+                live[m_indices.at(use)] = true;
+            }
+        }
+        return live;
+    }
+
+    void step_back(const NodeStmt *stmt, BitSet &live, BitSet *kill) const {
+        if (const auto var = stmt_def(stmt)) {
+            live[m_indices.at(var.value())] = false;
+            if (kill != nullptr) {
+                (*kill)[m_indices.at(var.value())] = true;
+            }
+        }
+        for (const std::string &use: stmt_uses(stmt)) {
+            live[m_indices.at(use)] = true;
+        }
+    }
+
+    const ControlFlowGraph &m_cfg;
+    std::map<std::string, size_t> m_indices;
+    std::vector<std::string> m_vars;
+    std::vector<BitSet> m_out;
+};
+
+// Value of a scalar in constant propagation: not assigned on any path seen so far,
+// a single known constant, or anything.
+struct LatticeValue {
+    enum class Kind {
+        undefined,
+        constant,
+        overdefined,
+    };
+
+    Kind kind = Kind::undefined;
+    int64_t value = 0;
+
+    static LatticeValue constant(const int64_t value) {
+        return {.kind = Kind::constant, .value = value};
+    }
+
+    static LatticeValue overdefined() {
+        return {.kind = Kind::overdefined};
+    }
+
+    [[nodiscard]] bool is_constant() const {
+        return kind == Kind::constant;
+    }
+
+    [[nodiscard]] LatticeValue meet(const LatticeValue &other) const {
+        if (kind == Kind::undefined) {
+            return other;
+        }
+        if (other.kind == Kind::undefined) {
+            return *this;
+        }
+        if (kind == Kind::constant && other.kind == Kind::constant && value == other.value) {
+            return *this;
+        }
+        return overdefined();
+    }
+
+    bool operator==(const LatticeValue &) const = default;
+};
+
+// Variables that are not in the map are undefined.
+using ConstEnv = std::map<std::string, LatticeValue>;
+
+// Conditional constant propagation (Wegman and Zadeck) over the blocks of a
+// ControlFlowGraph: a block is only analysed once some executable predecessor
+// branches to it, so constants flowing out of pruned branches never pollute the
+// join. Every value is exact 64-bit wrapping arithmetic as the generator emits it.
+class ConstantPropagation {
+public:
+    ConstantPropagation(const ControlFlowGraph &cfg, const std::vector<Token> &params)
+        : m_in(cfg.blocks().size())
+          , m_executable(cfg.blocks().size())
+          , m_edges(cfg.blocks().size()) {
+        for (const Token &param: params) {
+            m_in[cfg.entry()][param.value.value()] = LatticeValue::overdefined();
+        }
+        m_executable[cfg.entry()] = true;
+        std::vector<size_t> worklist = {cfg.entry()};
+        while (!worklist.empty()) {
+            const size_t b = worklist.back();
+            worklist.pop_back();
+            const BasicBlock &block = cfg.blocks()[b];
+            ConstEnv env = m_in[b];
+            for (const NodeStmt *stmt: block.stmts) {
+                transfer(stmt, env);
+            }
+            std::vector<size_t> taken;
+            if (block.cond == nullptr) {
+                for (size_t k = 0; k < block.succs.size(); k++) {
+                    taken.push_back(k);
+                }
+            } else if (const LatticeValue cond = eval(block.cond, env); cond.is_constant()) {
+                taken.push_back(cond.value != 0 ? 0 : 1);
+            } else if (cond.kind == LatticeValue::Kind::overdefined) {
+                taken = {0, 1};
+            }
+            for (const size_t k: taken) {
+                m_edges[b].insert(k);
+                const size_t succ = block.succs[k];
+                ConstEnv merged = m_executable[succ] ? meet(m_in[succ], env) : env;
+                if (!m_executable[succ] || merged != m_in[succ]) {
+                    m_executable[succ] = true;
+                    m_in[succ] = std::move(merged);
+                    worklist.push_back(succ);
+                }
+            }
+        }
+    }
+
+    [[nodiscard]] bool executable(const size_t block) const {
+        return m_executable[block];
+    }
+
+    // The direction a branch always goes, if only one of its edges is ever executable.
+    [[nodiscard]] std::optional<bool> branch_outcome(const size_t block) const {
+        if (!m_executable[block] || m_edges[block].size() != 1) {
+            return {};
+        }
+        return *m_edges[block].begin() == 0;
+    }
+
+    [[nodiscard]] const ConstEnv &env_in(const size_t block) const {
+        return m_in[block];
+    }
+
+    static void transfer(const NodeStmt *stmt, ConstEnv &env) {
+        if (const auto let = std::get_if<NodeStmtLet *>(&stmt->var)) {
+            env[(*let)->ident.value.value()] = eval((*let)->expr, env);
+        } else if (const auto assign = std::get_if<NodeStmtAssign *>(&stmt->var)) {
+            env[(*assign)->ident.value.value()] = eval((*assign)->expr, env);
+        } else if (const auto var = stmt_def(stmt)) {
+            // input and arrays
+            env[var.value()] = LatticeValue::overdefined();
+        }
+    }
+
+    static LatticeValue eval(const NodeExpr *expr, const ConstEnv &env) { // NOLINT(*-no-recursion)
+        if (const auto bin_expr = std::get_if<NodeBinExpr *>(&expr->var)) {
+            return eval_bin(*bin_expr, env);
+        }
+        const NodeTerm *term = std::get<NodeTerm *>(expr->var);
+        if (const auto int_lit = std::get_if<NodeTermIntLit *>(&term->var)) {
+            return eval_literal((*int_lit)->int_lit);
+        }
+        if (const auto ident = std::get_if<NodeTermIdent *>(&term->var)) {
+            const auto it = env.find((*ident)->ident.value.value());
+            return it == env.end() ? LatticeValue{} : it->second;
+        }
+        if (const auto paren = std::get_if<NodeTermParen *>(&term->var)) {
+            return eval((*paren)->expr, env);
+        }
+        // array elements and calls
+        return LatticeValue::overdefined();
+    }
+
+    static LatticeValue eval_literal(const Token &int_lit) {
+        return LatticeValue::constant(int_lit.int_value);
+    }
+
+private:
+    static ConstEnv meet(const ConstEnv &a, const ConstEnv &b) {
+        ConstEnv merged = a;
+        for (const auto &[name, value]: b) {
+            merged[name] = merged[name].meet(value);
+        }
+        return merged;
+    }
+
+    static LatticeValue eval_bin(const NodeBinExpr *bin_expr, const ConstEnv &env) { // NOLINT(*-no-recursion)
+        const auto [lhs_expr, rhs_expr] = bin_operands(bin_expr);
+        const LatticeValue lhs = eval(lhs_expr, env);
+        const bool is_and = std::holds_alternative<NodeBinExprAnd *>(bin_expr->var);
+        const bool is_or = std::holds_alternative<NodeBinExprOr *>(bin_expr->var);
+        // the rhs of `&&` and `||` is not evaluated once the lhs decides
+        if (is_and && lhs.is_constant() && lhs.value == 0) {
+            return LatticeValue::constant(0);
+        }
+        if (is_or && lhs.is_constant() && lhs.value != 0) {
+            return LatticeValue::constant(1);
+        }
+        const LatticeValue rhs = eval(rhs_expr, env);
+        if (lhs.kind == LatticeValue::Kind::overdefined || rhs.kind == LatticeValue::Kind::overdefined) {
+            return LatticeValue::overdefined();
+        }
+        if (!lhs.is_constant() || !rhs.is_constant()) {
+            return {};
+        }
+        const int64_t a = lhs.value;
+        const int64_t b = rhs.value;
+        const auto ua = static_cast<uint64_t>(a);
+        const auto ub = static_cast<uint64_t>(b);
+        const auto wrap = [](const uint64_t value) { return LatticeValue::constant(static_cast<int64_t>(value)); };
+        const auto truth = [](const bool value) { return LatticeValue::constant(value ? 1 : 0); };
+        const bool traps = b == 0 || (a == std::numeric_limits<int64_t>::min() && b == -1);
+
+        return std::visit([&]<typename T>(const T *) -> LatticeValue {
+            if constexpr (std::is_same_v<T, NodeBinExprAdd>) {
+                return wrap(ua + ub);
+            } else if constexpr (std::is_same_v<T, NodeBinExprSub>) {
+                return wrap(ua - ub);
+            } else if constexpr (std::is_same_v<T, NodeBinExprMulti>) {
+                return wrap(ua * ub);
+            } else if constexpr (std::is_same_v<T, NodeBinExprDiv>) {
+                // leave faulting divisions to the program at run time
+                return traps ? LatticeValue::overdefined() : LatticeValue::constant(a / b);
+            } else if constexpr (std::is_same_v<T, NodeBinExprMod>) {
+                return traps ? LatticeValue::overdefined() : LatticeValue::constant(a % b);
+            } else if constexpr (std::is_same_v<T, NodeBinExprBitAnd>) {
+                return wrap(ua & ub);
+            } else if constexpr (std::is_same_v<T, NodeBinExprBitOr>) {
+                return wrap(ua | ub);
+            } else if constexpr (std::is_same_v<T, NodeBinExprBitXor>) {
+                return wrap(ua ^ ub);
+            } else if constexpr (std::is_same_v<T, NodeBinExprShl>) {
+                return wrap(ua << (ub & 63));
+            } else if constexpr (std::is_same_v<T, NodeBinExprShr>) {
+                return LatticeValue::constant(a >> (ub & 63));
+            } else if constexpr (std::is_same_v<T, NodeBinExprEq>) {
+                return truth(a == b);
+            } else if constexpr (std::is_same_v<T, NodeBinExprNotEq>) {
+                return truth(a != b);
+            } else if constexpr (std::is_same_v<T, NodeBinExprLess>) {
+                return truth(a < b);
+            } else if constexpr (std::is_same_v<T, NodeBinExprLessEq>) {
+                return truth(a <= b);
+            } else if constexpr (std::is_same_v<T, NodeBinExprGreater>) {
+                return truth(a > b);
+            } else if constexpr (std::is_same_v<T, NodeBinExprGreaterEq>) {
+                return truth(a >= b);
+            } else {
+                // `&&` and `||` with both sides evaluated
+                return truth(b != 0);
+            }
+        }, bin_expr->var);
+    }
+
+    std::vector<ConstEnv> m_in;
+    std::vector<bool> m_executable;
+    std::vector<std::set<size_t>> m_edges; // executable successor indices per block
+};
+
+// `while (i < K) { ...; i = i + d; ... }` and the like: the counter is compared
+// against a literal and only assigned by one `i = i + d` or `i = i - d` at the top
+// level of the body, so it moves by exactly `step` per iteration. The loop runs
+// while the counter is below `bound` for a positive step, above it for a negative one.
+struct CountedLoop {
+    std::string counter;
+    int64_t step;
+    int64_t bound; // exclusive
+};
+
+inline std::optional<CountedLoop> counted_loop(const NodeStmtWhile *stmt_while) {
+    const auto bin_expr = std::get_if<NodeBinExpr *>(&stmt_while->condition->var);
+    if (bin_expr == nullptr) {
+        return {};
+    }
+    const auto ident = [](const NodeExpr *expr) -> std::optional<std::string> {
+        const auto term = std::get_if<NodeTerm *>(&expr->var);
+        if (term == nullptr || !std::holds_alternative<NodeTermIdent *>((*term)->var)) {
+            return {};
+        }
+        return std::get<NodeTermIdent *>((*term)->var)->ident.value.value();
+    };
+    const auto literal = [](const NodeExpr *expr) -> std::optional<int64_t> {
+        const auto term = std::get_if<NodeTerm *>(&expr->var);
+        if (term == nullptr || !std::holds_alternative<NodeTermIntLit *>((*term)->var)) {
+            return {};
+        }
+        const LatticeValue value = ConstantPropagation::eval_literal(std::get<NodeTermIntLit *>((*term)->var)->int_lit);
+        return value.is_constant() ? std::optional(value.value) : std::nullopt;
+    };
+
+    // counter, bound and whether the counter has to stay below it, with `adjust`
+    // turning an inclusive bound into an exclusive one
+    std::optional<std::string> counter;
+    std::optional<int64_t> bound;
+    bool upward = true;
+    int64_t adjust = 0;
+    const auto match = [&](const NodeExpr *lhs, const NodeExpr *rhs, const bool below, const int64_t inclusive) {
+        if (ident(lhs).has_value() && literal(rhs).has_value()) {
+            counter = ident(lhs);
+            bound = literal(rhs);
+            upward = below;
+        } else if (literal(lhs).has_value() && ident(rhs).has_value()) {
+            counter = ident(rhs);
+            bound = literal(lhs);
+            upward = !below;
+        }
+        adjust = upward ? inclusive : -inclusive;
+    };
+    std::visit([&]<typename T>(const T *bin) {
+        if constexpr (std::is_same_v<T, NodeBinExprLess>) {
+            match(bin->lhs, bin->rhs, true, 0);
+        } else if constexpr (std::is_same_v<T, NodeBinExprLessEq>) {
+            match(bin->lhs, bin->rhs, true, 1);
+        } else if constexpr (std::is_same_v<T, NodeBinExprGreater>) {
+            match(bin->lhs, bin->rhs, false, 0);
+        } else if constexpr (std::is_same_v<T, NodeBinExprGreaterEq>) {
+            match(bin->lhs, bin->rhs, false, 1);
+        }
+    }, (*bin_expr)->var);
+    if (!counter.has_value()) {
+        return {};
+    }
+    const __int128 exclusive = static_cast<__int128>(bound.value()) + adjust;
+    if (exclusive > std::numeric_limits<int64_t>::max() || exclusive < std::numeric_limits<int64_t>::min()) {
+        return {};
+    }
+
+    const std::vector<NodeStmt *> &body = stmt_while->scope->stmts;
+    if (count_defs(body, counter.value()) != 1) {
+        return {};
+    }
+    for (const NodeStmt *stmt: body) {
+        const auto assign = std::get_if<NodeStmtAssign *>(&stmt->var);
+        if (assign == nullptr || (*assign)->ident.value.value() != counter.value()) {
+            continue;
+        }
+        const auto add_sub = std::get_if<NodeBinExpr *>(&(*assign)->expr->var);
+        if (add_sub == nullptr) {
+            return {};
+        }
+        std::optional<int64_t> step;
+        if (const auto add = std::get_if<NodeBinExprAdd *>(&(*add_sub)->var)) {
+            if (ident((*add)->lhs) == counter) {
+                step = literal((*add)->rhs);
+            } else if (ident((*add)->rhs) == counter) {
+                step = literal((*add)->lhs);
+            }
+        } else if (const auto sub = std::get_if<NodeBinExprSub *>(&(*add_sub)->var)) {
+            if (ident((*sub)->lhs) == counter && literal((*sub)->rhs).has_value()
+                && literal((*sub)->rhs) != std::numeric_limits<int64_t>::min()) {
+                step = -literal((*sub)->rhs).value();
+            }
+        }
+        if (!step.has_value() || step == 0 || (step.value() > 0) != upward) {
+            return {};
+        }
+        return CountedLoop{.counter = counter.value(), .step = step.value(), .bound = static_cast<int64_t>(exclusive)};
+    }
+    // the only assignment is nested in a branch or inner loop
+    return {};
+}
+
+// Iterations of `loop` starting from `start`, unless the counter would wrap around
+// before the condition fails.
+inline std::optional<uint64_t> trip_count(const CountedLoop &loop, const int64_t start) {
+    const __int128 distance = loop.step > 0
+                                  ? static_cast<__int128>(loop.bound) - start
+                                  : static_cast<__int128>(start) - loop.bound;
+    if (distance <= 0) {
+        return 0;
+    }
+    const __int128 step = loop.step > 0 ? loop.step : -static_cast<__int128>(loop.step);
+    const __int128 trips = (distance + step - 1) / step;
+    const __int128 last = start + trips * loop.step;
+    if (last > std::numeric_limits<int64_t>::max() || last < std::numeric_limits<int64_t>::min()) {
+        return {};
+    }
+    return static_cast<uint64_t>(trips);
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct Diagnostic {
+    int line; // 0 if it is about the whole program
+    int column; // 0 if only the line is known
+    std::string message;
+};
+
+// Errors collected by the tokenizer, parser and generator, so that one run
+// reports every problem in a file instead of stopping at the first. Once
+// `max_errors` are recorded the rest are dropped and the stages stop early.
+class Diagnostics {
+public:
+    explicit Diagnostics(const size_t max_errors = 20)
+        : m_max_errors(max_errors) {
+    }
+
+    void error(const int line, const int column, std::string message) {
+        if (full()) {
+            return;
+        }
+        m_errors.push_back({.line = line, .column = column, .message = std::move(message)});
+    }
+
+    [[nodiscard]] bool has_errors() const {
+        return !m_errors.empty();
+    }
+
+    [[nodiscard]] bool full() const {
+        return m_max_errors != 0 && m_errors.size() >= m_max_errors;
+    }
+
+    [[nodiscard]] const std::vector<Diagnostic> &errors() const {
+        return m_errors;
+    }
+
+    // `path:line:column: error: message`, one per line, in source order.
+    void print(std::ostream &out, const std::string &path) const {
+        std::vector<Diagnostic> sorted = m_errors;
+        std::ranges::stable_sort(sorted, {}, [](const Diagnostic &diagnostic) {
+            return std::pair(diagnostic.line, diagnostic.column);
+        });
+        for (const Diagnostic &diagnostic: sorted) {
+            out << path << ":";
+            if (diagnostic.line != 0) {
+                out << diagnostic.line << ":";
+            }
+            if (diagnostic.column != 0) {
+                out << diagnostic.column << ":";
+            }
+            out << " error: " << diagnostic.message << "\n";
+        }
+        if (full()) {
+            out << path << ": too many errors, stopped after " << m_max_errors << "\n";
+        }
+    }
+
+private:
+    size_t m_max_errors;
+    std::vector<Diagnostic> m_errors;
+};
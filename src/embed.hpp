@@ -0,0 +1,1026 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include "tokenization.hpp"
+
+// Compiles .gn programs while the C++ embedding them is compiled. The pipeline
+// follows Tokenizer, Parser and Generator but runs in constant evaluation, so
+// its storage is fixed-capacity arrays instead of strings and the arena, and
+// it targets a small stack bytecode that Program::run executes at compile time
+// or at run time. Functions and arrays are left to the full compiler.
+//
+//     constexpr auto program = embed::compile<"let x = 6; print(x * 7);">();
+//     program.run({}, [](int64_t value) { std::cout << value << '\n'; });
+//
+// A source with an error fails the C++ build with the error and its position.
+namespace embed {
+
+template <typename T, size_t Capacity>
+class FixedVector {
+public:
+    // false, and nothing added, when full
+    constexpr bool push_back(const T &item) {
+        if (m_size == Capacity) {
+            return false;
+        }
+        m_items[m_size++] = item;
+        return true;
+    }
+
+    constexpr void resize(const size_t size) {
+        m_size = size;
+    }
+
+    [[nodiscard]] constexpr size_t size() const {
+        return m_size;
+    }
+
+    constexpr T &operator[](const size_t i) {
+        return m_items[i];
+    }
+
+    constexpr const T &operator[](const size_t i) const {
+        return m_items[i];
+    }
+
+    constexpr const T *begin() const {
+        return m_items.data();
+    }
+
+    constexpr const T *end() const {
+        return m_items.data() + m_size;
+    }
+
+private:
+    std::array<T, Capacity> m_items{};
+    size_t m_size = 0;
+};
+
+// A string literal as a template argument: embed::compile<"...">().
+template <size_t N>
+struct FixedString {
+    // NOLINTNEXTLINE(*-explicit-constructor)
+    constexpr FixedString(const char (&text)[N]) {
+        std::copy_n(text, N, chars.begin());
+    }
+
+    [[nodiscard]] constexpr std::string_view view() const {
+        return {chars.data(), N - 1};
+    }
+
+    std::array<char, N> chars{};
+};
+
+enum class ErrorKind {
+    invalid_character,
+    integer_out_of_range,
+    unterminated_comment,
+    expected,
+    undeclared_identifier,
+    identifier_already_used,
+    division_by_zero,
+    unsupported,
+    too_large,
+};
+
+// The first error in a source; compilation stops there.
+struct Error {
+    ErrorKind kind{};
+    int line = 0;
+    int column = 0;
+    // the offending text, or what was expected unless that is a token
+    std::string_view text{};
+    std::optional<TokenType> expected{};
+    // nothing at the end of the source
+    std::optional<TokenType> found{};
+
+    // worded like the compiler's diagnostics
+    [[nodiscard]] std::string message() const {
+        switch (kind) {
+            case ErrorKind::invalid_character:
+                return "Invalid character '" + std::string(text) + "'";
+            case ErrorKind::integer_out_of_range:
+                return "Integer literal out of range: " + std::string(text);
+            case ErrorKind::unterminated_comment:
+                return "Unterminated comment";
+            case ErrorKind::expected: {
+                const std::string what = expected.has_value() ? to_string(expected.value()) : std::string(text);
+                if (found.has_value()) {
+                    return "Expected " + what + ", found " + to_string(found.value());
+                }
+                return "Expected " + what + " at end of file";
+            }
+            case ErrorKind::undeclared_identifier:
+                return "Undeclared identifier: " + std::string(text);
+            case ErrorKind::identifier_already_used:
+                return "Identifier already used: " + std::string(text);
+            case ErrorKind::division_by_zero:
+                return "Division by zero";
+            case ErrorKind::unsupported:
+                return "Not supported in embedded programs: " + std::string(text);
+            case ErrorKind::too_large:
+                return "Program too large";
+        }
+        return {};
+    }
+};
+
+enum class Op : uint8_t {
+    push, // arg
+    load, // slot arg
+    store, // pops into slot arg
+    input, // next input value into slot arg
+    print, // pops
+    exit, // status on top
+    jump, // to instruction arg
+    jump_if_zero, // pops
+    // binary operators pop two and push one
+    add,
+    sub,
+    mul,
+    div,
+    mod,
+    bit_and,
+    bit_or,
+    bit_xor,
+    shl,
+    shr,
+    eq,
+    ne,
+    lt,
+    le,
+    gt,
+    ge,
+};
+
+struct Instr {
+    Op op{};
+    int64_t arg = 0;
+};
+
+// Binary operators as the generated code evaluates them: wrapping arithmetic,
+// shift counts taken mod 64 and truncating division. Nothing when the
+// operation faults, which is division by zero and INT64_MIN / -1.
+constexpr std::optional<int64_t> apply(const Op op, const int64_t lhs, const int64_t rhs) {
+    const auto a = static_cast<uint64_t>(lhs);
+    const auto b = static_cast<uint64_t>(rhs);
+    switch (op) {
+        case Op::add:
+            return static_cast<int64_t>(a + b);
+        case Op::sub:
+            return static_cast<int64_t>(a - b);
+        case Op::mul:
+            return static_cast<int64_t>(a * b);
+        case Op::div:
+        case Op::mod:
+            if (rhs == 0 || (lhs == std::numeric_limits<int64_t>::min() && rhs == -1)) {
+                return {};
+            }
+            return op == Op::div ? lhs / rhs : lhs % rhs;
+        case Op::bit_and:
+            return lhs & rhs;
+        case Op::bit_or:
+            return lhs | rhs;
+        case Op::bit_xor:
+            return lhs ^ rhs;
+        case Op::shl:
+            return static_cast<int64_t>(a << (b & 63));
+        case Op::shr:
+            return lhs >> (b & 63);
+        case Op::eq:
+            return lhs == rhs;
+        case Op::ne:
+            return lhs != rhs;
+        case Op::lt:
+            return lhs < rhs;
+        case Op::le:
+            return lhs <= rhs;
+        case Op::gt:
+            return lhs > rhs;
+        case Op::ge:
+            return lhs >= rhs;
+        default:
+            return {};
+    }
+}
+
+// Bytecode with room for CodeCapacity instructions, run on a frame of
+// FrameCapacity values: the variables followed by the operand stack.
+template <size_t CodeCapacity, size_t FrameCapacity>
+struct Program {
+    FixedVector<Instr, CodeCapacity> code;
+    size_t num_slots = 0;
+    size_t max_depth = 0;
+    std::optional<Error> error;
+
+    [[nodiscard]] constexpr bool ok() const {
+        return !error.has_value();
+    }
+
+    // input() reads from `input`, 0 once it is used up, and print(value) calls
+    // `print`. Returns the exit status, or nothing if an operation faulted.
+    template <typename Print>
+    constexpr std::optional<int64_t> run(const std::span<const int64_t> input, Print &&print) const {
+        std::array<int64_t, FrameCapacity> frame{};
+        size_t top = num_slots;
+        size_t next_input = 0;
+        size_t pc = 0;
+        while (pc < code.size()) {
+            const Instr &instr = code[pc++];
+            const auto arg = static_cast<size_t>(instr.arg);
+            switch (instr.op) {
+                case Op::push:
+                    frame[top++] = instr.arg;
+                    break;
+                case Op::load:
+                    frame[top++] = frame[arg];
+                    break;
+                case Op::store:
+                    frame[arg] = frame[--top];
+                    break;
+                case Op::input:
+                    frame[arg] = next_input < input.size() ? input[next_input++] : 0;
+                    break;
+                case Op::print:
+                    print(frame[--top]);
+                    break;
+                case Op::exit:
+                    return frame[top - 1];
+                case Op::jump:
+                    pc = arg;
+                    break;
+                case Op::jump_if_zero:
+                    if (frame[--top] == 0) {
+                        pc = arg;
+                    }
+                    break;
+                default: {
+                    top--;
+                    const std::optional<int64_t> result = apply(instr.op, frame[top - 1], frame[top]);
+                    if (!result.has_value()) {
+                        return {};
+                    }
+                    frame[top - 1] = result.value();
+                }
+            }
+        }
+        return 0;
+    }
+};
+
+// Source text to bytecode with at most Capacity tokens. Names are resolved
+// while parsing, so the AST already refers to variable slots.
+template <size_t Capacity>
+class Compiler {
+public:
+    using Result = Program<Capacity * 6 + 2, Capacity * 2 + 1>;
+
+    constexpr explicit Compiler(const std::string_view src)
+        : m_src(src) {
+    }
+
+    constexpr Result compile() {
+        tokenize();
+        int first = -1;
+        if (!m_error.has_value()) {
+            first = parse_stmts(false);
+        }
+        if (!m_error.has_value()) {
+            emit_stmts(first);
+            emit(Op::push, 0);
+            emit(Op::exit);
+        }
+        Result result;
+        result.error = m_error;
+        if (!m_error.has_value()) {
+            result.code = m_code;
+            result.num_slots = m_num_slots;
+            result.max_depth = m_max_depth;
+        }
+        return result;
+    }
+
+private:
+    struct Token {
+        TokenType type{};
+        int line = 0;
+        int column = 0;
+        std::string_view text{};
+        int64_t int_value = 0;
+    };
+
+    enum class NodeKind : uint8_t {
+        int_lit,
+        var,
+        binary,
+        let,
+        assign,
+        print,
+        input,
+        exit,
+        scope,
+        if_,
+        while_,
+    };
+
+    // Children are indices into m_nodes, -1 for none.
+    struct Node {
+        NodeKind kind{};
+        TokenType op{}; // binary
+        int64_t value = 0; // int_lit value or variable slot
+        int lhs = -1; // operand, condition or value; first statement of a scope
+        int rhs = -1; // second operand, or the scope of if and while
+        int alt = -1; // the elif or else of an if
+        int next = -1; // following statement in the same scope
+        int line = 0;
+        int column = 0;
+    };
+
+    struct Var {
+        std::string_view name;
+        int slot = 0;
+    };
+
+    // Two-character operators come first so that they win over their prefixes.
+    static constexpr std::array<std::pair<std::string_view, TokenType>, 27> operators = {{
+        {"==", TokenType::eq_eq},
+        {"!=", TokenType::not_e},
+        {"<=", TokenType::less_eq},
+        {">=", TokenType::greater_eq},
+        {"<<", TokenType::shl},
+        {">>", TokenType::shr},
+        {"&&", TokenType::and_and},
+        {"||", TokenType::or_or},
+        {"(", TokenType::open_paren},
+        {")", TokenType::close_paren},
+        {"[", TokenType::open_bracket},
+        {"]", TokenType::close_bracket},
+        {"{", TokenType::open_curly},
+        {"}", TokenType::close_curly},
+        {";", TokenType::semi},
+        {",", TokenType::comma},
+        {"=", TokenType::eq},
+        {"<", TokenType::less},
+        {">", TokenType::greater},
+        {"+", TokenType::plus},
+        {"-", TokenType::minus},
+        {"*", TokenType::star},
+        {"/", TokenType::fslash},
+        {"%", TokenType::percent},
+        {"&", TokenType::amp},
+        {"|", TokenType::pipe},
+        {"^", TokenType::caret},
+    }};
+
+    static constexpr bool is_alpha(const char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    }
+
+    static constexpr bool is_digit(const char c) {
+        return c >= '0' && c <= '9';
+    }
+
+    static constexpr bool is_space(const char c) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+    constexpr void fail(const int line, const int column, const ErrorKind kind, const std::string_view text = {}) {
+        if (!m_error.has_value()) {
+            m_error = Error{.kind = kind, .line = line, .column = column, .text = text};
+        }
+    }
+
+    // Same rules as Tokenizer::next.
+    constexpr void tokenize() {
+        size_t i = 0;
+        int line = 1;
+        size_t line_start = 0;
+        while (i < m_src.size() && !m_error.has_value()) {
+            const char c = m_src[i];
+            const int column = static_cast<int>(i - line_start) + 1;
+            const size_t start = i;
+            if (is_alpha(c)) {
+                while (i < m_src.size() && (is_alpha(m_src[i]) || is_digit(m_src[i]))) {
+                    i++;
+                }
+                const std::string_view word = m_src.substr(start, i - start);
+                add_token({keyword_type(word).value_or(TokenType::ident), line, column, word});
+            } else if (is_digit(c)) {
+                uint64_t value = 0;
+                bool overflow = false;
+                while (i < m_src.size() && is_digit(m_src[i])) {
+                    const auto digit = static_cast<uint64_t>(m_src[i++] - '0');
+                    overflow = overflow || value > (std::numeric_limits<int64_t>::max() - digit) / 10;
+                    value = value * 10 + digit;
+                }
+                const std::string_view text = m_src.substr(start, i - start);
+                if (overflow) {
+                    fail(line, column, ErrorKind::integer_out_of_range, text);
+                }
+                add_token({TokenType::int_lit, line, column, text, static_cast<int64_t>(value)});
+            } else if (m_src.substr(i).starts_with("//")) {
+                while (i < m_src.size() && m_src[i] != '\n') {
+                    i++;
+                }
+            } else if (m_src.substr(i).starts_with("/*")) {
+                const size_t end = m_src.find("*/", i + 2);
+                const size_t stop = end == std::string_view::npos ? m_src.size() : end + 2;
+                for (; i < stop; i++) {
+                    if (m_src[i] == '\n') {
+                        line++;
+                        line_start = i + 1;
+                    }
+                }
+                if (end == std::string_view::npos) {
+                    fail(line, static_cast<int>(i - line_start) + 1, ErrorKind::unterminated_comment);
+                }
+            } else if (c == '\n') {
+                i++;
+                line++;
+                line_start = i;
+            } else if (is_space(c)) {
+                i++;
+            } else {
+                const auto op = std::ranges::find_if(operators, [&](const auto &entry) {
+                    return m_src.substr(i).starts_with(entry.first);
+                });
+                if (op == operators.end()) {
+                    fail(line, column, ErrorKind::invalid_character, m_src.substr(i, 1));
+                    break;
+                }
+                i += op->first.size();
+                add_token({op->second, line, column, op->first});
+            }
+        }
+    }
+
+    constexpr void add_token(const Token &token) {
+        if (!m_tokens.push_back(token)) {
+            fail(token.line, token.column, ErrorKind::too_large);
+        }
+    }
+
+    [[nodiscard]] constexpr const Token *peek(const size_t offset = 0) const {
+        return m_index + offset < m_tokens.size() ? &m_tokens[m_index + offset] : nullptr;
+    }
+
+    [[nodiscard]] constexpr bool peek_is(const TokenType type, const size_t offset = 0) const {
+        const Token *token = peek(offset);
+        return token != nullptr && token->type == type;
+    }
+
+    // Reports what the current token should have been, see Parser::error_expected.
+    constexpr void fail_expected(const std::string_view what, const std::optional<TokenType> expected = {}) {
+        if (m_error.has_value()) {
+            return;
+        }
+        Error error{.kind = ErrorKind::expected, .text = what, .expected = expected};
+        if (const Token *token = peek()) {
+            error.line = token->line;
+            error.column = token->column;
+            error.found = token->type;
+        } else if (m_tokens.size() != 0) {
+            error.line = m_tokens[m_tokens.size() - 1].line;
+            error.column = m_tokens[m_tokens.size() - 1].column;
+        } else {
+            error.line = 1;
+        }
+        m_error = error;
+    }
+
+    constexpr bool expect(const TokenType type) {
+        if (peek_is(type)) {
+            m_index++;
+            return true;
+        }
+        fail_expected({}, type);
+        return false;
+    }
+
+    constexpr int add_node(const Node &node) {
+        if (!m_nodes.push_back(node)) {
+            fail(node.line, node.column, ErrorKind::too_large);
+            return -1;
+        }
+        return static_cast<int>(m_nodes.size()) - 1;
+    }
+
+    [[nodiscard]] constexpr const Var *find_var(const std::string_view name) const {
+        const auto it = std::ranges::find(m_vars, name, &Var::name);
+        return it == m_vars.end() ? nullptr : it;
+    }
+
+    constexpr int parse_term() // NOLINT(*-no-recursion)
+    {
+        const Token *token = peek();
+        if (token == nullptr) {
+            return -1;
+        }
+        if (token->type == TokenType::int_lit) {
+            m_index++;
+            return add_node({.kind = NodeKind::int_lit, .value = token->int_value, .line = token->line,
+                             .column = token->column});
+        }
+        if (token->type == TokenType::open_paren) {
+            m_index++;
+            const int expr = parse_expr();
+            if (expr < 0) {
+                fail_expected("expression");
+            }
+            expect(TokenType::close_paren);
+            return expr;
+        }
+        if (token->type != TokenType::ident) {
+            return -1;
+        }
+        if (peek_is(TokenType::open_paren, 1)) {
+            fail(token->line, token->column, ErrorKind::unsupported, "functions");
+            return -1;
+        }
+        if (peek_is(TokenType::open_bracket, 1)) {
+            fail(token->line, token->column, ErrorKind::unsupported, "arrays");
+            return -1;
+        }
+        m_index++;
+        const Var *var = find_var(token->text);
+        if (var == nullptr) {
+            fail(token->line, token->column, ErrorKind::undeclared_identifier, token->text);
+            return -1;
+        }
+        return add_node({.kind = NodeKind::var, .value = var->slot, .line = token->line, .column = token->column});
+    }
+
+    // Precedence climbing, like Parser::parse_expr.
+    constexpr int parse_expr(const int min_prec = 0) // NOLINT(*-no-recursion)
+    {
+        int lhs = parse_term();
+        if (lhs < 0) {
+            return -1;
+        }
+        while (const Token *token = peek()) {
+            const std::optional<int> prec = bin_prec(token->type);
+            if (!prec.has_value() || prec < min_prec) {
+                break;
+            }
+            m_index++;
+            const int rhs = parse_expr(prec.value() + 1);
+            if (rhs < 0) {
+                fail_expected("expression");
+                return -1;
+            }
+            lhs = add_node({.kind = NodeKind::binary, .op = token->type, .lhs = lhs, .rhs = rhs,
+                            .line = token->line, .column = token->column});
+        }
+        return lhs;
+    }
+
+    // `(` expr `)`
+    constexpr int parse_condition() // NOLINT(*-no-recursion)
+    {
+        expect(TokenType::open_paren);
+        const int expr = parse_expr();
+        if (expr < 0) {
+            fail_expected("expression");
+        }
+        expect(TokenType::close_paren);
+        return expr;
+    }
+
+    // `{` stmts `}`, with the variables declared in it going out of scope after.
+    constexpr int parse_scope() // NOLINT(*-no-recursion)
+    {
+        const Token *open = peek();
+        if (!peek_is(TokenType::open_curly)) {
+            fail_expected("scope");
+            return -1;
+        }
+        m_index++;
+        const size_t num_vars = m_vars.size();
+        const int first = parse_stmts(true);
+        m_vars.resize(num_vars);
+        expect(TokenType::close_curly);
+        return add_node({.kind = NodeKind::scope, .lhs = first, .line = open->line, .column = open->column});
+    }
+
+    // Statements up to the end of the source, or up to a `}` in a scope. Returns
+    // the first, the rest are linked through Node::next.
+    constexpr int parse_stmts(const bool in_scope) // NOLINT(*-no-recursion)
+    {
+        int first = -1;
+        int last = -1;
+        while (peek() != nullptr && !m_error.has_value()) {
+            if (in_scope && peek_is(TokenType::close_curly)) {
+                break;
+            }
+            const int stmt = parse_stmt();
+            if (stmt < 0) {
+                fail_expected(in_scope ? "`}`" : "statement");
+                break;
+            }
+            if (last < 0) {
+                first = stmt;
+            } else {
+                m_nodes[last].next = stmt;
+            }
+            last = stmt;
+        }
+        return first;
+    }
+
+    constexpr int parse_stmt() // NOLINT(*-no-recursion)
+    {
+        const Token *first = peek();
+        const int line = first->line;
+        const int column = first->column;
+        switch (first->type) {
+            case TokenType::let: {
+                m_index++;
+                const Token *ident = peek();
+                if (!expect(TokenType::ident)) {
+                    return -1;
+                }
+                if (peek_is(TokenType::open_bracket)) {
+                    fail(ident->line, ident->column, ErrorKind::unsupported, "arrays");
+                    return -1;
+                }
+                expect(TokenType::eq);
+                const int expr = parse_expr();
+                if (expr < 0) {
+                    fail_expected("expression");
+                }
+                expect(TokenType::semi);
+                if (find_var(ident->text) != nullptr) {
+                    fail(ident->line, ident->column, ErrorKind::identifier_already_used, ident->text);
+                }
+                const int slot = static_cast<int>(m_vars.size());
+                if (!m_vars.push_back({ident->text, slot})) {
+                    fail(ident->line, ident->column, ErrorKind::too_large);
+                }
+                m_num_slots = std::max(m_num_slots, m_vars.size());
+                return add_node({.kind = NodeKind::let, .value = slot, .lhs = expr, .line = line,
+                                 .column = column});
+            }
+            case TokenType::ident: {
+                if (peek_is(TokenType::open_paren, 1)) {
+                    fail(first->line, first->column, ErrorKind::unsupported, "functions");
+                    return -1;
+                }
+                if (peek_is(TokenType::open_bracket, 1)) {
+                    fail(first->line, first->column, ErrorKind::unsupported, "arrays");
+                    return -1;
+                }
+                if (!peek_is(TokenType::eq, 1)) {
+                    return -1;
+                }
+                m_index += 2;
+                const int expr = parse_expr();
+                if (expr < 0) {
+                    fail_expected("expression");
+                }
+                expect(TokenType::semi);
+                const Var *var = find_var(first->text);
+                if (var == nullptr) {
+                    fail(first->line, first->column, ErrorKind::undeclared_identifier, first->text);
+                    return -1;
+                }
+                return add_node({.kind = NodeKind::assign, .value = var->slot, .lhs = expr, .line = line,
+                                 .column = column});
+            }
+            case TokenType::print:
+            case TokenType::exit: {
+                m_index++;
+                const int expr = parse_condition();
+                expect(TokenType::semi);
+                const NodeKind kind = first->type == TokenType::print ? NodeKind::print : NodeKind::exit;
+                return add_node({.kind = kind, .lhs = expr, .line = line, .column = column});
+            }
+            case TokenType::input: {
+                m_index++;
+                expect(TokenType::open_paren);
+                const Token *ident = peek();
+                if (!peek_is(TokenType::ident)) {
+                    fail_expected("identifier");
+                    return -1;
+                }
+                m_index++;
+                expect(TokenType::close_paren);
+                expect(TokenType::semi);
+                const Var *var = find_var(ident->text);
+                if (var == nullptr) {
+                    fail(ident->line, ident->column, ErrorKind::undeclared_identifier, ident->text);
+                    return -1;
+                }
+                return add_node({.kind = NodeKind::input, .value = var->slot, .line = line, .column = column});
+            }
+            case TokenType::open_curly:
+                return parse_scope();
+            case TokenType::if_: {
+                m_index++;
+                const int condition = parse_condition();
+                const int scope = parse_scope();
+                const int stmt = add_node({.kind = NodeKind::if_, .lhs = condition, .rhs = scope, .line = line,
+                                           .column = column});
+                int tail = stmt;
+                // an elif is an if in the else branch of the one before
+                while (peek_is(TokenType::elif) && !m_error.has_value()) {
+                    const Token *elif = peek();
+                    m_index++;
+                    const int elif_condition = parse_condition();
+                    const int elif_scope = parse_scope();
+                    const int branch = add_node({.kind = NodeKind::if_, .lhs = elif_condition, .rhs = elif_scope,
+                                                 .line = elif->line, .column = elif->column});
+                    if (tail >= 0) {
+                        m_nodes[tail].alt = branch;
+                    }
+                    tail = branch;
+                }
+                if (peek_is(TokenType::else_)) {
+                    m_index++;
+                    const int else_scope = parse_scope();
+                    if (tail >= 0) {
+                        m_nodes[tail].alt = else_scope;
+                    }
+                }
+                return stmt;
+            }
+            case TokenType::parallel:
+                // runs sequentially here, which a parallel loop's result never depends on
+                m_index++;
+                if (!peek_is(TokenType::while_)) {
+                    fail_expected("`while`");
+                    return -1;
+                }
+                [[fallthrough]];
+            case TokenType::while_: {
+                m_index++;
+                const int condition = parse_condition();
+                const int scope = parse_scope();
+                return add_node({.kind = NodeKind::while_, .lhs = condition, .rhs = scope, .line = line,
+                                 .column = column});
+            }
+            case TokenType::fn:
+            case TokenType::return_:
+                fail(line, column, ErrorKind::unsupported, "functions");
+                return -1;
+            default:
+                return -1;
+        }
+    }
+
+    static constexpr Op binary_op(const TokenType type) {
+        switch (type) {
+            case TokenType::plus:
+                return Op::add;
+            case TokenType::minus:
+                return Op::sub;
+            case TokenType::star:
+                return Op::mul;
+            case TokenType::fslash:
+                return Op::div;
+            case TokenType::percent:
+                return Op::mod;
+            case TokenType::amp:
+                return Op::bit_and;
+            case TokenType::pipe:
+                return Op::bit_or;
+            case TokenType::caret:
+                return Op::bit_xor;
+            case TokenType::shl:
+                return Op::shl;
+            case TokenType::shr:
+                return Op::shr;
+            case TokenType::eq_eq:
+                return Op::eq;
+            case TokenType::not_e:
+                return Op::ne;
+            case TokenType::less:
+                return Op::lt;
+            case TokenType::less_eq:
+                return Op::le;
+            case TokenType::greater:
+                return Op::gt;
+            default:
+                return Op::ge;
+        }
+    }
+
+    // The value of a constant expression, nothing if it has variables or faults.
+    [[nodiscard]] constexpr std::optional<int64_t> fold(const int index) const // NOLINT(*-no-recursion)
+    {
+        const Node &node = m_nodes[index];
+        if (node.kind == NodeKind::int_lit) {
+            return node.value;
+        }
+        if (node.kind != NodeKind::binary) {
+            return {};
+        }
+        const std::optional<int64_t> lhs = fold(node.lhs);
+        const std::optional<int64_t> rhs = fold(node.rhs);
+        if (!lhs.has_value() || !rhs.has_value()) {
+            return {};
+        }
+        if (node.op == TokenType::and_and) {
+            return lhs != 0 && rhs != 0;
+        }
+        if (node.op == TokenType::or_or) {
+            return lhs != 0 || rhs != 0;
+        }
+        return apply(binary_op(node.op), lhs.value(), rhs.value());
+    }
+
+    // Index of the next instruction, for jumps.
+    [[nodiscard]] constexpr int64_t here() const {
+        return static_cast<int64_t>(m_code.size());
+    }
+
+    constexpr size_t emit(const Op op, const int64_t arg = 0) {
+        if (!m_code.push_back({op, arg})) {
+            fail(0, 0, ErrorKind::too_large);
+            return 0;
+        }
+        switch (op) {
+            case Op::push:
+            case Op::load:
+                m_max_depth = std::max(m_max_depth, ++m_depth);
+                break;
+            case Op::input:
+            case Op::exit:
+            case Op::jump:
+                break;
+            default:
+                m_depth--;
+        }
+        return m_code.size() - 1;
+    }
+
+    constexpr void patch(const size_t jump) {
+        m_code[jump].arg = here();
+    }
+
+    constexpr void emit_expr(const int index) // NOLINT(*-no-recursion)
+    {
+        const Node &node = m_nodes[index];
+        if (const std::optional<int64_t> value = fold(index)) {
+            emit(Op::push, value.value());
+            return;
+        }
+        if (node.kind == NodeKind::var) {
+            emit(Op::load, node.value);
+            return;
+        }
+        if (node.op == TokenType::and_and || node.op == TokenType::or_or) {
+            // 0 or 1, without evaluating the right side when the left decides
+            const bool is_and = node.op == TokenType::and_and;
+            emit_expr(node.lhs);
+            if (!is_and) {
+                emit(Op::push, 0);
+                emit(Op::eq);
+            }
+            const size_t short_circuit = emit(Op::jump_if_zero);
+            emit_expr(node.rhs);
+            const size_t rhs_false = emit(Op::jump_if_zero);
+            emit(Op::push, 1);
+            const size_t done = emit(Op::jump);
+            m_depth--;
+            patch(rhs_false);
+            emit(Op::push, 0);
+            const size_t done_false = emit(Op::jump);
+            m_depth--;
+            patch(short_circuit);
+            emit(Op::push, is_and ? 0 : 1);
+            patch(done);
+            patch(done_false);
+            return;
+        }
+        const Node &rhs = m_nodes[node.rhs];
+        if ((node.op == TokenType::fslash || node.op == TokenType::percent) && rhs.kind == NodeKind::int_lit
+            && rhs.value == 0) {
+            fail(rhs.line, rhs.column, ErrorKind::division_by_zero);
+        }
+        emit_expr(node.lhs);
+        emit_expr(node.rhs);
+        emit(binary_op(node.op));
+    }
+
+    constexpr void emit_stmts(int index) // NOLINT(*-no-recursion)
+    {
+        for (; index >= 0; index = m_nodes[index].next) {
+            emit_stmt(index);
+        }
+    }
+
+    constexpr void emit_stmt(const int index) // NOLINT(*-no-recursion)
+    {
+        const Node &node = m_nodes[index];
+        switch (node.kind) {
+            case NodeKind::let:
+            case NodeKind::assign:
+                emit_expr(node.lhs);
+                emit(Op::store, node.value);
+                break;
+            case NodeKind::print:
+                emit_expr(node.lhs);
+                emit(Op::print);
+                break;
+            case NodeKind::exit:
+                emit_expr(node.lhs);
+                emit(Op::exit);
+                m_depth--;
+                break;
+            case NodeKind::input:
+                emit(Op::input, node.value);
+                break;
+            case NodeKind::scope:
+                emit_stmts(node.lhs);
+                break;
+            case NodeKind::if_: {
+                // a constant condition leaves only the branch it takes
+                if (const std::optional<int64_t> value = fold(node.lhs)) {
+                    if (value != 0) {
+                        emit_stmt(node.rhs);
+                    } else if (node.alt >= 0) {
+                        emit_stmt(node.alt);
+                    }
+                    break;
+                }
+                emit_expr(node.lhs);
+                const size_t skip = emit(Op::jump_if_zero);
+                emit_stmt(node.rhs);
+                if (node.alt < 0) {
+                    patch(skip);
+                    break;
+                }
+                const size_t done = emit(Op::jump);
+                patch(skip);
+                emit_stmt(node.alt);
+                patch(done);
+                break;
+            }
+            case NodeKind::while_: {
+                if (fold(node.lhs) == 0) {
+                    break;
+                }
+                const int64_t start = here();
+                emit_expr(node.lhs);
+                const size_t done = emit(Op::jump_if_zero);
+                emit_stmt(node.rhs);
+                emit(Op::jump, start);
+                patch(done);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    std::string_view m_src;
+    std::optional<Error> m_error;
+    FixedVector<Token, Capacity> m_tokens;
+    size_t m_index = 0;
+    FixedVector<Node, Capacity> m_nodes;
+    FixedVector<Var, Capacity> m_vars;
+    size_t m_num_slots = 0;
+    FixedVector<Instr, Capacity * 6 + 2> m_code;
+    size_t m_depth = 0;
+    size_t m_max_depth = 0;
+};
+
+// Compiles `source` with room for `Capacity` tokens; usable at compile time and
+// at run time. Check ok() before running the result.
+template <size_t Capacity>
+constexpr auto compile_text(const std::string_view source) {
+    return Compiler<Capacity>(source).compile();
+}
+
+// Not constexpr: compile() reaches it for a source with errors, which makes the
+// C++ compiler name the error and where it is in its diagnostic.
+template <ErrorKind Kind, int Line, int Column>
+void source_error() {
+}
+
+// Compiles `Source` during C++ compilation into a Program of exactly the size it needs.
+template <FixedString Source>
+consteval auto compile() {
+    constexpr auto draft = compile_text<Source.view().size() + 1>(Source.view());
+    if constexpr (!draft.ok()) {
+        source_error<draft.error->kind, draft.error->line, draft.error->column>();
+    }
+    Program<draft.code.size(), draft.num_slots + draft.max_depth> program;
+    for (const Instr &instr: draft.code) {
+        program.code.push_back(instr);
+    }
+    program.num_slots = draft.num_slots;
+    program.max_depth = draft.max_depth;
+    return program;
+}
+
+} // namespace embed
@@ -1,14 +1,48 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
+#include <bit>
 #include <cassert>
+#include <map>
+#include <set>
+#include <span>
+#include <sstream>
+#include <tuple>
 
+#include "dataflow.hpp"
 #include "parser.hpp"
+#include "profile.hpp"
+
+struct GeneratorOptions {
+    // Count executions of every basic block, branch and loop iteration and write
+    // the totals per source line to `profile_path` when the program exits.
+    bool instrument = false;
+    std::string profile_path = "gn.prof";
+    // Emit `%line` markers so that `nasm -g -F dwarf` maps every instruction back
+    // to its line in `source_path`.
+    bool debug_info = false;
+    std::string source_path;
+    // Calls to functions whose body is a single `return` of at most this many
+    // expression nodes are expanded in place. 0 disables inlining.
+    size_t inline_threshold = 16;
+    // Lower element-wise array loops to SSE2 (two lanes of 64 bits).
+    bool vectorize = true;
+    // Counts from an instrumented run of the same source, used to lay out
+    // if/elif/else chains, see gen_if_profiled.
+    Profile profile{};
+    // Threads running a `parallel while`, 0 for one per CPU.
+    size_t threads = 0;
+};
 
 class Generator {
 public:
-    explicit Generator(NodeProg prog)
-        : m_prog(std::move(prog)) {
+    // Semantic errors such as undeclared identifiers go to `diagnostics`; the
+    // assembly returned by gen_prog is only meaningful if there were none.
+    Generator(NodeProg prog, Diagnostics &diagnostics, GeneratorOptions options = {})
+        : m_prog(std::move(prog))
+          , m_options(std::move(options))
+          , m_diagnostics(diagnostics) {
     }
 
     void gen_term(const NodeTerm *term) {
@@ -16,140 +50,146 @@ public:
             Generator &gen;
 
             void operator()(const NodeTermIntLit *term_int_lit) const {
-                gen.m_output << "    mov rax, " << term_int_lit->int_lit.value.value() << "\n";
+                const int64_t value = term_int_lit->int_lit.int_value;
+                if (fits_imm32(value)) {
+                    gen.push(std::to_string(value));
+                    return;
+                }
+                gen.gen_load_imm("rax", value);
                 gen.push("rax");
             }
 
             void operator()(const NodeTermIdent *term_ident) const {
-                const auto it = std::ranges::find_if(std::as_const(gen.m_vars), [&](const Var &var) {
-                    return var.name == term_ident->ident.value.value();
-                });
-                if (it == gen.m_vars.cend()) {
-                    std::cerr << "Undeclared identifier: " << term_ident->ident.value.value() << std::endl;
-                    exit(EXIT_FAILURE);
-                }
-                std::stringstream offset;
-                offset << "QWORD [rsp + " << (gen.m_stack_size - it->stack_loc - 1) * 8 << "]";
-                gen.push(offset.str());
+                const Var &var = gen.lookup_var(term_ident->ident, false);
+                gen.push("QWORD " + gen.var_slot(var));
+            }
+
+            void operator()(const NodeTermIndex *term_index) const {
+                const Var &array = gen.lookup_var(term_index->ident, true);
+                const ElementRef element = gen.gen_index(array, term_index->index);
+                gen.push("QWORD " + gen.element_slot(array, element));
             }
 
             void operator()(const NodeTermParen *term_paren) const {
                 gen.gen_expr(term_paren->expr);
             }
+
+            void operator()(const NodeTermCall *term_call) const {
+                gen.gen_call(term_call);
+                gen.push("rax");
+            }
         };
         TermVisitor visitor({.gen = *this});
         std::visit(visitor, term->var);
     }
 
+    // Leaves the value of `bin_expr` in rax. Operators are tiled as described at
+    // gen_into_rax, so only operands that are themselves complex touch the stack.
     void gen_bin_expr(const NodeBinExpr *bin_expr) {
         struct BinExprVisitor {
             Generator &gen;
+            const NodeBinExpr *bin_expr;
 
             void operator()(const NodeBinExprSub *sub) const {
-                gen.gen_expr(sub->rhs);
-                gen.gen_expr(sub->lhs);
-                gen.pop("rax");
-                gen.pop("rbx");
-                gen.m_output << "    sub rax, rbx\n";
-                gen.push("rax");
+                gen.gen_alu("sub", false, sub->lhs, sub->rhs);
             }
 
             void operator()(const NodeBinExprAdd *add) const {
-                gen.gen_expr(add->rhs);
-                gen.gen_expr(add->lhs);
-                gen.pop("rax");
-                gen.pop("rbx");
-                gen.m_output << "    add rax, rbx\n";
-                gen.push("rax");
+                if (!gen.gen_lea(add->lhs, add->rhs)) {
+                    gen.gen_alu("add", true, add->lhs, add->rhs);
+                }
             }
 
             void operator()(const NodeBinExprMulti *multi) const {
-                gen.gen_expr(multi->rhs);
-                gen.gen_expr(multi->lhs);
-                gen.pop("rax");
-                gen.pop("rbx");
-                gen.m_output << "    mul rbx\n";
-                gen.push("rax");
+                if (!gen.gen_mul_const(multi->lhs, multi->rhs)) {
+                    gen.gen_alu("imul", true, multi->lhs, multi->rhs);
+                }
             }
 
+            // Division truncates towards zero. Dividing by a literal other than -1 needs no idiv.
             void operator()(const NodeBinExprDiv *div) const {
-                gen.gen_expr(div->rhs);
-                gen.gen_expr(div->lhs);
-                gen.pop("rax");
-                gen.pop("rbx");
-                gen.m_output << "    div rbx\n";
-                gen.push("rax");
+                const auto divisor = int_literal(div->rhs);
+                if (divisor == 0) {
+                    gen.error(literal_token(div->rhs), "Division by zero");
+                } else if (divisor.has_value()) {
+                    gen.gen_into_rax(div->lhs);
+                    gen.gen_div_const(divisor.value());
+                    return;
+                }
+                gen.gen_idiv(div->lhs, div->rhs);
+            }
+
+            // The remainder takes the sign of the dividend, like idiv.
+            void operator()(const NodeBinExprMod *mod) const {
+                const auto divisor = int_literal(mod->rhs);
+                if (divisor == 0) {
+                    gen.error(literal_token(mod->rhs), "Division by zero");
+                } else if (divisor.has_value()) {
+                    gen.gen_into_rax(mod->lhs);
+                    gen.gen_mod_const(divisor.value(), gen.is_non_negative(mod->lhs));
+                    return;
+                }
+                gen.gen_idiv(mod->lhs, mod->rhs);
+                gen.m_output << "    mov rax, rdx\n";
+            }
+
+            void operator()(const NodeBinExprBitAnd *bit_and) const {
+                gen.gen_alu("and", true, bit_and->lhs, bit_and->rhs);
+            }
+
+            void operator()(const NodeBinExprBitOr *bit_or) const {
+                gen.gen_alu("or", true, bit_or->lhs, bit_or->rhs);
+            }
+
+            void operator()(const NodeBinExprBitXor *bit_xor) const {
+                gen.gen_alu("xor", true, bit_xor->lhs, bit_xor->rhs);
+            }
+
+            // Shift counts are taken modulo 64 like the hardware does, `>>` is arithmetic.
+            void operator()(const NodeBinExprShl *shl) const {
+                gen.gen_shift("shl", shl->lhs, shl->rhs);
+            }
+
+            void operator()(const NodeBinExprShr *shr) const {
+                gen.gen_shift("sar", shr->lhs, shr->rhs);
+            }
+
+            // `&&` and `||` produce 0 or 1 and skip the rhs once the lhs decides.
+            void operator()(const NodeBinExprAnd *) const {
+                gen.gen_logical(bin_expr);
+            }
+
+            void operator()(const NodeBinExprOr *) const {
+                gen.gen_logical(bin_expr);
             }
 
             //relational
             void operator()(const NodeBinExprEq *eq) const {
-                gen.gen_expr(eq->rhs);
-                gen.gen_expr(eq->lhs);
-                gen.pop("rax"); // Now left operand goes to rax
-                gen.pop("rbx"); // And right operand goes to rbx
-                gen.m_output << "    cmp rax, rbx\n";
-                gen.m_output << "    sete al\n";
-                gen.m_output << "    movzx rax, al\n";
-                gen.push("rax");
+                gen.gen_set(eq->lhs, eq->rhs, {"e", "e"});
             }
 
             void operator()(const NodeBinExprNotEq *neq) const {
-                gen.gen_expr(neq->rhs);
-                gen.gen_expr(neq->lhs);
-                gen.pop("rax");
-                gen.pop("rbx");
-                gen.m_output << "    cmp rax, rbx\n";
-                gen.m_output << "    setne al\n";
-                gen.m_output << "    movzx rax, al\n";
-                gen.push("rax");
+                gen.gen_set(neq->lhs, neq->rhs, {"ne", "ne"});
             }
 
             void operator()(const NodeBinExprLess *less) const {
-                gen.gen_expr(less->rhs);
-                gen.gen_expr(less->lhs);
-                gen.pop("rax");
-                gen.pop("rbx");
-                gen.m_output << "    cmp rax, rbx\n";
-                gen.m_output << "    setl al\n";
-                gen.m_output << "    movzx rax, al\n";
-                gen.push("rax");
+                gen.gen_set(less->lhs, less->rhs, {"l", "g"});
             }
 
             void operator()(const NodeBinExprLessEq *less_eq) const {
-                gen.gen_expr(less_eq->rhs);
-                gen.gen_expr(less_eq->lhs);
-                gen.pop("rax");
-                gen.pop("rbx");
-                gen.m_output << "    cmp rax, rbx\n";
-                gen.m_output << "    setle al\n";
-                gen.m_output << "    movzx rax, al\n";
-                gen.push("rax");
+                gen.gen_set(less_eq->lhs, less_eq->rhs, {"le", "ge"});
             }
 
             void operator()(const NodeBinExprGreater *greater) const {
-                gen.gen_expr(greater->rhs);
-                gen.gen_expr(greater->lhs);
-                gen.pop("rax");
-                gen.pop("rbx");
-                gen.m_output << "    cmp rax, rbx\n";
-                gen.m_output << "    setg al\n";
-                gen.m_output << "    movzx rax, al\n";
-                gen.push("rax");
+                gen.gen_set(greater->lhs, greater->rhs, {"g", "l"});
             }
 
             void operator()(const NodeBinExprGreaterEq *greater_eq) const {
-                gen.gen_expr(greater_eq->rhs);
-                gen.gen_expr(greater_eq->lhs);
-                gen.pop("rax"); // left operand from x (should be 11)
-                gen.pop("rbx"); // right operand from 10
-                gen.m_output << "    cmp rax, rbx\n";
-                gen.m_output << "    setge al\n";
-                gen.m_output << "    movzx rax, al\n";
-                gen.push("rax");
+                gen.gen_set(greater_eq->lhs, greater_eq->rhs, {"ge", "le"});
             }
         };
 
-        BinExprVisitor visitor{.gen = *this};
+        BinExprVisitor visitor{.gen = *this, .bin_expr = bin_expr};
         std::visit(visitor, bin_expr->var);
     }
 
@@ -163,6 +203,7 @@ public:
 
             void operator()(const NodeBinExpr *bin_expr) const {
                 gen.gen_bin_expr(bin_expr);
+                gen.push("rax");
             }
         };
 
@@ -170,82 +211,605 @@ public:
         std::visit(visitor, expr->var);
     }
 
+    // Arguments are passed in registers in System V order and the result is
+    // returned in rax. Small functions are expanded in place instead.
+    void gen_call(const NodeTermCall *call) {
+        const std::string &name = call->name.value.value();
+        const auto it = m_functions.find(name);
+        if (it == m_functions.end()) {
+            if (m_streaming) {
+                gen_forward_call(call);
+                return;
+            }
+            error(call->name, "Undeclared function: " + name);
+            return;
+        }
+        const NodeStmtFn *fn = it->second;
+        if (call->args.size() != fn->params.size()) {
+            error(call->name, "Function " + name + " expects " + std::to_string(fn->params.size())
+                              + " arguments, got " + std::to_string(call->args.size()));
+            return;
+        }
+        if (fn->params.size() > arg_regs.size()) {
+            // reported with the declaration
+            return;
+        }
+        for (const NodeExpr *arg: call->args) {
+            gen_expr(arg);
+        }
+
+        if (const auto body = inline_body(fn); body.has_value() && std::ranges::find(m_inlining, fn) == m_inlining.end()) {
+            // The arguments already sit on the stack exactly where the callee's
+            // parameters would, so they become the only visible variables.
+            m_output << "    ;; inline " << name << "\n";
+            std::vector<Var> caller_vars = std::exchange(m_vars, {});
+            for (size_t i = 0; i < fn->params.size(); i++) {
+                m_vars.push_back({.name = fn->params[i].value.value(), .stack_loc = m_stack_size - fn->params.size() + i});
+            }
+            m_inlining.push_back(fn);
+            gen_into_rax(body.value());
+            m_inlining.pop_back();
+            m_vars = std::move(caller_vars);
+            if (!fn->params.empty()) {
+                m_output << "    add rsp, " << fn->params.size() * 8 << "\n";
+                m_stack_size -= fn->params.size();
+            }
+            m_output << "    ;; /inline " << name << "\n";
+            return;
+        }
+
+        pop_args(call->args.size());
+        m_output << "    call fn_" << name << "\n";
+    }
+
+    // A call to a function whose declaration a stream has not reached yet; it is
+    // checked by end_stream.
+    void gen_forward_call(const NodeTermCall *call) {
+        m_forward_calls.emplace_back(call->name, call->args.size());
+        if (call->args.size() > arg_regs.size()) {
+            return;
+        }
+        for (const NodeExpr *arg: call->args) {
+            gen_expr(arg);
+        }
+        pop_args(call->args.size());
+        m_output << "    call fn_" << call->name.value.value() << "\n";
+    }
+
     void gen_scope(const NodeScope *scope) {
         begin_scope();
-        for (const NodeStmt *stmt: scope->stmts) {
+        gen_stmts(scope->stmts);
+        end_scope();
+    }
+
+    // Statements following an if or while start a new basic block.
+    void gen_stmts(const std::vector<NodeStmt *> &stmts) {
+        bool block_start = false;
+        for (const NodeStmt *stmt: stmts) {
+            if (block_start) {
+                set_line(stmt->line);
+                count(stmt->line, "block");
+            }
             gen_stmt(stmt);
+            block_start = std::holds_alternative<NodeStmtIf *>(stmt->var)
+                          || std::holds_alternative<NodeStmtWhile *>(stmt->var);
         }
-        end_scope();
     }
 
-    void gen_if_pred(const NodeIfPred *pred, const std::string &end_label) {
+    void gen_if_pred(const NodeIfPred *pred, const std::string &end_label, const int if_line) {
         struct PredVisitor {
             Generator &gen;
             const std::string &end_label;
+            int if_line;
 
             void operator()(const NodeIfPredElif *elif) const {
                 gen.m_output << "    ;; elif\n";
-                gen.gen_expr(elif->expr);
-                gen.pop("rax");
-                const std::string label = gen.create_label();
-                gen.m_output << "    test rax, rax\n";
-                gen.m_output << "    jz " << label << "\n";
+                gen.set_line(elif->line);
+                const std::string label = elif->pred.has_value()
+                                              ? gen.create_pred_label(elif->pred.value())
+                                              : gen.create_label("if_none", if_line);
+                gen.gen_cond_jump(elif->expr, false, label);
+                gen.count(elif->line, "taken");
                 gen.gen_scope(elif->scope);
                 gen.m_output << "    jmp " << end_label << "\n";
+                gen.m_output << label << ":\n";
                 if (elif->pred.has_value()) {
-                    gen.m_output << label << ":\n";
-                    gen.gen_if_pred(elif->pred.value(), end_label);
+                    gen.gen_if_pred(elif->pred.value(), end_label, if_line);
+                } else {
+                    gen.count(if_line, "not-taken");
                 }
             }
 
             void operator()(const NodeIfPredElse *else_) const {
                 gen.m_output << "    ;; else\n";
+                gen.set_line(else_->line);
+                gen.count(else_->line, "taken");
                 gen.gen_scope(else_->scope);
             }
         };
 
-        PredVisitor visitor{.gen = *this, .end_label = end_label};
+        PredVisitor visitor{.gen = *this, .end_label = end_label, .if_line = if_line};
         std::visit(visitor, pred->var);
     }
 
+    // One arm of an if/elif/else chain, `expr` is null for the else.
+    struct IfArm {
+        const NodeExpr *expr;
+        const NodeScope *scope;
+        int line;
+        uint64_t taken = 0;
+    };
+
+    [[nodiscard]] static std::vector<IfArm> if_arms(const NodeStmtIf *stmt_if, const int line) {
+        std::vector<IfArm> arms = {{.expr = stmt_if->expr, .scope = stmt_if->scope, .line = line}};
+        std::optional<NodeIfPred *> pred = stmt_if->pred;
+        while (pred.has_value()) {
+            if (const auto elif = std::get_if<NodeIfPredElif *>(&pred.value()->var)) {
+                arms.push_back({.expr = (*elif)->expr, .scope = (*elif)->scope, .line = (*elif)->line});
+                pred = (*elif)->pred;
+            } else {
+                const auto else_ = std::get<NodeIfPredElse *>(pred.value()->var);
+                arms.push_back({.expr = nullptr, .scope = else_->scope, .line = else_->line});
+                pred.reset();
+            }
+        }
+        return arms;
+    }
+
+    // The values of a variable for which a test holds, empty when lo > hi.
+    struct ValueRange {
+        int64_t lo;
+        int64_t hi;
+    };
+
+    // `x == 3`, `x < 10`, `10 >= x` and so on: a scalar compared against a literal.
+    [[nodiscard]] static std::optional<std::pair<std::string, ValueRange>> value_range(const NodeExpr *expr) {
+        const auto bin_expr = std::get_if<NodeBinExpr *>(&unparen(expr)->var);
+        if (bin_expr == nullptr) {
+            return {};
+        }
+        enum class Op { eq, less, less_eq, greater, greater_eq };
+        const auto compared = [](const auto *cmp, const Op op) {
+            return std::tuple(cmp->lhs, cmp->rhs, op);
+        };
+        std::optional<std::tuple<const NodeExpr *, const NodeExpr *, Op>> test;
+        if (const auto eq = std::get_if<NodeBinExprEq *>(&(*bin_expr)->var)) {
+            test = compared(*eq, Op::eq);
+        } else if (const auto less = std::get_if<NodeBinExprLess *>(&(*bin_expr)->var)) {
+            test = compared(*less, Op::less);
+        } else if (const auto less_eq = std::get_if<NodeBinExprLessEq *>(&(*bin_expr)->var)) {
+            test = compared(*less_eq, Op::less_eq);
+        } else if (const auto greater = std::get_if<NodeBinExprGreater *>(&(*bin_expr)->var)) {
+            test = compared(*greater, Op::greater);
+        } else if (const auto greater_eq = std::get_if<NodeBinExprGreaterEq *>(&(*bin_expr)->var)) {
+            test = compared(*greater_eq, Op::greater_eq);
+        } else {
+            return {};
+        }
+        auto [lhs, rhs, op] = test.value();
+        std::optional<std::string> name = ident_name(unparen(lhs));
+        std::optional<int64_t> value = int_literal(rhs);
+        if (!name.has_value() || !value.has_value()) {
+            // `c < x` is `x > c`
+            name = ident_name(unparen(rhs));
+            value = int_literal(lhs);
+            op = op == Op::less ? Op::greater
+                 : op == Op::less_eq ? Op::greater_eq
+                 : op == Op::greater ? Op::less
+                 : op == Op::greater_eq ? Op::less_eq
+                 : op;
+        }
+        if (!name.has_value() || !value.has_value()) {
+            return {};
+        }
+        const int64_t c = value.value();
+        constexpr int64_t min = INT64_MIN;
+        constexpr int64_t max = INT64_MAX;
+        switch (op) {
+            case Op::eq:
+                return std::pair(name.value(), ValueRange{c, c});
+            case Op::less:
+                return std::pair(name.value(), c == min ? ValueRange{max, min} : ValueRange{min, c - 1});
+            case Op::less_eq:
+                return std::pair(name.value(), ValueRange{min, c});
+            case Op::greater:
+                return std::pair(name.value(), c == max ? ValueRange{max, min} : ValueRange{c + 1, max});
+            default:
+                return std::pair(name.value(), ValueRange{c, max});
+        }
+    }
+
+    // The ranges of a chain of tests of one variable, in order.
+    [[nodiscard]] static std::optional<std::pair<std::string, std::vector<ValueRange>>> chain_ranges(
+        const std::span<const IfArm> arms) {
+        std::optional<std::string> name;
+        std::vector<ValueRange> ranges;
+        for (const IfArm &arm: arms) {
+            const auto test = value_range(arm.expr);
+            if (!test.has_value() || (name.has_value() && name.value() != test->first)) {
+                return {};
+            }
+            name = test->first;
+            ranges.push_back(test->second);
+        }
+        if (!name.has_value()) {
+            return {};
+        }
+        return std::pair(name.value(), std::move(ranges));
+    }
+
+    // At most one of the tests can hold and none has side effects, so they may
+    // run in any order: one variable compared against disjoint ranges of literals.
+    [[nodiscard]] static bool exclusive_tests(const std::span<const IfArm> arms) {
+        const auto chain = chain_ranges(arms);
+        if (!chain.has_value()) {
+            return false;
+        }
+        std::vector<ValueRange> ranges = chain->second;
+        std::erase_if(ranges, [](const ValueRange &range) { return range.lo > range.hi; });
+        std::ranges::sort(ranges, {}, &ValueRange::lo);
+        for (size_t i = 1; i < ranges.size(); i++) {
+            if (ranges[i].lo <= ranges[i - 1].hi) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // A run of values that all lead to the same arm; `arm` is the number of
+    // tests for values that pass none of them.
+    struct CaseSegment {
+        int64_t lo;
+        int64_t hi;
+        size_t arm;
+    };
+
+    // Splits the int64 range into segments by the arm that the first test
+    // holding for a value picks, merging neighbours that pick the same one.
+    [[nodiscard]] static std::vector<CaseSegment> case_segments(const std::vector<ValueRange> &ranges) {
+        std::vector<int64_t> starts = {INT64_MIN};
+        for (const ValueRange &range: ranges) {
+            if (range.lo <= range.hi) {
+                starts.push_back(range.lo);
+                if (range.hi != INT64_MAX) {
+                    starts.push_back(range.hi + 1);
+                }
+            }
+        }
+        std::ranges::sort(starts);
+        starts.erase(std::ranges::unique(starts).begin(), starts.end());
+        std::vector<CaseSegment> segments;
+        for (size_t i = 0; i < starts.size(); i++) {
+            const int64_t lo = starts[i];
+            const int64_t hi = i + 1 < starts.size() ? starts[i + 1] - 1 : INT64_MAX;
+            size_t arm = 0;
+            while (arm < ranges.size() && (lo < ranges[arm].lo || lo > ranges[arm].hi)) {
+                arm++;
+            }
+            if (!segments.empty() && segments.back().arm == arm) {
+                segments.back().hi = hi;
+            } else {
+                segments.push_back({.lo = lo, .hi = hi, .arm = arm});
+            }
+        }
+        return segments;
+    }
+
+    // Lowers a chain of at least min_switch_tests tests comparing one scalar
+    // against literals to a jump table when the values tested are dense, and to
+    // a binary search over the segments of values otherwise. False, generating
+    // nothing, for any other chain.
+    bool gen_if_switch(const NodeStmtIf *stmt_if, const int line) {
+        const std::vector<IfArm> arms = if_arms(stmt_if, line);
+        const bool has_else = arms.back().expr == nullptr;
+        const size_t num_tests = arms.size() - (has_else ? 1 : 0);
+        if (num_tests < min_switch_tests) {
+            return false;
+        }
+        const auto chain = chain_ranges(std::span(arms.data(), num_tests));
+        if (!chain.has_value()) {
+            return false;
+        }
+        const Var *var = find_var(chain->first);
+        if (var == nullptr || var->is_array()) {
+            return false;
+        }
+
+        m_output << "    ;; switch\n";
+        m_output << create_label("switch", line) << ":\n";
+        const std::string end_label = create_label("if_end", line);
+        std::vector<std::string> labels;
+        for (size_t i = 0; i < num_tests; i++) {
+            labels.push_back(create_label("case", arms[i].line));
+        }
+        labels.push_back(has_else ? create_label("else", arms.back().line)
+                         : m_options.instrument ? create_label("if_none", line)
+                         : end_label);
+        m_output << "    mov rax, QWORD " << var_slot(*var) << "\n";
+        const std::vector<CaseSegment> segments = case_segments(chain->second);
+        if (!gen_jump_table(segments, labels, line)) {
+            gen_case_search(segments, labels, line);
+        }
+
+        for (size_t i = 0; i < arms.size(); i++) {
+            m_output << (i == 0 ? "    ;; if\n" : arms[i].expr != nullptr ? "    ;; elif\n" : "    ;; else\n");
+            m_output << labels[i] << ":\n";
+            set_line(arms[i].line);
+            count(arms[i].line, "taken");
+            gen_scope(arms[i].scope);
+            if (i + 1 < arms.size() || (!has_else && labels.back() != end_label)) {
+                m_output << "    jmp " << end_label << "\n";
+            }
+        }
+        if (!has_else && labels.back() != end_label) {
+            m_output << labels.back() << ":\n";
+            count(line, "not-taken");
+        }
+        m_output << end_label << ":\n";
+        m_output << "    ;; /switch\n";
+        return true;
+    }
+
+    // Dispatches on rax through a table of arm addresses covering the values
+    // from the lowest to the highest tested. Only worth it when at least a
+    // quarter of the entries lead to an arm.
+    bool gen_jump_table(const std::vector<CaseSegment> &segments, const std::vector<std::string> &labels,
+                        const int line) {
+        const size_t none = labels.size() - 1;
+        const auto first = std::ranges::find_if(segments, [&](const CaseSegment &seg) { return seg.arm != none; });
+        const auto last = std::ranges::find_if(segments.rbegin(), segments.rend(),
+                                               [&](const CaseSegment &seg) { return seg.arm != none; });
+        if (first == segments.end()) {
+            return false;
+        }
+        const int64_t lo = first->lo;
+        const int64_t hi = last->hi;
+        // 0 when the table would cover every int64
+        const uint64_t span = static_cast<uint64_t>(hi) - static_cast<uint64_t>(lo) + 1;
+        if (span == 0 || span > max_jump_table_entries) {
+            return false;
+        }
+        uint64_t covered = 0;
+        size_t num_cases = 0;
+        for (auto it = first; it != last.base(); ++it) {
+            if (it->arm != none) {
+                covered += static_cast<uint64_t>(it->hi) - static_cast<uint64_t>(it->lo) + 1;
+                num_cases++;
+            }
+        }
+        if (num_cases < min_switch_tests || covered * 4 < span) {
+            return false;
+        }
+
+        const std::string table = create_label("switch_table", line);
+        // values below lo wrap around to above the table
+        if (lo != 0) {
+            if (fits_imm32(lo)) {
+                m_output << "    sub rax, " << lo << "\n";
+            } else {
+                m_output << "    mov rcx, " << lo << "\n";
+                m_output << "    sub rax, rcx\n";
+            }
+        }
+        m_output << "    cmp rax, " << span - 1 << "\n";
+        m_output << "    ja " << labels[none] << "\n";
+        m_output << "    lea rcx, [rel " << table << "]\n";
+        m_output << "    jmp [rcx + rax*8]\n";
+
+        std::stringstream entries;
+        entries << table << ":\n";
+        for (auto it = first; it != last.base(); ++it) {
+            for (int64_t value = it->lo;; value++) {
+                entries << "    dq " << labels[it->arm] << "\n";
+                if (value == it->hi) {
+                    break;
+                }
+            }
+        }
+        m_jump_tables += entries.str();
+        return true;
+    }
+
+    // Binary search for the segment holding rax, halving the segments left
+    // with every comparison.
+    void gen_case_search(const std::span<const CaseSegment> segments, const std::vector<std::string> &labels,
+                         const int line) { // NOLINT(*-no-recursion)
+        if (segments.size() == 1) {
+            m_output << "    jmp " << labels[segments[0].arm] << "\n";
+            return;
+        }
+        const size_t mid = segments.size() / 2;
+        const int64_t bound = segments[mid].lo;
+        if (fits_imm32(bound)) {
+            m_output << "    cmp rax, " << bound << "\n";
+        } else {
+            m_output << "    mov rcx, " << bound << "\n";
+            m_output << "    cmp rax, rcx\n";
+        }
+        if (mid == 1) {
+            m_output << "    jl " << labels[segments[0].arm] << "\n";
+            gen_case_search(segments.subspan(1), labels, line);
+        } else if (segments.size() - mid == 1) {
+            m_output << "    jge " << labels[segments[mid].arm] << "\n";
+            gen_case_search(segments.first(mid), labels, line);
+        } else {
+            const std::string upper = create_label("switch_upper", line);
+            m_output << "    jge " << upper << "\n";
+            gen_case_search(segments.first(mid), labels, line);
+            m_output << upper << ":\n";
+            gen_case_search(segments.subspan(mid), labels, line);
+        }
+    }
+
+    // Lays out an if chain by its profile. Exclusive tests are tried most
+    // frequently taken first, and the body of an arm taken by fewer than half of
+    // the tests reaching it is moved out of line behind an inverted jump, so the
+    // common path falls through. False, generating nothing, if the profile has
+    // no counts for the chain.
+    bool gen_if_profiled(const NodeStmtIf *stmt_if, const int line) {
+        std::vector<IfArm> arms = if_arms(stmt_if, line);
+        uint64_t reaching = m_options.profile.count(line, "not-taken");
+        std::set<int> lines;
+        for (IfArm &arm: arms) {
+            arm.taken = m_options.profile.count(arm.line, "taken");
+            reaching += arm.taken;
+            lines.insert(arm.line);
+        }
+        // the counts of arms sharing a line cannot be told apart
+        if (reaching == 0 || lines.size() != arms.size()) {
+            return false;
+        }
+        const bool has_else = arms.back().expr == nullptr;
+        const std::span tests(arms.data(), arms.size() - (has_else ? 1 : 0));
+        if (exclusive_tests(tests)) {
+            std::ranges::stable_sort(tests, std::ranges::greater{}, &IfArm::taken);
+        }
+
+        m_output << "    ;; if\n";
+        m_output << create_label("if", line) << ":\n";
+        const std::string end_label = create_label("if_end", line);
+        for (size_t i = 0; i < arms.size(); i++) {
+            const IfArm &arm = arms[i];
+            if (i > 0) {
+                m_output << (arm.expr != nullptr ? "    ;; elif\n" : "    ;; else\n");
+                set_line(arm.line);
+            }
+            if (arm.expr == nullptr) {
+                count(arm.line, "taken");
+                gen_scope(arm.scope);
+                break;
+            }
+            if (arm.taken * 2 < reaching) {
+                const std::string cold_label = create_label("if_cold", arm.line);
+                gen_cond_jump(arm.expr, true, cold_label);
+                gen_cold(arm.line, [&] {
+                    m_output << cold_label << ":\n";
+                    count(arm.line, "taken");
+                    gen_scope(arm.scope);
+                    m_output << "    jmp " << end_label << "\n";
+                });
+            } else {
+                const bool last = i + 1 == arms.size();
+                const std::string next_label = !last
+                                                   ? create_label(arms[i + 1].expr != nullptr ? "elif" : "else",
+                                                                  arms[i + 1].line)
+                                                   : m_options.instrument
+                                                         ? create_label("if_none", line)
+                                                         : end_label;
+                gen_cond_jump(arm.expr, false, next_label);
+                count(arm.line, "taken");
+                gen_scope(arm.scope);
+                if (next_label != end_label) {
+                    m_output << "    jmp " << end_label << "\n";
+                    m_output << next_label << ":\n";
+                }
+            }
+            reaching -= arm.taken;
+        }
+        if (!has_else) {
+            count(line, "not-taken");
+        }
+        m_output << end_label << ":\n";
+        m_output << "    ;; /if\n";
+        return true;
+    }
+
+    // Generates into the out-of-line code that gen_epilogue places after the
+    // function bodies, starting at `line`.
+    template<typename Gen>
+    void gen_cold(const int line, const Gen &gen) {
+        std::stringstream output;
+        std::swap(m_output, output);
+        const int current_line = std::exchange(m_current_line, 0);
+        set_line(line);
+        gen();
+        m_current_line = current_line;
+        std::swap(m_output, output);
+        m_cold += output.str();
+    }
+
     void gen_stmt(const NodeStmt *stmt) {
         struct StmtVisitor {
             Generator &gen;
+            int line;
 
             void operator()(const NodeStmtExit *stmt_exit) const {
                 gen.m_output << "    ;; exit\n";
-                gen.gen_expr(stmt_exit->expr);
-                gen.m_output << "    mov rax, 60\n";
-                gen.pop("rdi");
-                gen.m_output << "    syscall\n";
+                gen.gen_into("rdi", stmt_exit->expr);
+                gen.gen_exit();
                 gen.m_output << "    ;; /exit\n";
             }
 
             void operator()(const NodeStmtLet *stmt_let) const {
                 gen.m_output << "    ;; let\n";
-                if (std::ranges::find_if(
-                        std::as_const(gen.m_vars),
-                        [&](const Var &var) { return var.name == stmt_let->ident.value.value(); })
-                    != gen.m_vars.cend()) {
-                    std::cerr << "Identifier already used: " << stmt_let->ident.value.value() << std::endl;
-                    exit(EXIT_FAILURE);
-                }
-                gen.m_vars.push_back({.name = stmt_let->ident.value.value(), .stack_loc = gen.m_stack_size});
+                gen.declare_var(stmt_let->ident);
+                const auto init = int_literal(stmt_let->expr);
+                gen.m_vars.push_back({
+                    .name = stmt_let->ident.value.value(),
+                    .stack_loc = gen.m_stack_size,
+                    .non_negative = init.has_value() && init.value() >= 0,
+                });
                 gen.gen_expr(stmt_let->expr);
                 gen.m_output << "    ;; /let\n";
             }
 
             void operator()(const NodeStmtAssign *stmt_assign) const {
-                const auto it = std::ranges::find_if(gen.m_vars, [&](const Var &var) {
-                    return var.name == stmt_assign->ident.value.value();
-                });
-                if (it == gen.m_vars.end()) {
-                    std::cerr << "Undeclared identifier: " << stmt_assign->ident.value.value() << std::endl;
-                    exit(EXIT_FAILURE);
+                Var &var = gen.lookup_var(stmt_assign->ident, false);
+                // Range facts are only ever dropped, never re-established by an
+                // assignment, so they stay valid whichever branch ran before.
+                const auto k = increment(stmt_assign);
+                if (!k.has_value() || !increment_fits(var.upper_bound, k.value())) {
+                    var.non_negative = false;
+                }
+                var.upper_bound.reset();
+                gen.gen_store("QWORD " + gen.var_slot(var), stmt_assign->expr);
+            }
+
+            void operator()(const NodeStmtLetArray *stmt_let) const {
+                gen.m_output << "    ;; let array\n";
+                gen.declare_var(stmt_let->ident);
+                const int64_t length = stmt_let->size.int_value;
+                size_t n = 1;
+                const bool valid = length > 0 && length <= max_array_length;
+                if (!valid) {
+                    gen.error(stmt_let->size, "Invalid array length: " + stmt_let->size.value.value());
+                } else {
+                    n = static_cast<size_t>(length);
+                }
+                gen.m_vars.push_back({.name = stmt_let->ident.value.value(), .stack_loc = gen.m_stack_size, .length = n,
+                                      .valid_length = valid});
+                // elements are zeroed; element i lives at [rsp + i * 8] right after this
+                if (n <= 4) {
+                    for (size_t i = 0; i < n; i++) {
+                        gen.m_output << "    push 0\n";
+                    }
+                } else {
+                    gen.m_output << "    sub rsp, " << n * 8 << "\n";
+                    gen.m_output << "    mov rdi, rsp\n";
+                    gen.m_output << "    mov rcx, " << n << "\n";
+                    gen.m_output << "    xor eax, eax\n";
+                    gen.m_output << "    rep stosq\n";
+                }
+                gen.m_stack_size += n;
+                gen.m_output << "    ;; /let array\n";
+            }
+
+            void operator()(const NodeStmtAssignIndex *stmt_assign) const {
+                const Var &array = gen.lookup_var(stmt_assign->ident, true);
+                // the value goes first unless it has no side effects or the index needs no code
+                if (gen.is_leaf(stmt_assign->expr)) {
+                    const ElementRef element = gen.gen_index(array, stmt_assign->index);
+                    gen.gen_store("QWORD " + gen.element_slot(array, element), stmt_assign->expr, "rbx");
+                } else if (int_literal(stmt_assign->index).has_value()) {
+                    gen.gen_into_rax(stmt_assign->expr);
+                    const ElementRef element = gen.gen_index(array, stmt_assign->index);
+                    gen.m_output << "    mov " << gen.element_slot(array, element) << ", rax\n";
+                } else {
+                    gen.gen_expr(stmt_assign->expr);
+                    const ElementRef element = gen.gen_index(array, stmt_assign->index);
+                    gen.pop("rbx");
+                    gen.m_output << "    mov " << gen.element_slot(array, element) << ", rbx\n";
                 }
-                gen.gen_expr(stmt_assign->expr);
-                gen.pop("rax");
-                gen.m_output << "    mov [rsp + " << (gen.m_stack_size - it->stack_loc - 1) * 8 << "], rax\n";
             }
 
             void operator()(const NodeScope *scope) const {
@@ -255,44 +819,128 @@ public:
             }
 
             void operator()(const NodeStmtIf *stmt_if) const {
+                if (gen.gen_if_switch(stmt_if, line)) {
+                    return;
+                }
+                if (!gen.m_options.profile.empty() && gen.gen_if_profiled(stmt_if, line)) {
+                    return;
+                }
                 gen.m_output << "    ;; if\n";
-                gen.gen_expr(stmt_if->expr);
-                gen.pop("rax");
-                const std::string label = gen.create_label();
-                gen.m_output << "    test rax, rax\n";
-                gen.m_output << "    jz " << label << "\n";
+                gen.m_output << gen.create_label("if", line) << ":\n";
+                const std::string end_label = gen.create_label("if_end", line);
+                const std::string label = stmt_if->pred.has_value()
+                                              ? gen.create_pred_label(stmt_if->pred.value())
+                                              : gen.m_options.instrument
+                                                    ? gen.create_label("if_none", line)
+                                                    : end_label;
+                gen.gen_cond_jump(stmt_if->expr, false, label);
+                gen.count(line, "taken");
                 gen.gen_scope(stmt_if->scope);
                 if (stmt_if->pred.has_value()) {
-                    const std::string end_label = gen.create_label();
                     gen.m_output << "    jmp " << end_label << "\n";
                     gen.m_output << label << ":\n";
-                    gen.gen_if_pred(stmt_if->pred.value(), end_label);
-                    gen.m_output << end_label << ":\n";
-                } else {
+                    gen.gen_if_pred(stmt_if->pred.value(), end_label, line);
+                } else if (gen.m_options.instrument) {
+                    gen.m_output << "    jmp " << end_label << "\n";
                     gen.m_output << label << ":\n";
+                    gen.count(line, "not-taken");
                 }
+                gen.m_output << end_label << ":\n";
                 gen.m_output << "    ;; /if\n";
             }
 
             //code generation for while loop
             void operator()(const NodeStmtWhile *stmt_while) const {
                 gen.m_output << "    ;; while\n";
+                // Facts about variables the body assigns only hold on the first
+                // iteration. Increments keep a variable non-negative only if it is
+                // the counter, whose bound keeps them all from overflowing.
+                const auto bound = loop_bound(stmt_while->condition);
+                Assigned assigned;
+                collect_assigned(stmt_while->scope->stmts, assigned);
+                for (Var &var: gen.m_vars) {
+                    if (assigned.all.contains(var.name)) {
+                        var.upper_bound.reset();
+                    }
+                    if (assigned.not_increment.contains(var.name)) {
+                        var.non_negative = false;
+                    }
+                    if (const auto sum = assigned.increments.find(var.name); sum != assigned.increments.end()
+                        && (!bound.has_value() || bound->first != var.name
+                            || !increment_fits(bound->second, sum->second))) {
+                        var.non_negative = false;
+                    }
+                }
+                // a `parallel while` inside the body of another runs on its thread
+                if (stmt_while->parallel && !gen.m_parallel_base.has_value()) {
+                    gen.gen_parallel_while(stmt_while, line);
+                    return;
+                }
+                if (bound.has_value()) {
+                    gen.try_vectorize(stmt_while, bound->first, bound->second, line);
+                }
+
+                // Inside the body `i < K` holds until `i` is assigned.
+                Var *induction = bound.has_value() ? gen.find_var(bound->first) : nullptr;
+                const auto gen_body = [&] {
+                    if (induction != nullptr && !induction->is_array()) {
+                        induction->upper_bound = bound->second;
+                    }
+                    gen.count(line, "loop");
+                    gen.gen_scope(stmt_while->scope);
+                    if (induction != nullptr) {
+                        induction->upper_bound.reset();
+                    }
+                };
+
+                // Every copy runs a whole iteration that the original condition
+                // would have allowed, the plain loop below picks up the rest.
+                if (stmt_while->unroll > 1) {
+                    const std::string unrolled_label = gen.create_label("while_unrolled", line);
+                    const std::string unrolled_end = gen.create_label("while_unrolled_end", line);
+                    gen.m_output << unrolled_label << ":\n";
+                    gen.gen_cond_jump(stmt_while->unrolled_condition, false, unrolled_end);
+                    for (size_t copy = 0; copy < stmt_while->unroll; copy++) {
+                        gen_body();
+                    }
+                    gen.set_line(line);
+                    gen.m_output << "    jmp " << unrolled_label << "\n";
+                    gen.m_output << unrolled_end << ":\n";
+                }
+
                 // Create unique labels for the beginning and exit of the loop
-                std::string start_label = gen.create_label();
-                std::string exit_label = gen.create_label();
+                std::string start_label = gen.create_label("while", line);
+                std::string exit_label = gen.create_label("while_end", line);
+
+                // A loop the profile saw iterate is rotated: entered at a test at
+                // the bottom, so that an iteration takes one branch instead of two.
+                if (gen.m_options.profile.count(line, "loop") > 0) {
+                    const std::string test_label = gen.create_label("while_test", line);
+                    std::stringstream test;
+                    std::swap(gen.m_output, test);
+                    gen.gen_cond_jump(stmt_while->condition, true, start_label);
+                    std::swap(gen.m_output, test);
+                    gen.m_output << "    jmp " << test_label << "\n";
+                    gen.m_output << start_label << ":\n";
+                    gen_body();
+                    gen.set_line(line);
+                    gen.m_output << test_label << ":\n";
+                    gen.m_output << test.str();
+                    gen.m_output << exit_label << ":\n";
+                    gen.m_output << "    ;; /while\n";
+                    return;
+                }
 
                 // Emit loop start label
                 gen.m_output << start_label << ":\n";
                 // Generate code for the loop condition
-                gen.gen_expr(stmt_while->condition);
-                gen.pop("rax");
-                gen.m_output << "    cmp rax, 0\n";
                 // Exit loop if condition false (zero)
-                gen.m_output << "    je " << exit_label << "\n";
+                gen.gen_cond_jump(stmt_while->condition, false, exit_label);
 
                 // Generate code for the loop body (scope)
-                gen.gen_scope(stmt_while->scope);
+                gen_body();
                 // Jump back to the beginning of the loop
+                gen.set_line(line);
                 gen.m_output << "    jmp " << start_label << "\n";
                 // Emit loop exit label
                 gen.m_output << exit_label << ":\n";
@@ -301,97 +949,1920 @@ public:
 
             //code generation for print statement
             void operator()(const NodeStmtPrint *stmt_print) const {
+                // `print(a)` on an array prints every element with a single runtime call
+                if (const Var *array = gen.array_operand(stmt_print->expr)) {
+                    gen.m_output << "    ;; print array\n";
+                    gen.gen_array_call("print_ints", *array);
+                    gen.m_output << "    ;; /print array\n";
+                    return;
+                }
                 gen.m_output << "    ;; print\n";
-                // Evaluate the expression (result is pushed onto the stack)
-                gen.gen_expr(stmt_print->expr);
-                gen.pop("rax"); // Retrieve evaluated result from the stack
-                // Use an external function to print the integer.
-                // This function (print_int) must be defined externally (in assembly or C) and linked.
-                gen.m_output << "    mov rdi, rax\n";
-                gen.m_output << "    call print_int\n";
+                // print_int from io.asm takes the value in rdi
+                gen.gen_into("rdi", stmt_print->expr);
+                gen.call_runtime("print_int");
                 gen.m_output << "    ;; /print\n";
             }
 
+            void operator()(const NodeStmtPrintText *stmt_print) const {
+                gen.m_output << "    ;; print text\n";
+                gen.m_output << "    lea rdi, [rel " << gen.text_label(stmt_print->text) << "]\n";
+                gen.m_output << "    mov rsi, " << stmt_print->text.size() << "\n";
+                gen.call_runtime("print_text");
+                gen.m_output << "    ;; /print text\n";
+            }
+
+            void operator()(const NodeStmtFn *stmt_fn) const {
+                if (gen.m_current_fn != nullptr || !gen.m_scopes.empty()) {
+                    gen.error(stmt_fn->name,
+                              "Functions can only be declared at the top level: " + stmt_fn->name.value.value());
+                    return;
+                }
+                // the body is emitted after the main program
+                gen.m_output << "    ;; fn " << stmt_fn->name.value.value() << "\n";
+            }
+
+            void operator()(const NodeStmtReturn *stmt_return) const {
+                if (gen.m_current_fn == nullptr) {
+                    gen.error("`return` outside of a function");
+                    return;
+                }
+                gen.m_output << "    ;; return\n";
+                // A self-recursive call in tail position reuses the current frame:
+                // the new arguments go to their registers and we jump back to the entry.
+                if (const auto tail_call = gen.self_tail_call(stmt_return->expr)) {
+                    for (const NodeExpr *arg: tail_call.value()->args) {
+                        gen.gen_expr(arg);
+                    }
+                    gen.pop_args(tail_call.value()->args.size());
+                    if (gen.m_stack_size != 0) {
+                        gen.m_output << "    add rsp, " << gen.m_stack_size * 8 << "\n";
+                    }
+                    gen.m_output << "    jmp fn_" << gen.m_current_fn->name.value.value() << "\n";
+                    gen.m_output << "    ;; /return\n";
+                    return;
+                }
+                gen.gen_into_rax(stmt_return->expr);
+                gen.gen_ret();
+                gen.m_output << "    ;; /return\n";
+            }
+
+            void operator()(const NodeStmtCall *stmt_call) const {
+                gen.m_output << "    ;; call\n";
+                gen.gen_call(stmt_call->call);
+                gen.m_output << "    ;; /call\n";
+            }
+
             //code generator for input statement
             void operator()(const NodeStmtInput *stmt_input) const {
+                if (Var *array = gen.find_var(stmt_input->ident.value.value()); array != nullptr && array->is_array()) {
+                    gen.m_output << "    ;; input array\n";
+                    gen.gen_array_call("input_ints", *array);
+                    gen.m_output << "    ;; /input array\n";
+                    return;
+                }
                 gen.m_output << "    ;; input\n";
                 // Call an external function input_int which reads an integer from STDIN,
                 // returning the result in rax.
-                gen.m_output << "    call input_int\n";
+                gen.call_runtime("input_int");
                 // Now, store the result in the variable's location.
-                const auto it = std::ranges::find_if(gen.m_vars, [&](const Generator::Var &var) {
-                    return var.name == stmt_input->ident.value.value();
-                });
-                if (it == gen.m_vars.cend()) {
-                    std::cerr << "Undeclared identifier in input: " << stmt_input->ident.value.value() << std::endl;
-                    exit(EXIT_FAILURE);
-                }
-                // Assuming variable address is [rsp + (offset calculation)]
-                gen.m_output << "    mov [rsp + " << (gen.m_stack_size - it->stack_loc - 1) * 8 << "], rax\n";
+                Var &var = gen.lookup_var(stmt_input->ident, false);
+                var.non_negative = false;
+                var.upper_bound.reset();
+                gen.m_output << "    mov " << gen.var_slot(var) << ", rax\n";
                 gen.m_output << "    ;; /input\n";
             }
         };
 
-        StmtVisitor visitor{.gen = *this};
+        set_line(stmt->line);
+        m_stmt_line = stmt->line;
+        m_stmt_column = stmt->column;
+        StmtVisitor visitor{.gen = *this, .line = stmt->line};
         std::visit(visitor, stmt->var);
     }
 
+    // Only the io.asm routines the program calls are declared, see runtime_externs.
     [[nodiscard]] std::string gen_prog() {
-        m_output<<"extern print_int\nextern input_int\n";
-        m_output << "global _start\n_start:\n";
-
+        gen_prologue();
         for (const NodeStmt *stmt: m_prog.stmts) {
-            gen_stmt(stmt);
+            if (const auto fn = std::get_if<NodeStmtFn *>(&stmt->var)) {
+                declare_fn(*fn);
+            }
+        }
+        for (const NodeStmt *stmt: m_prog.stmts) {
+            gen_top_stmt(stmt);
         }
+        gen_epilogue();
+        return runtime_externs(m_runtime_used) + m_output.str();
+    }
 
-        m_output << "    mov rax, 60\n";
-        m_output << "    mov rdi, 0\n";
-        m_output << "    syscall\n";
-        return m_output.str();
+    // Streaming compilation for a parser that hands over one top-level statement
+    // at a time: begin_stream(), gen_stream_stmt() for every statement, then
+    // end_stream(). Only function declarations are referred to afterwards, so the
+    // nodes of any other statement can be released once it has been generated.
+    // Calls to functions declared further down are checked at the end and are
+    // never inlined.
+    void begin_stream() {
+        m_streaming = true;
+        // the routines used are not known yet
+        m_output << runtime_externs({runtime_routines.begin(), runtime_routines.end()});
+        gen_prologue();
+    }
+
+    void gen_stream_stmt(const NodeStmt *stmt) {
+        if (const auto fn = std::get_if<NodeStmtFn *>(&stmt->var)) {
+            declare_fn(*fn);
+        }
+        gen_top_stmt(stmt);
+    }
+
+    // The rest of the assembly: the exit, the function bodies and the data section.
+    [[nodiscard]] std::string end_stream() {
+        for (const auto &[name, num_args]: m_forward_calls) {
+            const auto it = m_functions.find(name.value.value());
+            if (it == m_functions.end()) {
+                error(name, "Undeclared function: " + name.value.value());
+            } else if (it->second->params.size() != num_args) {
+                error(name, "Function " + name.value.value() + " expects "
+                            + std::to_string(it->second->params.size()) + " arguments, got "
+                            + std::to_string(num_args));
+            }
+        }
+        gen_epilogue();
+        return take_output();
+    }
+
+    // The assembly written since the last call, so that a stream can be written
+    // out as it is produced.
+    [[nodiscard]] std::string take_output() {
+        std::string text = m_output.str();
+        m_output.str({});
+        return text;
     }
 
 private:
-    void push(const std::string &reg) {
-        m_output << "    push " << reg << "\n";
-        m_stack_size++;
+    struct Var {
+        std::string name;
+        size_t stack_loc;
+        size_t length = 0; // number of elements for arrays, 0 for scalars
+        // Range facts used to drop array bounds checks. They are only set where a
+        // `let` or a loop condition proves them and are cleared on any doubt.
+        bool non_negative = false;
+        std::optional<int64_t> upper_bound{}; // exclusive
+        // false for an array declared with a length out of range, which has one
+        // element so that the rest of the program can still be generated
+        bool valid_length = true;
+
+        [[nodiscard]] bool is_array() const {
+            return length != 0;
+        }
+    };
+
+    static constexpr std::array<const char *, 6> arg_regs = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
+    // arrays live in the stack frame, keep them well below the default 8 mb stack limit
+    static constexpr int64_t max_array_length = 1 << 19;
+    // if/elif chains on one variable with this many tests become a jump table
+    // or a binary search, see gen_if_switch
+    static constexpr size_t min_switch_tests = 4;
+    static constexpr uint64_t max_jump_table_entries = 1024;
+
+    [[nodiscard]] static std::optional<int64_t> int_literal(const NodeExpr *expr) {
+        const auto term = std::get_if<NodeTerm *>(&expr->var);
+        if (term == nullptr) {
+            return {};
+        }
+        if (const auto paren = std::get_if<NodeTermParen *>(&(*term)->var)) {
+            return int_literal((*paren)->expr);
+        }
+        const auto int_lit = std::get_if<NodeTermIntLit *>(&(*term)->var);
+        if (int_lit == nullptr) {
+            return {};
+        }
+        return (*int_lit)->int_lit.int_value;
     }
 
-    void pop(const std::string &reg) {
-        m_output << "    pop " << reg << "\n";
-        m_stack_size--;
+    // The token of an expression int_literal found a value in.
+    [[nodiscard]] static const Token &literal_token(const NodeExpr *expr) { // NOLINT(*-no-recursion)
+        const NodeTerm *term = std::get<NodeTerm *>(expr->var);
+        if (const auto paren = std::get_if<NodeTermParen *>(&term->var)) {
+            return literal_token((*paren)->expr);
+        }
+        return std::get<NodeTermIntLit *>(term->var)->int_lit;
     }
 
-    void begin_scope() {
-        m_scopes.push_back(m_vars.size());
+    [[nodiscard]] static std::optional<std::string> ident_name(const NodeExpr *expr) {
+        const auto term = std::get_if<NodeTerm *>(&expr->var);
+        if (term == nullptr) {
+            return {};
+        }
+        const auto ident = std::get_if<NodeTermIdent *>(&(*term)->var);
+        if (ident == nullptr) {
+            return {};
+        }
+        return (*ident)->ident.value.value();
     }
 
-    void end_scope() {
-        const size_t pop_count = m_vars.size() - m_scopes.back();
-        if (pop_count != 0) {
-            m_output << "    add rsp, " << pop_count * 8 << "\n";
+    // k of `x = x + k` for a literal k >= 0.
+    [[nodiscard]] static std::optional<int64_t> increment(const NodeStmtAssign *assign) {
+        const auto bin_expr = std::get_if<NodeBinExpr *>(&assign->expr->var);
+        if (bin_expr == nullptr) {
+            return {};
         }
-        m_stack_size -= pop_count;
-        for (size_t i = 0; i < pop_count; i++) {
-            m_vars.pop_back();
+        const auto add = std::get_if<NodeBinExprAdd *>(&(*bin_expr)->var);
+        if (add == nullptr || ident_name((*add)->lhs) != assign->ident.value.value()) {
+            return {};
         }
-        m_scopes.pop_back();
+        const auto k = int_literal((*add)->rhs);
+        if (!k.has_value() || k.value() < 0) {
+            return {};
+        }
+        return k;
     }
 
-    std::string create_label() {
-        std::stringstream ss;
-        ss << "label" << m_label_count++;
-        return ss.str();
+    // `x = x + k` for a literal k >= 0, or exactly `step` if given.
+    [[nodiscard]] static bool is_increment(const NodeStmtAssign *assign, const std::optional<int64_t> step = {}) {
+        const auto k = increment(assign);
+        return k.has_value() && (!step.has_value() || k == step);
     }
 
-    struct Var {
-        std::string name;
-        size_t stack_loc;
+    // Whether x + k, for 0 <= k, cannot wrap around given x < `bound`. Without
+    // a bound an increment may turn a non-negative variable negative.
+    [[nodiscard]] static bool increment_fits(const std::optional<int64_t> bound, const int64_t k) {
+        return bound.has_value() && bound.value() <= INT64_MAX - k;
+    }
+
+    // `i < K`, `i <= K`, `K > i` or `K >= i` for a literal K, as the counter and
+    // its exclusive upper bound.
+    [[nodiscard]] static std::optional<std::pair<std::string, int64_t>> loop_bound(const NodeExpr *condition) {
+        const auto bin_expr = std::get_if<NodeBinExpr *>(&condition->var);
+        if (bin_expr == nullptr) {
+            return {};
+        }
+        const auto bound = [](const NodeExpr *counter, const NodeExpr *limit, const int64_t inclusive)
+            -> std::optional<std::pair<std::string, int64_t>> {
+            const auto name = ident_name(counter);
+            const auto k = int_literal(limit);
+            if (!name.has_value() || !k.has_value() || k.value() == INT64_MAX) {
+                return {};
+            }
+            return std::pair(name.value(), k.value() + inclusive);
+        };
+        if (const auto less = std::get_if<NodeBinExprLess *>(&(*bin_expr)->var)) {
+            return bound((*less)->lhs, (*less)->rhs, 0);
+        }
+        if (const auto less_eq = std::get_if<NodeBinExprLessEq *>(&(*bin_expr)->var)) {
+            return bound((*less_eq)->lhs, (*less_eq)->rhs, 1);
+        }
+        if (const auto greater = std::get_if<NodeBinExprGreater *>(&(*bin_expr)->var)) {
+            return bound((*greater)->rhs, (*greater)->lhs, 0);
+        }
+        if (const auto greater_eq = std::get_if<NodeBinExprGreaterEq *>(&(*bin_expr)->var)) {
+            return bound((*greater_eq)->rhs, (*greater_eq)->lhs, 1);
+        }
+        return {};
+    }
+
+    struct Assigned {
+        std::set<std::string> all;
+        // assigned other than by increments, or by increments in nested loops
+        std::set<std::string> not_increment;
+        // sum of the other increments, how far one pass can move the variable
+        std::map<std::string, int64_t> increments;
     };
 
+    // Scalars assigned anywhere in `stmts`, including nested blocks.
+    static void collect_assigned(const std::vector<NodeStmt *> &stmts, Assigned &assigned, // NOLINT(*-no-recursion)
+                                 const bool in_loop = false) {
+        struct AssignedVisitor {
+            Assigned &assigned;
+            bool in_loop;
+
+            void operator()(const NodeStmtAssign *stmt_assign) const {
+                const std::string &name = stmt_assign->ident.value.value();
+                assigned.all.insert(name);
+                const auto k = increment(stmt_assign);
+                if (!k.has_value() || in_loop) {
+                    assigned.not_increment.insert(name);
+                    return;
+                }
+                int64_t &sum = assigned.increments[name];
+                sum = k.value() > INT64_MAX - sum ? INT64_MAX : sum + k.value();
+            }
+
+            void operator()(const NodeStmtInput *stmt_input) const {
+                assigned.all.insert(stmt_input->ident.value.value());
+                assigned.not_increment.insert(stmt_input->ident.value.value());
+            }
+
+            void operator()(const NodeScope *scope) const {
+                collect_assigned(scope->stmts, assigned, in_loop);
+            }
+
+            void operator()(const NodeStmtIf *stmt_if) const {
+                collect_assigned(stmt_if->scope->stmts, assigned, in_loop);
+                std::optional<NodeIfPred *> pred = stmt_if->pred;
+                while (pred.has_value()) {
+                    if (const auto elif = std::get_if<NodeIfPredElif *>(&pred.value()->var)) {
+                        collect_assigned((*elif)->scope->stmts, assigned, in_loop);
+                        pred = (*elif)->pred;
+                    } else {
+                        collect_assigned(std::get<NodeIfPredElse *>(pred.value()->var)->scope->stmts, assigned,
+                                         in_loop);
+                        pred.reset();
+                    }
+                }
+            }
+
+            void operator()(const NodeStmtWhile *stmt_while) const {
+                collect_assigned(stmt_while->scope->stmts, assigned, true);
+            }
+
+            void operator()(const NodeStmtExit *) const {
+            }
+
+            void operator()(const NodeStmtLet *) const {
+            }
+
+            void operator()(const NodeStmtPrint *) const {
+            }
+
+            void operator()(const NodeStmtFn *) const {
+            }
+
+            void operator()(const NodeStmtReturn *) const {
+            }
+
+            void operator()(const NodeStmtCall *) const {
+            }
+
+            void operator()(const NodeStmtLetArray *) const {
+            }
+
+            void operator()(const NodeStmtAssignIndex *) const {
+            }
+
+            void operator()(const NodeStmtPrintText *) const {
+            }
+        };
+
+        for (const NodeStmt *stmt: stmts) {
+            std::visit(AssignedVisitor{.assigned = assigned, .in_loop = in_loop}, stmt->var);
+        }
+    }
+
+    // Entry points of io.asm. Each lives in sections of its own there, so the
+    // linker leaves out the ones no `extern` here leads to, see genesis_link_flags.
+    static constexpr std::array<const char *, 8> runtime_routines = {
+        "print_int", "input_int", "print_ints", "input_ints", "prof_dump", "bounds_fail", "print_text", "par_for",
+    };
+
+    static std::string runtime_externs(const std::set<std::string> &routines) {
+        std::string externs;
+        for (const std::string &routine: routines) {
+            externs += "extern " + routine + "\n";
+        }
+        return externs;
+    }
+
+    void gen_prologue() {
+        m_output << "global _start\n_start:\n";
+    }
+
+    // The top level is one statement list, see gen_stmts. Function bodies are
+    // emitted after the main program.
+    void gen_top_stmt(const NodeStmt *stmt) {
+        if (m_num_top_stmts++ == 0) {
+            count(stmt->line, "block");
+        } else if (m_block_start) {
+            set_line(stmt->line);
+            count(stmt->line, "block");
+        }
+        gen_stmt(stmt);
+        m_block_start = std::holds_alternative<NodeStmtIf *>(stmt->var)
+                        || std::holds_alternative<NodeStmtWhile *>(stmt->var);
+        if (const auto fn = std::get_if<NodeStmtFn *>(&stmt->var)) {
+            m_top_fns.emplace_back(*fn, stmt->line);
+        }
+    }
+
+    void gen_epilogue() {
+        m_output << "    mov rdi, 0\n";
+        gen_exit();
+
+        for (const auto &[fn, line]: m_top_fns) {
+            gen_fn(fn, line);
+        }
+        m_output << m_cold;
+        m_output << m_parallel_bodies;
+
+        if (m_options.instrument) {
+            gen_profile_runtime();
+        }
+        if (!m_jump_tables.empty()) {
+            m_output << "section .rodata\n";
+            m_output << "align 8\n";
+            m_output << m_jump_tables;
+        }
+        if (!m_texts.empty()) {
+            m_output << "section .data\n";
+            for (size_t i = 0; i < m_texts.size(); i++) {
+                m_output << "text_" << i << ": db ";
+                for (size_t c = 0; c < m_texts[i].size(); c++) {
+                    m_output << (c == 0 ? "" : ",") << static_cast<int>(static_cast<unsigned char>(m_texts[i][c]));
+                }
+                m_output << "\n";
+            }
+        }
+    }
+
+    void declare_fn(const NodeStmtFn *fn) {
+        const std::string &name = fn->name.value.value();
+        if (!m_functions.try_emplace(name, fn).second) {
+            error(fn->name, "Function already declared: " + name);
+        }
+        if (fn->params.size() > arg_regs.size()) {
+            error(fn->name, "Function " + name + " takes more than " + std::to_string(arg_regs.size()) + " parameters");
+        }
+    }
+
+    // The callee spills its register arguments into ordinary stack slots on entry,
+    // so from then on parameters are addressed exactly like `let` variables.
+    void gen_fn(const NodeStmtFn *fn, const int line) {
+        const std::string &name = fn->name.value.value();
+        std::vector<Var> outer_vars = std::exchange(m_vars, {});
+        std::vector<size_t> outer_scopes = std::exchange(m_scopes, {});
+        const size_t outer_stack_size = std::exchange(m_stack_size, 0);
+        m_current_fn = fn;
+
+        set_line(line);
+        m_output << "fn_" << name << ":\n";
+        count(line, "block");
+        for (size_t i = 0; i < std::min(fn->params.size(), arg_regs.size()); i++) {
+            const std::string &param = fn->params[i].value.value();
+            if (std::ranges::find(m_vars, param, &Var::name) != m_vars.end()) {
+                error(fn->params[i], "Identifier already used: " + param);
+            }
+            m_vars.push_back({.name = param, .stack_loc = m_stack_size});
+            push(arg_regs[i]);
+        }
+        gen_scope(fn->scope);
+        // falling off the end returns 0
+        m_output << "    mov rax, 0\n";
+        gen_ret();
+
+        m_current_fn = nullptr;
+        m_vars = std::move(outer_vars);
+        m_scopes = std::move(outer_scopes);
+        m_stack_size = outer_stack_size;
+    }
+
+    // Returns from the current function with the result already in rax. The frame is
+    // dropped without touching m_stack_size, since code after a `return` is still
+    // compiled against the same layout.
+    void gen_ret() {
+        if (m_stack_size != 0) {
+            m_output << "    add rsp, " << m_stack_size * 8 << "\n";
+        }
+        m_output << "    ret\n";
+    }
+
+    // Moves the top `count` stack values into the argument registers, last argument on top.
+    void pop_args(const size_t count) {
+        for (size_t i = count; i > 0; i--) {
+            pop(arg_regs[i - 1]);
+        }
+    }
+
+    [[nodiscard]] std::optional<const NodeTermCall *> self_tail_call(const NodeExpr *expr) const {
+        const auto term = std::get_if<NodeTerm *>(&expr->var);
+        if (term == nullptr) {
+            return {};
+        }
+        const auto call = std::get_if<NodeTermCall *>(&(*term)->var);
+        if (call == nullptr || (*call)->name.value.value() != m_current_fn->name.value.value()
+            || (*call)->args.size() != m_current_fn->params.size()) {
+            return {};
+        }
+        return *call;
+    }
+
+    // The returned expression of `fn` if it is small enough to expand at call sites.
+    [[nodiscard]] std::optional<const NodeExpr *> inline_body(const NodeStmtFn *fn) const {
+        if (fn->scope->stmts.size() != 1) {
+            return {};
+        }
+        const auto ret = std::get_if<NodeStmtReturn *>(&fn->scope->stmts.front()->var);
+        if (ret == nullptr) {
+            return {};
+        }
+        const ExprInfo info = expr_info((*ret)->expr, fn->name.value.value());
+        if (info.calls_self || info.size > m_options.inline_threshold) {
+            return {};
+        }
+        return (*ret)->expr;
+    }
+
+    struct ExprInfo {
+        size_t size = 0;
+        bool calls_self = false;
+    };
+
+    static ExprInfo expr_info(const NodeExpr *expr, const std::string &fn_name) { // NOLINT(*-no-recursion)
+        struct InfoVisitor {
+            const std::string &fn_name;
+            ExprInfo &info;
+
+            void operator()(const NodeTerm *term) const {
+                info.size++;
+                std::visit(*this, term->var);
+            }
+
+            void operator()(const NodeBinExpr *bin_expr) const {
+                info.size++;
+                std::visit([&](const auto *bin) {
+                    add(expr_info(bin->lhs, fn_name));
+                    add(expr_info(bin->rhs, fn_name));
+                }, bin_expr->var);
+            }
+
+            void operator()(const NodeTermIntLit *) const {
+            }
+
+            void operator()(const NodeTermIdent *) const {
+            }
+
+            void operator()(const NodeTermParen *term_paren) const {
+                add(expr_info(term_paren->expr, fn_name));
+            }
+
+            void operator()(const NodeTermIndex *term_index) const {
+                add(expr_info(term_index->index, fn_name));
+            }
+
+            void operator()(const NodeTermCall *term_call) const {
+                info.calls_self |= term_call->name.value.value() == fn_name;
+                for (const NodeExpr *arg: term_call->args) {
+                    add(expr_info(arg, fn_name));
+                }
+            }
+
+            void add(const ExprInfo &other) const {
+                info.size += other.size;
+                info.calls_self |= other.calls_self;
+            }
+        };
+
+        ExprInfo info;
+        std::visit(InfoVisitor{.fn_name = fn_name, .info = info}, expr->var);
+        return info;
+    }
+
+    // exit status in rdi; exit_group, so that threads of `parallel while` loops end too
+    void gen_exit() {
+        if (m_options.instrument) {
+            m_output << "    jmp gn_prof_exit\n";
+        } else {
+            m_output << "    mov rax, 231\n";
+            m_output << "    syscall\n";
+        }
+    }
+
+    // Bumps the execution counter for (`line`, `kind`) when instrumenting. Code
+    // that may run on several threads at once, the bodies of parallel loops and
+    // the functions they can call, bumps it atomically.
+    void count(const int line, const std::string &kind) {
+        if (!m_options.instrument) {
+            return;
+        }
+        const auto [it, inserted] = m_profile_slots.try_emplace({line, kind}, m_profile_slots.size());
+        if (inserted) {
+            m_profile_sites.emplace_back(line, kind);
+        }
+        const bool shared = m_parallel_base.has_value() || m_current_fn != nullptr;
+        m_output << (shared ? "    lock inc" : "    inc") << " QWORD [rel gn_prof_counts + " << it->second * 8 << "]\n";
+    }
+
+    // The counter table and the exit hook that hands it to prof_dump in io.asm.
+    void gen_profile_runtime() {
+        m_output << "gn_prof_exit:\n";
+        m_output << "    push rdi\n";
+        m_output << "    lea rdi, [rel gn_prof_sites]\n";
+        m_output << "    lea rsi, [rel gn_prof_counts]\n";
+        m_output << "    mov rdx, " << m_profile_sites.size() << "\n";
+        m_output << "    lea rcx, [rel gn_prof_path]\n";
+        call_runtime("prof_dump");
+        m_output << "    pop rdi\n";
+        m_output << "    mov rax, 231\n";
+        m_output << "    syscall\n";
+
+        m_output << "section .data\n";
+        // as numbers, like the texts: the path may hold quotes or bytes NASM would not take
+        m_output << "gn_prof_path: db ";
+        for (const char c: m_options.profile_path) {
+            m_output << static_cast<int>(static_cast<unsigned char>(c)) << ",";
+        }
+        m_output << "0\n";
+        for (size_t i = 0; i < m_profile_sites.size(); i++) {
+            m_output << "gn_prof_kind" << i << ": db \"" << m_profile_sites[i].second << "\"\n";
+        }
+        m_output << "align 8\n";
+        m_output << "gn_prof_sites:\n";
+        for (size_t i = 0; i < m_profile_sites.size(); i++) {
+            m_output << "    dq " << m_profile_sites[i].first << ", gn_prof_kind" << i << ", "
+                    << m_profile_sites[i].second.size() << "\n";
+        }
+        m_output << "section .bss\n";
+        m_output << "align 8\n";
+        m_output << "gn_prof_counts: resq " << std::max<size_t>(m_profile_sites.size(), 1) << "\n";
+    }
+
+    void push(const std::string &reg) {
+        m_output << "    push " << reg << "\n";
+        m_stack_size++;
+    }
+
+    void pop(const std::string &reg) {
+        m_output << "    pop " << reg << "\n";
+        m_stack_size--;
+    }
+
+    void begin_scope() {
+        m_scopes.push_back(m_vars.size());
+    }
+
+    void end_scope() {
+        const size_t pop_count = m_vars.size() - m_scopes.back();
+        size_t slot_count = 0;
+        for (size_t i = 0; i < pop_count; i++) {
+            slot_count += std::max<size_t>(m_vars.back().length, 1);
+            m_vars.pop_back();
+        }
+        if (slot_count != 0) {
+            m_output << "    add rsp, " << slot_count * 8 << "\n";
+        }
+        m_stack_size -= slot_count;
+        m_scopes.pop_back();
+    }
+
+    Var *find_var(const std::string &name) {
+        const auto it = std::ranges::find(m_vars, name, &Var::name);
+        return it == m_vars.end() ? nullptr : &*it;
+    }
+
+    Var &lookup_var(const Token &ident, const bool array) {
+        Var *var = find_var(ident.value.value());
+        if (var == nullptr) {
+            error(ident, "Undeclared identifier: " + ident.value.value());
+            return placeholder_var(ident, array);
+        }
+        if (var->is_array() != array) {
+            error(ident, (array ? "Not an array: " : "Array used as a value: ") + ident.value.value());
+            return placeholder_var(ident, array);
+        }
+        return *var;
+    }
+
+    // Stands in for a variable that could not be resolved, so that generation
+    // can go on looking for further errors.
+    Var &placeholder_var(const Token &ident, const bool array) {
+        m_placeholder = {.name = ident.value.value(), .stack_loc = 0, .length = array ? 1u : 0u};
+        return m_placeholder;
+    }
+
+    void declare_var(const Token &ident) const {
+        if (std::ranges::find(m_vars, ident.value.value(), &Var::name) != m_vars.cend()) {
+            error(ident, "Identifier already used: " + ident.value.value());
+        }
+    }
+
+    // Records an error and carries on, so that one run reports all of them.
+    // Tokens the optimizer made have no position, errors at them go to their statement.
+    void error(const Token &token, const std::string &message) const {
+        if (token.line == 0) {
+            error(message);
+        } else {
+            m_diagnostics.error(token.line, token.column, message);
+        }
+    }
+
+    // At the start of the statement being generated.
+    void error(const std::string &message) const {
+        m_diagnostics.error(m_stmt_line, m_stmt_column, message);
+    }
+
+    [[nodiscard]] std::string var_slot(const Var &var) const {
+        const auto [reg, top] = frame_of(var);
+        std::stringstream ss;
+        ss << "[" << reg << " + " << (top - var.stack_loc - 1) * 8 << "]";
+        return ss.str();
+    }
+
+    // The register `var` is addressed from and the stack size it is relative to.
+    // In the body of a parallel loop the variables from before the loop are in
+    // the frame of the thread that started it, which rbp points to.
+    [[nodiscard]] std::pair<const char *, size_t> frame_of(const Var &var) const {
+        if (m_parallel_base.has_value() && var.stack_loc < m_parallel_base.value()) {
+            return {"rbp", m_parallel_base.value()};
+        }
+        return {"rsp", m_stack_size};
+    }
+
+    // An element index known at compile time, or nullopt when it was left in rax.
+    using ElementRef = std::optional<size_t>;
+
+    // Evaluates an array index and checks it against the array length, unless the
+    // index is a literal or a loop counter whose range is already proven.
+    ElementRef gen_index(const Var &array, const NodeExpr *index) {
+        if (const auto literal = int_literal(index)) {
+            if (!array.valid_length) {
+                return 0;
+            }
+            if (literal.value() < 0 || static_cast<size_t>(literal.value()) >= array.length) {
+                error(literal_token(index), "Index " + std::to_string(literal.value()) + " out of bounds for "
+                                            + array.name + "[" + std::to_string(array.length) + "]");
+                return 0;
+            }
+            return static_cast<size_t>(literal.value());
+        }
+        gen_into_rax(index);
+        if (!index_in_bounds(array, index)) {
+            m_output << "    cmp rax, " << array.length << "\n";
+            m_output << "    jae bounds_fail\n";
+            m_runtime_used.insert("bounds_fail");
+        }
+        return {};
+    }
+
+    [[nodiscard]] bool index_in_bounds(const Var &array, const NodeExpr *index) {
+        const auto name = ident_name(index);
+        if (!name.has_value()) {
+            return false;
+        }
+        const Var *var = find_var(name.value());
+        return var != nullptr && !var->is_array() && var->non_negative && var->upper_bound.has_value()
+               && var->upper_bound.value() <= static_cast<int64_t>(array.length);
+    }
+
+    // Instruction selection. Instead of pushing every subexpression, expression
+    // trees are tiled into rax with these patterns, largest first:
+    //   leaf          a literal, scalar or element at a literal index, used as the
+    //                 immediate or memory operand of the instruction consuming it
+    //   x + y*s (+k)  `lea rax, [rax + rbx*s + k]` for s in 2, 4 and 8
+    //   x * k         `shl` for powers of two, `lea rax, [rax + rax*2]` for 3, 5, 9
+    //   x op leaf     `add rax, 5`, `imul rax, QWORD [rsp + 8]`, `cmp rax, 10`
+    //   leaf op x     the same with the operands swapped, where op allows it
+    //   x op y        y is spilled to the stack while x is computed
+    // The rhs is still evaluated before the lhs, as either may call a function
+    // that prints; leaves have no side effects and are loaded whenever convenient.
+
+    [[nodiscard]] static bool fits_imm32(const int64_t value) {
+        return value >= INT32_MIN && value <= INT32_MAX;
+    }
+
+    [[nodiscard]] static const NodeExpr *unparen(const NodeExpr *expr) {
+        while (const auto term = std::get_if<NodeTerm *>(&expr->var)) {
+            const auto paren = std::get_if<NodeTermParen *>(&(*term)->var);
+            if (paren == nullptr) {
+                break;
+            }
+            expr = (*paren)->expr;
+        }
+        return expr;
+    }
+
+    // The memory operand reading `expr` if it is a scalar or an element at a
+    // literal index within bounds, computed against the current stack depth.
+    [[nodiscard]] std::optional<std::string> memory_operand(const NodeExpr *expr) {
+        const auto term = std::get_if<NodeTerm *>(&unparen(expr)->var);
+        if (term == nullptr) {
+            return {};
+        }
+        if (const auto ident = std::get_if<NodeTermIdent *>(&(*term)->var)) {
+            const Var *var = find_var((*ident)->ident.value.value());
+            if (var == nullptr || var->is_array()) {
+                return {};
+            }
+            return "QWORD " + var_slot(*var);
+        }
+        if (const auto index = std::get_if<NodeTermIndex *>(&(*term)->var)) {
+            const Var *array = find_var((*index)->ident.value.value());
+            const auto literal = int_literal((*index)->index);
+            if (array == nullptr || !array->is_array() || !literal.has_value() || literal.value() < 0
+                || static_cast<size_t>(literal.value()) >= array->length) {
+                return {};
+            }
+            return "QWORD " + element_slot(*array, static_cast<size_t>(literal.value()));
+        }
+        return {};
+    }
+
+    // An immediate or memory operand standing for `expr`.
+    [[nodiscard]] std::optional<std::string> leaf_operand(const NodeExpr *expr) {
+        if (const auto literal = int_literal(expr)) {
+            return fits_imm32(literal.value()) ? std::optional(std::to_string(literal.value())) : std::nullopt;
+        }
+        return memory_operand(expr);
+    }
+
+    [[nodiscard]] bool is_leaf(const NodeExpr *expr) {
+        return int_literal(expr).has_value() || memory_operand(expr).has_value();
+    }
+
+    [[nodiscard]] static std::string low_dword(const std::string &reg) {
+        return reg.starts_with("r") && std::isdigit(reg[1]) ? reg + "d" : "e" + reg.substr(1);
+    }
+
+    // The shortest encoding: xor for zero, a 32-bit mov (which zero-extends) below
+    // 2^32, a sign-extended imm32 for small negatives and movabs for the rest.
+    void gen_load_imm(const std::string &reg, const int64_t value) {
+        if (value == 0) {
+            m_output << "    xor " << low_dword(reg) << ", " << low_dword(reg) << "\n";
+        } else if (value > 0 && value <= UINT32_MAX) {
+            m_output << "    mov " << low_dword(reg) << ", " << value << "\n";
+        } else {
+            m_output << "    mov " << reg << ", " << value << "\n";
+        }
+    }
+
+    void gen_load(const std::string &reg, const NodeExpr *leaf) {
+        if (const auto literal = int_literal(leaf)) {
+            gen_load_imm(reg, literal.value());
+        } else {
+            m_output << "    mov " << reg << ", " << memory_operand(leaf).value() << "\n";
+        }
+    }
+
+    void gen_into_rax(const NodeExpr *expr) {
+        expr = unparen(expr);
+        if (is_leaf(expr)) {
+            gen_load("rax", expr);
+        } else if (const auto bin_expr = std::get_if<NodeBinExpr *>(&expr->var)) {
+            gen_bin_expr(*bin_expr);
+        } else if (const auto call = std::get_if<NodeTermCall *>(&std::get<NodeTerm *>(expr->var)->var)) {
+            gen_call(*call);
+        } else if (const auto index = std::get_if<NodeTermIndex *>(&std::get<NodeTerm *>(expr->var)->var)) {
+            const Var &array = lookup_var((*index)->ident, true);
+            const ElementRef element = gen_index(array, (*index)->index);
+            m_output << "    mov rax, " << element_slot(array, element) << "\n";
+        } else {
+            gen_expr(expr);
+            pop("rax");
+        }
+    }
+
+    void gen_into(const std::string &reg, const NodeExpr *expr) {
+        if (is_leaf(expr)) {
+            gen_load(reg, expr);
+            return;
+        }
+        gen_into_rax(expr);
+        if (reg != "rax") {
+            m_output << "    mov " << reg << ", rax\n";
+        }
+    }
+
+    // `mov destination, expr`, storing literals that fit as immediates.
+    void gen_store(const std::string &destination, const NodeExpr *expr, const std::string &scratch = "rax") {
+        if (const auto literal = int_literal(expr); literal.has_value() && fits_imm32(literal.value())) {
+            m_output << "    mov " << destination << ", " << literal.value() << "\n";
+            return;
+        }
+        gen_into(scratch, expr);
+        m_output << "    mov " << destination << ", " << scratch << "\n";
+    }
+
+    // Evaluates the rhs and then the lhs, leaving the lhs in rax and the rhs in `rhs_reg`.
+    void gen_operands(const NodeExpr *lhs, const NodeExpr *rhs, const std::string &rhs_reg = "rbx") {
+        if (is_leaf(rhs)) {
+            gen_into_rax(lhs);
+            gen_load(rhs_reg, rhs);
+        } else if (is_leaf(lhs)) {
+            gen_into_rax(rhs);
+            m_output << "    mov " << rhs_reg << ", rax\n";
+            gen_load("rax", lhs);
+        } else {
+            gen_into_rax(rhs);
+            push("rax");
+            gen_into_rax(lhs);
+            pop(rhs_reg);
+        }
+    }
+
+    // rax = lhs `op` rhs for add, sub, imul, and, or and xor.
+    void gen_alu(const std::string &op, const bool commutative, const NodeExpr *lhs, const NodeExpr *rhs) {
+        // imul only takes an immediate in its three operand form
+        const auto emit = [&](const NodeExpr *leaf) {
+            const char *imul_imm = op == "imul" && int_literal(leaf).has_value() ? "rax, " : "";
+            m_output << "    " << op << " rax, " << imul_imm << leaf_operand(leaf).value() << "\n";
+        };
+        if (leaf_operand(rhs).has_value()) {
+            gen_into_rax(lhs);
+            emit(rhs);
+        } else if (leaf_operand(lhs).has_value() && (commutative || op == "sub")) {
+            gen_into_rax(rhs);
+            if (op == "sub") {
+                // lhs - rhs == -rhs + lhs
+                m_output << "    neg rax\n";
+                m_output << "    add rax, " << leaf_operand(lhs).value() << "\n";
+            } else {
+                emit(lhs);
+            }
+        } else {
+            gen_operands(lhs, rhs);
+            m_output << "    " << op << " rax, rbx\n";
+        }
+    }
+
+    struct Condition {
+        std::string cc; // for `cmp lhs, rhs`
+        std::string swapped_cc; // for `cmp rhs, lhs`
+    };
+
+    // Sets the flags for lhs against rhs and returns the condition code to test.
+    [[nodiscard]] std::string gen_compare(const NodeExpr *lhs, const NodeExpr *rhs, const Condition &condition) {
+        const auto compare = [&](const std::string &operand) {
+            if (operand == "0") {
+                m_output << "    test rax, rax\n";
+            } else {
+                m_output << "    cmp rax, " << operand << "\n";
+            }
+        };
+        if (leaf_operand(rhs).has_value()) {
+            gen_into_rax(lhs);
+            compare(leaf_operand(rhs).value());
+            return condition.cc;
+        }
+        if (leaf_operand(lhs).has_value()) {
+            gen_into_rax(rhs);
+            compare(leaf_operand(lhs).value());
+            return condition.swapped_cc;
+        }
+        gen_operands(lhs, rhs);
+        m_output << "    cmp rax, rbx\n";
+        return condition.cc;
+    }
+
+    void gen_set(const NodeExpr *lhs, const NodeExpr *rhs, const Condition &condition) {
+        const std::string cc = gen_compare(lhs, rhs, condition);
+        m_output << "    set" << cc << " al\n";
+        m_output << "    movzx eax, al\n";
+    }
+
+    // `x + y*s` and `y*s + x` for s in 2, 4 and 8 as one lea, also with a literal
+    // added on top. Returns false, emitting nothing, if the tree does not fit.
+    bool gen_lea(const NodeExpr *lhs, const NodeExpr *rhs) {
+        int64_t displacement = 0;
+        if (const auto literal = int_literal(rhs); literal.has_value() && fits_imm32(literal.value())) {
+            const auto inner = std::get_if<NodeBinExpr *>(&unparen(lhs)->var);
+            if (inner == nullptr || !std::holds_alternative<NodeBinExprAdd *>((*inner)->var)) {
+                return false;
+            }
+            displacement = literal.value();
+            std::tie(lhs, rhs) = bin_operands(*inner);
+        }
+        const auto scaled = [&](const NodeExpr *expr) -> std::optional<std::pair<const NodeExpr *, int64_t>> {
+            const auto bin_expr = std::get_if<NodeBinExpr *>(&unparen(expr)->var);
+            if (bin_expr == nullptr || !std::holds_alternative<NodeBinExprMulti *>((*bin_expr)->var)) {
+                return {};
+            }
+            const auto [factor_lhs, factor_rhs] = bin_operands(*bin_expr);
+            for (const auto &[index, scale]: {std::pair(factor_lhs, factor_rhs), std::pair(factor_rhs, factor_lhs)}) {
+                const auto literal = int_literal(scale);
+                if (literal == 2 || literal == 4 || literal == 8) {
+                    if (!int_literal(index).has_value()) {
+                        return std::pair(index, literal.value());
+                    }
+                }
+            }
+            return {};
+        };
+        std::string address;
+        if (const auto rhs_scaled = scaled(rhs); rhs_scaled.has_value() && !int_literal(lhs).has_value()) {
+            gen_operands(lhs, rhs_scaled->first);
+            address = "rax + rbx*" + std::to_string(rhs_scaled->second);
+        } else if (const auto lhs_scaled = scaled(lhs); lhs_scaled.has_value() && !int_literal(rhs).has_value()) {
+            gen_operands(lhs_scaled->first, rhs);
+            address = "rbx + rax*" + std::to_string(lhs_scaled->second);
+        } else {
+            return false;
+        }
+        if (displacement != 0) {
+            address += (displacement < 0 ? " - " : " + ") + std::to_string(std::abs(displacement));
+        }
+        m_output << "    lea rax, [" << address << "]\n";
+        return true;
+    }
+
+    // Multiplication by a literal that a shift or lea does better than imul.
+    bool gen_mul_const(const NodeExpr *lhs, const NodeExpr *rhs) {
+        const NodeExpr *other = rhs;
+        auto factor = int_literal(lhs);
+        if (!factor.has_value()) {
+            factor = int_literal(rhs);
+            other = lhs;
+        }
+        if (!factor.has_value() || factor.value() <= 1) {
+            return false;
+        }
+        const auto k = static_cast<uint64_t>(factor.value());
+        if (std::has_single_bit(k)) {
+            gen_into_rax(other);
+            m_output << "    shl rax, " << std::countr_zero(k) << "\n";
+        } else if (k == 3 || k == 5 || k == 9) {
+            gen_into_rax(other);
+            m_output << "    lea rax, [rax + rax*" << k - 1 << "]\n";
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    // rax = lhs, rdx:rax / rhs by idiv, reading a scalar divisor from memory.
+    void gen_idiv(const NodeExpr *lhs, const NodeExpr *rhs) {
+        if (memory_operand(rhs).has_value()) {
+            gen_into_rax(lhs);
+            m_output << "    cqo\n";
+            m_output << "    idiv " << memory_operand(rhs).value() << "\n";
+            return;
+        }
+        gen_operands(lhs, rhs);
+        m_output << "    cqo\n";
+        m_output << "    idiv rbx\n";
+    }
+
+    void gen_shift(const std::string &op, const NodeExpr *lhs, const NodeExpr *rhs) {
+        if (const auto count = int_literal(rhs)) {
+            gen_into_rax(lhs);
+            m_output << "    " << op << " rax, " << (count.value() & 63) << "\n";
+            return;
+        }
+        gen_operands(lhs, rhs, "rcx");
+        m_output << "    " << op << " rax, cl\n";
+    }
+
+    void gen_logical(const NodeBinExpr *bin_expr) {
+        const std::string false_label = create_label("cond_false", m_stmt_line);
+        const std::string end_label = create_label("cond_end", m_stmt_line);
+        gen_cond_jump(bin_expr, false, false_label);
+        m_output << "    mov eax, 1\n";
+        m_output << "    jmp " << end_label << "\n";
+        m_output << false_label << ":\n";
+        m_output << "    xor eax, eax\n";
+        m_output << end_label << ":\n";
+    }
+
+    // Jumps to `label` if `expr` is non-zero (`jump_if`) or zero (`!jump_if`), and
+    // falls through otherwise. `&&` and `||` become chains of branches that never
+    // materialise intermediate booleans, and comparisons branch on the flags.
+    void gen_cond_jump(const NodeExpr *expr, const bool jump_if, const std::string &label) { // NOLINT(*-no-recursion)
+        if (const auto bin_expr = std::get_if<NodeBinExpr *>(&expr->var)) {
+            gen_cond_jump(*bin_expr, jump_if, label);
+            return;
+        }
+        if (const auto paren = std::get_if<NodeTermParen *>(&std::get<NodeTerm *>(expr->var)->var)) {
+            gen_cond_jump((*paren)->expr, jump_if, label);
+            return;
+        }
+        gen_into_rax(expr);
+        m_output << "    test rax, rax\n";
+        m_output << "    " << (jump_if ? "jnz " : "jz ") << label << "\n";
+    }
+
+    void gen_cond_jump(const NodeBinExpr *bin_expr, const bool jump_if, const std::string &label) { // NOLINT(*-no-recursion)
+        const auto logical = [&](const NodeExpr *lhs, const NodeExpr *rhs, const bool is_and) {
+            if (jump_if != is_and) {
+                // `a && b` jumping when false, `a || b` jumping when true: either side decides
+                gen_cond_jump(lhs, jump_if, label);
+                gen_cond_jump(rhs, jump_if, label);
+            } else {
+                // otherwise the lhs can only rule the jump out
+                const std::string skip_label = create_label(is_and ? "and_skip" : "or_skip", m_stmt_line);
+                gen_cond_jump(lhs, !jump_if, skip_label);
+                gen_cond_jump(rhs, jump_if, label);
+                m_output << skip_label << ":\n";
+            }
+        };
+        const auto compare = [&](const NodeExpr *lhs, const NodeExpr *rhs, const Condition &condition,
+                                 const Condition &inverse) {
+            const std::string cc = gen_compare(lhs, rhs, jump_if ? condition : inverse);
+            m_output << "    j" << cc << " " << label << "\n";
+        };
+
+        if (const auto and_ = std::get_if<NodeBinExprAnd *>(&bin_expr->var)) {
+            logical((*and_)->lhs, (*and_)->rhs, true);
+        } else if (const auto or_ = std::get_if<NodeBinExprOr *>(&bin_expr->var)) {
+            logical((*or_)->lhs, (*or_)->rhs, false);
+        } else if (const auto eq = std::get_if<NodeBinExprEq *>(&bin_expr->var)) {
+            compare((*eq)->lhs, (*eq)->rhs, {"e", "e"}, {"ne", "ne"});
+        } else if (const auto neq = std::get_if<NodeBinExprNotEq *>(&bin_expr->var)) {
+            compare((*neq)->lhs, (*neq)->rhs, {"ne", "ne"}, {"e", "e"});
+        } else if (const auto less = std::get_if<NodeBinExprLess *>(&bin_expr->var)) {
+            compare((*less)->lhs, (*less)->rhs, {"l", "g"}, {"ge", "le"});
+        } else if (const auto less_eq = std::get_if<NodeBinExprLessEq *>(&bin_expr->var)) {
+            compare((*less_eq)->lhs, (*less_eq)->rhs, {"le", "ge"}, {"g", "l"});
+        } else if (const auto greater = std::get_if<NodeBinExprGreater *>(&bin_expr->var)) {
+            compare((*greater)->lhs, (*greater)->rhs, {"g", "l"}, {"le", "ge"});
+        } else if (const auto greater_eq = std::get_if<NodeBinExprGreaterEq *>(&bin_expr->var)) {
+            compare((*greater_eq)->lhs, (*greater_eq)->rhs, {"ge", "le"}, {"l", "g"});
+        } else {
+            gen_bin_expr(bin_expr);
+            m_output << "    test rax, rax\n";
+            m_output << "    " << (jump_if ? "jnz " : "jz ") << label << "\n";
+        }
+    }
+
+    [[nodiscard]] bool is_non_negative(const NodeExpr *expr) {
+        if (const auto literal = int_literal(expr)) {
+            return literal.value() >= 0;
+        }
+        const auto name = ident_name(expr);
+        const Var *var = name.has_value() ? find_var(name.value()) : nullptr;
+        return var != nullptr && !var->is_array() && var->non_negative;
+    }
+
+    // rax = rax % divisor, with the sign of the dividend like idiv.
+    void gen_mod_const(const int64_t divisor, const bool non_negative) {
+        const uint64_t abs_divisor = divisor < 0 ? 0 - static_cast<uint64_t>(divisor) : divisor;
+        if (divisor == -1) {
+            // INT64_MIN % -1 traps in idiv, as it does with -O0
+            m_output << "    mov rcx, -1\n";
+            m_output << "    cqo\n";
+            m_output << "    idiv rcx\n";
+            m_output << "    mov rax, rdx\n";
+            return;
+        }
+        if (abs_divisor == 1) {
+            m_output << "    xor eax, eax\n";
+            return;
+        }
+        if (std::has_single_bit(abs_divisor)) {
+            const uint64_t mask = abs_divisor - 1;
+            const std::string mask_operand = mask <= INT32_MAX ? std::to_string(mask) : "rcx";
+            if (mask > INT32_MAX) {
+                m_output << "    mov rcx, " << mask << "\n";
+            }
+            if (non_negative) {
+                m_output << "    and rax, " << mask_operand << "\n";
+                return;
+            }
+            // bias negative dividends so the mask yields the truncated remainder
+            const int k = std::countr_zero(abs_divisor);
+            m_output << "    mov rdx, rax\n";
+            m_output << "    sar rdx, 63\n";
+            m_output << "    shr rdx, " << 64 - k << "\n";
+            m_output << "    add rax, rdx\n";
+            m_output << "    and rax, " << mask_operand << "\n";
+            m_output << "    sub rax, rdx\n";
+            return;
+        }
+        // n - (n / d) * d, with the quotient from the multiply-high sequence
+        m_output << "    mov rsi, rax\n";
+        gen_div_const(divisor);
+        m_output << "    mov rcx, " << divisor << "\n";
+        m_output << "    imul rax, rcx\n";
+        m_output << "    sub rsi, rax\n";
+        m_output << "    mov rax, rsi\n";
+    }
+
+    // rax = rax / divisor, rounded towards zero like idiv.
+    void gen_div_const(const int64_t divisor) {
+        const uint64_t abs_divisor = divisor < 0 ? 0 - static_cast<uint64_t>(divisor) : divisor;
+        if (divisor == -1) {
+            // INT64_MIN / -1 overflows and has to trap like it does with -O0
+            m_output << "    mov rcx, -1\n";
+            m_output << "    cqo\n";
+            m_output << "    idiv rcx\n";
+            return;
+        }
+        if (abs_divisor == 1) {
+            // nothing to do for 1
+        } else if (std::has_single_bit(abs_divisor)) {
+            // bias negative dividends by 2^k - 1 so the arithmetic shift rounds towards zero
+            const int k = std::countr_zero(abs_divisor);
+            m_output << "    mov rdx, rax\n";
+            m_output << "    sar rdx, 63\n";
+            m_output << "    shr rdx, " << 64 - k << "\n";
+            m_output << "    add rax, rdx\n";
+            m_output << "    sar rax, " << k << "\n";
+        } else {
+            const auto [magic, shift] = signed_magic(divisor);
+            m_output << "    mov rcx, rax\n";
+            m_output << "    mov rax, " << magic << "\n";
+            m_output << "    imul rcx\n";
+            if (divisor > 0 && magic < 0) {
+                m_output << "    add rdx, rcx\n";
+            } else if (divisor < 0 && magic > 0) {
+                m_output << "    sub rdx, rcx\n";
+            }
+            if (shift > 0) {
+                m_output << "    sar rdx, " << shift << "\n";
+            }
+            // add one when the quotient is negative
+            m_output << "    mov rax, rdx\n";
+            m_output << "    shr rax, 63\n";
+            m_output << "    add rax, rdx\n";
+            return;
+        }
+        if (divisor < 0) {
+            m_output << "    neg rax\n";
+        }
+    }
+
+    // Multiplier and shift such that n / divisor == (mulhi(n, magic) [+- n]) >> shift,
+    // plus one for negative results (Hacker's Delight 10-1). |divisor| must be >= 2.
+    [[nodiscard]] static std::pair<int64_t, int> signed_magic(const int64_t divisor) {
+        constexpr uint64_t two63 = 1ULL << 63;
+        const uint64_t ad = divisor < 0 ? 0 - static_cast<uint64_t>(divisor) : divisor;
+        const uint64_t t = two63 + (static_cast<uint64_t>(divisor) >> 63);
+        const uint64_t anc = t - 1 - t % ad;
+        int p = 63;
+        uint64_t q1 = two63 / anc;
+        uint64_t r1 = two63 - q1 * anc;
+        uint64_t q2 = two63 / ad;
+        uint64_t r2 = two63 - q2 * ad;
+        uint64_t delta;
+        do {
+            p++;
+            q1 *= 2;
+            r1 *= 2;
+            if (r1 >= anc) {
+                q1++;
+                r1 -= anc;
+            }
+            q2 *= 2;
+            r2 *= 2;
+            if (r2 >= ad) {
+                q2++;
+                r2 -= ad;
+            }
+            delta = ad - r2;
+        } while (q1 < delta || (q1 == delta && r1 == 0));
+        const uint64_t magic = q2 + 1;
+        return {static_cast<int64_t>(divisor < 0 ? 0 - magic : magic), p - 64};
+    }
+
+    // The array named by `expr` if it is just an identifier of one.
+    [[nodiscard]] Var *array_operand(const NodeExpr *expr) {
+        const auto name = ident_name(expr);
+        if (!name.has_value()) {
+            return nullptr;
+        }
+        Var *var = find_var(name.value());
+        return var != nullptr && var->is_array() ? var : nullptr;
+    }
+
+    // Calls a bulk runtime routine taking the first element in rdi and the length in rsi.
+    void gen_array_call(const std::string &routine, const Var &array) {
+        m_output << "    lea rdi, " << element_slot(array, 0) << "\n";
+        m_output << "    mov rsi, " << array.length << "\n";
+        call_runtime(routine);
+    }
+
+    // Calls `routine` from io.asm, noting it so that only used routines are declared.
+    void call_runtime(const std::string &routine) {
+        m_runtime_used.insert(routine);
+        m_output << "    call " << routine << "\n";
+    }
+
+    // Elements are laid out upwards from the lowest slot of the array.
+    [[nodiscard]] std::string element_slot(const Var &array, const ElementRef &element) const {
+        const auto [reg, top] = frame_of(array);
+        const size_t base = (top - array.stack_loc - array.length) * 8;
+        std::stringstream ss;
+        if (element.has_value()) {
+            ss << "[" << reg << " + " << base + element.value() * 8 << "]";
+        } else {
+            ss << "[" << reg << " + rax * 8 + " << base << "]";
+        }
+        return ss.str();
+    }
+
+    // `while (i < n)` or `while (i <= n)` with `i = i + k` once at the top level
+    // of the body: its iterations, as numbers from 0, and how to get the counter
+    // back from them. Variables from outside the loop that the body assigns are
+    // reductions, combined into the original when each chunk of iterations is done.
+    struct ParallelLoop {
+        std::string counter;
+        int64_t step;
+        bool inclusive;
+        const NodeExpr *bound;
+        std::map<std::string, std::string> reductions; // to the instruction combining them, `add` or `imul`
+    };
+
+    // What the body of a parallel loop does, collected by check_parallel_body.
+    struct ParallelBody {
+        std::string counter;
+        int64_t step;
+        std::set<std::string> locals;
+        std::map<std::string, std::string> reductions;
+        std::set<std::string> reads;
+        // arrays from before the loop that are stored to, all at [counter]
+        std::set<std::string> stored;
+        // how far past the iteration's own value the counter is at each a[counter],
+        // 0 before `i = i + k` and k after it
+        std::map<std::string, std::set<int64_t>> counter_offsets;
+        // arrays indexed by anything but the counter
+        std::set<std::string> indexed_apart;
+        int64_t offset = 0;
+        bool ok = true;
+    };
+
+    // The loop of a `parallel while` if it can be run that way, reporting why not otherwise.
+    std::optional<ParallelLoop> parallel_loop(const NodeStmtWhile *stmt_while) {
+        ParallelLoop loop{.counter = {}, .step = 0, .inclusive = false, .bound = nullptr, .reductions = {}};
+        if (const auto bin_expr = std::get_if<NodeBinExpr *>(&stmt_while->condition->var)) {
+            if (const auto less = std::get_if<NodeBinExprLess *>(&(*bin_expr)->var)) {
+                loop.counter = ident_name((*less)->lhs).value_or("");
+                loop.bound = (*less)->rhs;
+            } else if (const auto less_eq = std::get_if<NodeBinExprLessEq *>(&(*bin_expr)->var)) {
+                loop.counter = ident_name((*less_eq)->lhs).value_or("");
+                loop.bound = (*less_eq)->rhs;
+                loop.inclusive = true;
+            }
+        }
+        const std::vector<NodeStmt *> &body = stmt_while->scope->stmts;
+        for (const NodeStmt *stmt: body) {
+            const auto assign = std::get_if<NodeStmtAssign *>(&stmt->var);
+            if (assign != nullptr && (*assign)->ident.value.value() == loop.counter && is_increment(*assign)) {
+                const NodeBinExpr *add = std::get<NodeBinExpr *>((*assign)->expr->var);
+                loop.step = int_literal(std::get<NodeBinExprAdd *>(add->var)->rhs).value();
+            }
+        }
+        const Var *counter = find_var(loop.counter);
+        if (counter == nullptr || counter->is_array() || loop.step <= 0 || count_defs(body, loop.counter) != 1) {
+            error("`parallel while` needs a condition `i < n` or `i <= n` and one `i = i + k` with k > 0 "
+                  "at the top level of its body");
+            return {};
+        }
+
+        // the bound is computed once, before any iteration runs
+        Assigned assigned;
+        collect_assigned(body, assigned);
+        std::set<std::string> bound_uses;
+        collect_uses(loop.bound, bound_uses);
+        const bool invariant = !has_call(loop.bound) && std::ranges::all_of(bound_uses, [&](const std::string &name) {
+            const Var *var = find_var(name);
+            return var == nullptr || (!var->is_array() && !assigned.all.contains(name));
+        });
+        if (!invariant) {
+            error("The bound of a `parallel while` cannot change while it runs");
+            return {};
+        }
+
+        ParallelBody checked{.counter = loop.counter, .step = loop.step, .locals = {}, .reductions = {}, .reads = {},
+                             .stored = {}, .counter_offsets = {}, .indexed_apart = {}, .offset = 0, .ok = true};
+        const int line = m_stmt_line;
+        const int column = m_stmt_column;
+        check_parallel_body(body, checked);
+        m_stmt_line = line;
+        m_stmt_column = column;
+        // each iteration owns the elements at its counter, and only those
+        for (const std::string &name: checked.stored) {
+            if (checked.indexed_apart.contains(name) || checked.counter_offsets[name].size() > 1) {
+                error("Array " + name + " is stored to at " + name + "[" + loop.counter
+                      + "] and used at other elements in a `parallel while`");
+                checked.ok = false;
+            }
+        }
+        for (const auto &[name, op]: checked.reductions) {
+            const Var *var = find_var(name);
+            if (var == nullptr || var->is_array()) {
+                error((var == nullptr ? "Undeclared identifier: " : "Array used as a value: ") + name);
+                checked.ok = false;
+            } else if (checked.reads.contains(name)) {
+                error("Reduction variable " + name + " can only be used by its `" + name + " = " + name
+                      + " + e` or `* e` in a `parallel while`");
+                checked.ok = false;
+            }
+        }
+        if (!checked.ok) {
+            return {};
+        }
+        loop.reductions = std::move(checked.reductions);
+        return loop;
+    }
+
+    // `x = x + e`, `x = e + x`, `x = x * e` or `x = e * x` where e does not read x:
+    // the instruction combining two partial results and e.
+    [[nodiscard]] static std::optional<std::pair<std::string, const NodeExpr *>> reduction(
+        const NodeStmtAssign *assign) {
+        const auto bin_expr = std::get_if<NodeBinExpr *>(&assign->expr->var);
+        if (bin_expr == nullptr) {
+            return {};
+        }
+        std::optional<std::pair<std::string, const NodeExpr *>> result;
+        const std::string &name = assign->ident.value.value();
+        const auto match = [&](const char *op, const NodeExpr *lhs, const NodeExpr *rhs) {
+            if (ident_name(lhs) == name) {
+                result.emplace(op, rhs);
+            } else if (ident_name(rhs) == name) {
+                result.emplace(op, lhs);
+            }
+        };
+        if (const auto add = std::get_if<NodeBinExprAdd *>(&(*bin_expr)->var)) {
+            match("add", (*add)->lhs, (*add)->rhs);
+        } else if (const auto multi = std::get_if<NodeBinExprMulti *>(&(*bin_expr)->var)) {
+            match("imul", (*multi)->lhs, (*multi)->rhs);
+        }
+        if (result.has_value()) {
+            std::set<std::string> uses;
+            collect_uses(result->second, uses);
+            if (uses.contains(name)) {
+                return {};
+            }
+        }
+        return result;
+    }
+
+    void check_parallel_body(const std::vector<NodeStmt *> &stmts, ParallelBody &body) { // NOLINT(*-no-recursion)
+        for (const NodeStmt *stmt: stmts) {
+            m_stmt_line = stmt->line;
+            m_stmt_column = stmt->column;
+            // workers share the input buffer, and an exit from one drops what the others printed
+            for (const NodeTermCall *call: stmt_calls(stmt)) {
+                const std::string &name = call->name.value.value();
+                std::set<std::string> seen;
+                if (m_streaming && !m_functions.contains(name)) {
+                    error(call->name, "A `parallel while` can only call functions declared above it with --stream");
+                    body.ok = false;
+                } else if (calls_input_or_exit(name, seen)) {
+                    error(call->name, "A `parallel while` cannot call " + name + ", which can use `input` or `exit`");
+                    body.ok = false;
+                }
+            }
+            if (std::holds_alternative<NodeStmtInput *>(stmt->var) || std::holds_alternative<NodeStmtExit *>(stmt->var)
+                || std::holds_alternative<NodeStmtReturn *>(stmt->var)) {
+                error("`input`, `exit` and `return` cannot be used in a `parallel while`");
+                body.ok = false;
+            } else if (const auto assign = std::get_if<NodeStmtAssign *>(&stmt->var)) {
+                const std::string &name = (*assign)->ident.value.value();
+                collect_indices((*assign)->expr, body);
+                if (name == body.counter) {
+                    // the one top-level `i = i + k`, see parallel_loop
+                    collect_uses((*assign)->expr, body.reads);
+                    body.offset = body.step;
+                    continue;
+                }
+                if (body.locals.contains(name)) {
+                    collect_uses((*assign)->expr, body.reads);
+                    continue;
+                }
+                const auto found = reduction(*assign);
+                const auto it = body.reductions.find(name);
+                if (!found.has_value() || (it != body.reductions.end() && it->second != found->first)) {
+                    error("A `parallel while` can only assign " + name + " as `" + name + " = " + name + " + e` or `"
+                          + name + " = " + name + " * e`, the same way everywhere");
+                    body.ok = false;
+                    continue;
+                }
+                body.reductions.emplace(name, found->first);
+                collect_uses(found->second, body.reads);
+            } else if (const auto scope = std::get_if<NodeScope *>(&stmt->var)) {
+                check_parallel_body((*scope)->stmts, body);
+            } else if (const auto stmt_while = std::get_if<NodeStmtWhile *>(&stmt->var)) {
+                collect_uses((*stmt_while)->condition, body.reads);
+                collect_indices((*stmt_while)->condition, body);
+                check_parallel_body((*stmt_while)->scope->stmts, body);
+            } else if (const auto stmt_if = std::get_if<NodeStmtIf *>(&stmt->var)) {
+                collect_uses((*stmt_if)->expr, body.reads);
+                collect_indices((*stmt_if)->expr, body);
+                check_parallel_body((*stmt_if)->scope->stmts, body);
+                std::optional<NodeIfPred *> pred = (*stmt_if)->pred;
+                while (pred.has_value()) {
+                    if (const auto elif = std::get_if<NodeIfPredElif *>(&pred.value()->var)) {
+                        collect_uses((*elif)->expr, body.reads);
+                        collect_indices((*elif)->expr, body);
+                        check_parallel_body((*elif)->scope->stmts, body);
+                        pred = (*elif)->pred;
+                    } else {
+                        check_parallel_body(std::get<NodeIfPredElse *>(pred.value()->var)->scope->stmts, body);
+                        pred.reset();
+                    }
+                }
+            } else {
+                if (const auto assign_index = std::get_if<NodeStmtAssignIndex *>(&stmt->var)) {
+                    const std::string &name = (*assign_index)->ident.value.value();
+                    collect_indices((*assign_index)->expr, body);
+                    collect_index(name, (*assign_index)->index, body);
+                    if (body.locals.contains(name)) {
+                        // arrays of the body's own
+                    } else if (ident_name(unparen((*assign_index)->index)) != body.counter) {
+                        error("A `parallel while` can only store to " + name + "[" + body.counter
+                              + "], the element of its own iteration");
+                        body.ok = false;
+                    } else {
+                        body.stored.insert(name);
+                    }
+                } else if (const auto let = std::get_if<NodeStmtLet *>(&stmt->var)) {
+                    collect_indices((*let)->expr, body);
+                } else if (const auto print = std::get_if<NodeStmtPrint *>(&stmt->var)) {
+                    collect_indices((*print)->expr, body);
+                } else if (const auto call = std::get_if<NodeStmtCall *>(&stmt->var)) {
+                    for (const NodeExpr *arg: (*call)->call->args) {
+                        collect_indices(arg, body);
+                    }
+                }
+                if (const auto def = stmt_def(stmt)) {
+                    body.locals.insert(def.value());
+                }
+                const std::set<std::string> uses = stmt_uses(stmt);
+                body.reads.insert(uses.begin(), uses.end());
+            }
+        }
+    }
+
+    // Whether calling `name` can run `input` or `exit`, in its own body or in the
+    // functions it calls. `seen` holds the functions already looked into.
+    bool calls_input_or_exit(const std::string &name, std::set<std::string> &seen) const { // NOLINT(*-no-recursion)
+        const auto it = m_functions.find(name);
+        return it != m_functions.end() && seen.insert(name).second
+               && reaches_input_or_exit(it->second->scope->stmts, seen);
+    }
+
+    bool reaches_input_or_exit(const std::vector<NodeStmt *> &stmts, // NOLINT(*-no-recursion)
+                               std::set<std::string> &seen) const {
+        for (const NodeStmt *stmt: stmts) {
+            if (std::holds_alternative<NodeStmtInput *>(stmt->var) || std::holds_alternative<NodeStmtExit *>(stmt->var)) {
+                return true;
+            }
+            for (const NodeTermCall *call: stmt_calls(stmt)) {
+                if (calls_input_or_exit(call->name.value.value(), seen)) {
+                    return true;
+                }
+            }
+            if (const auto scope = std::get_if<NodeScope *>(&stmt->var)) {
+                if (reaches_input_or_exit((*scope)->stmts, seen)) {
+                    return true;
+                }
+            } else if (const auto stmt_while = std::get_if<NodeStmtWhile *>(&stmt->var)) {
+                if (reaches_input_or_exit((*stmt_while)->scope->stmts, seen)) {
+                    return true;
+                }
+            } else if (const auto stmt_if = std::get_if<NodeStmtIf *>(&stmt->var)) {
+                if (reaches_input_or_exit((*stmt_if)->scope->stmts, seen)) {
+                    return true;
+                }
+                std::optional<NodeIfPred *> pred = (*stmt_if)->pred;
+                while (pred.has_value()) {
+                    const NodeScope *arm;
+                    if (const auto elif = std::get_if<NodeIfPredElif *>(&pred.value()->var)) {
+                        arm = (*elif)->scope;
+                        pred = (*elif)->pred;
+                    } else {
+                        arm = std::get<NodeIfPredElse *>(pred.value()->var)->scope;
+                        pred.reset();
+                    }
+                    if (reaches_input_or_exit(arm->stmts, seen)) {
+                        return true;
+                    }
+                }
+            }
+        }
+        return false;
+    }
+
+    // Records the array elements `expr` reads in `body`.
+    static void collect_indices(const NodeExpr *expr, ParallelBody &body) { // NOLINT(*-no-recursion)
+        if (const auto bin_expr = std::get_if<NodeBinExpr *>(&expr->var)) {
+            const auto [lhs, rhs] = bin_operands(*bin_expr);
+            collect_indices(lhs, body);
+            collect_indices(rhs, body);
+            return;
+        }
+        const NodeTerm *term = std::get<NodeTerm *>(expr->var);
+        if (const auto paren = std::get_if<NodeTermParen *>(&term->var)) {
+            collect_indices((*paren)->expr, body);
+        } else if (const auto index = std::get_if<NodeTermIndex *>(&term->var)) {
+            collect_index((*index)->ident.value.value(), (*index)->index, body);
+        } else if (const auto call = std::get_if<NodeTermCall *>(&term->var)) {
+            for (const NodeExpr *arg: (*call)->args) {
+                collect_indices(arg, body);
+            }
+        }
+    }
+
+    // Records a use of array[index] in `body`, reads in the index included.
+    static void collect_index(const std::string &array, const NodeExpr *index, ParallelBody &body) { // NOLINT(*-no-recursion)
+        collect_indices(index, body);
+        if (ident_name(unparen(index)) == body.counter) {
+            body.counter_offsets[array].insert(body.offset);
+        } else {
+            body.indexed_apart.insert(array);
+        }
+    }
+
+    // Runs the iterations of a `parallel while` through par_for in io.asm. The
+    // body becomes a routine of its own that runs a range of iterations with its
+    // own copies of the counter and of the reductions, and reaches all other
+    // variables from before the loop through rbp. The trip count is computed up
+    // front, unsigned, so that `n - i` cannot overflow.
+    void gen_parallel_while(const NodeStmtWhile *stmt_while, const int line) {
+        const std::optional<ParallelLoop> loop = parallel_loop(stmt_while);
+        if (!loop.has_value()) {
+            return;
+        }
+        const std::string body_label = create_label("parallel_body", line);
+        const std::string none_label = create_label("parallel_none", line);
+        const std::string run_label = create_label("parallel_run", line);
+        const auto step = [&](const std::string &reg) {
+            if (loop->step == 1) {
+                return;
+            }
+            if (fits_imm32(loop->step)) {
+                m_output << "    imul " << reg << ", " << reg << ", " << loop->step << "\n";
+            } else {
+                gen_load_imm("rcx", loop->step);
+                m_output << "    imul " << reg << ", rcx\n";
+            }
+        };
+
+        m_output << "    ;; parallel while\n";
+        gen_into_rax(loop->bound);
+        m_output << "    sub rax, " << var_slot(*find_var(loop->counter)) << "\n";
+        m_output << (loop->inclusive ? "    jl " : "    jle ") << none_label << "\n";
+        if (!loop->inclusive) {
+            m_output << "    dec rax\n";
+        }
+        if (loop->step != 1) {
+            m_output << "    xor edx, edx\n";
+            gen_load_imm("rcx", loop->step);
+            m_output << "    div rcx\n";
+        }
+        m_output << "    inc rax\n";
+        m_output << "    jmp " << run_label << "\n";
+        m_output << none_label << ":\n";
+        m_output << "    xor eax, eax\n";
+        m_output << run_label << ":\n";
+        push("rax");
+        push("rbp");
+        m_output << "    mov rdi, rax\n";
+        m_output << "    lea rsi, [rel " << body_label << "]\n";
+        m_output << "    lea rdx, [rsp + 16]\n";
+        m_output << "    mov rcx, " << m_options.threads << "\n";
+        call_runtime("par_for");
+        pop("rbp");
+        pop("rax");
+        step("rax");
+        m_output << "    add " << var_slot(*find_var(loop->counter)) << ", rax\n";
+        m_output << "    ;; /parallel while\n";
+
+        std::stringstream output;
+        std::swap(m_output, output);
+        const int current_line = std::exchange(m_current_line, 0);
+        const std::vector<Var> outer_vars = m_vars;
+        const size_t stack_size = m_stack_size;
+        m_parallel_base = m_stack_size;
+        set_line(line);
+        m_output << body_label << ":\n";
+        const Var end{.name = {}, .stack_loc = m_stack_size};
+        push("rsi");
+        const Var next{.name = {}, .stack_loc = m_stack_size};
+        push("rdi");
+        const auto local_index = [&](const std::string &name) {
+            return static_cast<size_t>(find_var(name) - m_vars.data());
+        };
+        const size_t counter = local_index(loop->counter);
+        m_output << "    mov rax, rdi\n";
+        step("rax");
+        m_output << "    add rax, " << var_slot(m_vars[counter]) << "\n";
+        m_vars[counter].stack_loc = m_stack_size;
+        push("rax");
+        std::vector<std::tuple<std::string, std::string, size_t>> reductions; // original, instruction, copy
+        for (const auto &[name, op]: loop->reductions) {
+            const size_t index = local_index(name);
+            reductions.emplace_back(var_slot(m_vars[index]), op, index);
+            m_vars[index].stack_loc = m_stack_size;
+            push(op == "add" ? "0" : "1");
+        }
+
+        const std::string loop_label = create_label("parallel_loop", line);
+        const std::string done_label = create_label("parallel_done", line);
+        m_output << loop_label << ":\n";
+        m_output << "    mov rax, " << var_slot(next) << "\n";
+        m_output << "    cmp rax, " << var_slot(end) << "\n";
+        m_output << "    jae " << done_label << "\n";
+        if (const auto bound = loop_bound(stmt_while->condition)) {
+            m_vars[counter].upper_bound = bound->second;
+        }
+        count(line, "loop");
+        gen_scope(stmt_while->scope);
+        set_line(line);
+        m_output << "    inc QWORD " << var_slot(next) << "\n";
+        m_output << "    jmp " << loop_label << "\n";
+        m_output << done_label << ":\n";
+        for (const auto &[original, op, index]: reductions) {
+            if (op == "add") {
+                m_output << "    mov rax, " << var_slot(m_vars[index]) << "\n";
+                m_output << "    lock add QWORD " << original << ", rax\n";
+                continue;
+            }
+            const std::string retry_label = create_label("parallel_reduce", line);
+            m_output << "    mov rcx, " << var_slot(m_vars[index]) << "\n";
+            m_output << "    mov rax, " << original << "\n";
+            m_output << retry_label << ":\n";
+            m_output << "    mov rdx, rax\n";
+            m_output << "    imul rdx, rcx\n";
+            m_output << "    lock cmpxchg " << original << ", rdx\n";
+            m_output << "    jne " << retry_label << "\n";
+        }
+        m_output << "    add rsp, " << (m_stack_size - stack_size) * 8 << "\n";
+        m_output << "    ret\n";
+
+        m_parallel_base.reset();
+        m_stack_size = stack_size;
+        m_vars = outer_vars;
+        m_current_line = current_line;
+        std::swap(m_output, output);
+        m_parallel_bodies += output.str();
+    }
+
+    // Turns `while (i < K) { a[i] = b[i] + c[i] - x; ...; i = i + 1; }` into a loop
+    // handling two elements per iteration with SSE2, emitted in front of the scalar
+    // loop, which then only runs the remaining iteration if any. Only statements of
+    // the form `array[i] = expr` are allowed, where expr adds and subtracts elements
+    // at index i, literals and scalars the loop does not assign. Each lane only
+    // touches index i, so lanes cannot observe each other.
+    void try_vectorize(const NodeStmtWhile *stmt_while, const std::string &induction, const int64_t bound,
+                       const int line) {
+        if (!m_options.vectorize || m_options.instrument) {
+            return;
+        }
+        const Var *counter = find_var(induction);
+        const std::vector<NodeStmt *> &body = stmt_while->scope->stmts;
+        if (counter == nullptr || counter->is_array() || !counter->non_negative || body.size() < 2) {
+            return;
+        }
+        const auto step = std::get_if<NodeStmtAssign *>(&body.back()->var);
+        if (step == nullptr || (*step)->ident.value.value() != induction || !is_increment(*step, 1)) {
+            return;
+        }
+        std::vector<const NodeStmtAssignIndex *> lanes;
+        for (size_t i = 0; i + 1 < body.size(); i++) {
+            const auto assign = std::get_if<NodeStmtAssignIndex *>(&body[i]->var);
+            if (assign == nullptr || ident_name((*assign)->index) != induction
+                || !vectorizable_array((*assign)->ident, bound)
+                || vector_regs((*assign)->expr, induction, bound) > 14) {
+                return;
+            }
+            lanes.push_back(*assign);
+        }
+
+        const std::string loop_label = create_label("while_vec", line);
+        const std::string done_label = create_label("while_vec_end", line);
+        m_output << "    ;; vectorized while\n";
+        m_output << "    mov rcx, " << var_slot(*counter) << "\n";
+        m_output << loop_label << ":\n";
+        m_output << "    lea rax, [rcx + 2]\n";
+        m_output << "    cmp rax, " << bound << "\n";
+        m_output << "    jg " << done_label << "\n";
+        for (const NodeStmtAssignIndex *assign: lanes) {
+            gen_vector_expr(assign->expr, 0);
+            m_output << "    movdqu " << vector_slot(lookup_var(assign->ident, true)) << ", xmm0\n";
+        }
+        m_output << "    add rcx, 2\n";
+        m_output << "    jmp " << loop_label << "\n";
+        m_output << done_label << ":\n";
+        m_output << "    mov " << var_slot(*counter) << ", rcx\n";
+        m_output << "    ;; /vectorized while\n";
+    }
+
+    [[nodiscard]] bool vectorizable_array(const Token &ident, const int64_t bound) {
+        const Var *array = find_var(ident.value.value());
+        return array != nullptr && array->is_array() && static_cast<int64_t>(array->length) >= bound;
+    }
+
+    // Number of xmm registers needed to evaluate `expr` lane-wise, or a large
+    // number if it cannot be vectorized.
+    [[nodiscard]] size_t vector_regs(const NodeExpr *expr, const std::string &induction, // NOLINT(*-no-recursion)
+                                     const int64_t bound) {
+        constexpr size_t unsupported = 1000;
+        if (const auto bin_expr = std::get_if<NodeBinExpr *>(&expr->var)) {
+            const NodeExpr *lhs;
+            const NodeExpr *rhs;
+            if (const auto add = std::get_if<NodeBinExprAdd *>(&(*bin_expr)->var)) {
+                lhs = (*add)->lhs;
+                rhs = (*add)->rhs;
+            } else if (const auto sub = std::get_if<NodeBinExprSub *>(&(*bin_expr)->var)) {
+                lhs = (*sub)->lhs;
+                rhs = (*sub)->rhs;
+            } else {
+                return unsupported;
+            }
+            return std::max(vector_regs(lhs, induction, bound), vector_regs(rhs, induction, bound) + 1);
+        }
+        const NodeTerm *term = std::get<NodeTerm *>(expr->var);
+        if (const auto paren = std::get_if<NodeTermParen *>(&term->var)) {
+            return vector_regs((*paren)->expr, induction, bound);
+        }
+        if (std::holds_alternative<NodeTermIntLit *>(term->var)) {
+            return int_literal(expr).has_value() ? 1 : unsupported;
+        }
+        if (const auto ident = std::get_if<NodeTermIdent *>(&term->var)) {
+            // the loop only assigns arrays and the counter, so other scalars are invariant
+            const Var *var = find_var((*ident)->ident.value.value());
+            return var != nullptr && !var->is_array() && var->name != induction ? 1 : unsupported;
+        }
+        if (const auto index = std::get_if<NodeTermIndex *>(&term->var)) {
+            return ident_name((*index)->index) == induction && vectorizable_array((*index)->ident, bound)
+                       ? 1
+                       : unsupported;
+        }
+        return unsupported;
+    }
+
+    // Evaluates `expr` for elements rcx and rcx + 1 into xmm`reg`.
+    void gen_vector_expr(const NodeExpr *expr, const size_t reg) { // NOLINT(*-no-recursion)
+        const std::string xmm = "xmm" + std::to_string(reg);
+        if (const auto bin_expr = std::get_if<NodeBinExpr *>(&expr->var)) {
+            const bool is_add = std::holds_alternative<NodeBinExprAdd *>((*bin_expr)->var);
+            const auto [lhs, rhs] = is_add
+                                        ? std::pair(std::get<NodeBinExprAdd *>((*bin_expr)->var)->lhs,
+                                                    std::get<NodeBinExprAdd *>((*bin_expr)->var)->rhs)
+                                        : std::pair(std::get<NodeBinExprSub *>((*bin_expr)->var)->lhs,
+                                                    std::get<NodeBinExprSub *>((*bin_expr)->var)->rhs);
+            gen_vector_expr(lhs, reg);
+            gen_vector_expr(rhs, reg + 1);
+            m_output << "    " << (is_add ? "paddq " : "psubq ") << xmm << ", xmm" << reg + 1 << "\n";
+            return;
+        }
+        const NodeTerm *term = std::get<NodeTerm *>(expr->var);
+        if (const auto paren = std::get_if<NodeTermParen *>(&term->var)) {
+            gen_vector_expr((*paren)->expr, reg);
+        } else if (std::holds_alternative<NodeTermIntLit *>(term->var)) {
+            m_output << "    mov rax, " << int_literal(expr).value() << "\n";
+            m_output << "    movq " << xmm << ", rax\n";
+            m_output << "    punpcklqdq " << xmm << ", " << xmm << "\n";
+        } else if (const auto ident = std::get_if<NodeTermIdent *>(&term->var)) {
+            m_output << "    movq " << xmm << ", " << var_slot(lookup_var((*ident)->ident, false)) << "\n";
+            m_output << "    punpcklqdq " << xmm << ", " << xmm << "\n";
+        } else {
+            const Var &array = lookup_var(std::get<NodeTermIndex *>(term->var)->ident, true);
+            m_output << "    movdqu " << xmm << ", " << vector_slot(array) << "\n";
+        }
+    }
+
+    [[nodiscard]] std::string vector_slot(const Var &array) const {
+        const auto [reg, top] = frame_of(array);
+        std::stringstream ss;
+        ss << "[" << reg << " + rcx * 8 + " << (top - array.stack_loc - array.length) * 8 << "]";
+        return ss.str();
+    }
+
+    // Labels are named after the region they start and its source line, so that
+    // profilers attribute samples to e.g. `while_12_3` instead of `_start`.
+    // Label of `text` in the data section emitted after the code.
+    std::string text_label(const std::string &text) {
+        m_texts.push_back(text);
+        return "text_" + std::to_string(m_texts.size() - 1);
+    }
+
+    std::string create_label(const std::string &region, const int line) {
+        std::stringstream ss;
+        ss << region << "_" << line << "_" << m_label_count++;
+        return ss.str();
+    }
+
+    std::string create_pred_label(const NodeIfPred *pred) {
+        if (const auto elif = std::get_if<NodeIfPredElif *>(&pred->var)) {
+            return create_label("elif", (*elif)->line);
+        }
+        return create_label("else", std::get<NodeIfPredElse *>(pred->var)->line);
+    }
+
+    // Attributes the following instructions to `line` of the source file.
+    void set_line(const int line) {
+        if (!m_options.debug_info || line == m_current_line) {
+            return;
+        }
+        m_current_line = line;
+        m_output << "%line " << line << "+0 " << m_options.source_path << "\n";
+    }
+
     const NodeProg m_prog;
+    const GeneratorOptions m_options;
     std::stringstream m_output;
     size_t m_stack_size = 0;
     std::vector<Var> m_vars{};
     std::vector<size_t> m_scopes{};
     int m_label_count = 0;
+    Diagnostics &m_diagnostics;
+    Var m_placeholder{};
+    std::vector<std::string> m_texts;
+    std::string m_cold; // rarely run branch bodies, see gen_cold
+    std::string m_jump_tables; // see gen_jump_table
+    std::string m_parallel_bodies; // see gen_parallel_while
+    std::optional<size_t> m_parallel_base{}; // stack size at the parallel loop being generated
+    int m_current_line = 0;
+    int m_stmt_line = 0;
+    int m_stmt_column = 0;
+    std::map<std::string, const NodeStmtFn *> m_functions{};
+    std::vector<std::pair<const NodeStmtFn *, int>> m_top_fns{}; // with their lines
+    size_t m_num_top_stmts = 0;
+    bool m_block_start = false;
+    bool m_streaming = false;
+    std::vector<std::pair<Token, size_t>> m_forward_calls{}; // name and number of arguments
+    const NodeStmtFn *m_current_fn = nullptr;
+    std::vector<const NodeStmtFn *> m_inlining{};
+    std::set<std::string> m_runtime_used{};
+    std::map<std::pair<int, std::string>, size_t> m_profile_slots{};
+    std::vector<std::pair<int, std::string>> m_profile_sites{};
 };
@@ -0,0 +1,99 @@
+#include "genesis.hpp"
+
+#include <algorithm>
+#include <new>
+
+#include "optimizer.hpp"
+
+std::vector<Token> genesis_tokenize(const std::string_view source, Diagnostics &diagnostics) {
+    Tokenizer tokenizer(std::string(source), diagnostics);
+    return tokenizer.tokenize();
+}
+
+Compilation genesis_parse(const std::string_view source, const GenesisOptions &options) {
+    Compilation compilation(options.max_errors);
+    Compilation::State &state = *compilation.m_state;
+    // The arena does not grow: a program whose AST, or the nodes the optimizer
+    // adds to it, outgrow arena_bytes fails to compile instead of throwing.
+    try {
+        state.tokens = genesis_tokenize(source, state.diagnostics);
+        // the parser keeps going after tokenizer errors so that its errors are reported too
+        state.parser.emplace(std::move(state.tokens), state.diagnostics,
+                             ArenaAllocator(options.arena_bytes, options.arena_hooks));
+        std::optional<NodeProg> prog = state.parser->parse_prog();
+        if (!prog.has_value() || state.diagnostics.has_errors()) {
+            return compilation;
+        }
+        if (options.optimize) {
+            Optimizer optimizer(prog.value(), state.parser->allocator(), options.unroll);
+            optimizer.run();
+        }
+        state.prog = std::move(prog);
+    } catch (const std::bad_alloc &) {
+        state.diagnostics.error(0, 0, "program too large for the arena of " + std::to_string(options.arena_bytes)
+                                      + " bytes");
+    }
+    return compilation;
+}
+
+Compilation genesis_compile(const std::string_view source, const GenesisOptions &options) {
+    if (options.stream) {
+        Compilation compilation(options.max_errors);
+        Compilation::State &state = *compilation.m_state;
+        std::string asm_text;
+        genesis_stream(std::string(source), options, state.diagnostics,
+                       [&asm_text](const std::string &text) { asm_text += text; });
+        if (!state.diagnostics.has_errors()) {
+            state.asm_text = std::move(asm_text);
+        }
+        return compilation;
+    }
+    Compilation compilation = genesis_parse(source, options);
+    Compilation::State &state = *compilation.m_state;
+    if (!state.prog.has_value()) {
+        return compilation;
+    }
+    try {
+        Generator generator(state.prog.value(), state.diagnostics, options.generator);
+        std::string asm_text = generator.gen_prog();
+        if (!state.diagnostics.has_errors()) {
+            state.asm_text = std::move(asm_text);
+        }
+    } catch (const std::bad_alloc &) {
+        state.diagnostics.error(0, 0, "out of memory generating code");
+    }
+    return compilation;
+}
+
+StreamStats genesis_stream(std::string source, const GenesisOptions &options, Diagnostics &diagnostics,
+                           const std::function<void(const std::string &)> &write) {
+    StreamStats stats;
+    try {
+        Tokenizer tokenizer(std::move(source), diagnostics);
+        TokenStream stream(tokenizer);
+        Parser parser(stream, diagnostics, ArenaAllocator(options.arena_bytes, options.arena_hooks));
+        Generator generator({}, diagnostics, options.generator);
+        generator.begin_stream();
+        ArenaAllocator::Mark kept = parser.allocator().mark();
+        while (const std::optional<NodeStmt *> stmt = parser.parse_top_stmt()) {
+            if (!parser.failed()) {
+                generator.gen_stream_stmt(stmt.value());
+                write(generator.take_output());
+            }
+            stats.peak_arena_bytes = std::max(stats.peak_arena_bytes, parser.arena_bytes_used());
+            if (std::holds_alternative<NodeStmtFn *>(stmt.value()->var)) {
+                kept = parser.allocator().mark();
+            } else {
+                parser.allocator().release(kept);
+            }
+        }
+        if (!parser.failed()) {
+            write(generator.end_stream());
+        }
+        stats.tokens = stream.num_tokens();
+    } catch (const std::bad_alloc &) {
+        diagnostics.error(0, 0, "program too large for the arena of " + std::to_string(options.arena_bytes)
+                                + " bytes");
+    }
+    return stats;
+}
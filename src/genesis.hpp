@@ -0,0 +1,117 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "generation.hpp"
+
+// In-process interface to the compiler, built as the libgenesis library. Nothing
+// here reads or writes files, starts processes or exits: every stage returns its
+// result in memory and problems come back as diagnostics, running out of memory
+// included: an AST outgrowing GenesisOptions::arena_bytes is reported as an error
+// rather than thrown. Compilations share no state, so separate threads can
+// compile at the same time.
+
+struct GenesisOptions {
+    // run the dataflow optimizer (constant propagation, loop evaluation and unrolling)
+    bool optimize = true;
+    size_t unroll = 4;
+    size_t max_errors = 20;
+    // have genesis_compile go through genesis_stream, which leaves no program()
+    bool stream = false;
+    GeneratorOptions generator{};
+    // size of the AST arena and where its memory comes from
+    size_t arena_bytes = Parser::default_arena_bytes;
+    ArenaHooks arena_hooks{};
+};
+
+// Everything one compile produced. The AST points into an arena owned by the
+// Compilation and stays valid exactly as long as it does.
+class Compilation {
+public:
+    Compilation(Compilation &&) noexcept = default;
+    Compilation &operator=(Compilation &&) noexcept = default;
+    ~Compilation() = default;
+
+    [[nodiscard]] bool ok() const {
+        return !m_state->diagnostics.has_errors();
+    }
+
+    [[nodiscard]] const Diagnostics &diagnostics() const {
+        return m_state->diagnostics;
+    }
+
+    // The parser moves the text of the tokens it consumes into the AST, so once
+    // parsed only their types and positions are left here.
+    [[nodiscard]] const std::vector<Token> &tokens() const {
+        return m_state->parser.has_value() ? m_state->parser->tokens() : m_state->tokens;
+    }
+
+    // null unless the source parsed without errors
+    [[nodiscard]] const NodeProg *program() const {
+        return m_state->prog.has_value() ? &m_state->prog.value() : nullptr;
+    }
+
+    // NASM source for x86-64 Linux, to be linked with io.asm; empty unless ok()
+    [[nodiscard]] const std::string &asm_text() const {
+        return m_state->asm_text;
+    }
+
+private:
+    // Kept at a fixed address, the parser refers to the diagnostics.
+    struct State {
+        explicit State(const size_t max_errors)
+            : diagnostics(max_errors) {
+        }
+
+        Diagnostics diagnostics;
+        std::vector<Token> tokens; // until they are handed to the parser
+        std::optional<Parser> parser;
+        std::optional<NodeProg> prog;
+        std::string asm_text;
+    };
+
+    explicit Compilation(const size_t max_errors)
+        : m_state(std::make_unique<State>(max_errors)) {
+    }
+
+    friend Compilation genesis_parse(std::string_view source, const GenesisOptions &options);
+    friend Compilation genesis_compile(std::string_view source, const GenesisOptions &options);
+
+    std::unique_ptr<State> m_state;
+};
+
+// Flags for `ld` to link the object of asm_text() with io.asm's into a minimal
+// static executable. Runtime routines and buffers the program never reaches are
+// dropped, and the headers, code and constants share one segment. Symbols are
+// kept only when there is debug info to go with them.
+inline std::string genesis_link_flags(const bool debug_info) {
+    return debug_info ? "--gc-sections -z noseparate-code" : "--gc-sections -z noseparate-code -s";
+}
+
+// Splits `source` into tokens, reporting characters that start none to `diagnostics`.
+std::vector<Token> genesis_tokenize(std::string_view source, Diagnostics &diagnostics);
+
+// Tokenizes and parses `source`, then runs the optimizer over the AST if asked to.
+Compilation genesis_parse(std::string_view source, const GenesisOptions &options = {});
+
+// genesis_parse followed by code generation.
+Compilation genesis_compile(std::string_view source, const GenesisOptions &options = {});
+
+// What genesis_stream went through, for geny's time report.
+struct StreamStats {
+    size_t tokens = 0;
+    size_t peak_arena_bytes = 0;
+};
+
+// Compiles `source` a top-level statement at a time, without the optimizer: every
+// statement is parsed, generated, handed to `write` and released before the next
+// one is read, and only function declarations stay in the arena for the calls
+// that follow them. What was written is to be thrown away if `diagnostics` ends
+// up with errors.
+StreamStats genesis_stream(std::string source, const GenesisOptions &options, Diagnostics &diagnostics,
+                           const std::function<void(const std::string &)> &write);
@@ -1,45 +1,164 @@
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <optional>
 #include <sstream>
+#include <thread>
 #include <vector>
 
+#include "cache.hpp"
 #include "generation.hpp"
+#include "optimizer.hpp"
+#include "options.hpp"
+#include "server.hpp"
+#include "timing.hpp"
+
+std::string read_file(const std::string &path) {
+    std::stringstream contents_stream;
+    std::fstream input(path, std::ios::in);
+    contents_stream << input.rdbuf();
+    return contents_stream.str();
+}
+
+void print_time_report(const TimeReport &report, const TimeReportFormat format) {
+    if (format == TimeReportFormat::text) {
+        report.print_text(std::cerr);
+    } else if (format == TimeReportFormat::json) {
+        report.print_json(std::cerr);
+    }
+}
+
+// --stream: every top-level statement is written to out.asm as soon as it is
+// generated, see genesis_stream.
+void stream_asm(std::string contents, const CompileOptions &opts, Diagnostics &diagnostics, TimeReport &report) {
+    const StreamStats stats = report.measure("stream", [&] {
+        std::fstream file("../out.asm", std::ios::out);
+        return genesis_stream(std::move(contents), genesis_options(opts), diagnostics,
+                              [&file](const std::string &text) { file << text; });
+    });
+    report.count("tokens", stats.tokens);
+    report.count("peak arena bytes", stats.peak_arena_bytes);
+}
 
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        std::cerr << "Incorrect usage. Correct usage is..." << std::endl;
-        std::cerr << "./geny ../<input.gn>" << std::endl;
+    const std::optional<CompileOptions> opts = parse_args(argc, argv);
+    if (!opts.has_value()) {
+        print_usage();
         return EXIT_FAILURE;
     }
-
-    std::string contents; {
-        std::stringstream contents_stream;
-        std::fstream input(argv[1], std::ios::in);
-        contents_stream << input.rdbuf();
-        contents = contents_stream.str();
+    if (opts->serve) {
+        CompileServer server(opts->socket_path, opts->workers, "../io.asm");
+        return server.run();
     }
 
-    Tokenizer tokenizer(std::move(contents));
-    std::vector<Token> tokens = tokenizer.tokenize();
+    TimeReport report;
+    std::string contents = report.measure("read", [&] { return read_file(opts->input_path); });
+    report.count("source bytes", contents.size());
 
-    Parser parser(std::move(tokens));
-    std::optional<NodeProg> prog = parser.parse_prog();
+    // The runtime is linked into every executable, so it is part of the key as well,
+    // and so is the profile the branches were laid out by. The compiler is keyed by
+    // its own executable: GENESIS_VERSION stays the same across rebuilds that change
+    // the generated code.
+    std::optional<CompileCache> cache;
+    std::string cache_key;
+    if (opts->use_cache && !opts->stop_after_asm) {
+        const bool hit = report.measure("cache lookup", [&] {
+            cache.emplace(opts->cache_dir, opts->cache_max_bytes);
+            const std::string runtime = read_file("../io.asm");
+            const std::string fingerprint = opts->fingerprint();
+            const std::string profile = opts->profile_use_path.empty() ? "" : read_file(opts->profile_use_path);
+            const std::string compiler = read_file("/proc/self/exe");
+            cache_key = CompileCache::make_key({contents, runtime, compiler, fingerprint + profile});
+            return cache->fetch(cache_key, "out");
+        });
+        if (hit) {
+            report.measure("run", [] { return system("./out"); });
+            print_time_report(report, opts->time_report);
+            return EXIT_SUCCESS;
+        }
+    }
 
-    if (!prog.has_value()) {
-        std::cerr << "Invalid program" << std::endl;
+    // Every stage keeps going after an error so that all of them are reported at once.
+    Diagnostics diagnostics(opts->max_errors);
+    const auto fail = [&] {
+        diagnostics.print(std::cerr, opts->input_path);
         exit(EXIT_FAILURE);
-    } {
-        Generator generator(prog.value());
-        std::fstream file("../out.asm", std::ios::out);
-        file << generator.gen_prog();
+    };
+
+    if (opts->stream) {
+        stream_asm(std::move(contents), opts.value(), diagnostics, report);
+        if (diagnostics.has_errors()) {
+            fail();
+        }
+    } else {
+        Tokenizer tokenizer(std::move(contents), diagnostics);
+        std::vector<Token> tokens = report.measure("tokenize", [&] {
+            return tokenizer.tokenize_parallel(std::thread::hardware_concurrency());
+        });
+        report.count("tokens", tokens.size());
+
+        Parser parser(std::move(tokens), diagnostics);
+        std::optional<NodeProg> prog = report.measure("parse", [&] { return parser.parse_prog(); });
+        report.count("ast nodes", parser.node_count());
+        report.count("arena bytes", parser.arena_bytes_used());
+
+        if (!prog.has_value() || diagnostics.has_errors()) {
+            fail();
+        }
+        if (opts->optimize) {
+            Optimizer optimizer(prog.value(), parser.allocator(), opts->unroll);
+            report.measure("optimize", [&] { optimizer.run(); });
+            report.count("folded exprs", optimizer.num_folded());
+            report.count("pruned branches", optimizer.num_pruned_branches());
+            report.count("removed stmts", optimizer.num_removed_stmts());
+            report.count("evaluated loops", optimizer.num_evaluated_loops());
+            report.count("unrolled loops", optimizer.num_unrolled_loops());
+            report.count("reused exprs", optimizer.num_reused_exprs());
+        } {
+            Generator generator(prog.value(), diagnostics, genesis_options(opts.value()).generator);
+            const std::string asm_text = report.measure("generate", [&] { return generator.gen_prog(); });
+            report.count("asm bytes", asm_text.size());
+            if (diagnostics.has_errors()) {
+                fail();
+            }
+            report.measure("write asm", [&] {
+                std::fstream file("../out.asm", std::ios::out);
+                file << asm_text;
+            });
+        }
+    }
+    if (opts->stop_after_asm) {
+        print_time_report(report, opts->time_report);
+        return EXIT_SUCCESS;
     }
 
-    system("nasm -f elf64 ../io.asm -o ../io.o");
-    system("nasm -f elf64 ../out.asm -o ../out.o");
+    // A failed step leaves the files of the previous compile behind, which must be
+    // neither linked, run nor cached under this source's key.
+    const std::string nasm = opts->debug_info ? "nasm -f elf64 -g -F dwarf " : "nasm -f elf64 ";
+    const int runtime_status = report.measure("nasm runtime", [&] {
+        return system((nasm + "../io.asm -o ../io.o").c_str());
+    });
+    const int program_status = report.measure("nasm program", [&] {
+        return system((nasm + "../out.asm -o ../out.o").c_str());
+    });
+    if (runtime_status != 0 || program_status != 0) {
+        std::cerr << "geny: nasm failed" << std::endl;
+        print_time_report(report, opts->time_report);
+        return EXIT_FAILURE;
+    }
 
-    system("ld -o out ../out.o ../io.o");
+    const std::string link = "ld " + genesis_link_flags(opts->debug_info) + " -o out ../out.o ../io.o";
+    if (report.measure("link", [&] { return system(link.c_str()); }) != 0) {
+        std::cerr << "geny: ld failed" << std::endl;
+        print_time_report(report, opts->time_report);
+        return EXIT_FAILURE;
+    }
+    report.count("executable bytes", std::filesystem::file_size("out"));
+    if (cache.has_value()) {
+        report.measure("cache store", [&] { cache->store(cache_key, "out"); });
+    }
 
-    system("./out");
+    report.measure("run", [] { return system("./out"); });
+    print_time_report(report, opts->time_report);
     return EXIT_SUCCESS;
 };
@@ -0,0 +1,1151 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <limits>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "dataflow.hpp"
+
+// Runs statements on known values at compile time. Gives up on anything with an
+// effect other than setting scalars and printing numbers, and after max_steps steps.
+class Evaluator {
+public:
+    static constexpr size_t max_steps = 4096;
+    static constexpr size_t max_output = 16 * 1024;
+
+    explicit Evaluator(ConstEnv env)
+        : m_env(std::move(env)) {
+    }
+
+    [[nodiscard]] bool run(const NodeStmt *stmt) {
+        return exec(stmt);
+    }
+
+    [[nodiscard]] const ConstEnv &env() const {
+        return m_env;
+    }
+
+    [[nodiscard]] const std::string &output() const {
+        return m_output;
+    }
+
+private:
+    bool exec_scope(const NodeScope *scope) { // NOLINT(*-no-recursion)
+        std::vector<std::string> declared;
+        for (const NodeStmt *stmt: scope->stmts) {
+            if (const auto let = std::get_if<NodeStmtLet *>(&stmt->var)) {
+                declared.push_back((*let)->ident.value.value());
+            }
+            if (!exec(stmt)) {
+                return false;
+            }
+        }
+        for (const std::string &name: declared) {
+            m_env.erase(name);
+        }
+        return true;
+    }
+
+    bool exec(const NodeStmt *stmt) { // NOLINT(*-no-recursion)
+        if (++m_steps > max_steps) {
+            return false;
+        }
+        if (const auto let = std::get_if<NodeStmtLet *>(&stmt->var)) {
+            return assign((*let)->ident, (*let)->expr);
+        }
+        if (const auto stmt_assign = std::get_if<NodeStmtAssign *>(&stmt->var)) {
+            return assign((*stmt_assign)->ident, (*stmt_assign)->expr);
+        }
+        if (const auto print = std::get_if<NodeStmtPrint *>(&stmt->var)) {
+            const auto value = eval((*print)->expr);
+            if (!value.has_value()) {
+                return false;
+            }
+            m_output += std::to_string(value.value()) + "\n";
+            return m_output.size() <= max_output;
+        }
+        if (const auto scope = std::get_if<NodeScope *>(&stmt->var)) {
+            return exec_scope(*scope);
+        }
+        if (const auto stmt_if = std::get_if<NodeStmtIf *>(&stmt->var)) {
+            return exec_if(*stmt_if);
+        }
+        if (const auto stmt_while = std::get_if<NodeStmtWhile *>(&stmt->var)) {
+            while (true) {
+                const auto cond = eval((*stmt_while)->condition);
+                if (!cond.has_value()) {
+                    return false;
+                }
+                if (cond.value() == 0) {
+                    return true;
+                }
+                if (++m_steps > max_steps || !exec_scope((*stmt_while)->scope)) {
+                    return false;
+                }
+            }
+        }
+        // input, arrays, calls, exit and return
+        return false;
+    }
+
+    bool exec_if(const NodeStmtIf *stmt_if) { // NOLINT(*-no-recursion)
+        const auto cond = eval(stmt_if->expr);
+        if (!cond.has_value()) {
+            return false;
+        }
+        if (cond.value() != 0) {
+            return exec_scope(stmt_if->scope);
+        }
+        std::optional<NodeIfPred *> pred = stmt_if->pred;
+        while (pred.has_value()) {
+            if (const auto elif = std::get_if<NodeIfPredElif *>(&pred.value()->var)) {
+                const auto elif_cond = eval((*elif)->expr);
+                if (!elif_cond.has_value()) {
+                    return false;
+                }
+                if (elif_cond.value() != 0) {
+                    return exec_scope((*elif)->scope);
+                }
+                pred = (*elif)->pred;
+            } else {
+                return exec_scope(std::get<NodeIfPredElse *>(pred.value()->var)->scope);
+            }
+        }
+        return true;
+    }
+
+    bool assign(const Token &ident, const NodeExpr *expr) {
+        const auto value = eval(expr);
+        if (!value.has_value()) {
+            return false;
+        }
+        m_env[ident.value.value()] = LatticeValue::constant(value.value());
+        return true;
+    }
+
+    // Division by zero, array elements, calls and unknown variables have no value here.
+    [[nodiscard]] std::optional<int64_t> eval(const NodeExpr *expr) const {
+        const LatticeValue value = ConstantPropagation::eval(expr, m_env);
+        return value.is_constant() ? std::optional(value.value) : std::nullopt;
+    }
+
+    ConstEnv m_env;
+    std::string m_output;
+    size_t m_steps = 0;
+};
+
+// Rewrites the AST in place between parsing and code generation, using the
+// analyses from dataflow.hpp on the main program and on every function body:
+//  - expressions that always evaluate to the same value become literals,
+//  - if/elif arms that are never taken are dropped, and an arm that is always
+//    taken becomes the final else,
+//  - loops that never run and code that is never reached are deleted,
+//  - loops that only compute on known values are run at compile time and
+//    replaced by what they print and the values they leave behind,
+//  - assignments to variables that are not read afterwards are deleted,
+//  - an expression computed again while its value is still available is read
+//    from a hidden `__cseN` variable holding the first result instead,
+//  - small counted loops are marked for unrolling by `unroll`.
+class Optimizer {
+public:
+    Optimizer(NodeProg &prog, ArenaAllocator &allocator, const size_t unroll)
+        : m_prog(prog)
+          , m_allocator(allocator)
+          , m_unroll(unroll) {
+    }
+
+    void run() {
+        // names stand for variables, see dataflow.hpp; the generator rejects what breaks that
+        if (!well_scoped(m_prog.stmts, {})) {
+            return;
+        }
+        collect_array_lengths(m_prog.stmts);
+        optimize_body(m_prog.stmts, {});
+        for (const NodeStmt *stmt: m_prog.stmts) {
+            if (const auto fn = std::get_if<NodeStmtFn *>(&stmt->var)) {
+                optimize_body((*fn)->scope->stmts, (*fn)->params);
+            }
+        }
+    }
+
+    [[nodiscard]] size_t num_folded() const {
+        return m_num_folded;
+    }
+
+    [[nodiscard]] size_t num_pruned_branches() const {
+        return m_num_pruned_branches;
+    }
+
+    [[nodiscard]] size_t num_removed_stmts() const {
+        return m_num_removed_stmts;
+    }
+
+    [[nodiscard]] size_t num_evaluated_loops() const {
+        return m_num_evaluated_loops;
+    }
+
+    [[nodiscard]] size_t num_unrolled_loops() const {
+        return m_num_unrolled_loops;
+    }
+
+    [[nodiscard]] size_t num_reused_exprs() const {
+        return m_num_reused_exprs;
+    }
+
+private:
+    // Evaluating a loop hands new constants to the code after it, so the
+    // propagation runs again, a bounded number of times.
+    static constexpr size_t max_rounds = 4;
+    // Loops with more statements than this, nested ones included, are not unrolled.
+    static constexpr size_t max_unroll_size = 16;
+    // Expressions cheaper than this are recomputed rather than kept in a variable,
+    // with + or < costing 1 and * costing 3.
+    static constexpr size_t min_reuse_cost = 2;
+
+    void optimize_body(std::vector<NodeStmt *> &stmts, const std::vector<Token> &params) {
+        for (size_t round = 0; round < max_rounds; round++) {
+            const ControlFlowGraph cfg(stmts);
+            const ConstantPropagation constants(cfg, params);
+            fold(cfg, constants);
+            prune(stmts, cfg, constants);
+            if (!evaluate_loops(stmts, cfg, constants)) {
+                break;
+            }
+        }
+        const ControlFlowGraph cfg(stmts);
+        const Liveness liveness(cfg);
+        std::set<const NodeStmt *> dead;
+        for (size_t b = 0; b < cfg.blocks().size(); b++) {
+            const std::vector<const NodeStmt *> &block_stmts = cfg.blocks()[b].stmts;
+            for (size_t i = 0; i < block_stmts.size(); i++) {
+                const auto assign = std::get_if<NodeStmtAssign *>(&block_stmts[i]->var);
+                // a faulting expression stays even when its value is never read
+                if (assign != nullptr && !has_call((*assign)->expr) && !can_fault((*assign)->expr)
+                    && !liveness.live_after(b, i, (*assign)->ident.value.value())) {
+                    dead.insert(block_stmts[i]);
+                }
+            }
+        }
+        if (!dead.empty()) {
+            erase(stmts, dead);
+        }
+        reuse_values(stmts);
+        if (m_unroll > 1) {
+            const ControlFlowGraph final_cfg(stmts);
+            unroll_loops(stmts, final_cfg, ConstantPropagation(final_cfg, params));
+        }
+    }
+
+    // Constants at the point where `stmt`, a compound statement, starts.
+    static ConstEnv env_before(const NodeStmt *stmt, const ControlFlowGraph &cfg,
+                               const ConstantPropagation &constants) {
+        const size_t block = cfg.block_of(stmt);
+        ConstEnv env = constants.env_in(block);
+        // compound statements end the block they start in
+        for (const NodeStmt *before: cfg.blocks()[block].stmts) {
+            ConstantPropagation::transfer(before, env);
+        }
+        return env;
+    }
+
+    // Replaces loops an Evaluator can run to completion with their effects, returns
+    // whether any was replaced.
+    bool evaluate_loops(std::vector<NodeStmt *> &stmts, const ControlFlowGraph &cfg, // NOLINT(*-no-recursion)
+                        const ConstantPropagation &constants) {
+        bool changed = false;
+        std::vector<NodeStmt *> result;
+        for (NodeStmt *stmt: stmts) {
+            if (const auto stmt_while = std::get_if<NodeStmtWhile *>(&stmt->var)) {
+                if (const auto effects = evaluate_loop(stmt, *stmt_while, env_before(stmt, cfg, constants))) {
+                    result.insert(result.end(), effects->begin(), effects->end());
+                    changed = true;
+                    m_num_evaluated_loops++;
+                    continue;
+                }
+                changed |= evaluate_loops((*stmt_while)->scope->stmts, cfg, constants);
+            } else if (const auto scope = std::get_if<NodeScope *>(&stmt->var)) {
+                changed |= evaluate_loops((*scope)->stmts, cfg, constants);
+            } else if (const auto stmt_if = std::get_if<NodeStmtIf *>(&stmt->var)) {
+                changed |= evaluate_loops((*stmt_if)->scope->stmts, cfg, constants);
+                std::optional<NodeIfPred *> pred = (*stmt_if)->pred;
+                while (pred.has_value()) {
+                    if (const auto elif = std::get_if<NodeIfPredElif *>(&pred.value()->var)) {
+                        changed |= evaluate_loops((*elif)->scope->stmts, cfg, constants);
+                        pred = (*elif)->pred;
+                    } else {
+                        changed |= evaluate_loops(std::get<NodeIfPredElse *>(pred.value()->var)->scope->stmts,
+                                                  cfg, constants);
+                        pred.reset();
+                    }
+                }
+            }
+            result.push_back(stmt);
+        }
+        stmts = std::move(result);
+        return changed;
+    }
+
+    // The statements doing what the loop in `stmt` does, if it can be run now.
+    std::optional<std::vector<NodeStmt *>> evaluate_loop(const NodeStmt *stmt, const NodeStmtWhile *stmt_while,
+                                                         const ConstEnv &entry) {
+        if (const auto loop = counted_loop(stmt_while)) {
+            // don't bother with loops known to outrun the budget
+            const auto start = entry.find(loop->counter);
+            if (start != entry.end() && start->second.is_constant()) {
+                const auto trips = trip_count(loop.value(), start->second.value);
+                if (!trips.has_value() || trips.value() > Evaluator::max_steps) {
+                    return {};
+                }
+            }
+        }
+        Evaluator evaluator(entry);
+        if (!evaluator.run(stmt)) {
+            return {};
+        }
+
+        std::vector<NodeStmt *> effects;
+        if (!evaluator.output().empty()) {
+            const auto print = m_allocator.emplace<NodeStmtPrintText>(evaluator.output());
+            effects.push_back(m_allocator.emplace<NodeStmt>(print, stmt->line, stmt->column));
+        }
+        for (const auto &[name, value]: evaluator.env()) {
+            // variables declared in the loop are gone, those it left alone need no update
+            const auto before = entry.find(name);
+            if (before == entry.end() || before->second == value) {
+                continue;
+            }
+            const Token ident{TokenType::ident, stmt->line, name};
+            const auto assign = m_allocator.emplace<NodeStmtAssign>(ident, make_literal(value.value));
+            effects.push_back(m_allocator.emplace<NodeStmt>(assign, stmt->line, stmt->column));
+        }
+        return effects;
+    }
+
+    // Marks innermost counted loops with small bodies for unrolling by m_unroll.
+    void unroll_loops(const std::vector<NodeStmt *> &stmts, const ControlFlowGraph &cfg, // NOLINT(*-no-recursion)
+                      const ConstantPropagation &constants) {
+        for (const NodeStmt *stmt: stmts) {
+            if (const auto stmt_while = std::get_if<NodeStmtWhile *>(&stmt->var)) {
+                unroll_loops((*stmt_while)->scope->stmts, cfg, constants);
+                // a parallel loop hands out single iterations, see Generator::gen_parallel_while
+                if (!(*stmt_while)->parallel && !contains_loop((*stmt_while)->scope->stmts)
+                    && size((*stmt_while)->scope->stmts) <= max_unroll_size) {
+                    unroll_loop(*stmt_while, env_before(stmt, cfg, constants));
+                }
+            } else if (const auto scope = std::get_if<NodeScope *>(&stmt->var)) {
+                unroll_loops((*scope)->stmts, cfg, constants);
+            } else if (const auto stmt_if = std::get_if<NodeStmtIf *>(&stmt->var)) {
+                unroll_loops((*stmt_if)->scope->stmts, cfg, constants);
+                std::optional<NodeIfPred *> pred = (*stmt_if)->pred;
+                while (pred.has_value()) {
+                    if (const auto elif = std::get_if<NodeIfPredElif *>(&pred.value()->var)) {
+                        unroll_loops((*elif)->scope->stmts, cfg, constants);
+                        pred = (*elif)->pred;
+                    } else {
+                        unroll_loops(std::get<NodeIfPredElse *>(pred.value()->var)->scope->stmts, cfg, constants);
+                        pred.reset();
+                    }
+                }
+            }
+        }
+    }
+
+    // The counter moves by `step` per iteration, so while it is more than
+    // (unroll - 1) steps short of the bound, `unroll` more iterations are certain.
+    void unroll_loop(NodeStmtWhile *stmt_while, const ConstEnv &entry) {
+        const auto loop = counted_loop(stmt_while);
+        if (!loop.has_value()) {
+            return;
+        }
+        const auto start = entry.find(loop->counter);
+        if (start != entry.end() && start->second.is_constant()) {
+            const auto trips = trip_count(loop.value(), start->second.value);
+            if (trips.has_value() && trips.value() < m_unroll) {
+                return;
+            }
+        }
+        const __int128 limit = static_cast<__int128>(loop->bound)
+                               - static_cast<__int128>(m_unroll - 1) * loop->step;
+        if (limit > std::numeric_limits<int64_t>::max() || limit < std::numeric_limits<int64_t>::min()) {
+            return;
+        }
+        const Token ident{TokenType::ident, 0, loop->counter};
+        const auto counter = m_allocator.emplace<NodeExpr>(
+            m_allocator.emplace<NodeTerm>(m_allocator.emplace<NodeTermIdent>(ident)));
+        const auto bin_expr = m_allocator.emplace<NodeBinExpr>();
+        if (loop->step > 0) {
+            bin_expr->var = m_allocator.emplace<NodeBinExprLess>(counter, make_literal(static_cast<int64_t>(limit)));
+        } else {
+            bin_expr->var = m_allocator.emplace<NodeBinExprGreater>(counter,
+                                                                   make_literal(static_cast<int64_t>(limit)));
+        }
+        stmt_while->unroll = m_unroll;
+        stmt_while->unrolled_condition = m_allocator.emplace<NodeExpr>(bin_expr);
+        m_num_unrolled_loops++;
+    }
+
+    static bool contains_loop(const std::vector<NodeStmt *> &stmts) { // NOLINT(*-no-recursion)
+        for (const NodeStmt *stmt: stmts) {
+            if (std::holds_alternative<NodeStmtWhile *>(stmt->var)) {
+                return true;
+            }
+            if (const auto scope = std::get_if<NodeScope *>(&stmt->var); scope && contains_loop((*scope)->stmts)) {
+                return true;
+            }
+            if (const auto stmt_if = std::get_if<NodeStmtIf *>(&stmt->var)) {
+                if (contains_loop((*stmt_if)->scope->stmts)) {
+                    return true;
+                }
+                std::optional<NodeIfPred *> pred = (*stmt_if)->pred;
+                while (pred.has_value()) {
+                    if (const auto elif = std::get_if<NodeIfPredElif *>(&pred.value()->var)) {
+                        if (contains_loop((*elif)->scope->stmts)) {
+                            return true;
+                        }
+                        pred = (*elif)->pred;
+                    } else {
+                        return contains_loop(std::get<NodeIfPredElse *>(pred.value()->var)->scope->stmts);
+                    }
+                }
+            }
+        }
+        return false;
+    }
+
+    // Number of statements, nested ones included.
+    static size_t size(const std::vector<NodeStmt *> &stmts) { // NOLINT(*-no-recursion)
+        size_t total = stmts.size();
+        for (const NodeStmt *stmt: stmts) {
+            if (const auto scope = std::get_if<NodeScope *>(&stmt->var)) {
+                total += size((*scope)->stmts);
+            } else if (const auto stmt_if = std::get_if<NodeStmtIf *>(&stmt->var)) {
+                total += size((*stmt_if)->scope->stmts);
+                std::optional<NodeIfPred *> pred = (*stmt_if)->pred;
+                while (pred.has_value()) {
+                    if (const auto elif = std::get_if<NodeIfPredElif *>(&pred.value()->var)) {
+                        total += size((*elif)->scope->stmts);
+                        pred = (*elif)->pred;
+                    } else {
+                        total += size(std::get<NodeIfPredElse *>(pred.value()->var)->scope->stmts);
+                        pred.reset();
+                    }
+                }
+            }
+        }
+        return total;
+    }
+
+    // An expression that reads only scalars and can neither fault nor have an
+    // effect, so its value depends on nothing else and computing it early is safe.
+    struct ValueKey {
+        std::string text; // equal for expressions computing the same value
+        size_t cost = 0;
+        std::set<std::string> reads;
+    };
+
+    // A value computed at `first`, which runs as part of `before` or of its condition.
+    struct Available {
+        NodeExpr *first;
+        const NodeStmt *before;
+        std::set<std::string> reads;
+        std::string temp; // the variable holding it, once it is used a second time
+    };
+
+    using ValueTable = std::map<std::string, Available *>;
+
+    // Global value numbering on the structured AST: a value is available in the
+    // statements its computation dominates until a variable it reads is written,
+    // so the table is copied into nested scopes and every arm of an if chain sees
+    // the conditions before it. Repeated computations are replaced by a variable
+    // declared in front of the statement that computed the value first.
+    void reuse_values(std::vector<NodeStmt *> &stmts) {
+        ValueTable table;
+        number_values(stmts, table);
+        if (!m_temps.empty()) {
+            insert_temps(stmts);
+        }
+        m_temps.clear();
+        m_available.clear();
+    }
+
+    void number_values(const std::vector<NodeStmt *> &stmts, ValueTable &table) { // NOLINT(*-no-recursion)
+        for (const NodeStmt *stmt: stmts) {
+            if (std::holds_alternative<NodeStmtFn *>(stmt->var)) {
+                continue;
+            }
+            if (const auto scope = std::get_if<NodeScope *>(&stmt->var)) {
+                ValueTable inner = table;
+                number_values((*scope)->stmts, inner);
+                kill_defs(table, (*scope)->stmts);
+            } else if (const auto stmt_if = std::get_if<NodeStmtIf *>(&stmt->var)) {
+                number_if(stmt, *stmt_if, table);
+            } else if (const auto stmt_while = std::get_if<NodeStmtWhile *>(&stmt->var)) {
+                // values written anywhere in the loop differ from one iteration to the next
+                std::set<std::string> varying;
+                collect_defs((*stmt_while)->scope->stmts, varying);
+                for (const std::string &var: varying) {
+                    kill(table, var);
+                }
+                // a parallel body must keep the shapes gen_parallel_while recognizes
+                if (!(*stmt_while)->parallel) {
+                    reuse_expr((*stmt_while)->condition, stmt, table, varying);
+                    ValueTable inner = table;
+                    number_values((*stmt_while)->scope->stmts, inner);
+                }
+            } else {
+                const auto assign = std::get_if<NodeStmtAssign *>(&stmt->var);
+                for (NodeExpr *expr: stmt_exprs(stmt)) {
+                    if (assign != nullptr && updates((*assign)->ident, expr)) {
+                        // `i = i + 1` stays recognizable as a counter or reduction
+                        const auto [lhs, rhs] = bin_operands(std::get<NodeBinExpr *>(expr->var));
+                        reuse_expr(lhs, stmt, table, {});
+                        reuse_expr(rhs, stmt, table, {});
+                    } else {
+                        reuse_expr(expr, stmt, table, {});
+                    }
+                }
+                if (const auto def = stmt_def(stmt)) {
+                    kill(table, def.value());
+                }
+            }
+        }
+    }
+
+    // Conditions are evaluated with nothing in between, so a value from any of them
+    // can be computed in front of the whole chain and is available in later ones.
+    void number_if(const NodeStmt *stmt, const NodeStmtIf *stmt_if, ValueTable &table) { // NOLINT(*-no-recursion)
+        std::vector<const NodeScope *> arms = {stmt_if->scope};
+        reuse_expr(stmt_if->expr, stmt, table, {});
+        ValueTable first_arm = table;
+        number_values(stmt_if->scope->stmts, first_arm);
+        std::optional<NodeIfPred *> pred = stmt_if->pred;
+        while (pred.has_value()) {
+            if (const auto elif = std::get_if<NodeIfPredElif *>(&pred.value()->var)) {
+                reuse_expr((*elif)->expr, stmt, table, {});
+                arms.push_back((*elif)->scope);
+                ValueTable arm = table;
+                number_values((*elif)->scope->stmts, arm);
+                pred = (*elif)->pred;
+            } else {
+                const NodeScope *scope = std::get<NodeIfPredElse *>(pred.value()->var)->scope;
+                arms.push_back(scope);
+                ValueTable arm = table;
+                number_values(scope->stmts, arm);
+                pred.reset();
+            }
+        }
+        for (const NodeScope *arm: arms) {
+            kill_defs(table, arm->stmts);
+        }
+    }
+
+    // Replaces `expr` if its value is available, otherwise makes it and its operands
+    // available. Values reading a `varying` variable are left alone.
+    void reuse_expr(NodeExpr *expr, const NodeStmt *before, ValueTable &table, // NOLINT(*-no-recursion)
+                    const std::set<std::string> &varying) {
+        // a parenthesized expression is numbered as what it encloses
+        if (const auto term = std::get_if<NodeTerm *>(&expr->var)) {
+            if (const auto paren = std::get_if<NodeTermParen *>(&(*term)->var)) {
+                reuse_expr((*paren)->expr, before, table, varying);
+                return;
+            }
+        }
+        if (const std::optional<ValueKey> key = value_key(expr);
+            key.has_value() && key->cost >= min_reuse_cost
+            && std::ranges::none_of(key->reads, [&](const std::string &var) { return varying.contains(var); })) {
+            if (const auto it = table.find(key->text); it != table.end()) {
+                expr->var = make_ident(temp_of(*it->second))->var;
+                m_num_reused_exprs++;
+                return;
+            }
+            m_available.push_back({.first = expr, .before = before, .reads = key->reads, .temp = {}});
+            table.emplace(key->text, &m_available.back());
+        }
+        if (const auto bin_expr = std::get_if<NodeBinExpr *>(&expr->var)) {
+            const auto [lhs, rhs] = bin_operands(*bin_expr);
+            reuse_expr(lhs, before, table, varying);
+            reuse_expr(rhs, before, table, varying);
+            return;
+        }
+        const NodeTerm *term = std::get<NodeTerm *>(expr->var);
+        if (const auto call = std::get_if<NodeTermCall *>(&term->var)) {
+            for (NodeExpr *arg: (*call)->args) {
+                reuse_expr(arg, before, table, varying);
+            }
+        }
+        // indices are left as written for the bounds check and vectorizer patterns
+    }
+
+    // The variable holding `value`, declared on its first use: the first computation
+    // moves into `let __cseN = ...;` in front of its statement and reads it instead.
+    const std::string &temp_of(Available &value) {
+        if (!value.temp.empty()) {
+            return value.temp;
+        }
+        value.temp = "__cse" + std::to_string(m_num_temps++);
+        const auto computed = m_allocator.emplace<NodeExpr>();
+        computed->var = value.first->var;
+        value.first->var = make_ident(value.temp)->var;
+        const Token ident{TokenType::ident, value.before->line, value.temp};
+        const auto let = m_allocator.emplace<NodeStmtLet>(ident, computed);
+        // a temporary used in the computation of one declared earlier goes first
+        std::vector<NodeStmt *> &temps = m_temps[value.before];
+        const auto user = std::ranges::find_if(temps, [&](const NodeStmt *temp) {
+            return contains(std::get<NodeStmtLet *>(temp->var)->expr, value.first);
+        });
+        temps.insert(user, m_allocator.emplace<NodeStmt>(let, value.before->line, value.before->column));
+        return value.temp;
+    }
+
+    // Declares the temporaries in front of the statements they were made for.
+    void insert_temps(std::vector<NodeStmt *> &stmts) { // NOLINT(*-no-recursion)
+        std::vector<NodeStmt *> result;
+        for (NodeStmt *stmt: stmts) {
+            if (const auto temps = m_temps.find(stmt); temps != m_temps.end()) {
+                result.insert(result.end(), temps->second.begin(), temps->second.end());
+            }
+            if (const auto scope = std::get_if<NodeScope *>(&stmt->var)) {
+                insert_temps((*scope)->stmts);
+            } else if (const auto stmt_while = std::get_if<NodeStmtWhile *>(&stmt->var)) {
+                insert_temps((*stmt_while)->scope->stmts);
+            } else if (const auto stmt_if = std::get_if<NodeStmtIf *>(&stmt->var)) {
+                insert_temps((*stmt_if)->scope->stmts);
+                std::optional<NodeIfPred *> pred = (*stmt_if)->pred;
+                while (pred.has_value()) {
+                    if (const auto elif = std::get_if<NodeIfPredElif *>(&pred.value()->var)) {
+                        insert_temps((*elif)->scope->stmts);
+                        pred = (*elif)->pred;
+                    } else {
+                        insert_temps(std::get<NodeIfPredElse *>(pred.value()->var)->scope->stmts);
+                        pred.reset();
+                    }
+                }
+            }
+            result.push_back(stmt);
+        }
+        stmts = std::move(result);
+    }
+
+    // Whether evaluating `expr` can stop the program: an element read out of
+    // bounds, or a division by something other than a literal besides 0 and -1.
+    static bool can_fault(const NodeExpr *expr) { // NOLINT(*-no-recursion)
+        if (const auto bin_expr = std::get_if<NodeBinExpr *>(&expr->var)) {
+            const auto [lhs, rhs] = bin_operands(*bin_expr);
+            if (std::holds_alternative<NodeBinExprDiv *>((*bin_expr)->var)
+                || std::holds_alternative<NodeBinExprMod *>((*bin_expr)->var)) {
+                const auto divisor = int_literal(rhs);
+                if (!divisor.has_value() || divisor == 0 || divisor == -1) {
+                    return true;
+                }
+            }
+            return can_fault(lhs) || can_fault(rhs);
+        }
+        const NodeTerm *term = std::get<NodeTerm *>(expr->var);
+        if (const auto paren = std::get_if<NodeTermParen *>(&term->var)) {
+            return can_fault((*paren)->expr);
+        }
+        if (const auto call = std::get_if<NodeTermCall *>(&term->var)) {
+            return std::ranges::any_of((*call)->args, can_fault);
+        }
+        return std::holds_alternative<NodeTermIndex *>(term->var);
+    }
+
+    // The key of a pure, total expression, nothing for anything else. Operands of
+    // commutative operators are ordered, so `b * a` finds `a * b`.
+    static std::optional<ValueKey> value_key(const NodeExpr *expr) { // NOLINT(*-no-recursion)
+        if (const auto bin_expr = std::get_if<NodeBinExpr *>(&expr->var)) {
+            const auto [lhs_expr, rhs_expr] = bin_operands(*bin_expr);
+            std::optional<ValueKey> lhs = value_key(lhs_expr);
+            std::optional<ValueKey> rhs = value_key(rhs_expr);
+            if (!lhs.has_value() || !rhs.has_value()) {
+                return {};
+            }
+            const auto [op, cost, commutative] = op_info(*bin_expr);
+            if (std::holds_alternative<NodeBinExprDiv *>((*bin_expr)->var)
+                || std::holds_alternative<NodeBinExprMod *>((*bin_expr)->var)) {
+                // only a literal divisor other than 0 and -1 cannot fault
+                const auto divisor = int_literal(rhs_expr);
+                if (!divisor.has_value() || divisor == 0 || divisor == -1) {
+                    return {};
+                }
+            }
+            if (commutative && rhs->text < lhs->text) {
+                std::swap(lhs, rhs);
+            }
+            ValueKey key{.text = "(" + lhs->text + " " + std::string(op) + " " + rhs->text + ")",
+                         .cost = lhs->cost + rhs->cost + cost, .reads = std::move(lhs->reads)};
+            key.reads.insert(rhs->reads.begin(), rhs->reads.end());
+            return key;
+        }
+        const NodeTerm *term = std::get<NodeTerm *>(expr->var);
+        if (const auto int_lit = std::get_if<NodeTermIntLit *>(&term->var)) {
+            return ValueKey{.text = std::to_string((*int_lit)->int_lit.int_value), .cost = 0, .reads = {}};
+        }
+        if (const auto ident = std::get_if<NodeTermIdent *>(&term->var)) {
+            const std::string &name = (*ident)->ident.value.value();
+            return ValueKey{.text = name, .cost = 0, .reads = {name}};
+        }
+        if (const auto paren = std::get_if<NodeTermParen *>(&term->var)) {
+            return value_key((*paren)->expr);
+        }
+        return {};
+    }
+
+    struct OpInfo {
+        std::string_view op;
+        size_t cost;
+        bool commutative;
+    };
+
+    static OpInfo op_info(const NodeBinExpr *bin_expr) {
+        return std::visit([]<typename T>(const T *) -> OpInfo {
+            if constexpr (std::is_same_v<T, NodeBinExprAdd>) {
+                return {"+", 1, true};
+            } else if constexpr (std::is_same_v<T, NodeBinExprSub>) {
+                return {"-", 1, false};
+            } else if constexpr (std::is_same_v<T, NodeBinExprMulti>) {
+                return {"*", 3, true};
+            } else if constexpr (std::is_same_v<T, NodeBinExprDiv>) {
+                return {"/", 4, false};
+            } else if constexpr (std::is_same_v<T, NodeBinExprMod>) {
+                return {"%", 4, false};
+            } else if constexpr (std::is_same_v<T, NodeBinExprBitAnd>) {
+                return {"&", 1, true};
+            } else if constexpr (std::is_same_v<T, NodeBinExprBitOr>) {
+                return {"|", 1, true};
+            } else if constexpr (std::is_same_v<T, NodeBinExprBitXor>) {
+                return {"^", 1, true};
+            } else if constexpr (std::is_same_v<T, NodeBinExprShl>) {
+                return {"<<", 1, false};
+            } else if constexpr (std::is_same_v<T, NodeBinExprShr>) {
+                return {">>", 1, false};
+            } else if constexpr (std::is_same_v<T, NodeBinExprEq>) {
+                return {"==", 1, true};
+            } else if constexpr (std::is_same_v<T, NodeBinExprNotEq>) {
+                return {"!=", 1, true};
+            } else if constexpr (std::is_same_v<T, NodeBinExprLess>) {
+                return {"<", 1, false};
+            } else if constexpr (std::is_same_v<T, NodeBinExprLessEq>) {
+                return {"<=", 1, false};
+            } else if constexpr (std::is_same_v<T, NodeBinExprGreater>) {
+                return {">", 1, false};
+            } else if constexpr (std::is_same_v<T, NodeBinExprGreaterEq>) {
+                return {">=", 1, false};
+            } else if constexpr (std::is_same_v<T, NodeBinExprAnd>) {
+                // a branch on the lhs
+                return {"&&", 2, false};
+            } else {
+                return {"||", 2, false};
+            }
+        }, bin_expr->var);
+    }
+
+    static std::optional<int64_t> int_literal(const NodeExpr *expr) { // NOLINT(*-no-recursion)
+        const auto term = std::get_if<NodeTerm *>(&expr->var);
+        if (term == nullptr) {
+            return {};
+        }
+        if (const auto paren = std::get_if<NodeTermParen *>(&(*term)->var)) {
+            return int_literal((*paren)->expr);
+        }
+        if (const auto int_lit = std::get_if<NodeTermIntLit *>(&(*term)->var)) {
+            return (*int_lit)->int_lit.int_value;
+        }
+        return {};
+    }
+
+    // `var = var op ...` or `var = ... op var`
+    static bool updates(const Token &var, const NodeExpr *expr) {
+        const auto bin_expr = std::get_if<NodeBinExpr *>(&expr->var);
+        if (bin_expr == nullptr) {
+            return false;
+        }
+        const auto is_var = [&](const NodeExpr *operand) {
+            const auto term = std::get_if<NodeTerm *>(&operand->var);
+            return term != nullptr && std::holds_alternative<NodeTermIdent *>((*term)->var)
+                   && std::get<NodeTermIdent *>((*term)->var)->ident.value == var.value;
+        };
+        const auto [lhs, rhs] = bin_operands(*bin_expr);
+        return is_var(lhs) || is_var(rhs);
+    }
+
+    static bool contains(const NodeExpr *expr, const NodeExpr *node) { // NOLINT(*-no-recursion)
+        if (expr == node) {
+            return true;
+        }
+        if (const auto bin_expr = std::get_if<NodeBinExpr *>(&expr->var)) {
+            const auto [lhs, rhs] = bin_operands(*bin_expr);
+            return contains(lhs, node) || contains(rhs, node);
+        }
+        const NodeTerm *term = std::get<NodeTerm *>(expr->var);
+        if (const auto paren = std::get_if<NodeTermParen *>(&term->var)) {
+            return contains((*paren)->expr, node);
+        }
+        if (const auto call = std::get_if<NodeTermCall *>(&term->var)) {
+            return std::ranges::any_of((*call)->args, [&](const NodeExpr *arg) { return contains(arg, node); });
+        }
+        return false;
+    }
+
+    static void kill(ValueTable &table, const std::string &var) {
+        std::erase_if(table, [&](const auto &entry) { return entry.second->reads.contains(var); });
+    }
+
+    static void kill_defs(ValueTable &table, const std::vector<NodeStmt *> &stmts) {
+        std::set<std::string> defs;
+        collect_defs(stmts, defs);
+        for (const std::string &var: defs) {
+            kill(table, var);
+        }
+    }
+
+    // Every variable `stmts` write, nested statements included.
+    static void collect_defs(const std::vector<NodeStmt *> &stmts, std::set<std::string> &defs) { // NOLINT(*-no-recursion)
+        for (const NodeStmt *stmt: stmts) {
+            if (const auto def = stmt_def(stmt)) {
+                defs.insert(def.value());
+            } else if (const auto scope = std::get_if<NodeScope *>(&stmt->var)) {
+                collect_defs((*scope)->stmts, defs);
+            } else if (const auto stmt_while = std::get_if<NodeStmtWhile *>(&stmt->var)) {
+                collect_defs((*stmt_while)->scope->stmts, defs);
+            } else if (const auto stmt_if = std::get_if<NodeStmtIf *>(&stmt->var)) {
+                collect_defs((*stmt_if)->scope->stmts, defs);
+                std::optional<NodeIfPred *> pred = (*stmt_if)->pred;
+                while (pred.has_value()) {
+                    if (const auto elif = std::get_if<NodeIfPredElif *>(&pred.value()->var)) {
+                        collect_defs((*elif)->scope->stmts, defs);
+                        pred = (*elif)->pred;
+                    } else {
+                        collect_defs(std::get<NodeIfPredElse *>(pred.value()->var)->scope->stmts, defs);
+                        pred.reset();
+                    }
+                }
+            }
+        }
+    }
+
+    NodeExpr *make_ident(const std::string &name) {
+        const Token token{TokenType::ident, 0, name};
+        return m_allocator.emplace<NodeExpr>(m_allocator.emplace<NodeTerm>(m_allocator.emplace<NodeTermIdent>(token)));
+    }
+
+    NodeExpr *make_literal(const int64_t value) {
+        const Token token{.type = TokenType::int_lit, .line = 0, .value = std::to_string(value), .int_value = value};
+        return m_allocator.emplace<NodeExpr>(m_allocator.emplace<NodeTerm>(m_allocator.emplace<NodeTermIntLit>(token)));
+    }
+
+    // Replaces constant expressions, evaluated in the environment at each statement.
+    void fold(const ControlFlowGraph &cfg, const ConstantPropagation &constants) {
+        for (size_t b = 0; b < cfg.blocks().size(); b++) {
+            if (!constants.executable(b)) {
+                continue;
+            }
+            const BasicBlock &block = cfg.blocks()[b];
+            ConstEnv env = constants.env_in(b);
+            for (const NodeStmt *stmt: block.stmts) {
+                if (const auto assign_index = std::get_if<NodeStmtAssignIndex *>(&stmt->var)) {
+                    fold_index((*assign_index)->ident, (*assign_index)->index, env);
+                }
+                for (NodeExpr *expr: stmt_exprs(stmt)) {
+                    fold_expr(expr, env);
+                }
+                ConstantPropagation::transfer(stmt, env);
+            }
+            if (block.cond != nullptr) {
+                fold_expr(const_cast<NodeExpr *>(block.cond), env);
+            }
+        }
+    }
+
+    // Only values `accept` allows are turned into literals: a literal zero divisor or
+    // out of range index would turn a run time fault into a compile error.
+    void fold_expr(NodeExpr *expr, const ConstEnv &env, // NOLINT(*-no-recursion)
+                   const std::function<bool(int64_t)> &accept = any_value) {
+        if (const LatticeValue value = ConstantPropagation::eval(expr, env); value.is_constant()) {
+            const auto term = std::get_if<NodeTerm *>(&expr->var);
+            const bool is_literal = term != nullptr && std::holds_alternative<NodeTermIntLit *>((*term)->var);
+            if (!is_literal && accept(value.value)) {
+                expr->var = make_literal(value.value)->var;
+                m_num_folded++;
+            }
+            return;
+        }
+        if (const auto bin_expr = std::get_if<NodeBinExpr *>(&expr->var)) {
+            const auto [lhs, rhs] = bin_operands(*bin_expr);
+            const bool divides = std::holds_alternative<NodeBinExprDiv *>((*bin_expr)->var)
+                                 || std::holds_alternative<NodeBinExprMod *>((*bin_expr)->var);
+            fold_expr(lhs, env);
+            if (divides) {
+                fold_expr(rhs, env, [](const int64_t value) { return value != 0; });
+            } else {
+                fold_expr(rhs, env);
+            }
+            return;
+        }
+        const NodeTerm *term = std::get<NodeTerm *>(expr->var);
+        if (const auto paren = std::get_if<NodeTermParen *>(&term->var)) {
+            fold_expr((*paren)->expr, env, accept);
+        } else if (const auto index = std::get_if<NodeTermIndex *>(&term->var)) {
+            fold_index((*index)->ident, (*index)->index, env);
+        } else if (const auto call = std::get_if<NodeTermCall *>(&term->var)) {
+            for (NodeExpr *arg: (*call)->args) {
+                fold_expr(arg, env);
+            }
+        }
+    }
+
+    static bool any_value(int64_t) {
+        return true;
+    }
+
+    void fold_index(const Token &array, NodeExpr *index, const ConstEnv &env) {
+        const auto it = m_array_lengths.find(array.value.value());
+        const int64_t length = it == m_array_lengths.end() ? 0 : it->second;
+        fold_expr(index, env, [length](const int64_t value) { return value >= 0 && value < length; });
+    }
+
+    // Shortest length declared for every array name, so that a folded index is in
+    // range whichever of the arrays of that name it refers to.
+    void collect_array_lengths(const std::vector<NodeStmt *> &stmts) { // NOLINT(*-no-recursion)
+        for (const NodeStmt *stmt: stmts) {
+            if (const auto let_array = std::get_if<NodeStmtLetArray *>(&stmt->var)) {
+                const LatticeValue length = ConstantPropagation::eval_literal((*let_array)->size);
+                const auto [it, inserted] = m_array_lengths.try_emplace((*let_array)->ident.value.value(),
+                                                                        length.value);
+                if (!length.is_constant()) {
+                    it->second = 0;
+                } else if (!inserted) {
+                    it->second = std::min(it->second, length.value);
+                }
+            } else if (const auto fn = std::get_if<NodeStmtFn *>(&stmt->var)) {
+                collect_array_lengths((*fn)->scope->stmts);
+            } else if (const auto scope = std::get_if<NodeScope *>(&stmt->var)) {
+                collect_array_lengths((*scope)->stmts);
+            } else if (const auto stmt_while = std::get_if<NodeStmtWhile *>(&stmt->var)) {
+                collect_array_lengths((*stmt_while)->scope->stmts);
+            } else if (const auto stmt_if = std::get_if<NodeStmtIf *>(&stmt->var)) {
+                collect_array_lengths((*stmt_if)->scope->stmts);
+                std::optional<NodeIfPred *> pred = (*stmt_if)->pred;
+                while (pred.has_value()) {
+                    if (const auto elif = std::get_if<NodeIfPredElif *>(&pred.value()->var)) {
+                        collect_array_lengths((*elif)->scope->stmts);
+                        pred = (*elif)->pred;
+                    } else {
+                        collect_array_lengths(std::get<NodeIfPredElse *>(pred.value()->var)->scope->stmts);
+                        pred.reset();
+                    }
+                }
+            }
+        }
+    }
+
+    static std::vector<NodeExpr *> stmt_exprs(const NodeStmt *stmt) {
+        if (const auto stmt_exit = std::get_if<NodeStmtExit *>(&stmt->var)) {
+            return {(*stmt_exit)->expr};
+        }
+        if (const auto let = std::get_if<NodeStmtLet *>(&stmt->var)) {
+            return {(*let)->expr};
+        }
+        if (const auto assign = std::get_if<NodeStmtAssign *>(&stmt->var)) {
+            return {(*assign)->expr};
+        }
+        if (const auto assign_index = std::get_if<NodeStmtAssignIndex *>(&stmt->var)) {
+            return {(*assign_index)->expr};
+        }
+        if (const auto print = std::get_if<NodeStmtPrint *>(&stmt->var)) {
+            return {(*print)->expr};
+        }
+        if (const auto ret = std::get_if<NodeStmtReturn *>(&stmt->var)) {
+            return {(*ret)->expr};
+        }
+        if (const auto call = std::get_if<NodeStmtCall *>(&stmt->var)) {
+            return (*call)->call->args;
+        }
+        return {};
+    }
+
+    struct Arm {
+        NodeExpr *cond; // null for else
+        NodeScope *scope;
+        int line;
+    };
+
+    // Drops statements in blocks that never execute and branches that are never taken.
+    void prune(std::vector<NodeStmt *> &stmts, const ControlFlowGraph &cfg, // NOLINT(*-no-recursion)
+               const ConstantPropagation &constants) {
+        std::vector<NodeStmt *> kept;
+        for (NodeStmt *stmt: stmts) {
+            if (std::holds_alternative<NodeStmtFn *>(stmt->var)) {
+                // declarations, their bodies are optimized on their own
+                kept.push_back(stmt);
+                continue;
+            }
+            if (!constants.executable(cfg.block_of(stmt))) {
+                m_num_removed_stmts++;
+                continue;
+            }
+            if (const auto stmt_if = std::get_if<NodeStmtIf *>(&stmt->var)) {
+                if (!prune_if(stmt, *stmt_if, cfg, constants)) {
+                    continue;
+                }
+            } else if (const auto stmt_while = std::get_if<NodeStmtWhile *>(&stmt->var)) {
+                if (constants.branch_outcome(cfg.cond_block((*stmt_while)->condition)) == false) {
+                    m_num_pruned_branches++;
+                    continue;
+                }
+                prune((*stmt_while)->scope->stmts, cfg, constants);
+            } else if (const auto scope = std::get_if<NodeScope *>(&stmt->var)) {
+                prune((*scope)->stmts, cfg, constants);
+                if ((*scope)->stmts.empty()) {
+                    continue;
+                }
+            }
+            kept.push_back(stmt);
+        }
+        stmts = std::move(kept);
+    }
+
+    // Rewrites the if chain of `stmt`, returns false if nothing of it is left.
+    bool prune_if(NodeStmt *stmt, NodeStmtIf *stmt_if, const ControlFlowGraph &cfg, // NOLINT(*-no-recursion)
+                  const ConstantPropagation &constants) {
+        std::vector<Arm> arms = {{.cond = stmt_if->expr, .scope = stmt_if->scope, .line = stmt->line}};
+        std::optional<NodeIfPred *> pred = stmt_if->pred;
+        while (pred.has_value()) {
+            if (const auto elif = std::get_if<NodeIfPredElif *>(&pred.value()->var)) {
+                arms.push_back({.cond = (*elif)->expr, .scope = (*elif)->scope, .line = (*elif)->line});
+                pred = (*elif)->pred;
+            } else {
+                const NodeIfPredElse *else_ = std::get<NodeIfPredElse *>(pred.value()->var);
+                arms.push_back({.cond = nullptr, .scope = else_->scope, .line = else_->line});
+                pred.reset();
+            }
+        }
+
+        std::vector<Arm> kept;
+        bool changed = false;
+        for (const Arm &arm: arms) {
+            if (arm.cond == nullptr) {
+                kept.push_back(arm);
+                break;
+            }
+            const std::optional<bool> outcome = constants.branch_outcome(cfg.cond_block(arm.cond));
+            if (outcome == false) {
+                changed = true;
+                m_num_pruned_branches++;
+                continue;
+            }
+            if (outcome == true) {
+                changed = true;
+                m_num_pruned_branches++;
+                kept.push_back({.cond = nullptr, .scope = arm.scope, .line = arm.line});
+                break;
+            }
+            kept.push_back(arm);
+        }
+
+        for (const Arm &arm: kept) {
+            prune(arm.scope->stmts, cfg, constants);
+        }
+        if (kept.empty()) {
+            return false;
+        }
+        if (kept.front().cond == nullptr) {
+            stmt->var = kept.front().scope;
+            return true;
+        }
+        if (changed) {
+            stmt_if->expr = kept.front().cond;
+            stmt_if->scope = kept.front().scope;
+            stmt_if->pred = make_pred(kept, 1);
+        }
+        return true;
+    }
+
+    std::optional<NodeIfPred *> make_pred(const std::vector<Arm> &arms, const size_t i) { // NOLINT(*-no-recursion)
+        if (i == arms.size()) {
+            return {};
+        }
+        if (arms[i].cond == nullptr) {
+            const auto else_ = m_allocator.emplace<NodeIfPredElse>(arms[i].scope, arms[i].line);
+            return m_allocator.emplace<NodeIfPred>(else_);
+        }
+        const auto elif = m_allocator.emplace<NodeIfPredElif>(arms[i].cond, arms[i].scope, make_pred(arms, i + 1),
+                                                              arms[i].line);
+        return m_allocator.emplace<NodeIfPred>(elif);
+    }
+
+    // Removes `dead` statements wherever they are nested.
+    void erase(std::vector<NodeStmt *> &stmts, const std::set<const NodeStmt *> &dead) { // NOLINT(*-no-recursion)
+        for (const NodeStmt *stmt: stmts) {
+            if (const auto scope = std::get_if<NodeScope *>(&stmt->var)) {
+                erase((*scope)->stmts, dead);
+            } else if (const auto stmt_while = std::get_if<NodeStmtWhile *>(&stmt->var)) {
+                erase((*stmt_while)->scope->stmts, dead);
+            } else if (const auto stmt_if = std::get_if<NodeStmtIf *>(&stmt->var)) {
+                erase((*stmt_if)->scope->stmts, dead);
+                std::optional<NodeIfPred *> pred = (*stmt_if)->pred;
+                while (pred.has_value()) {
+                    if (const auto elif = std::get_if<NodeIfPredElif *>(&pred.value()->var)) {
+                        erase((*elif)->scope->stmts, dead);
+                        pred = (*elif)->pred;
+                    } else {
+                        erase(std::get<NodeIfPredElse *>(pred.value()->var)->scope->stmts, dead);
+                        pred.reset();
+                    }
+                }
+            }
+        }
+        std::erase_if(stmts, [&](const NodeStmt *stmt) {
+            if (dead.contains(stmt)) {
+                m_num_removed_stmts++;
+                return true;
+            }
+            // scopes and branches that only held dead statements
+            if (const auto scope = std::get_if<NodeScope *>(&stmt->var)) {
+                return (*scope)->stmts.empty();
+            }
+            if (const auto stmt_if = std::get_if<NodeStmtIf *>(&stmt->var)) {
+                return is_empty_if(*stmt_if);
+            }
+            return false;
+        });
+    }
+
+    // An if chain with nothing in any arm and no calls or faults in any condition.
+    static bool is_empty_if(const NodeStmtIf *stmt_if) {
+        if (!stmt_if->scope->stmts.empty() || has_call(stmt_if->expr) || can_fault(stmt_if->expr)) {
+            return false;
+        }
+        std::optional<NodeIfPred *> pred = stmt_if->pred;
+        while (pred.has_value()) {
+            if (const auto elif = std::get_if<NodeIfPredElif *>(&pred.value()->var)) {
+                if (!(*elif)->scope->stmts.empty() || has_call((*elif)->expr) || can_fault((*elif)->expr)) {
+                    return false;
+                }
+                pred = (*elif)->pred;
+            } else {
+                return std::get<NodeIfPredElse *>(pred.value()->var)->scope->stmts.empty();
+            }
+        }
+        return true;
+    }
+
+    NodeProg &m_prog;
+    ArenaAllocator &m_allocator;
+    size_t m_unroll;
+    std::map<std::string, int64_t> m_array_lengths;
+    size_t m_num_folded = 0;
+    size_t m_num_pruned_branches = 0;
+    size_t m_num_removed_stmts = 0;
+    size_t m_num_evaluated_loops = 0;
+    size_t m_num_unrolled_loops = 0;
+    size_t m_num_reused_exprs = 0;
+    // value numbering state, see reuse_values
+    std::deque<Available> m_available;
+    std::map<const NodeStmt *, std::vector<NodeStmt *>> m_temps;
+    size_t m_num_temps = 0;
+};
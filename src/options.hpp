@@ -0,0 +1,215 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+#include "protocol.hpp"
+
+#ifndef GENESIS_VERSION
+#define GENESIS_VERSION "dev"
+#endif
+
+enum class TimeReportFormat {
+    none,
+    text,
+    json,
+};
+
+struct CompileOptions {
+    std::string input_path;
+    TimeReportFormat time_report = TimeReportFormat::none;
+
+    // runtime execution counters, see GeneratorOptions
+    bool instrument = false;
+    std::string profile_path = "gn.prof";
+    // --profile-use: counts from such a run to lay out branches by, see Generator::gen_if_profiled
+    std::string profile_use_path;
+
+    // DWARF line tables pointing back at the .gn source
+    bool debug_info = false;
+
+    // AST optimizations driven by dataflow analysis, see optimizer.hpp
+    bool optimize = true;
+    size_t inline_threshold = 16;
+    bool vectorize = true;
+    // copies of a counted loop body per condition test, 1 disables unrolling
+    size_t unroll = 4;
+    // stop reporting after this many errors, 0 for no limit
+    size_t max_errors = 20;
+    // threads running a `parallel while`, 0 for one per CPU the program may use
+    size_t threads = 0;
+
+    // --stream: compile each top-level statement as soon as it is parsed, keeping
+    // neither the token list nor the AST of the whole file. Implies -O0, since the
+    // optimizer needs the whole program.
+    bool stream = false;
+
+    // -S: write out.asm and stop, without assembling, linking or running
+    bool stop_after_asm = false;
+
+    // `--serve`: answer compile requests on a Unix socket instead, see server.hpp
+    bool serve = false;
+    std::string socket_path;
+    size_t workers = 0; // 0: one per hardware thread
+
+    // compile cache
+    bool use_cache = true;
+    std::string cache_dir;
+    uintmax_t cache_max_bytes = 256 * 1024 * 1024; // 256 mb
+
+    // Everything that changes the produced executable goes in here, so that a
+    // cached binary is never reused for a compile that would have built a different one.
+    [[nodiscard]] std::string fingerprint() const {
+        std::stringstream ss;
+        ss << "version=" << GENESIS_VERSION << ";";
+        if (instrument) {
+            ss << "instrument=" << profile_path << ";";
+        }
+        ss << "optimize=" << optimize << ";";
+        ss << "inline=" << inline_threshold << ";";
+        ss << "vectorize=" << vectorize << ";";
+        ss << "unroll=" << unroll << ";";
+        ss << "threads=" << threads << ";";
+        if (!profile_use_path.empty()) {
+            // the profile contents are part of the cache key as well
+            ss << "profile-use;";
+        }
+        if (stream) {
+            // forward calls are not inlined
+            ss << "stream;";
+        }
+        if (debug_info) {
+            // the line table embeds the source path
+            ss << "debug=" << input_path << ";";
+        }
+        return ss.str();
+    }
+};
+
+inline std::string default_cache_dir() {
+    if (const char *dir = std::getenv("GENY_CACHE_DIR"); dir != nullptr && *dir != '\0') {
+        return dir;
+    }
+    if (const char *xdg = std::getenv("XDG_CACHE_HOME"); xdg != nullptr && *xdg != '\0') {
+        return std::string(xdg) + "/geny";
+    }
+    if (const char *home = std::getenv("HOME"); home != nullptr && *home != '\0') {
+        return std::string(home) + "/.cache/geny";
+    }
+    return ".geny-cache";
+}
+
+inline void print_usage() {
+    std::cerr << "Incorrect usage. Correct usage is..." << std::endl;
+    std::cerr << "./geny [options] ../<input.gn>" << std::endl;
+    std::cerr << "./geny --serve[=<socket>] [--workers=<n>]" << std::endl;
+    std::cerr << "Options:" << std::endl;
+    std::cerr << "    --instrument[=<file>]    count block, branch and loop executions per source line," << std::endl;
+    std::cerr << "                             written to <file> (default gn.prof) at exit" << std::endl;
+    std::cerr << "    --profile-generate[=<file>] same as --instrument" << std::endl;
+    std::cerr << "    --profile-use=<file>     lay out if/elif chains by the counts of an instrumented run" << std::endl;
+    std::cerr << "    -g, --debug              emit DWARF line info mapping instructions to .gn lines" << std::endl;
+    std::cerr << "    -O0                      skip constant propagation, loop evaluation, unrolling and dead code removal" << std::endl;
+    std::cerr << "    --inline-threshold=<n>   inline single-return functions of up to n nodes (0: off)" << std::endl;
+    std::cerr << "    --no-vectorize           keep element-wise array loops scalar" << std::endl;
+    std::cerr << "    --unroll=<n>             copies of small counted loop bodies per test (1: off)" << std::endl;
+    std::cerr << "    --threads=<n>            threads of `parallel while` loops (default: one per CPU)" << std::endl;
+    std::cerr << "    --max-errors=<n>         stop after n errors (default 20, 0: report all)" << std::endl;
+    std::cerr << "    --stream                 generate each top-level statement as it is parsed, in memory" << std::endl;
+    std::cerr << "                             bounded by nesting depth (implies -O0)" << std::endl;
+    std::cerr << "    -S                       write out.asm and stop before assembling" << std::endl;
+    std::cerr << "    --serve[=<socket>]       compile requests from geny_client (default $GENY_SOCKET)" << std::endl;
+    std::cerr << "    --workers=<n>            requests compiled at once by --serve (default: all cores)" << std::endl;
+    std::cerr << "    --time-report[=json]     print per stage timings and memory use to stderr" << std::endl;
+    std::cerr << "    --no-cache               always run the full pipeline" << std::endl;
+    std::cerr << "    --cache-dir=<dir>        compile cache location (default $GENY_CACHE_DIR)" << std::endl;
+    std::cerr << "    --cache-max-size=<bytes> evict least recently used entries above this size" << std::endl;
+}
+
+inline std::optional<CompileOptions> parse_args(const int argc, char *argv[]) {
+    CompileOptions opts;
+    opts.cache_dir = default_cache_dir();
+    opts.socket_path = default_socket_path();
+    for (int i = 1; i < argc; i++) {
+        const std::string_view arg = argv[i];
+        if (arg == "--time-report") {
+            opts.time_report = TimeReportFormat::text;
+        } else if (arg == "--time-report=json") {
+            opts.time_report = TimeReportFormat::json;
+        } else if (arg == "--instrument") {
+            opts.instrument = true;
+        } else if (arg.starts_with("--instrument=")) {
+            opts.instrument = true;
+            opts.profile_path = arg.substr(std::string_view("--instrument=").size());
+        } else if (arg == "--profile-generate") {
+            opts.instrument = true;
+        } else if (arg.starts_with("--profile-generate=")) {
+            opts.instrument = true;
+            opts.profile_path = arg.substr(std::string_view("--profile-generate=").size());
+        } else if (arg.starts_with("--profile-use=")) {
+            opts.profile_use_path = arg.substr(std::string_view("--profile-use=").size());
+        } else if (arg == "-g" || arg == "--debug") {
+            opts.debug_info = true;
+        } else if (arg == "-O0") {
+            opts.optimize = false;
+        } else if (arg.starts_with("--inline-threshold=")) {
+            opts.inline_threshold = std::strtoull(argv[i] + std::string_view("--inline-threshold=").size(), nullptr, 10);
+        } else if (arg == "--no-vectorize") {
+            opts.vectorize = false;
+        } else if (arg.starts_with("--threads=")) {
+            opts.threads = std::strtoull(argv[i] + std::string_view("--threads=").size(), nullptr, 10);
+        } else if (arg.starts_with("--max-errors=")) {
+            opts.max_errors = std::strtoull(argv[i] + std::string_view("--max-errors=").size(), nullptr, 10);
+        } else if (arg.starts_with("--unroll=")) {
+            opts.unroll = std::max<size_t>(1, std::strtoull(argv[i] + std::string_view("--unroll=").size(), nullptr, 10));
+        } else if (arg == "--stream") {
+            opts.stream = true;
+        } else if (arg == "-S") {
+            opts.stop_after_asm = true;
+        } else if (arg == "--serve") {
+            opts.serve = true;
+        } else if (arg.starts_with("--serve=")) {
+            opts.serve = true;
+            opts.socket_path = arg.substr(std::string_view("--serve=").size());
+        } else if (arg.starts_with("--workers=")) {
+            opts.workers = std::strtoull(argv[i] + std::string_view("--workers=").size(), nullptr, 10);
+        } else if (arg == "--no-cache") {
+            opts.use_cache = false;
+        } else if (arg.starts_with("--cache-dir=")) {
+            opts.cache_dir = arg.substr(std::string_view("--cache-dir=").size());
+        } else if (arg.starts_with("--cache-max-size=")) {
+            opts.cache_max_bytes = std::strtoull(argv[i] + std::string_view("--cache-max-size=").size(), nullptr, 10);
+        } else if (arg.starts_with("--")) {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return {};
+        } else if (opts.input_path.empty()) {
+            opts.input_path = arg;
+        } else {
+            return {};
+        }
+    }
+    if (opts.serve) {
+        return opts.input_path.empty() ? std::optional(opts) : std::nullopt;
+    }
+    if (opts.input_path.empty()) {
+        return {};
+    }
+    if (opts.stream) {
+        opts.optimize = false;
+    }
+    if (!opts.profile_use_path.empty() && !std::filesystem::is_regular_file(opts.profile_use_path)) {
+        std::cerr << "Cannot read profile: " << opts.profile_use_path << std::endl;
+        return {};
+    }
+    if (opts.debug_info) {
+        opts.input_path = std::filesystem::absolute(opts.input_path).lexically_normal().string();
+    }
+    return opts;
+}
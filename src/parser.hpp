@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <cassert>
 #include <variant>
 
@@ -71,6 +72,48 @@ struct NodeBinExprDiv {
     NodeExpr *rhs;
 };
 
+struct NodeBinExprMod {
+    NodeExpr *lhs;
+    NodeExpr *rhs;
+};
+
+//bitwise and shifts
+struct NodeBinExprBitAnd {
+    NodeExpr *lhs;
+    NodeExpr *rhs;
+};
+
+struct NodeBinExprBitOr {
+    NodeExpr *lhs;
+    NodeExpr *rhs;
+};
+
+struct NodeBinExprBitXor {
+    NodeExpr *lhs;
+    NodeExpr *rhs;
+};
+
+struct NodeBinExprShl {
+    NodeExpr *lhs;
+    NodeExpr *rhs;
+};
+
+struct NodeBinExprShr {
+    NodeExpr *lhs;
+    NodeExpr *rhs;
+};
+
+//logical, the rhs is only evaluated when it decides the result
+struct NodeBinExprAnd {
+    NodeExpr *lhs;
+    NodeExpr *rhs;
+};
+
+struct NodeBinExprOr {
+    NodeExpr *lhs;
+    NodeExpr *rhs;
+};
+
 struct NodeBinExpr {
     std::variant<
         NodeBinExprAdd *,
@@ -82,11 +125,34 @@ struct NodeBinExpr {
         NodeBinExprLess *,
         NodeBinExprLessEq *,
         NodeBinExprGreater *,
-        NodeBinExprGreaterEq *> var;
+        NodeBinExprGreaterEq *,
+        NodeBinExprMod *,
+        NodeBinExprBitAnd *,
+        NodeBinExprBitOr *,
+        NodeBinExprBitXor *,
+        NodeBinExprShl *,
+        NodeBinExprShr *,
+        NodeBinExprAnd *,
+        NodeBinExprOr *> var;
+};
+
+inline std::pair<NodeExpr *, NodeExpr *> bin_operands(const NodeBinExpr *bin_expr) {
+    return std::visit([](const auto *bin) { return std::pair(bin->lhs, bin->rhs); }, bin_expr->var);
+}
+
+struct NodeTermCall {
+    Token name;
+    std::vector<NodeExpr *> args;
+};
+
+// array element read
+struct NodeTermIndex {
+    Token ident;
+    NodeExpr *index{};
 };
 
 struct NodeTerm {
-    std::variant<NodeTermIntLit *, NodeTermIdent *, NodeTermParen *> var;
+    std::variant<NodeTermIntLit *, NodeTermIdent *, NodeTermParen *, NodeTermCall *, NodeTermIndex *> var;
     // Explicit constructors:
     NodeTerm(NodeTermIntLit *p) : var(p) {
     }
@@ -96,6 +162,12 @@ struct NodeTerm {
 
     NodeTerm(NodeTermParen *p) : var(p) {
     }
+
+    NodeTerm(NodeTermCall *p) : var(p) {
+    }
+
+    NodeTerm(NodeTermIndex *p) : var(p) {
+    }
 };
 
 struct NodeExpr {
@@ -123,10 +195,12 @@ struct NodeIfPredElif {
     NodeExpr *expr{};
     NodeScope *scope{};
     std::optional<NodeIfPred *> pred;
+    int line = 0;
 };
 
 struct NodeIfPredElse {
-    NodeScope *scope;
+    NodeScope *scope{};
+    int line = 0;
 };
 
 struct NodeIfPred {
@@ -148,6 +222,12 @@ struct NodeStmtAssign {
 struct NodeStmtWhile {
     NodeExpr *condition;
     NodeScope *scope;
+    // Set by the optimizer: while `unrolled_condition` holds, at least `unroll` more
+    // iterations run, so the body is emitted that many times per test.
+    size_t unroll = 1;
+    NodeExpr *unrolled_condition = nullptr;
+    // `parallel while`: iterations are spread over threads, see Generator::gen_parallel_while
+    bool parallel = false;
 };
 
 //input and print
@@ -155,49 +235,128 @@ struct NodeStmtPrint {
     NodeExpr *expr;
 };
 
+// output of a loop the optimizer evaluated at compile time
+struct NodeStmtPrintText {
+    std::string text;
+};
+
 struct NodeStmtInput {
     Token ident; // identifier that will receive the input
 };
 
+//functions
+struct NodeStmtFn {
+    Token name;
+    std::vector<Token> params;
+    NodeScope *scope{};
+};
+
+struct NodeStmtReturn {
+    NodeExpr *expr{};
+};
+
+// a call whose result is discarded
+struct NodeStmtCall {
+    NodeTermCall *call{};
+};
+
+//arrays
+struct NodeStmtLetArray {
+    Token ident;
+    Token size; // int literal
+};
+
+struct NodeStmtAssignIndex {
+    Token ident;
+    NodeExpr *index{};
+    NodeExpr *expr{};
+};
+
 
 struct NodeStmt {
     std::variant<NodeStmtExit *, NodeStmtLet *, NodeScope *, NodeStmtIf *, NodeStmtAssign *,
         //addes for while loop
         NodeStmtWhile *,
         NodeStmtPrint *,
-        NodeStmtInput *> var;
+        NodeStmtInput *,
+        NodeStmtFn *,
+        NodeStmtReturn *,
+        NodeStmtCall *,
+        NodeStmtLetArray *,
+        NodeStmtAssignIndex *,
+        NodeStmtPrintText *> var;
+    int line = 0; // line of the statement's first token
+    int column = 0; // and its column
 };
 
 struct NodeProg {
     std::vector<NodeStmt *> stmts;
 };
 
+// Recursive descent parser. A syntax error is reported to `diagnostics` and
+// parsing resumes after the statement it occurred in, so one pass finds every
+// error in the file; parse_prog only returns a program if there were none.
 class Parser {
 public:
-    explicit Parser(std::vector<Token> tokens)
+    static constexpr size_t default_arena_bytes = 1024 * 1024 * 4; // 4 mb
+
+    // The AST is allocated from `allocator` and lives as long as the parser.
+    Parser(std::vector<Token> tokens, Diagnostics &diagnostics,
+           ArenaAllocator allocator = ArenaAllocator(default_arena_bytes))
         : m_tokens(std::move(tokens))
-          , m_allocator(1024 * 1024 * 4) // 4 mb
+          , m_allocator(std::move(allocator))
+          , m_diagnostics(diagnostics)
+    {
+    }
+
+    // Parses tokens as they come out of `stream`; used through parse_top_stmt so
+    // that each statement can be compiled and released before the next is read.
+    Parser(TokenStream &stream, Diagnostics &diagnostics,
+           ArenaAllocator allocator = ArenaAllocator(default_arena_bytes))
+        : m_stream(&stream)
+          , m_allocator(std::move(allocator))
+          , m_diagnostics(diagnostics)
     {
     }
 
-    void error_expected(const std::string &msg) const {
-        std::cerr << "[Parse Error] Expected " << msg << " on line " << peek(-1).value().line << std::endl;
-        exit(EXIT_FAILURE);
+    // Reports what the current token should have been and unwinds to the
+    // enclosing statement list, see synchronize().
+    [[noreturn]] void error_expected(const std::string &msg) const {
+        if (const Token *token = peek()) {
+            m_diagnostics.error(token->line, token->column, "Expected " + msg + ", found " + to_string(token->type));
+        } else if (const Token *last = last_token()) {
+            m_diagnostics.error(last->line, last->column, "Expected " + msg + " at end of file");
+        } else {
+            m_diagnostics.error(1, 0, "Expected " + msg + " at end of file");
+        }
+        throw ParseError{};
     }
 
     std::optional<NodeTerm *> parse_term() // NOLINT(*-no-recursion)
     {
         if (auto int_lit = try_consume(TokenType::int_lit)) {
-            auto term_int_lit = m_allocator.emplace<NodeTermIntLit>(int_lit.value());
+            auto term_int_lit = m_allocator.emplace<NodeTermIntLit>(std::move(int_lit.value()));
             auto term = m_allocator.emplace<NodeTerm>(term_int_lit);
             return term;
         }
+        if (peek_is(TokenType::ident) && peek_is(TokenType::open_paren, 1)) {
+            auto term = m_allocator.emplace<NodeTerm>(parse_call());
+            return term;
+        }
+        if (peek_is(TokenType::ident) && peek_is(TokenType::open_bracket, 1)) {
+            auto term_index = m_allocator.emplace<NodeTermIndex>();
+            term_index->ident = consume();
+            consume();
+            term_index->index = parse_index();
+            auto term = m_allocator.emplace<NodeTerm>(term_index);
+            return term;
+        }
         if (auto ident = try_consume(TokenType::ident)) {
-            auto expr_ident = m_allocator.emplace<NodeTermIdent>(ident.value());
+            auto expr_ident = m_allocator.emplace<NodeTermIdent>(std::move(ident.value()));
             auto term = m_allocator.emplace<NodeTerm>(expr_ident);
             return term;
         }
-        if (const auto open_paren = try_consume(TokenType::open_paren)) {
+        if (try_consume(TokenType::open_paren)) {
             auto expr = parse_expr();
             if (!expr.has_value()) {
                 error_expected("expression");
@@ -210,6 +369,36 @@ public:
         return {};
     }
 
+    // expr `]`, after the `[`
+    NodeExpr *parse_index() // NOLINT(*-no-recursion)
+    {
+        const auto index = parse_expr();
+        if (!index.has_value()) {
+            error_expected("expression");
+        }
+        try_consume_err(TokenType::close_bracket);
+        return index.value();
+    }
+
+    // ident `(` [expr {`,` expr}] `)`
+    NodeTermCall *parse_call() // NOLINT(*-no-recursion)
+    {
+        auto call = m_allocator.emplace<NodeTermCall>();
+        call->name = consume();
+        consume();
+        if (!try_consume(TokenType::close_paren)) {
+            do {
+                if (const auto arg = parse_expr()) {
+                    call->args.push_back(arg.value());
+                } else {
+                    error_expected("expression");
+                }
+            } while (try_consume(TokenType::comma));
+            try_consume_err(TokenType::close_paren);
+        }
+        return call;
+    }
+
     std::optional<NodeExpr *> parse_expr(const int min_prec = 0) // NOLINT(*-no-recursion)
     {
         std::optional<NodeTerm *> term_lhs = parse_term();
@@ -218,18 +407,13 @@ public:
         }
         auto expr_lhs = m_allocator.emplace<NodeExpr>(term_lhs.value());
 
-        while (true) {
-            std::optional<Token> curr_tok = peek();
-            std::optional<int> prec;
-            if (curr_tok.has_value()) {
-                prec = bin_prec(curr_tok->type);
-                if (!prec.has_value() || prec < min_prec) {
-                    break;
-                }
-            } else {
+        while (const Token *curr_tok = peek()) {
+            const std::optional<int> prec = bin_prec(curr_tok->type);
+            if (!prec.has_value() || prec < min_prec) {
                 break;
             }
-            const auto [type, line, value] = consume();
+            const TokenType type = curr_tok->type;
+            skip();
             const int next_min_prec = prec.value() + 1;
             auto expr_rhs = parse_expr(next_min_prec);
             if (!expr_rhs.has_value()) {
@@ -275,6 +459,22 @@ public:
             } else if (type == TokenType::greater_eq) {
                 auto greater_eq = m_allocator.emplace<NodeBinExprGreaterEq>(expr_lhs2, expr_rhs.value());
                 expr->var = greater_eq;
+            } else if (type == TokenType::percent) {
+                expr->var = m_allocator.emplace<NodeBinExprMod>(expr_lhs2, expr_rhs.value());
+            } else if (type == TokenType::amp) {
+                expr->var = m_allocator.emplace<NodeBinExprBitAnd>(expr_lhs2, expr_rhs.value());
+            } else if (type == TokenType::pipe) {
+                expr->var = m_allocator.emplace<NodeBinExprBitOr>(expr_lhs2, expr_rhs.value());
+            } else if (type == TokenType::caret) {
+                expr->var = m_allocator.emplace<NodeBinExprBitXor>(expr_lhs2, expr_rhs.value());
+            } else if (type == TokenType::shl) {
+                expr->var = m_allocator.emplace<NodeBinExprShl>(expr_lhs2, expr_rhs.value());
+            } else if (type == TokenType::shr) {
+                expr->var = m_allocator.emplace<NodeBinExprShr>(expr_lhs2, expr_rhs.value());
+            } else if (type == TokenType::and_and) {
+                expr->var = m_allocator.emplace<NodeBinExprAnd>(expr_lhs2, expr_rhs.value());
+            } else if (type == TokenType::or_or) {
+                expr->var = m_allocator.emplace<NodeBinExprOr>(expr_lhs2, expr_rhs.value());
             } else {
                 assert(false); // Unreachable;
             }
@@ -289,8 +489,21 @@ public:
             return {};
         }
         auto scope = m_allocator.emplace<NodeScope>();
-        while (auto stmt = parse_stmt()) {
-            scope->stmts.push_back(stmt.value());
+        while (true) {
+            try {
+                const auto stmt = parse_stmt();
+                if (!stmt.has_value()) {
+                    break;
+                }
+                scope->stmts.push_back(stmt.value());
+            } catch (const ParseError &) {
+                m_failed = true;
+                // nothing left to recover into, every enclosing `}` is missing as well
+                if (m_diagnostics.full() || peek() == nullptr) {
+                    throw;
+                }
+                synchronize();
+            }
         }
         try_consume_err(TokenType::close_curly);
         return scope;
@@ -298,9 +511,10 @@ public:
 
     std::optional<NodeIfPred *> parse_if_pred() // NOLINT(*-no-recursion)
     {
-        if (try_consume(TokenType::elif)) {
+        if (const auto elif_tok = try_consume(TokenType::elif)) {
             try_consume_err(TokenType::open_paren);
-            const auto elif = m_allocator.alloc<NodeIfPredElif>();
+            const auto elif = m_allocator.emplace<NodeIfPredElif>();
+            elif->line = elif_tok->line;
             if (const auto expr = parse_expr()) {
                 elif->expr = expr.value();
             } else {
@@ -316,8 +530,9 @@ public:
             auto pred = m_allocator.emplace<NodeIfPred>(elif);
             return pred;
         }
-        if (try_consume(TokenType::else_)) {
-            auto else_ = m_allocator.alloc<NodeIfPredElse>();
+        if (const auto else_tok = try_consume(TokenType::else_)) {
+            auto else_ = m_allocator.emplace<NodeIfPredElse>();
+            else_->line = else_tok->line;
             if (const auto scope = parse_scope()) {
                 else_->scope = scope.value();
             } else {
@@ -331,42 +546,124 @@ public:
 
     std::optional<NodeStmt *> parse_stmt() // NOLINT(*-no-recursion)
     {
-        if (peek().has_value() && peek().value().type == TokenType::exit && peek(1).has_value()
-            && peek(1).value().type == TokenType::open_paren) {
+        const Token *first = peek();
+        if (first == nullptr) {
+            return {};
+        }
+        const int line = first->line;
+        const int column = first->column;
+        const std::optional<NodeStmt *> stmt = parse_stmt_kind(first->type);
+        if (stmt.has_value()) {
+            stmt.value()->line = line;
+            stmt.value()->column = column;
+        }
+        return stmt;
+    }
+
+    // Statements are told apart by their first token through a table indexed by
+    // its type. The parsers return nothing if the tokens after the first do not
+    // form their statement.
+    std::optional<NodeStmt *> parse_stmt_kind(const TokenType first) // NOLINT(*-no-recursion)
+    {
+        using StmtParser = std::optional<NodeStmt *> (Parser::*)();
+        static constexpr std::array<StmtParser, num_token_types> parsers = [] {
+            std::array<StmtParser, num_token_types> table{};
+            table[static_cast<size_t>(TokenType::exit)] = &Parser::parse_exit;
+            table[static_cast<size_t>(TokenType::let)] = &Parser::parse_let;
+            table[static_cast<size_t>(TokenType::ident)] = &Parser::parse_ident_stmt;
+            table[static_cast<size_t>(TokenType::open_curly)] = &Parser::parse_scope_stmt;
+            table[static_cast<size_t>(TokenType::if_)] = &Parser::parse_if;
+            table[static_cast<size_t>(TokenType::while_)] = &Parser::parse_while;
+            table[static_cast<size_t>(TokenType::parallel)] = &Parser::parse_parallel;
+            table[static_cast<size_t>(TokenType::print)] = &Parser::parse_print;
+            table[static_cast<size_t>(TokenType::input)] = &Parser::parse_input;
+            table[static_cast<size_t>(TokenType::fn)] = &Parser::parse_fn;
+            table[static_cast<size_t>(TokenType::return_)] = &Parser::parse_return;
+            return table;
+        }();
+        const StmtParser parser = parsers[static_cast<size_t>(first)];
+        if (parser == nullptr) {
+            return {};
+        }
+        return (this->*parser)();
+    }
+
+    // `exit` `(` expr `)` `;`
+    std::optional<NodeStmt *> parse_exit() // NOLINT(*-no-recursion)
+    {
+        if (!peek_is(TokenType::open_paren, 1)) {
+            return {};
+        }
+        consume();
+        consume();
+        auto stmt_exit = m_allocator.emplace<NodeStmtExit>();
+        if (const auto node_expr = parse_expr()) {
+            stmt_exit->expr = node_expr.value();
+        } else {
+            error_expected("expression");
+        }
+        try_consume_err(TokenType::close_paren);
+        try_consume_err(TokenType::semi);
+        auto stmt = m_allocator.emplace<NodeStmt>();
+        stmt->var = stmt_exit;
+        return stmt;
+    }
+
+    // `let` ident `=` expr `;` or `let` ident `[` int_lit `]` `;`
+    std::optional<NodeStmt *> parse_let() // NOLINT(*-no-recursion)
+    {
+        if (!peek_is(TokenType::ident, 1)) {
+            return {};
+        }
+        if (peek_is(TokenType::eq, 2)) {
             consume();
+            auto stmt_let = m_allocator.emplace<NodeStmtLet>();
+            stmt_let->ident = consume();
             consume();
-            auto stmt_exit = m_allocator.emplace<NodeStmtExit>();
-            if (const auto node_expr = parse_expr()) {
-                stmt_exit->expr = node_expr.value();
+            if (const auto expr = parse_expr()) {
+                stmt_let->expr = expr.value();
             } else {
                 error_expected("expression");
             }
-            try_consume_err(TokenType::close_paren);
             try_consume_err(TokenType::semi);
             auto stmt = m_allocator.emplace<NodeStmt>();
-            stmt->var = stmt_exit;
+            stmt->var = stmt_let;
             return stmt;
         }
-        if (peek().has_value() && peek().value().type == TokenType::let && peek(1).has_value()
-            && peek(1).value().type == TokenType::ident && peek(2).has_value()
-            && peek(2).value().type == TokenType::eq) {
+        if (peek_is(TokenType::open_bracket, 2)) {
             consume();
-            auto stmt_let = m_allocator.emplace<NodeStmtLet>();
+            auto stmt_let = m_allocator.emplace<NodeStmtLetArray>();
             stmt_let->ident = consume();
             consume();
+            stmt_let->size = try_consume_err(TokenType::int_lit);
+            try_consume_err(TokenType::close_bracket);
+            try_consume_err(TokenType::semi);
+            auto stmt = m_allocator.emplace<NodeStmt>(stmt_let);
+            return stmt;
+        }
+        return {};
+    }
+
+    // ident `[` expr `]` `=` expr `;`, ident `=` expr `;` or a call
+    std::optional<NodeStmt *> parse_ident_stmt() // NOLINT(*-no-recursion)
+    {
+        if (peek_is(TokenType::open_bracket, 1)) {
+            auto assign = m_allocator.emplace<NodeStmtAssignIndex>();
+            assign->ident = consume();
+            consume();
+            assign->index = parse_index();
+            try_consume_err(TokenType::eq);
             if (const auto expr = parse_expr()) {
-                stmt_let->expr = expr.value();
+                assign->expr = expr.value();
             } else {
                 error_expected("expression");
             }
             try_consume_err(TokenType::semi);
-            auto stmt = m_allocator.emplace<NodeStmt>();
-            stmt->var = stmt_let;
+            auto stmt = m_allocator.emplace<NodeStmt>(assign);
             return stmt;
         }
-        if (peek().has_value() && peek().value().type == TokenType::ident && peek(1).has_value()
-            && peek(1).value().type == TokenType::eq) {
-            const auto assign = m_allocator.alloc<NodeStmtAssign>();
+        if (peek_is(TokenType::eq, 1)) {
+            const auto assign = m_allocator.emplace<NodeStmtAssign>();
             assign->ident = consume();
             consume();
             if (const auto expr = parse_expr()) {
@@ -378,130 +675,289 @@ public:
             auto stmt = m_allocator.emplace<NodeStmt>(assign);
             return stmt;
         }
-        if (peek().has_value() && peek().value().type == TokenType::open_curly) {
-            if (auto scope = parse_scope()) {
-                auto stmt = m_allocator.emplace<NodeStmt>(scope.value());
-                return stmt;
-            }
-            error_expected("scope");
+        if (peek_is(TokenType::open_paren, 1)) {
+            auto stmt_call = m_allocator.emplace<NodeStmtCall>(parse_call());
+            try_consume_err(TokenType::semi);
+            auto stmt = m_allocator.emplace<NodeStmt>(stmt_call);
+            return stmt;
         }
-        if (auto if_ = try_consume(TokenType::if_)) {
-            try_consume_err(TokenType::open_paren);
-            auto stmt_if = m_allocator.emplace<NodeStmtIf>();
-            if (const auto expr = parse_expr()) {
-                stmt_if->expr = expr.value();
-            } else {
-                error_expected("expression");
-            }
-            try_consume_err(TokenType::close_paren);
-            if (const auto scope = parse_scope()) {
-                stmt_if->scope = scope.value();
-            } else {
-                error_expected("scope");
-            }
-            stmt_if->pred = parse_if_pred();
-            auto stmt = m_allocator.emplace<NodeStmt>(stmt_if);
+        return {};
+    }
+
+    std::optional<NodeStmt *> parse_scope_stmt() // NOLINT(*-no-recursion)
+    {
+        if (auto scope = parse_scope()) {
+            auto stmt = m_allocator.emplace<NodeStmt>(scope.value());
             return stmt;
         }
+        error_expected("scope");
+    }
 
-        //To parse while loop
-        if (try_consume(TokenType::while_)) {
-            try_consume_err(TokenType::open_paren);
-            auto condition = parse_expr();
-            if (!condition.has_value()) {
-                error_expected("expression");
-            }
-            try_consume_err(TokenType::close_paren);
-            auto scope = parse_scope();
-            if (!scope.has_value()) {
-                error_expected("scope");
-            }
-            // Allocate the while statement node using the arena allocator:
-            auto while_stmt = m_allocator.emplace<NodeStmtWhile>();
-            while_stmt->condition = condition.value();
-            while_stmt->scope = scope.value();
+    std::optional<NodeStmt *> parse_if() // NOLINT(*-no-recursion)
+    {
+        consume();
+        try_consume_err(TokenType::open_paren);
+        auto stmt_if = m_allocator.emplace<NodeStmtIf>();
+        if (const auto expr = parse_expr()) {
+            stmt_if->expr = expr.value();
+        } else {
+            error_expected("expression");
+        }
+        try_consume_err(TokenType::close_paren);
+        if (const auto scope = parse_scope()) {
+            stmt_if->scope = scope.value();
+        } else {
+            error_expected("scope");
+        }
+        stmt_if->pred = parse_if_pred();
+        auto stmt = m_allocator.emplace<NodeStmt>(stmt_if);
+        return stmt;
+    }
 
-            auto stmt = m_allocator.emplace<NodeStmt>();
-            stmt->var = while_stmt;
-            return stmt;
+    // `parallel` `while` `(` expr `)` scope
+    std::optional<NodeStmt *> parse_parallel() // NOLINT(*-no-recursion)
+    {
+        consume();
+        if (!peek_is(TokenType::while_)) {
+            error_expected("`while`");
         }
+        const std::optional<NodeStmt *> stmt = parse_while();
+        std::get<NodeStmtWhile *>(stmt.value()->var)->parallel = true;
+        return stmt;
+    }
 
-        //print statement
-        if (try_consume(TokenType::print)) {
-            try_consume_err(TokenType::open_paren);
-            auto expr = parse_expr();
-            if (!expr.has_value()) {
-                error_expected("expression");
-            }
-            try_consume_err(TokenType::close_paren);
-            try_consume_err(TokenType::semi);
-            auto print_stmt = m_allocator.emplace<NodeStmtPrint>();
-            print_stmt->expr = expr.value();
-            auto stmt = m_allocator.emplace<NodeStmt>();
-            stmt->var = print_stmt;
-            return stmt;
+    std::optional<NodeStmt *> parse_while() // NOLINT(*-no-recursion)
+    {
+        consume();
+        try_consume_err(TokenType::open_paren);
+        auto condition = parse_expr();
+        if (!condition.has_value()) {
+            error_expected("expression");
+        }
+        try_consume_err(TokenType::close_paren);
+        auto scope = parse_scope();
+        if (!scope.has_value()) {
+            error_expected("scope");
+        }
+        // Allocate the while statement node using the arena allocator:
+        auto while_stmt = m_allocator.emplace<NodeStmtWhile>();
+        while_stmt->condition = condition.value();
+        while_stmt->scope = scope.value();
+
+        auto stmt = m_allocator.emplace<NodeStmt>();
+        stmt->var = while_stmt;
+        return stmt;
+    }
+
+    std::optional<NodeStmt *> parse_print() // NOLINT(*-no-recursion)
+    {
+        consume();
+        try_consume_err(TokenType::open_paren);
+        auto expr = parse_expr();
+        if (!expr.has_value()) {
+            error_expected("expression");
         }
+        try_consume_err(TokenType::close_paren);
+        try_consume_err(TokenType::semi);
+        auto print_stmt = m_allocator.emplace<NodeStmtPrint>();
+        print_stmt->expr = expr.value();
+        auto stmt = m_allocator.emplace<NodeStmt>();
+        stmt->var = print_stmt;
+        return stmt;
+    }
 
-        //input statement
-        if (try_consume(TokenType::input)) {
-            try_consume_err(TokenType::open_paren);
-            auto ident = try_consume(TokenType::ident);
-            if (!ident.has_value()) {
-                error_expected("identifier");
-            }
-            try_consume_err(TokenType::close_paren);
-            try_consume_err(TokenType::semi);
-            auto input_stmt = m_allocator.emplace<NodeStmtInput>();
-            input_stmt->ident = ident.value();
-            auto stmt = m_allocator.emplace<NodeStmt>();
-            stmt->var = input_stmt;
-            return stmt;
+    std::optional<NodeStmt *> parse_input() {
+        consume();
+        try_consume_err(TokenType::open_paren);
+        auto ident = try_consume(TokenType::ident);
+        if (!ident.has_value()) {
+            error_expected("identifier");
         }
+        try_consume_err(TokenType::close_paren);
+        try_consume_err(TokenType::semi);
+        auto input_stmt = m_allocator.emplace<NodeStmtInput>();
+        input_stmt->ident = std::move(ident.value());
+        auto stmt = m_allocator.emplace<NodeStmt>();
+        stmt->var = input_stmt;
+        return stmt;
+    }
 
+    std::optional<NodeStmt *> parse_fn() // NOLINT(*-no-recursion)
+    {
+        consume();
+        auto fn = m_allocator.emplace<NodeStmtFn>();
+        fn->name = try_consume_err(TokenType::ident);
+        try_consume_err(TokenType::open_paren);
+        if (!try_consume(TokenType::close_paren)) {
+            do {
+                fn->params.push_back(try_consume_err(TokenType::ident));
+            } while (try_consume(TokenType::comma));
+            try_consume_err(TokenType::close_paren);
+        }
+        if (const auto scope = parse_scope()) {
+            fn->scope = scope.value();
+        } else {
+            error_expected("scope");
+        }
+        auto stmt = m_allocator.emplace<NodeStmt>(fn);
+        return stmt;
+    }
 
-        return {};
+    std::optional<NodeStmt *> parse_return() // NOLINT(*-no-recursion)
+    {
+        consume();
+        auto stmt_return = m_allocator.emplace<NodeStmtReturn>();
+        if (const auto expr = parse_expr()) {
+            stmt_return->expr = expr.value();
+        } else {
+            error_expected("expression");
+        }
+        try_consume_err(TokenType::semi);
+        auto stmt = m_allocator.emplace<NodeStmt>(stmt_return);
+        return stmt;
     }
 
     std::optional<NodeProg> parse_prog() {
         NodeProg prog;
-        while (peek().has_value()) {
-            if (auto stmt = parse_stmt()) {
-                prog.stmts.push_back(stmt.value());
-            } else {
+        while (const std::optional<NodeStmt *> stmt = parse_top_stmt()) {
+            prog.stmts.push_back(stmt.value());
+        }
+        if (m_failed) {
+            return {};
+        }
+        return prog;
+    }
+
+    // The next top-level statement, or nothing at the end of the file. Statements
+    // with syntax errors are reported and skipped, after which failed() is set.
+    std::optional<NodeStmt *> parse_top_stmt() {
+        while (peek() != nullptr && !m_diagnostics.full()) {
+            try {
+                if (auto stmt = parse_stmt()) {
+                    return stmt;
+                }
                 error_expected("statement");
+            } catch (const ParseError &) {
+                m_failed = true;
+                synchronize();
+                // a `}` without a matching `{`
+                try_consume(TokenType::close_curly);
             }
         }
-        return prog;
+        return {};
+    }
+
+    [[nodiscard]] bool failed() const {
+        return m_failed;
+    }
+
+    // every arena allocation is exactly one AST node
+    [[nodiscard]] size_t node_count() const {
+        return m_allocator.num_allocs();
+    }
+
+    [[nodiscard]] size_t arena_bytes_used() const {
+        return m_allocator.bytes_used();
+    }
+
+    // The arena owning the AST, for passes that add nodes to it.
+    ArenaAllocator &allocator() {
+        return m_allocator;
+    }
+
+    [[nodiscard]] const std::vector<Token> &tokens() const {
+        return m_tokens;
     }
 
 private:
-    [[nodiscard]] std::optional<Token> peek(const int offset = 0) const {
+    struct ParseError {
+    };
+
+    // Skips the rest of the statement an error occurred in: up to and including
+    // the next `;`, or a block opened after the error together with any `elif` and
+    // `else` following it. Stops in front of a `}` closing the enclosing scope.
+    void synchronize() {
+        size_t depth = 0;
+        while (const Token *token = peek()) {
+            const TokenType type = token->type;
+            if (type == TokenType::close_curly && depth == 0) {
+                return;
+            }
+            skip();
+            if (type == TokenType::close_curly) {
+                if (--depth == 0 && !peek_is(TokenType::elif) && !peek_is(TokenType::else_)) {
+                    return;
+                }
+            } else if (type == TokenType::open_curly) {
+                depth++;
+            } else if (type == TokenType::semi && depth == 0) {
+                return;
+            }
+        }
+    }
+
+    // The cursor hands out pointers into m_tokens (or the stream's lookahead) and
+    // moves tokens out once they are consumed, so no lookahead copies a token's text.
+    [[nodiscard]] const Token *peek(const size_t offset = 0) const {
+        if (m_stream != nullptr) {
+            return m_stream->peek(offset);
+        }
         if (m_index + offset >= m_tokens.size()) {
-            return {};
+            return nullptr;
         }
-        return m_tokens.at(m_index + offset);
+        return &m_tokens[m_index + offset];
+    }
+
+    [[nodiscard]] bool peek_is(const TokenType type, const size_t offset = 0) const {
+        if (m_stream != nullptr) {
+            const Token *token = m_stream->peek(offset);
+            return token != nullptr && token->type == type;
+        }
+        return m_index + offset < m_tokens.size() && m_tokens[m_index + offset].type == type;
     }
 
     Token consume() {
-        return m_tokens.at(m_index++);
+        if (m_stream != nullptr) {
+            return m_stream->consume();
+        }
+        return std::move(m_tokens[m_index++]);
+    }
+
+    // consume() for a token whose text is not needed
+    void skip() {
+        if (m_stream != nullptr) {
+            m_stream->consume();
+        } else {
+            m_index++;
+        }
+    }
+
+    [[nodiscard]] const Token *last_token() const {
+        if (m_stream != nullptr) {
+            return m_stream->last();
+        }
+        return m_tokens.empty() ? nullptr : &m_tokens.back();
     }
 
     Token try_consume_err(const TokenType type) {
-        if (peek().has_value() && peek().value().type == type) {
+        if (peek_is(type)) {
             return consume();
         }
         error_expected(to_string(type));
-        return {};
     }
 
     std::optional<Token> try_consume(const TokenType type) {
-        if (peek().has_value() && peek().value().type == type) {
+        if (peek_is(type)) {
             return consume();
         }
         return {};
     }
 
-    const std::vector<Token> m_tokens;
+    // Consumed tokens are left with their text moved into the AST.
+    std::vector<Token> m_tokens;
     size_t m_index = 0;
+    TokenStream *m_stream = nullptr;
     ArenaAllocator m_allocator;
+    Diagnostics &m_diagnostics;
+    bool m_failed = false;
 };
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+
+// Execution counts as an `--instrument` build writes them at exit: one
+// `<line> <kind> <count>` record per site, see Generator::count.
+class Profile {
+public:
+    // Reading stops at the first record that does not parse.
+    [[nodiscard]] static Profile parse(const std::string_view text) {
+        Profile profile;
+        std::istringstream input{std::string(text)};
+        int line;
+        std::string kind;
+        uint64_t count;
+        while (input >> line >> kind >> count) {
+            profile.m_counts[{line, kind}] += count;
+        }
+        return profile;
+    }
+
+    [[nodiscard]] bool empty() const {
+        return m_counts.empty();
+    }
+
+    // 0 for sites the profiled run never reached
+    [[nodiscard]] uint64_t count(const int line, const std::string &kind) const {
+        const auto it = m_counts.find({line, kind});
+        return it == m_counts.end() ? 0 : it->second;
+    }
+
+private:
+    std::map<std::pair<int, std::string>, uint64_t> m_counts;
+};
@@ -0,0 +1,236 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Wire format between `geny --serve` and its clients, over a Unix stream socket.
+// Every field is a frame: a 4 byte little-endian length followed by that many
+// bytes. A request is five frames and a response three:
+//
+//   request:  "geny/1", emit ("asm", "obj" or "exe"), path, options, source
+//   response: status (decimal), diagnostics, output
+//
+// `options` are geny command line flags separated by NUL bytes and `path` only
+// names the source in diagnostics. A connection may carry several requests.
+
+enum class Emit {
+    asm_text,
+    object,
+    executable,
+};
+
+enum class ServeStatus {
+    ok = 0,
+    compile_error = 1, // diagnostics hold the errors
+    tool_error = 2, // nasm or ld failed, diagnostics hold their output
+    bad_request = 3,
+};
+
+struct ServeRequest {
+    Emit emit = Emit::asm_text;
+    std::string path;
+    std::vector<std::string> options;
+    std::string source;
+};
+
+struct ServeResponse {
+    ServeStatus status = ServeStatus::ok;
+    std::string diagnostics;
+    std::string output; // NASM source, an ELF object or an ELF executable
+};
+
+namespace protocol {
+    inline constexpr std::string_view magic = "geny/1";
+    inline constexpr uint32_t max_frame_bytes = 256 * 1024 * 1024;
+
+    inline std::string_view emit_name(const Emit emit) {
+        switch (emit) {
+            case Emit::object:
+                return "obj";
+            case Emit::executable:
+                return "exe";
+            default:
+                return "asm";
+        }
+    }
+
+    inline std::optional<Emit> parse_emit(const std::string_view name) {
+        if (name == "asm") {
+            return Emit::asm_text;
+        }
+        if (name == "obj") {
+            return Emit::object;
+        }
+        if (name == "exe") {
+            return Emit::executable;
+        }
+        return {};
+    }
+
+    inline bool write_all(const int fd, const char *data, size_t size) {
+        while (size > 0) {
+            const ssize_t written = send(fd, data, size, MSG_NOSIGNAL);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                return false;
+            }
+            data += written;
+            size -= static_cast<size_t>(written);
+        }
+        return true;
+    }
+
+    inline bool read_all(const int fd, char *data, size_t size) {
+        while (size > 0) {
+            const ssize_t got = recv(fd, data, size, 0);
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got <= 0) {
+                return false;
+            }
+            data += got;
+            size -= static_cast<size_t>(got);
+        }
+        return true;
+    }
+
+    inline bool send_frame(const int fd, const std::string_view bytes) {
+        const auto size = static_cast<uint32_t>(bytes.size());
+        const char header[4] = {
+            static_cast<char>(size & 0xff),
+            static_cast<char>(size >> 8 & 0xff),
+            static_cast<char>(size >> 16 & 0xff),
+            static_cast<char>(size >> 24 & 0xff),
+        };
+        return write_all(fd, header, sizeof(header)) && write_all(fd, bytes.data(), bytes.size());
+    }
+
+    inline bool recv_frame(const int fd, std::string &bytes) {
+        unsigned char header[4];
+        if (!read_all(fd, reinterpret_cast<char *>(header), sizeof(header))) {
+            return false;
+        }
+        const uint32_t size = header[0] | header[1] << 8 | header[2] << 16 | static_cast<uint32_t>(header[3]) << 24;
+        if (size > max_frame_bytes) {
+            return false;
+        }
+        bytes.resize(size);
+        return read_all(fd, bytes.data(), size);
+    }
+
+    inline bool send_request(const int fd, const ServeRequest &request) {
+        std::string options;
+        for (size_t i = 0; i < request.options.size(); i++) {
+            if (i > 0) {
+                options.push_back('\0');
+            }
+            options += request.options[i];
+        }
+        return send_frame(fd, magic) && send_frame(fd, emit_name(request.emit)) && send_frame(fd, request.path)
+               && send_frame(fd, options) && send_frame(fd, request.source);
+    }
+
+    // Empty when the peer hung up or sent something that is not a request.
+    inline std::optional<ServeRequest> recv_request(const int fd) {
+        std::string frame;
+        if (!recv_frame(fd, frame) || frame != magic || !recv_frame(fd, frame)) {
+            return {};
+        }
+        ServeRequest request;
+        const std::optional<Emit> emit = parse_emit(frame);
+        if (!emit.has_value()) {
+            return {};
+        }
+        request.emit = emit.value();
+        if (!recv_frame(fd, request.path) || !recv_frame(fd, frame) || !recv_frame(fd, request.source)) {
+            return {};
+        }
+        size_t start = 0;
+        while (start < frame.size()) {
+            const size_t end = std::min(frame.find('\0', start), frame.size());
+            request.options.push_back(frame.substr(start, end - start));
+            start = end + 1;
+        }
+        return request;
+    }
+
+    inline bool send_response(const int fd, const ServeResponse &response) {
+        return send_frame(fd, std::to_string(static_cast<int>(response.status))) && send_frame(fd, response.diagnostics)
+               && send_frame(fd, response.output);
+    }
+
+    inline std::optional<ServeResponse> recv_response(const int fd) {
+        std::string status;
+        ServeResponse response;
+        if (!recv_frame(fd, status) || !recv_frame(fd, response.diagnostics) || !recv_frame(fd, response.output)) {
+            return {};
+        }
+        response.status = static_cast<ServeStatus>(std::strtol(status.c_str(), nullptr, 10));
+        return response;
+    }
+
+    inline bool make_address(const std::string &path, sockaddr_un &address) {
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path)) {
+            return false;
+        }
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        return true;
+    }
+
+    // A connected socket, or -1 if nothing listens at `path`.
+    inline int connect_to(const std::string &path) {
+        sockaddr_un address {};
+        if (!make_address(path, address)) {
+            return -1;
+        }
+        const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            return -1;
+        }
+        if (connect(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    // One request on a fresh connection.
+    inline std::optional<ServeResponse> compile(const std::string &socket_path, const ServeRequest &request) {
+        const int fd = connect_to(socket_path);
+        if (fd < 0) {
+            return {};
+        }
+        std::optional<ServeResponse> response;
+        if (send_request(fd, request)) {
+            response = recv_response(fd);
+        }
+        close(fd);
+        return response;
+    }
+}
+
+inline std::string default_socket_path() {
+    if (const char *path = std::getenv("GENY_SOCKET"); path != nullptr && *path != '\0') {
+        return path;
+    }
+    if (const char *dir = std::getenv("XDG_RUNTIME_DIR"); dir != nullptr && *dir != '\0') {
+        return std::string(dir) + "/geny.sock";
+    }
+    return "/tmp/geny-" + std::to_string(getuid()) + ".sock";
+}
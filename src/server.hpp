@@ -0,0 +1,301 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "genesis.hpp"
+#include "options.hpp"
+#include "protocol.hpp"
+
+// The library settings that the geny command line flags stand for.
+inline GenesisOptions genesis_options(const CompileOptions &opts) {
+    GenesisOptions options;
+    options.optimize = opts.optimize;
+    options.unroll = opts.unroll;
+    options.max_errors = opts.max_errors;
+    options.stream = opts.stream;
+    options.generator = {
+        .instrument = opts.instrument,
+        .profile_path = opts.profile_path,
+        .debug_info = opts.debug_info,
+        .source_path = opts.input_path,
+        .inline_threshold = opts.inline_threshold,
+        .vectorize = opts.vectorize,
+        .threads = opts.threads,
+    };
+    if (!opts.profile_use_path.empty()) {
+        std::stringstream profile;
+        profile << std::ifstream(opts.profile_use_path).rdbuf();
+        options.generator.profile = Profile::parse(profile.str());
+    }
+    return options;
+}
+
+// `geny --serve`: a long-running compiler behind a Unix domain socket, so that a
+// compile costs a round trip instead of a process start. Connections are queued
+// for a fixed pool of workers. Each worker keeps its AST arena between requests,
+// so the pages are already mapped, and all of them link against one io.o
+// assembled when the server starts. Requests are described in protocol.hpp.
+class CompileServer {
+public:
+    // Larger sources are answered with ServeStatus::bad_request.
+    static constexpr size_t max_source_bytes = 8 * 1024 * 1024;
+
+    CompileServer(std::string socket_path, const size_t workers, std::string runtime_path)
+        : m_socket_path(std::move(socket_path))
+        , m_runtime_path(std::move(runtime_path))
+        , m_num_workers(workers != 0 ? workers : std::max(1u, std::thread::hardware_concurrency())) {
+    }
+
+    // Serves until SIGINT or SIGTERM, then finishes the connections in progress.
+    int run() {
+        if (!listen_socket()) {
+            return EXIT_FAILURE;
+        }
+        prepare_scratch();
+        struct sigaction action {};
+        action.sa_handler = [](int) { s_stop = 1; };
+        sigaction(SIGINT, &action, nullptr);
+        sigaction(SIGTERM, &action, nullptr);
+
+        std::vector<std::thread> threads;
+        m_workers.resize(m_num_workers);
+        for (size_t i = 0; i < m_num_workers; i++) {
+            m_workers[i].dir = m_scratch / ("w" + std::to_string(i));
+            std::filesystem::create_directories(m_workers[i].dir);
+            threads.emplace_back([this, i] { work(m_workers[i]); });
+        }
+        std::cerr << "geny: serving on " << m_socket_path << " with " << m_num_workers << " workers" << std::endl;
+
+        pollfd listener {.fd = m_listen_fd, .events = POLLIN, .revents = 0};
+        while (s_stop == 0) {
+            // woken regularly to notice the stop flag
+            if (poll(&listener, 1, 200) <= 0) {
+                continue;
+            }
+            const int fd = accept4(m_listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd < 0) {
+                continue;
+            }
+            // a client that stops sending must not hold a worker forever
+            const timeval timeout {.tv_sec = 30, .tv_usec = 0};
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            {
+                std::lock_guard lock(m_mutex);
+                m_pending.push_back(fd);
+            }
+            m_ready.notify_one();
+        }
+
+        {
+            std::lock_guard lock(m_mutex);
+            m_stopping = true;
+        }
+        m_ready.notify_all();
+        for (std::thread &thread: threads) {
+            thread.join();
+        }
+        close(m_listen_fd);
+        unlink(m_socket_path.c_str());
+        std::error_code ec;
+        std::filesystem::remove_all(m_scratch, ec);
+        return EXIT_SUCCESS;
+    }
+
+private:
+    struct Worker {
+        std::filesystem::path dir; // out.asm, out.o and out of the current request
+        std::unique_ptr<std::byte[]> arena;
+        size_t arena_bytes = 0;
+        bool arena_in_use = false;
+    };
+
+    // Hands the worker's arena block to the parser, allocating it on first use.
+    // A request needing a second or larger arena gets a fresh one, which is freed
+    // with its compile so that one large source does not pin its memory.
+    static void *arena_allocate(const size_t num_bytes, void *user) {
+        auto &worker = *static_cast<Worker *>(user);
+        if (worker.arena_in_use || num_bytes > Parser::default_arena_bytes) {
+            return new (std::nothrow) std::byte[num_bytes];
+        }
+        if (worker.arena == nullptr) {
+            worker.arena = std::make_unique<std::byte[]>(Parser::default_arena_bytes);
+            worker.arena_bytes = Parser::default_arena_bytes;
+        }
+        worker.arena_in_use = true;
+        return worker.arena.get();
+    }
+
+    static void arena_deallocate(void *block, size_t, void *user) {
+        auto &worker = *static_cast<Worker *>(user);
+        if (block == worker.arena.get()) {
+            worker.arena_in_use = false;
+        } else {
+            delete[] static_cast<std::byte *>(block);
+        }
+    }
+
+    bool listen_socket() {
+        sockaddr_un address {};
+        if (!protocol::make_address(m_socket_path, address)) {
+            std::cerr << "geny: socket path too long: " << m_socket_path << std::endl;
+            return false;
+        }
+        // a socket file nobody answers on is left over from a server that died
+        if (const int fd = protocol::connect_to(m_socket_path); fd >= 0) {
+            close(fd);
+            std::cerr << "geny: a server is already listening on " << m_socket_path << std::endl;
+            return false;
+        }
+        unlink(m_socket_path.c_str());
+        m_listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (m_listen_fd < 0 || bind(m_listen_fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0
+            || listen(m_listen_fd, 64) != 0) {
+            std::cerr << "geny: cannot listen on " << m_socket_path << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        chmod(m_socket_path.c_str(), 0600);
+        return true;
+    }
+
+    // The runtime is assembled once here instead of for every request.
+    void prepare_scratch() {
+        m_scratch = std::filesystem::temp_directory_path() / ("geny-serve-" + std::to_string(getpid()));
+        std::filesystem::create_directories(m_scratch);
+        m_runtime_object = m_scratch / "io.o";
+        const std::string cmd = "nasm -f elf64 " + m_runtime_path + " -o " + m_runtime_object.string();
+        if (system(cmd.c_str()) != 0) {
+            std::cerr << "geny: cannot assemble " << m_runtime_path << ", only asm requests will succeed" << std::endl;
+            m_runtime_object.clear();
+        }
+    }
+
+    void work(Worker &worker) {
+        while (true) {
+            int fd;
+            {
+                std::unique_lock lock(m_mutex);
+                m_ready.wait(lock, [this] { return m_stopping || !m_pending.empty(); });
+                if (m_pending.empty()) {
+                    return;
+                }
+                fd = m_pending.front();
+                m_pending.pop_front();
+            }
+            while (const std::optional<ServeRequest> request = protocol::recv_request(fd)) {
+                if (!protocol::send_response(fd, respond(worker, request.value()))) {
+                    break;
+                }
+            }
+            close(fd);
+        }
+    }
+
+    // Memory running out fails the request, not the server.
+    ServeResponse respond(Worker &worker, const ServeRequest &request) const {
+        try {
+            return handle(worker, request);
+        } catch (const std::bad_alloc &) {
+            return {.status = ServeStatus::compile_error,
+                    .diagnostics = (request.path.empty() ? "<input>" : request.path) + ": error: out of memory\n",
+                    .output = {}};
+        }
+    }
+
+    ServeResponse handle(Worker &worker, const ServeRequest &request) const {
+        if (request.source.size() > max_source_bytes) {
+            return {.status = ServeStatus::bad_request,
+                    .diagnostics = "geny: sources above " + std::to_string(max_source_bytes) + " bytes are refused\n",
+                    .output = {}};
+        }
+        // the request's flags go through the same parser as geny's own
+        std::vector<std::string> args = {"geny"};
+        args.insert(args.end(), request.options.begin(), request.options.end());
+        args.push_back(request.path.empty() ? "<input>" : request.path);
+        std::vector<char *> argv;
+        for (std::string &arg: args) {
+            argv.push_back(arg.data());
+        }
+        const std::optional<CompileOptions> opts = parse_args(static_cast<int>(argv.size()), argv.data());
+        if (!opts.has_value() || opts->serve) {
+            return {.status = ServeStatus::bad_request, .diagnostics = "geny: invalid compile options\n", .output = {}};
+        }
+
+        GenesisOptions options = genesis_options(opts.value());
+        options.arena_bytes = std::max(Parser::default_arena_bytes,
+                                       request.source.size() * arena_bytes_per_source_byte);
+        options.arena_hooks = {.allocate = arena_allocate, .deallocate = arena_deallocate, .user = &worker};
+        const Compilation compilation = genesis_compile(request.source, options);
+        if (!compilation.ok()) {
+            std::stringstream diagnostics;
+            compilation.diagnostics().print(diagnostics, opts->input_path);
+            return {.status = ServeStatus::compile_error, .diagnostics = diagnostics.str(), .output = {}};
+        }
+        if (request.emit == Emit::asm_text) {
+            return {.status = ServeStatus::ok, .diagnostics = {}, .output = compilation.asm_text()};
+        }
+        if (m_runtime_object.empty()) {
+            return {.status = ServeStatus::tool_error, .diagnostics = "geny: nasm is not available to the server\n",
+                    .output = {}};
+        }
+
+        const std::string dir = worker.dir.string();
+        std::fstream(dir + "/out.asm", std::ios::out) << compilation.asm_text();
+        const std::string nasm = opts->debug_info ? "nasm -f elf64 -g -F dwarf " : "nasm -f elf64 ";
+        std::string cmd = nasm + dir + "/out.asm -o " + dir + "/out.o 2> " + dir + "/tools.log";
+        std::string output = dir + "/out.o";
+        if (request.emit == Emit::executable) {
+            cmd += " && ld " + genesis_link_flags(opts->debug_info) + " -o " + dir + "/out " + dir + "/out.o "
+                    + m_runtime_object.string() + " 2>> " + dir + "/tools.log";
+            output = dir + "/out";
+        }
+        if (system(cmd.c_str()) != 0) {
+            return {.status = ServeStatus::tool_error, .diagnostics = read_bytes(dir + "/tools.log"), .output = {}};
+        }
+        return {.status = ServeStatus::ok, .diagnostics = {}, .output = read_bytes(output)};
+    }
+
+    static std::string read_bytes(const std::string &path) {
+        std::stringstream contents;
+        contents << std::ifstream(path, std::ios::binary).rdbuf();
+        return contents.str();
+    }
+
+    // The arena is sized from the source instead of geny's fixed 4 MB. Typical
+    // programs take 13 to 23 bytes of AST per source byte, chains like `x+x+x`
+    // about 70, and the optimizer adds to that. Pages the AST never reaches are
+    // not touched, so the allowance costs address space rather than memory.
+    static constexpr size_t arena_bytes_per_source_byte = 128;
+    static inline volatile std::sig_atomic_t s_stop = 0;
+
+    std::string m_socket_path;
+    std::string m_runtime_path;
+    size_t m_num_workers;
+    int m_listen_fd = -1;
+    std::filesystem::path m_scratch;
+    std::filesystem::path m_runtime_object;
+    std::vector<Worker> m_workers;
+
+    std::mutex m_mutex;
+    std::condition_variable m_ready;
+    std::deque<int> m_pending;
+    bool m_stopping = false;
+};
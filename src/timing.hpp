@@ -0,0 +1,111 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "options.hpp"
+
+// Collects wall and cpu time per compiler stage plus a few size counters for
+// `--time-report`. Stages that shell out (nasm, ld, the program itself) are
+// charged the cpu time of the children they waited for.
+class TimeReport {
+public:
+    template <typename F>
+    decltype(auto) measure(const std::string &name, F &&stage) {
+        const auto wall_start = std::chrono::steady_clock::now();
+        const double cpu_start = cpu_seconds();
+        struct Finish {
+            TimeReport &report;
+            const std::string &name;
+            std::chrono::steady_clock::time_point wall_start;
+            double cpu_start;
+
+            ~Finish() {
+                const std::chrono::duration<double> wall = std::chrono::steady_clock::now() - wall_start;
+                report.m_stages.push_back({
+                    .name = name,
+                    .wall_ms = wall.count() * 1000.0,
+                    .cpu_ms = (cpu_seconds() - cpu_start) * 1000.0,
+                });
+            }
+        } finish{*this, name, wall_start, cpu_start};
+        return std::forward<F>(stage)();
+    }
+
+    void count(const std::string &name, const uint64_t value) {
+        m_counters.emplace_back(name, value);
+    }
+
+    void print_text(std::ostream &out) const {
+        double wall_total = 0;
+        double cpu_total = 0;
+        out << "===== geny time report =====\n";
+        out << std::left << std::setw(18) << "stage" << std::right << std::setw(12) << "wall (ms)"
+                << std::setw(12) << "cpu (ms)" << "\n";
+        out << std::fixed << std::setprecision(3);
+        for (const auto &[name, wall_ms, cpu_ms]: m_stages) {
+            out << std::left << std::setw(18) << name << std::right << std::setw(12) << wall_ms
+                    << std::setw(12) << cpu_ms << "\n";
+            wall_total += wall_ms;
+            cpu_total += cpu_ms;
+        }
+        out << std::left << std::setw(18) << "total" << std::right << std::setw(12) << wall_total
+                << std::setw(12) << cpu_total << "\n";
+        for (const auto &[name, value]: m_counters) {
+            out << std::left << std::setw(18) << name << std::right << std::setw(12) << value << "\n";
+        }
+        out << std::left << std::setw(18) << "peak rss (KiB)" << std::right << std::setw(12) << peak_rss_kib()
+                << "\n";
+        out << std::defaultfloat;
+    }
+
+    void print_json(std::ostream &out) const {
+        out << "{\"version\":\"" << GENESIS_VERSION << "\",\"stages\":[";
+        out << std::fixed << std::setprecision(3);
+        for (size_t i = 0; i < m_stages.size(); i++) {
+            const auto &[name, wall_ms, cpu_ms] = m_stages[i];
+            out << (i == 0 ? "" : ",") << "{\"name\":\"" << name << "\",\"wall_ms\":" << wall_ms
+                    << ",\"cpu_ms\":" << cpu_ms << "}";
+        }
+        out << "],\"counters\":{";
+        for (const auto &[name, value]: m_counters) {
+            out << "\"" << name << "\":" << value << ",";
+        }
+        out << "\"peak_rss_kib\":" << peak_rss_kib() << "}}\n";
+        out << std::defaultfloat;
+    }
+
+private:
+    struct Stage {
+        std::string name;
+        double wall_ms;
+        double cpu_ms;
+    };
+
+    static double cpu_seconds() {
+        double total = 0;
+        for (const int who: {RUSAGE_SELF, RUSAGE_CHILDREN}) {
+            rusage usage{};
+            getrusage(who, &usage);
+            total += static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec)
+                    + static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+        }
+        return total;
+    }
+
+    static long peak_rss_kib() {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
+    }
+
+    std::vector<Stage> m_stages;
+    std::vector<std::pair<std::string, uint64_t>> m_counters;
+};
@@ -1,8 +1,19 @@
 #pragma once
 
+#include <array>
+#include <cassert>
+#include <charconv>
+#include <cstdint>
+#include <iostream>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
 #include <vector>
 
+#include "diagnostics.hpp"
+
 enum class TokenType {
     exit,
     int_lit,
@@ -30,11 +41,31 @@ enum class TokenType {
     greater_eq, // ">="
     //loops
     while_,
+    parallel,
     // New tokens for input/output:
     print,
     input,
+    // functions:
+    fn,
+    return_,
+    comma,
+    // arrays:
+    open_bracket,
+    close_bracket,
+    // arithmetic, bitwise and logical operators:
+    percent, // "%"
+    amp, // "&"
+    pipe, // "|"
+    caret, // "^"
+    shl, // "<<"
+    shr, // ">>"
+    and_and, // "&&"
+    or_or, // "||"
 };
 
+// number of TokenType values, for tables indexed by type
+inline constexpr size_t num_token_types = static_cast<size_t>(TokenType::or_or) + 1;
+
 inline std::string to_string(const TokenType type) {
     switch (type) {
         case TokenType::exit:
@@ -85,93 +116,231 @@ inline std::string to_string(const TokenType type) {
             return ">=";
         case TokenType::while_:
             return "`while`";
+        case TokenType::parallel:
+            return "`parallel`";
         case TokenType::print:
             return "`print`";
         case TokenType::input:
             return "`input`";
+        case TokenType::fn:
+            return "`fn`";
+        case TokenType::return_:
+            return "`return`";
+        case TokenType::comma:
+            return "`,`";
+        case TokenType::open_bracket:
+            return "`[`";
+        case TokenType::close_bracket:
+            return "`]`";
+        case TokenType::percent:
+            return "%";
+        case TokenType::amp:
+            return "&";
+        case TokenType::pipe:
+            return "|";
+        case TokenType::caret:
+            return "^";
+        case TokenType::shl:
+            return "<<";
+        case TokenType::shr:
+            return ">>";
+        case TokenType::and_and:
+            return "&&";
+        case TokenType::or_or:
+            return "||";
     }
     assert(false);
 }
 
-inline std::optional<int> bin_prec(const TokenType type) {
+constexpr std::optional<int> bin_prec(const TokenType type) {
     switch (type) {
         case TokenType::star:
         case TokenType::fslash:
-            return 3; // highest among our operators
+        case TokenType::percent:
+            return 9; // highest among our operators
         case TokenType::plus:
         case TokenType::minus:
-            return 2;
+            return 8;
+        case TokenType::shl:
+        case TokenType::shr:
+            return 7;
         case TokenType::less:
         case TokenType::less_eq:
         case TokenType::greater:
         case TokenType::greater_eq:
         case TokenType::eq_eq:
         case TokenType::not_e:
-            return 1; // relational operators evaluated after arithmetic
+            return 6; // relational operators evaluated after arithmetic
+        // bitwise and logical operators bind like in C
+        case TokenType::amp:
+            return 5;
+        case TokenType::caret:
+            return 4;
+        case TokenType::pipe:
+            return 3;
+        case TokenType::and_and:
+            return 2;
+        case TokenType::or_or:
+            return 1;
         default:
             return {};
     }
 }
 
+// Words that are tokens of their own instead of identifiers.
+inline constexpr std::array<std::pair<std::string_view, TokenType>, 11> keywords = {{
+    {"exit", TokenType::exit},
+    {"let", TokenType::let},
+    {"if", TokenType::if_},
+    {"elif", TokenType::elif},
+    {"else", TokenType::else_},
+    {"while", TokenType::while_},
+    {"parallel", TokenType::parallel},
+    {"print", TokenType::print},
+    {"input", TokenType::input},
+    {"fn", TokenType::fn},
+    {"return", TokenType::return_},
+}};
+
+constexpr std::optional<TokenType> keyword_type(const std::string_view word) {
+    for (const auto &[keyword, type]: keywords) {
+        if (word == keyword) {
+            return type;
+        }
+    }
+    return {};
+}
+
 struct Token {
     TokenType type;
     int line;
     std::optional<std::string> value{};
+    int column = 0;
+    int64_t int_value = 0; // for int_lit, parsed by the tokenizer
 };
 
+// Splits source text into tokens. Characters that start no token are reported to
+// `diagnostics` and skipped.
 class Tokenizer {
 public:
-    explicit Tokenizer(std::string src)
-        : m_src(std::move(src)) {
+    Tokenizer(std::string src, Diagnostics &diagnostics)
+        : m_storage(std::move(src))
+          , m_src(m_storage)
+          , m_diagnostics(diagnostics) {
     }
 
+    // m_src views m_storage
+    Tokenizer(const Tokenizer &) = delete;
+    Tokenizer &operator=(const Tokenizer &) = delete;
+
+    // Sources are split for tokenize_parallel into chunks of at least this size.
+    static constexpr size_t default_chunk_bytes = 1024 * 1024;
+
     std::vector<Token> tokenize() {
         std::vector<Token> tokens;
+        while (std::optional<Token> token = next()) {
+            tokens.push_back(std::move(token.value()));
+        }
+        m_index = 0;
+        m_line = 1;
+        m_line_start = 0;
+        m_ends_in_comment = false;
+        return tokens;
+    }
+
+    // tokenize() on up to `num_threads` threads. The source is cut into chunks at
+    // line starts and every chunk is lexed on its own, speculatively assuming it
+    // does not begin inside a `/* */` comment. Chunks that do are lexed again once
+    // the state at their start is known, and the lines of each chunk are offset by
+    // the newlines before it, so tokens and errors equal those of tokenize().
+    std::vector<Token> tokenize_parallel(const size_t num_threads, const size_t min_chunk_bytes = default_chunk_bytes) {
+        const std::vector<std::string_view> chunks = split_lines(
+            std::min(num_threads, m_src.size() / std::max<size_t>(1, min_chunk_bytes)));
+        if (chunks.size() < 2) {
+            return tokenize();
+        }
+
+        std::vector<Chunk> results(chunks.size());
+        const auto lex = [&](const size_t i, const bool in_comment) {
+            Chunk &chunk = results[i];
+            chunk.tokens.clear();
+            chunk.diagnostics = Diagnostics(0);
+            Tokenizer tokenizer(chunks[i], chunk.diagnostics, in_comment, i + 1 == chunks.size());
+            while (std::optional<Token> token = tokenizer.next()) {
+                chunk.tokens.push_back(std::move(token.value()));
+            }
+            chunk.num_newlines = tokenizer.m_line - 1;
+            chunk.ends_in_comment = tokenizer.m_ends_in_comment;
+        };
+        for_each_chunk(chunks.size(), [&](const size_t i) { lex(i, false); });
+
+        // fixup: only a comment left open by the previous chunk changes how a chunk lexes
+        bool in_comment = false;
+        for (size_t i = 0; i < results.size(); i++) {
+            if (in_comment) {
+                lex(i, true);
+            }
+            in_comment = results[i].ends_in_comment;
+        }
+
+        std::vector<size_t> first_token(results.size() + 1, 0);
+        std::vector<int> line_offset(results.size(), 0);
+        for (size_t i = 0; i < results.size(); i++) {
+            first_token[i + 1] = first_token[i] + results[i].tokens.size();
+            if (i + 1 < results.size()) {
+                line_offset[i + 1] = line_offset[i] + results[i].num_newlines;
+            }
+        }
+        std::vector<Token> tokens(first_token.back());
+        for_each_chunk(results.size(), [&](const size_t i) {
+            size_t index = first_token[i];
+            for (Token &token: results[i].tokens) {
+                token.line += line_offset[i];
+                tokens[index++] = std::move(token);
+            }
+        });
+        for (size_t i = 0; i < results.size(); i++) {
+            for (const Diagnostic &diagnostic: results[i].diagnostics.errors()) {
+                m_diagnostics.error(diagnostic.line + line_offset[i], diagnostic.column, diagnostic.message);
+            }
+        }
+        return tokens;
+    }
+
+    // The next token, or nothing at the end of the source. Whitespace, comments
+    // and invalid characters before it are skipped.
+    std::optional<Token> next() {
+        if (m_in_comment) {
+            m_in_comment = false;
+            skip_comment_rest();
+        }
         std::string buf;
-        int line_count = 1;
         while (peek().has_value()) {
+            const int column = static_cast<int>(m_index - m_line_start) + 1;
             if (std::isalpha(peek().value())) {
                 buf.push_back(consume());
                 while (peek().has_value() && std::isalnum(peek().value())) {
                     buf.push_back(consume());
                 }
-                if (buf == "exit") {
-                    tokens.push_back({TokenType::exit, line_count});
-                    buf.clear();
-                } else if (buf == "let") {
-                    tokens.push_back({TokenType::let, line_count});
-                    buf.clear();
-                } else if (buf == "if") {
-                    tokens.push_back({TokenType::if_, line_count});
-                    buf.clear();
-                } else if (buf == "elif") {
-                    tokens.push_back({TokenType::elif, line_count});
-                    buf.clear();
-                } else if (buf == "else") {
-                    tokens.push_back({TokenType::else_, line_count});
-                    buf.clear();
-                } else if (buf == "while") {
-                    // New check for while
-                    tokens.push_back({TokenType::while_, line_count});
-                    buf.clear();
-                } else if (buf == "print") {
-                    tokens.push_back({TokenType::print, line_count});
-                    buf.clear();
-                } else if (buf == "input") {
-                    tokens.push_back({TokenType::input, line_count});
-                    buf.clear();
-                } else {
-                    tokens.push_back({TokenType::ident, line_count, buf});
-                    buf.clear();
+                if (const auto keyword = keyword_type(buf)) {
+                    return Token{keyword.value(), m_line, {}, column};
                 }
-            } else if (std::isdigit(peek().value())) {
+                return Token{TokenType::ident, m_line, std::move(buf), column};
+            }
+            if (std::isdigit(peek().value())) {
                 buf.push_back(consume());
                 while (peek().has_value() && std::isdigit(peek().value())) {
                     buf.push_back(consume());
                 }
-                tokens.push_back({TokenType::int_lit, line_count, buf});
-                buf.clear();
-            } else if (peek().value() == '/' && peek(1).has_value() && peek(1).value() == '/') {
+                Token token{TokenType::int_lit, m_line, {}, column};
+                const auto [end, ec] = std::from_chars(buf.data(), buf.data() + buf.size(), token.int_value);
+                if (ec != std::errc()) {
+                    m_diagnostics.error(m_line, column, "Integer literal out of range: " + buf);
+                }
+                token.value = std::move(buf);
+                return token;
+            }
+            if (peek().value() == '/' && peek(1).has_value() && peek(1).value() == '/') {
                 consume();
                 consume();
                 while (peek().has_value() && peek().value() != '\n') {
@@ -180,94 +349,180 @@ public:
             } else if (peek().value() == '/' && peek(1).has_value() && peek(1).value() == '*') {
                 consume();
                 consume();
-                while (peek().has_value()) {
-                    if (peek().value() == '*' && peek(1).has_value() && peek(1).value() == '/') {
-                        break;
-                    }
-                    consume();
-                }
-                if (peek().has_value()) {
-                    consume();
-                }
-                if (peek().has_value()) {
-                    consume();
-                }
+                skip_comment_rest();
             } else if (peek().value() == '(') {
                 consume();
-                tokens.push_back({TokenType::open_paren, line_count});
+                return Token{TokenType::open_paren, m_line, {}, column};
             } else if (peek().value() == ')') {
                 consume();
-                tokens.push_back({TokenType::close_paren, line_count});
+                return Token{TokenType::close_paren, m_line, {}, column};
             } else if (peek().value() == ';') {
                 consume();
-                tokens.push_back({TokenType::semi, line_count});
+                return Token{TokenType::semi, m_line, {}, column};
+            } else if (peek().value() == ',') {
+                consume();
+                return Token{TokenType::comma, m_line, {}, column};
             } else if (peek().value() == '=') {
-                if (peek(1).has_value() && peek(1).value() == '=') {
-                    consume(); // first '='
-                    consume(); // second '='
-                    tokens.push_back({TokenType::eq_eq, line_count});
-                } else {
+                consume();
+                if (peek().has_value() && peek().value() == '=') {
                     consume();
-                    tokens.push_back({TokenType::eq, line_count});
+                    return Token{TokenType::eq_eq, m_line, {}, column};
                 }
+                return Token{TokenType::eq, m_line, {}, column};
             } else if (peek().value() == '<') {
                 consume();
+                if (peek().has_value() && peek().value() == '<') {
+                    consume();
+                    return Token{TokenType::shl, m_line, {}, column};
+                }
                 if (peek().has_value() && peek().value() == '=') {
                     consume();
-                    tokens.push_back({TokenType::less_eq, line_count});
-                } else {
-                    tokens.push_back({TokenType::less, line_count});
+                    return Token{TokenType::less_eq, m_line, {}, column};
                 }
+                return Token{TokenType::less, m_line, {}, column};
             } else if (peek().value() == '>') {
                 consume();
+                if (peek().has_value() && peek().value() == '>') {
+                    consume();
+                    return Token{TokenType::shr, m_line, {}, column};
+                }
                 if (peek().has_value() && peek().value() == '=') {
                     consume();
-                    tokens.push_back({TokenType::greater_eq, line_count});
-                } else {
-                    tokens.push_back({TokenType::greater, line_count});
+                    return Token{TokenType::greater_eq, m_line, {}, column};
                 }
+                return Token{TokenType::greater, m_line, {}, column};
             } else if (peek().value() == '!') {
                 consume();
                 if (peek().has_value() && peek().value() == '=') {
                     consume();
-                    tokens.push_back({TokenType::not_e, line_count});
-                } else {
-                    std::cerr << "Unexpected character '!' without '='\n";
-                    exit(EXIT_FAILURE);
+                    return Token{TokenType::not_e, m_line, {}, column};
                 }
+                m_diagnostics.error(m_line, column, "Unexpected character '!' without '='");
             } else if (peek().value() == '+') {
                 consume();
-                tokens.push_back({TokenType::plus, line_count});
+                return Token{TokenType::plus, m_line, {}, column};
             } else if (peek().value() == '*') {
                 consume();
-                tokens.push_back({TokenType::star, line_count});
+                return Token{TokenType::star, m_line, {}, column};
             } else if (peek().value() == '-') {
                 consume();
-                tokens.push_back({TokenType::minus, line_count});
+                return Token{TokenType::minus, m_line, {}, column};
             } else if (peek().value() == '/') {
                 consume();
-                tokens.push_back({TokenType::fslash, line_count});
+                return Token{TokenType::fslash, m_line, {}, column};
+            } else if (peek().value() == '%') {
+                consume();
+                return Token{TokenType::percent, m_line, {}, column};
+            } else if (peek().value() == '^') {
+                consume();
+                return Token{TokenType::caret, m_line, {}, column};
+            } else if (peek().value() == '&') {
+                consume();
+                if (peek().has_value() && peek().value() == '&') {
+                    consume();
+                    return Token{TokenType::and_and, m_line, {}, column};
+                }
+                return Token{TokenType::amp, m_line, {}, column};
+            } else if (peek().value() == '|') {
+                consume();
+                if (peek().has_value() && peek().value() == '|') {
+                    consume();
+                    return Token{TokenType::or_or, m_line, {}, column};
+                }
+                return Token{TokenType::pipe, m_line, {}, column};
+            } else if (peek().value() == '[') {
+                consume();
+                return Token{TokenType::open_bracket, m_line, {}, column};
+            } else if (peek().value() == ']') {
+                consume();
+                return Token{TokenType::close_bracket, m_line, {}, column};
             } else if (peek().value() == '{') {
                 consume();
-                tokens.push_back({TokenType::open_curly, line_count});
+                return Token{TokenType::open_curly, m_line, {}, column};
             } else if (peek().value() == '}') {
                 consume();
-                tokens.push_back({TokenType::close_curly, line_count});
+                return Token{TokenType::close_curly, m_line, {}, column};
             } else if (peek().value() == '\n') {
                 consume();
-                line_count++;
+                m_line++;
+                m_line_start = m_index;
             } else if (std::isspace(peek().value())) {
                 consume();
             } else {
-                std::cerr << "Invalid token" << std::endl;
-                exit(EXIT_FAILURE);
+                m_diagnostics.error(m_line, column, std::string("Invalid character '") + consume() + "'");
             }
         }
-        m_index = 0;
-        return tokens;
+        return {};
     }
 
 private:
+    struct Chunk {
+        std::vector<Token> tokens;
+        Diagnostics diagnostics;
+        int num_newlines = 0;
+        bool ends_in_comment = false;
+    };
+
+    // Lexes one chunk of a source for tokenize_parallel. Only the last chunk reports
+    // a comment still open at its end, for the others the next chunk continues it.
+    Tokenizer(const std::string_view chunk, Diagnostics &diagnostics, const bool in_comment, const bool last)
+        : m_src(chunk)
+          , m_diagnostics(diagnostics)
+          , m_in_comment(in_comment)
+          , m_report_unterminated(last) {
+    }
+
+    // Up to `num_chunks` pieces of the source, each starting at the beginning of a line.
+    [[nodiscard]] std::vector<std::string_view> split_lines(const size_t num_chunks) const {
+        std::vector<std::string_view> chunks;
+        size_t start = 0;
+        for (size_t i = 1; i <= num_chunks && start < m_src.size(); i++) {
+            size_t end = m_src.size();
+            if (i < num_chunks) {
+                end = std::max(start, m_src.size() / num_chunks * i);
+                end = std::min(m_src.find('\n', end), m_src.size() - 1) + 1;
+            }
+            chunks.push_back(m_src.substr(start, end - start));
+            start = end;
+        }
+        return chunks;
+    }
+
+    // Runs `work(i)` for every chunk, each on its own thread.
+    template <typename Work>
+    static void for_each_chunk(const size_t num_chunks, Work &&work) {
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < num_chunks; i++) {
+            threads.emplace_back(work, i);
+        }
+        work(0);
+        for (std::thread &thread: threads) {
+            thread.join();
+        }
+    }
+
+    // Skips the rest of a `/* */` comment whose opening has been consumed.
+    void skip_comment_rest() {
+        while (peek().has_value()) {
+            if (peek().value() == '*' && peek(1).has_value() && peek(1).value() == '/') {
+                break;
+            }
+            if (consume() == '\n') {
+                m_line++;
+                m_line_start = m_index;
+            }
+        }
+        if (peek().has_value()) {
+            consume();
+            consume();
+            return;
+        }
+        m_ends_in_comment = true;
+        if (m_report_unterminated) {
+            m_diagnostics.error(m_line, static_cast<int>(m_index - m_line_start) + 1, "Unterminated comment");
+        }
+    }
+
     [[nodiscard]] std::optional<char> peek(const size_t offset = 0) const {
         if (m_index + offset >= m_src.length()) {
             return {};
@@ -279,6 +534,68 @@ private:
         return m_src.at(m_index++);
     }
 
-    const std::string m_src;
+    const std::string m_storage;
+    const std::string_view m_src;
     size_t m_index = 0;
+    int m_line = 1;
+    size_t m_line_start = 0;
+    Diagnostics &m_diagnostics;
+    bool m_in_comment = false; // the source starts inside a `/* */` comment
+    bool m_ends_in_comment = false;
+    bool m_report_unterminated = true;
+};
+
+// The tokens of a Tokenizer, produced only as the parser asks for them. Just the
+// parser's lookahead is kept, in a ring buffer, so the token list of a file is
+// never held in memory at once.
+class TokenStream {
+public:
+    // the parser looks at most three tokens ahead, to tell `let x =` from `let x[`
+    static constexpr size_t window = 3;
+
+    explicit TokenStream(Tokenizer &tokenizer)
+        : m_tokenizer(tokenizer) {
+    }
+
+    // null at the end of the source
+    [[nodiscard]] const Token *peek(const size_t offset = 0) {
+        assert(offset < window);
+        while (m_count <= offset) {
+            std::optional<Token> token = m_tokenizer.next();
+            if (!token.has_value()) {
+                return nullptr;
+            }
+            m_ring[(m_head + m_count) % window] = std::move(token.value());
+            m_count++;
+            m_num_tokens++;
+        }
+        return &m_ring[(m_head + offset) % window];
+    }
+
+    Token consume() {
+        [[maybe_unused]] const Token *next = peek();
+        assert(next != nullptr);
+        Token token = std::move(m_ring[m_head]);
+        m_head = (m_head + 1) % window;
+        m_count--;
+        m_last = {token.type, token.line, {}, token.column};
+        return token;
+    }
+
+    // The position of the last consumed token, for errors at the end of the file.
+    [[nodiscard]] const Token *last() const {
+        return m_num_tokens > m_count ? &m_last : nullptr;
+    }
+
+    [[nodiscard]] size_t num_tokens() const {
+        return m_num_tokens;
+    }
+
+private:
+    Tokenizer &m_tokenizer;
+    std::array<Token, window> m_ring{};
+    size_t m_head = 0;
+    size_t m_count = 0;
+    size_t m_num_tokens = 0;
+    Token m_last{};
 };
@@ -0,0 +1,148 @@
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "harness.hpp"
+
+// Division and remainder by literals, which never use idiv (see
+// Generator::gen_div_const and gen_mod_const), against C++ `/` and `%` over the
+// whole int64 range. One program reads every dividend and prints `x / d` and
+// `x % d` for every divisor. It is built optimized, where `0 - d` folds into a
+// negative literal, and with -O0. INT64_MIN / -1 is left out, it traps like
+// idiv does, see div_min_by_minus_one.gn.
+
+std::vector<int64_t> divisors(std::mt19937_64 &rng) {
+    std::vector<int64_t> result = {INT64_MIN, INT64_MIN + 1, INT64_MAX, INT64_MAX - 1, 1, -1, 3, -3, 5, 6, 7, -7, 9,
+                                   10, -10, 11, 12, 13, 25, 100, 125, 641, 1000, 1000000007, -1000000007,
+                                   4052555153018976267};
+    for (int k = 1; k < 63; k++) {
+        const int64_t power = int64_t{1} << k;
+        for (const int64_t d: {power, power - 1, power + 1}) {
+            if (k % 7 == 1 || k > 59 || k < 4) {
+                result.push_back(d);
+                result.push_back(-d);
+            }
+        }
+    }
+    for (int i = 0; i < 20; i++) {
+        const auto d = static_cast<int64_t>(rng() >> (1 + rng() % 63));
+        if (d != 0) {
+            result.push_back(i % 2 == 0 ? d : -d);
+        }
+    }
+    return result;
+}
+
+std::vector<int64_t> dividends(const std::vector<int64_t> &divisors, std::mt19937_64 &rng) {
+    std::vector<int64_t> result = {INT64_MIN, INT64_MIN + 1, INT64_MAX, INT64_MAX - 1, 0, 1, -1, 2, -2};
+    for (int k = 1; k < 63; k++) {
+        const int64_t power = int64_t{1} << k;
+        for (const int64_t n: {power, power - 1, power + 1}) {
+            result.push_back(n);
+            result.push_back(-n);
+        }
+    }
+    // multiples of a divisor and their neighbours, where the rounding changes
+    for (size_t i = 0; i < 40; i++) {
+        const int64_t d = divisors[rng() % divisors.size()];
+        const int64_t q = static_cast<int64_t>(rng() >> 1) / (d == INT64_MIN ? INT64_MIN : d < 0 ? -d : d);
+        const int64_t multiple = q * d;
+        for (const uint64_t delta: {uint64_t{0} - 1, uint64_t{0}, uint64_t{1}}) {
+            const uint64_t n = static_cast<uint64_t>(multiple) + delta;
+            result.push_back(static_cast<int64_t>(n));
+            result.push_back(static_cast<int64_t>(0 - n));
+        }
+    }
+    for (int i = 0; i < 100; i++) {
+        const uint64_t n = rng() >> (rng() % 64);
+        result.push_back(static_cast<int64_t>(i % 2 == 0 ? n : 0 - n));
+    }
+    return result;
+}
+
+// The literal `d` as an expression; source literals cannot be negative.
+std::string literal(const int64_t d) {
+    if (d == INT64_MIN) {
+        return "(0 - 9223372036854775807 - 1)";
+    }
+    return d < 0 ? "(0 - " + std::to_string(-d) + ")" : std::to_string(d);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        std::cerr << "usage: geny_div_const_test <io.asm>" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (!harness::tools_available()) {
+        std::cerr << "nasm or ld not found" << std::endl;
+        return harness::skip;
+    }
+    const harness::Sandbox sandbox(argv[1]);
+    std::mt19937_64 rng(20240611);
+    const std::vector<int64_t> ds = divisors(rng);
+    const std::vector<int64_t> ns = dividends(ds, rng);
+
+    std::stringstream source;
+    source << "let n = 0;\ninput(n);\nlet x = 0;\nwhile (n > 0) {\n    input(x);\n";
+    for (const int64_t d: ds) {
+        const std::string ops = "print(x / " + literal(d) + ");\n    print(x % " + literal(d) + ");\n";
+        if (d == -1) {
+            source << "    if (x != " << literal(INT64_MIN) << ") {\n        " << ops << "    }\n";
+        } else {
+            source << "    " << ops;
+        }
+    }
+    source << "    n = n - 1;\n}\n";
+
+    std::stringstream input;
+    std::vector<std::pair<std::string, int64_t>> expected; // operation and result, one per printed line
+    input << ns.size() << "\n";
+    for (const int64_t n: ns) {
+        input << n << "\n";
+        for (const int64_t d: ds) {
+            if (n != INT64_MIN || d != -1) {
+                expected.emplace_back(std::to_string(n) + " / " + std::to_string(d), n / d);
+                expected.emplace_back(std::to_string(n) + " % " + std::to_string(d), n % d);
+            }
+        }
+    }
+
+    size_t failures = 0;
+    for (const std::vector<std::string> &config: {std::vector<std::string>{}, {"-O0"}}) {
+        const std::string label = "[" + harness::describe(config) + "] ";
+        const Compilation compilation = genesis_compile(source.str(), genesis_options(
+                                                            harness::parse_flags(config, "div.gn").value()));
+        if (!compilation.ok()) {
+            compilation.diagnostics().print(std::cerr, "div.gn");
+            failures++;
+            continue;
+        }
+        const std::optional<harness::Run> run = sandbox.ok() ? sandbox.run(compilation.asm_text(), input.str())
+                                                              : std::nullopt;
+        if (!run.has_value()) {
+            std::cerr << label << "nasm or ld failed" << std::endl;
+            failures++;
+            continue;
+        }
+        // report the first differing result with its operands
+        std::istringstream lines(run->output);
+        for (const auto &[operation, result]: expected) {
+            std::string line;
+            if (!std::getline(lines, line) || line != std::to_string(result)) {
+                std::cerr << label << operation << ": expected " << result << ", got "
+                          << (lines ? line : "nothing") << std::endl;
+                failures++;
+                break;
+            }
+        }
+        if (run->status != "exit 0") {
+            std::cerr << label << "ended with " << run->status << std::endl;
+            failures++;
+        }
+    }
+    std::cout << ns.size() << " dividends, " << ds.size() << " divisors" << std::endl;
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,200 @@
+#include <array>
+#include <cstdint>
+#include <initializer_list>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "embed.hpp"
+#include "harness.hpp"
+
+// embed.hpp against the compiler. The static_asserts pin what embedded programs
+// compute to what the generated code computes: wrapping arithmetic, shift counts
+// taken mod 64, truncating division that faults on zero and INT64_MIN / -1, and
+// `&&` and `||` that skip their right side. They also pin the kind and position
+// of the error compile_text reports, which is what compile<> passes to
+// source_error. At run time the same sources go through genesis_compile: the
+// errors have to read the same, and when nasm and ld are there the programs have
+// to print the same and fault where the embedded ones do.
+
+struct Outcome {
+    std::array<int64_t, 8> printed{};
+    size_t num_printed = 0;
+    std::optional<int64_t> status = 0; // nothing if an operation faulted
+
+    constexpr bool operator==(const Outcome &) const = default;
+};
+
+template <typename Program>
+constexpr Outcome run(const Program &program, const std::initializer_list<int64_t> input = {}) {
+    Outcome outcome;
+    outcome.status = program.run(std::span(input.begin(), input.size()), [&outcome](const int64_t value) {
+        if (outcome.num_printed < outcome.printed.size()) {
+            outcome.printed[outcome.num_printed] = value;
+        }
+        outcome.num_printed++;
+    });
+    return outcome;
+}
+
+constexpr Outcome printed(const std::initializer_list<int64_t> values, const std::optional<int64_t> status = 0) {
+    Outcome outcome{.status = status};
+    for (const int64_t value: values) {
+        outcome.printed[outcome.num_printed++] = value;
+    }
+    return outcome;
+}
+
+constexpr int64_t min = INT64_MIN;
+constexpr int64_t max = INT64_MAX;
+
+// wrapping arithmetic, on values from input and on literals the compiler folds
+constexpr char wrapping[] = "let m = 0; input(m); print(m + 1); print(0 - m - 1 - 1); print(m * 3);"
+                            "print(9223372036854775807 + 1); print(0 - 9223372036854775807 - 2);";
+static_assert(run(embed::compile<wrapping>(), {max}) == printed({min, max, max - 2, min, max}));
+
+// shift counts are taken mod 64 and >> keeps the sign
+constexpr char shifts[] = "let x = 0; let n = 0; input(x); input(n); print(x << n); print(x << (n + 1));"
+                          "print((0 - 8 * x) >> (n + 1)); print(x << (n - 1)); print((0 - x) >> 63); print(1 << 65);"
+                          "print(x << (n + 40)); print((x << 62) >> (n + 60));";
+static_assert(run(embed::compile<shifts>(), {1, 64}) == printed({1, 2, -4, min, -1, 2, int64_t{1} << 40, 4}));
+
+// division truncates toward zero and the remainder takes the dividend's sign
+constexpr char division[] = "let a = 0; let b = 0; input(a); input(b); print(a / b); print(a % b);"
+                            "print((0 - a) / b); print((0 - a) % b); print(a / (0 - b)); print(a % (0 - b));";
+static_assert(run(embed::compile<division>(), {7, 2}) == printed({3, 1, -3, -1, -3, 1}));
+static_assert(run(embed::compile<division>(), {min, 3})
+              == printed({min / 3, min % 3, min / 3, min % 3, min / -3, min % -3}));
+
+// dividing by zero and INT64_MIN / -1 fault like idiv does, after what was printed before
+constexpr char faults[] = "let a = 0; let b = 0; input(a); input(b); print(1); print(a % b); print(2);";
+static_assert(run(embed::compile<faults>(), {5, 0}) == printed({1}, std::nullopt));
+static_assert(run(embed::compile<faults>(), {min, -1}) == printed({1}, std::nullopt));
+static_assert(run(embed::compile<faults>(), {min, 1}) == printed({1, 0, 2}));
+constexpr char quotient_faults[] = "let a = 0; let b = 0; input(a); input(b); print(a / b); exit(3);";
+static_assert(run(embed::compile<quotient_faults>(), {5, 0}) == printed({}, std::nullopt));
+static_assert(run(embed::compile<quotient_faults>(), {min, -1}) == printed({}, std::nullopt));
+static_assert(run(embed::compile<quotient_faults>(), {min, 2}) == printed({min / 2}, 3));
+// only a literal 0 is an error, a divisor computed from literals faults when run
+constexpr char computed_zero[] = "let x = 1; print(x % (2 - 2));";
+static_assert(run(embed::compile<computed_zero>()) == printed({}, std::nullopt));
+
+// `&&` and `||` give 0 or 1 and do not evaluate a right side that cannot matter
+constexpr char logic[] = "let z = 0; input(z); print(z != 0 && 10 / z > 1); print(z == 0 || 10 / z > 1);"
+                         "print(5 && 7); print(0 || 0 - 3); print(z && 2 / z);";
+static_assert(run(embed::compile<logic>(), {0}) == printed({0, 1, 1, 1, 0}));
+static_assert(run(embed::compile<logic>(), {2}) == printed({1, 1, 1, 1, 1}));
+
+// compile_text errors: the kind, line and column compile<> would report
+template <size_t N>
+constexpr bool fails(const char (&source)[N], const embed::ErrorKind kind, const int line, const int column) {
+    const auto program = embed::compile_text<N>(std::string_view(source, N - 1));
+    return !program.ok() && program.error->kind == kind && program.error->line == line
+           && program.error->column == column;
+}
+
+constexpr char invalid_character[] = "let x = 1;\nprint(x @ 2);";
+static_assert(fails(invalid_character, embed::ErrorKind::invalid_character, 2, 9));
+constexpr char out_of_range[] = "let x = 9223372036854775808;";
+static_assert(fails(out_of_range, embed::ErrorKind::integer_out_of_range, 1, 9));
+constexpr char unterminated[] = "let x = 1; /* print(x);\n";
+static_assert(fails(unterminated, embed::ErrorKind::unterminated_comment, 2, 1));
+constexpr char expected[] = "let x = 1\nprint(x);";
+static_assert(fails(expected, embed::ErrorKind::expected, 2, 1));
+constexpr char undeclared[] = "let x = 1;\nprint(y);";
+static_assert(fails(undeclared, embed::ErrorKind::undeclared_identifier, 2, 7));
+constexpr char already_used[] = "let x = 1;\n{\n    let x = 2;\n}";
+static_assert(fails(already_used, embed::ErrorKind::identifier_already_used, 3, 9));
+constexpr char division_by_zero[] = "let x = 1;\nprint(x / 0);";
+static_assert(fails(division_by_zero, embed::ErrorKind::division_by_zero, 2, 11));
+constexpr char remainder_by_zero[] = "let x = 1;\nprint(x % 0);";
+static_assert(fails(remainder_by_zero, embed::ErrorKind::division_by_zero, 2, 11));
+constexpr char unsupported[] = "let a[3];";
+static_assert(fails(unsupported, embed::ErrorKind::unsupported, 1, 5));
+static_assert(!embed::compile_text<4>("let x = 1; print(x);").ok()
+              && embed::compile_text<4>("let x = 1; print(x);").error->kind == embed::ErrorKind::too_large);
+
+struct Source {
+    std::string_view text;
+    std::vector<int64_t> input;
+};
+
+// The embedded program's output and status, worded like harness::Run.
+harness::Run run_embedded(const std::string_view source, const std::vector<int64_t> &input) {
+    const auto program = embed::compile_text<256>(source);
+    std::stringstream output;
+    const std::optional<int64_t> status = program.run(input, [&output](const int64_t value) {
+        output << value << "\n";
+    });
+    return {
+        .output = output.str(),
+        .status = status.has_value() ? "exit " + std::to_string(static_cast<uint8_t>(status.value())) : "signal 8",
+    };
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        std::cerr << "usage: geny_embed_test <io.asm>" << std::endl;
+        return EXIT_FAILURE;
+    }
+    size_t failures = 0;
+
+    // the errors read like the compiler's first one, at the same place
+    for (const std::string_view source: {invalid_character, out_of_range, unterminated, expected, undeclared,
+                                         already_used, division_by_zero, remainder_by_zero}) {
+        const auto program = embed::compile_text<256>(source);
+        const Compilation compilation = genesis_compile(source, genesis_options(
+                                                            harness::parse_flags({"-O0"}, "embed.gn").value()));
+        const std::vector<Diagnostic> &errors = compilation.diagnostics().errors();
+        if (program.ok() || errors.empty() || errors[0].line != program.error->line
+            || errors[0].column != program.error->column
+            || errors[0].message != program.error->message()) {
+            std::cerr << source << "\n    embedded: "
+                      << (program.ok() ? "no error"
+                                       : std::to_string(program.error->line) + ":"
+                                         + std::to_string(program.error->column) + " " + program.error->message())
+                      << "\n    compiler: "
+                      << (errors.empty() ? "no error"
+                                         : std::to_string(errors[0].line) + ":" + std::to_string(errors[0].column)
+                                           + " " + errors[0].message)
+                      << std::endl;
+            failures++;
+        }
+    }
+
+    if (!harness::tools_available()) {
+        std::cerr << "nasm or ld not found" << std::endl;
+        return failures == 0 ? harness::skip : EXIT_FAILURE;
+    }
+    const harness::Sandbox sandbox(argv[1]);
+    const std::vector<Source> sources = {
+        {wrapping, {max}}, {shifts, {1, 64}}, {division, {7, 2}}, {division, {min, 3}}, {faults, {5, 0}},
+        {faults, {min, -1}}, {faults, {min, 1}}, {quotient_faults, {5, 0}}, {quotient_faults, {min, -1}},
+        {quotient_faults, {min, 2}}, {computed_zero, {}}, {logic, {0}}, {logic, {2}},
+    };
+    for (const Source &source: sources) {
+        std::stringstream input;
+        for (const int64_t value: source.input) {
+            input << value << "\n";
+        }
+        const harness::Run expected = run_embedded(source.text, source.input);
+        for (const std::vector<std::string> &config: {std::vector<std::string>{}, {"-O0"}}) {
+            const Compilation compilation = genesis_compile(source.text, genesis_options(
+                                                                harness::parse_flags(config, "embed.gn").value()));
+            const std::optional<harness::Run> run = compilation.ok() && sandbox.ok()
+                                                        ? sandbox.run(compilation.asm_text(), input.str())
+                                                        : std::nullopt;
+            if (!run.has_value() || run->output != expected.output || run->status != expected.status) {
+                std::cerr << source.text << " [" << harness::describe(config) << "]\n    embedded: "
+                          << expected.status << " after:\n" << expected.output << "    compiled: "
+                          << (run.has_value() ? run->status + " after:\n" + run->output : "failed to build\n");
+                failures++;
+            }
+        }
+    }
+    std::cout << sources.size() << " programs" << std::endl;
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
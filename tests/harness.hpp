@@ -0,0 +1,126 @@
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "genesis.hpp"
+#include "server.hpp"
+
+// Compiling, linking and running .gn programs for the test drivers. Drivers exit
+// with `skip` when a program has to run but nasm or ld are missing, which ctest
+// counts as skipped.
+namespace harness {
+    inline constexpr int skip = 77;
+
+    inline std::optional<std::string> read_text(const std::filesystem::path &path) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            return {};
+        }
+        std::stringstream contents;
+        contents << file.rdbuf();
+        return contents.str();
+    }
+
+    inline bool tools_available() {
+        return system("command -v nasm > /dev/null && command -v ld > /dev/null") == 0;
+    }
+
+    // `flags` as geny would read them, or nothing if it would reject them.
+    inline std::optional<CompileOptions> parse_flags(const std::vector<std::string> &flags, const std::string &path) {
+        std::vector<std::string> args = {"geny"};
+        args.insert(args.end(), flags.begin(), flags.end());
+        args.push_back(path);
+        std::vector<char *> argv;
+        for (std::string &arg: args) {
+            argv.push_back(arg.data());
+        }
+        return parse_args(static_cast<int>(argv.size()), argv.data());
+    }
+
+    inline std::string describe(const std::vector<std::string> &flags) {
+        std::string text;
+        for (const std::string &flag: flags) {
+            text += (text.empty() ? "" : " ") + flag;
+        }
+        return text.empty() ? "default flags" : text;
+    }
+
+    struct Run {
+        std::string output;
+        std::string status; // `exit <code>` or `signal <number>`
+    };
+
+    // A scratch directory holding the assembled io.asm, removed with the object.
+    class Sandbox {
+    public:
+        explicit Sandbox(const std::filesystem::path &runtime)
+            : m_dir(std::filesystem::temp_directory_path() / ("geny-test-" + std::to_string(getpid()))) {
+            std::filesystem::create_directories(m_dir);
+            m_ok = system(("nasm -f elf64 " + runtime.string() + " -o " + (m_dir / "io.o").string()).c_str()) == 0;
+        }
+
+        Sandbox(const Sandbox &) = delete;
+        Sandbox &operator=(const Sandbox &) = delete;
+
+        ~Sandbox() {
+            std::error_code ec;
+            std::filesystem::remove_all(m_dir, ec);
+        }
+
+        // false if io.asm did not assemble
+        [[nodiscard]] bool ok() const {
+            return m_ok;
+        }
+
+        // Links `asm_text` and runs it in the scratch directory with `input` as its
+        // stdin; nothing if nasm or ld fail.
+        [[nodiscard]] std::optional<Run> run(const std::string &asm_text, const std::string &input) const {
+            const std::string base = (m_dir / "out").string();
+            std::fstream(base + ".asm", std::ios::out) << asm_text;
+            std::fstream(base + ".in", std::ios::out | std::ios::binary) << input;
+            const std::string build = "nasm -f elf64 " + base + ".asm -o " + base + ".o && ld "
+                                      + genesis_link_flags(false) + " -o " + base + " " + base + ".o "
+                                      + (m_dir / "io.o").string();
+            if (system(build.c_str()) != 0) {
+                return {};
+            }
+
+            posix_spawn_file_actions_t actions;
+            posix_spawn_file_actions_init(&actions);
+            posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, (base + ".in").c_str(), O_RDONLY, 0);
+            posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, (base + ".stdout").c_str(),
+                                             O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            // files the program writes, like profiles, go with the directory
+            posix_spawn_file_actions_addchdir_np(&actions, m_dir.c_str());
+            char *argv[] = {const_cast<char *>(base.c_str()), nullptr};
+            pid_t pid;
+            const int spawned = posix_spawn(&pid, base.c_str(), &actions, nullptr, argv, environ);
+            posix_spawn_file_actions_destroy(&actions);
+            if (spawned != 0) {
+                return {};
+            }
+            int status = 0;
+            waitpid(pid, &status, 0);
+            return Run{
+                .output = read_text(base + ".stdout").value_or(""),
+                .status = WIFSIGNALED(status) ? "signal " + std::to_string(WTERMSIG(status))
+                                              : "exit " + std::to_string(WEXITSTATUS(status)),
+            };
+        }
+
+    private:
+        std::filesystem::path m_dir;
+        bool m_ok = false;
+    };
+}
@@ -0,0 +1,228 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "optimizer.hpp"
+
+// The optimizer's counters on small programs, to catch transformations that
+// stop firing or start firing where they must not. What the optimized programs
+// print is checked by the programs in tests/programs.
+
+struct Counts {
+    size_t folded = 0;
+    size_t pruned = 0;
+    size_t removed = 0;
+    size_t evaluated = 0;
+    size_t unrolled = 0;
+    size_t reused = 0;
+
+    bool operator==(const Counts &) const = default;
+};
+
+std::ostream &operator<<(std::ostream &out, const Counts &counts) {
+    return out << "folded " << counts.folded << ", pruned " << counts.pruned << ", removed " << counts.removed
+               << ", evaluated " << counts.evaluated << ", unrolled " << counts.unrolled << ", reused "
+               << counts.reused;
+}
+
+struct Case {
+    std::string name;
+    std::string source;
+    Counts expected;
+    size_t unroll = 4;
+};
+
+const std::vector<Case> cases = {
+    // dataflow: constant propagation, branch pruning and dead assignments
+    {
+        "known condition keeps one arm",
+        "let d = 0; let x = 0; input(x);"
+        "if (d == 1) { print(1); } elif (d > 1) { print(2); } else { print(x); }",
+        {.folded = 2, .pruned = 2},
+    },
+    {
+        "loop on a known zero is dropped",
+        "let d = 0; while (d) { print(3); } print(4);",
+        {.folded = 1, .pruned = 1},
+    },
+    {
+        "arms agreeing on a value merge into a constant",
+        "let x = 0; input(x); let a = 5;"
+        "if (x == 1) { a = 5; } elif (x == 2) { a = 2 + 3; } print(a * 2);",
+        // both assignments are dead once `a * 2` is 10
+        {.folded = 2, .removed = 2},
+    },
+    {
+        "arms disagreeing leave the variable unknown",
+        "let x = 0; input(x); let b = 1; if (x == 1) { b = 2; } elif (x == 2) { b = 3; } print(b);",
+        {},
+    },
+    {
+        "back edge keeps a loop variable live and unknown",
+        "let n = 0; input(n); let i = 0; let c = 1;"
+        "while (i < n) { print(c); c = c + 1; i = i + 1; }",
+        {},
+    },
+    {
+        "assignment never read afterwards is removed",
+        "let x = 0; input(x); let y = x; y = x + 1; print(x);",
+        {.removed = 1},
+    },
+    {
+        "assignment never read afterwards stays if it can fault",
+        "let a[4]; let y = 0; input(y); let x = 0; x = a[y]; x = 10 / y; x = y % 3; print(1);",
+        // only `x = y % 3`, whose divisor is a literal, goes
+        {.removed = 1},
+    },
+    {
+        "division by a known zero stays",
+        "let z = 0; let x = 0; input(x); print(x / z); print(x % z);",
+        {},
+    },
+    {
+        "INT64_MIN / -1 on known values stays",
+        "let m = 0 - 9223372036854775807 - 1; let d = 0 - 1; print(m / d); print(m % d);",
+        // the operands become literals, the operations do not
+        {.folded = 6},
+    },
+    {
+        "statements after exit are dropped",
+        "let a = 1; let x = 0; input(x); a = a + x; exit(a); a = 3; print(a);",
+        {.folded = 1, .removed = 2},
+    },
+
+    // loops: evaluation within the step budget, trip counts and unrolling
+    {
+        "loop using the whole budget is evaluated",
+        // one step for the loop, two per pass
+        "let i = 0; while (i < 2047) { i = i + 1; } print(i);",
+        {.folded = 1, .removed = 1, .evaluated = 1},
+    },
+    {
+        "loop one pass over the budget stays",
+        "let i = 0; while (i < 2048) { i = i + 1; } print(i);",
+        {.unrolled = 1},
+    },
+    {
+        "inclusive bound on a negative step",
+        "let s = 0; let i = 10; while (i >= 0) { s = s + i; i = i - 1; } print(s);",
+        {.folded = 1, .removed = 2, .evaluated = 1},
+    },
+    {
+        "counter wrapping before the bound is not evaluated",
+        "let i = 9223372036854775795; while (i < 9223372036854775807) { i = i + 5; } print(i);",
+        // the unrolled test, i < INT64_MAX - 15, is still safe
+        {.unrolled = 1},
+    },
+    {
+        "counter reaching INT64_MAX exactly is evaluated",
+        "let i = 9223372036854775797; while (i < 9223372036854775807) { i = i + 5; } print(i);",
+        {.folded = 1, .removed = 1, .evaluated = 1},
+    },
+    {
+        "unknown start is unrolled",
+        "let n = 0; input(n); while (n >= 3) { print(n); n = n - 2; }",
+        {.unrolled = 1},
+    },
+    {
+        "unrolled bound that would overflow is not unrolled",
+        "let n = 0; input(n); while (n < 0 - 9223372036854775807 + 3) { print(n); n = n + 5; }",
+        // folding the bound into a literal is the only change
+        {.folded = 1},
+    },
+    {
+        "fewer passes than copies are not unrolled",
+        "let n = 0; let i = 5; input(n); while (i < 8) { print(n); i = i + 1; }",
+        {},
+    },
+    {
+        "unrolling by one is off",
+        "let n = 0; input(n); while (n < 100) { print(n); n = n + 1; }",
+        {},
+        1,
+    },
+    {
+        "loop writing a variable declared before it",
+        "let x = 3; let c = 0; while (c < 4) { x = x * 2; c = c + 1; } print(x);",
+        {.folded = 1, .removed = 2, .evaluated = 1},
+    },
+
+    // value numbering: repeated expressions read from a variable
+    {
+        "folded condition leaves nothing to reuse",
+        "let x = 0; input(x); if (x == 1 + 2 * 5) { print(1); } elif (x >= 10) { print(2); }",
+        // 1 + 2 * 5 folds to 11, and x alone is not worth a temp
+        {.folded = 1},
+    },
+    {
+        "value repeated across elif conditions",
+        "let a = 0; let b = 0; let c = 0; input(a); input(b); input(c);"
+        "if (a * b + c == 1) { print(1); } elif (a * b + c == 2) { print(2); }"
+        "elif (b * a + c > 5) { print(a * b + c); }",
+        {.reused = 3},
+    },
+    {
+        "assignment ends a value",
+        "let a = 0; let b = 0; let c = 0; input(a); input(b); input(c);"
+        "print(a * b + c); a = a + 1; print(a * b + c); print(a * b + c);",
+        {.reused = 1},
+    },
+    {
+        "input ends a value but not the values inside it that it does not read",
+        "let a = 0; let b = 0; let c = 0; input(a); input(b); input(c);"
+        "print(a * b + c); input(c); print(a * b + c); print(a * b);",
+        {.reused = 2},
+    },
+    {
+        "loop-varying value is reused only within a pass",
+        "let n = 0; let a = 0; let b = 0; input(n); input(a); input(b); let i = 0;"
+        "while (i < n) { print(a * b + i); print(a * b + i); i = i + 1; }",
+        {.reused = 1},
+    },
+    {
+        "loop-varying condition is not reused in the body",
+        "let n = 0; input(n); let i = 0; while (i * i < n) { print(i * i); i = i + 1; }",
+        {},
+    },
+    {
+        "invariant condition is reused in the body",
+        "let n = 0; input(n); let i = 0; while (i < n * n) { print(n * n); i = i + 1; }",
+        {.reused = 1},
+    },
+    {
+        "value inside a reused value",
+        "let a = 0; let b = 0; let c = 0; let d = 0; input(a); input(b); input(c); input(d);"
+        "print((a * b + c) * d); print((a * b + c) * d); print(a * b + c);",
+        {.reused = 2},
+    },
+};
+
+int main() {
+    size_t failures = 0;
+    for (const Case &test: cases) {
+        Diagnostics diagnostics;
+        Parser parser(Tokenizer(test.source, diagnostics).tokenize(), diagnostics);
+        std::optional<NodeProg> prog = parser.parse_prog();
+        if (!prog.has_value() || diagnostics.has_errors()) {
+            diagnostics.print(std::cerr, test.name);
+            failures++;
+            continue;
+        }
+        Optimizer optimizer(prog.value(), parser.allocator(), test.unroll);
+        optimizer.run();
+        const Counts counts{
+            .folded = optimizer.num_folded(),
+            .pruned = optimizer.num_pruned_branches(),
+            .removed = optimizer.num_removed_stmts(),
+            .evaluated = optimizer.num_evaluated_loops(),
+            .unrolled = optimizer.num_unrolled_loops(),
+            .reused = optimizer.num_reused_exprs(),
+        };
+        if (counts != test.expected) {
+            std::cerr << test.name << ":\n    expected " << test.expected << "\n    got      " << counts << std::endl;
+            failures++;
+        }
+    }
+    std::cout << cases.size() - failures << " of " << cases.size() << " cases passed" << std::endl;
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,100 @@
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "harness.hpp"
+
+// Compiles one tests/programs/<name>.gn through libgenesis, links it with io.asm
+// and checks what it does. Every program is built optimized and with -O0, plus
+// once more for every `// flags: ...` line in it. The run gets <name>.in as its
+// stdin and must print exactly <name>.out and end with the status of the
+// `// exit: <code>` or `// signal: <number>` line, 0 if there is none. If
+// <name>.err exists the compile has to fail with exactly those diagnostics.
+
+struct Expectation {
+    std::vector<std::vector<std::string>> configs = {{}, {"-O0"}};
+    std::string input;
+    std::string output;
+    std::optional<std::string> errors;
+    std::string status = "exit 0";
+};
+
+Expectation read_expectation(const std::filesystem::path &program, const std::string &source) {
+    Expectation expect;
+    std::istringstream lines(source);
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (line.starts_with("// flags:")) {
+            std::istringstream flags(line.substr(std::string_view("// flags:").size()));
+            std::vector<std::string> config;
+            for (std::string flag; flags >> flag;) {
+                config.push_back(flag);
+            }
+            expect.configs.push_back(config);
+        } else if (line.starts_with("// exit:")) {
+            expect.status = "exit " + std::to_string(std::stoi(line.substr(8)));
+        } else if (line.starts_with("// signal:")) {
+            expect.status = "signal " + std::to_string(std::stoi(line.substr(10)));
+        }
+    }
+    std::filesystem::path path = program;
+    expect.input = harness::read_text(path.replace_extension(".in")).value_or("");
+    expect.output = harness::read_text(path.replace_extension(".out")).value_or("");
+    expect.errors = harness::read_text(path.replace_extension(".err"));
+    return expect;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        std::cerr << "usage: geny_program_test <io.asm> <program.gn>" << std::endl;
+        return EXIT_FAILURE;
+    }
+    const std::filesystem::path program = std::filesystem::absolute(argv[2]);
+    const std::optional<std::string> source = harness::read_text(program);
+    if (!source.has_value()) {
+        std::cerr << "cannot read " << program << std::endl;
+        return EXIT_FAILURE;
+    }
+    const Expectation expect = read_expectation(program, source.value());
+    if (!expect.errors.has_value() && !harness::tools_available()) {
+        std::cerr << "nasm or ld not found" << std::endl;
+        return harness::skip;
+    }
+    const harness::Sandbox sandbox(std::filesystem::absolute(argv[1]));
+
+    size_t failures = 0;
+    for (const std::vector<std::string> &config: expect.configs) {
+        const std::string label = "[" + harness::describe(config) + "] ";
+        const std::optional<CompileOptions> opts = harness::parse_flags(config, program.string());
+        if (!opts.has_value()) {
+            std::cerr << label << "invalid flags" << std::endl;
+            failures++;
+            continue;
+        }
+        const Compilation compilation = genesis_compile(source.value(), genesis_options(opts.value()));
+        std::stringstream diagnostics;
+        compilation.diagnostics().print(diagnostics, program.filename().string());
+        if (expect.errors.has_value() || !compilation.ok()) {
+            if (diagnostics.str() != expect.errors) {
+                std::cerr << label << "diagnostics differ, expected:\n" << expect.errors.value_or("(none)\n")
+                          << "got:\n" << diagnostics.str();
+                failures++;
+            }
+            continue;
+        }
+
+        const std::optional<harness::Run> run = sandbox.ok() ? sandbox.run(compilation.asm_text(), expect.input)
+                                                              : std::nullopt;
+        if (!run.has_value()) {
+            std::cerr << label << "nasm or ld failed" << std::endl;
+            failures++;
+        } else if (run->output != expect.output || run->status != expect.status) {
+            std::cerr << label << "expected " << expect.status << " after:\n" << expect.output
+                      << "got " << run->status << " after:\n" << run->output;
+            failures++;
+        }
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
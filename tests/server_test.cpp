@@ -0,0 +1,169 @@
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "harness.hpp"
+
+// A CompileServer on a thread of this process, driven through protocol::compile
+// like geny_client drives it: answers must match genesis_compile's, errors and
+// bad requests must come back with their status, and the server must keep
+// answering after requests too large or too malformed to compile.
+
+struct Check {
+    std::string name;
+    ServeRequest request;
+    ServeStatus status;
+    std::string diagnostics; // checked unless empty
+    std::optional<std::string> output; // checked when set
+};
+
+// What the server should answer, compiled with room for any of the sources here.
+std::string asm_text(const std::string &source, const std::vector<std::string> &flags) {
+    GenesisOptions options = genesis_options(harness::parse_flags(flags, "<input>").value());
+    options.arena_bytes = 256 * 1024 * 1024;
+    return genesis_compile(source, options).asm_text();
+}
+
+// A program whose AST outgrows geny's 4 MB arena.
+std::string large_source() {
+    std::string source = "let x = 0;\ninput(x);\n";
+    for (int i = 0; i < 1000; i++) {
+        source += "print(x";
+        for (int j = 0; j < 40; j++) {
+            source += " + x * " + std::to_string(j);
+        }
+        source += ");\n";
+    }
+    return source;
+}
+
+// `bytes` framed as protocol::send_frame frames them.
+std::string frame(const std::string &bytes) {
+    const auto size = static_cast<uint32_t>(bytes.size());
+    return std::string{static_cast<char>(size & 0xff), static_cast<char>(size >> 8 & 0xff),
+                       static_cast<char>(size >> 16 & 0xff), static_cast<char>(size >> 24 & 0xff)}
+           + bytes;
+}
+
+// Sends `bytes` and whatever comes back before the server hangs up.
+std::optional<ServeResponse> send_raw(const std::string &socket_path, const std::string &bytes) {
+    const int fd = protocol::connect_to(socket_path);
+    if (fd < 0) {
+        return {};
+    }
+    std::optional<ServeResponse> response;
+    if (protocol::write_all(fd, bytes.data(), bytes.size())) {
+        shutdown(fd, SHUT_WR);
+        response = protocol::recv_response(fd);
+    }
+    close(fd);
+    return response;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        std::cerr << "usage: geny_server_test <io.asm>" << std::endl;
+        return EXIT_FAILURE;
+    }
+    const std::string socket_path =
+        (std::filesystem::temp_directory_path() / ("geny-server-test-" + std::to_string(getpid()) + ".sock")).string();
+    CompileServer server(socket_path, 2, argv[1]);
+    int server_status = -1;
+    std::thread serving([&] { server_status = server.run(); });
+    // the socket answers once the server listens; requests wait for the workers
+    for (int i = 0; i < 500 && !std::filesystem::exists(socket_path); i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    const std::string small = "let x = 0;\ninput(x);\nprint(x * 7);\n";
+    const std::string large = large_source();
+    const std::vector<Check> checks = {
+        {"asm", {.emit = Emit::asm_text, .path = "small.gn", .options = {}, .source = small}, ServeStatus::ok, "",
+         asm_text(small, {})},
+        {"asm with options", {.emit = Emit::asm_text, .path = "small.gn", .options = {"-O0", "--unroll=1"},
+         .source = small}, ServeStatus::ok, "", asm_text(small, {"-O0", "--unroll=1"})},
+        {"compile error", {.emit = Emit::asm_text, .path = "bad.gn", .options = {}, .source = "let x = 1;\nprint(y);"},
+         ServeStatus::compile_error, "bad.gn:2:7: error: Undeclared identifier: y\n", ""},
+        {"invalid option", {.emit = Emit::asm_text, .path = "small.gn", .options = {"--no-such-flag"}, .source = small},
+         ServeStatus::bad_request, "geny: invalid compile options\n", ""},
+        {"nested serve", {.emit = Emit::asm_text, .path = "small.gn", .options = {"--serve"}, .source = small},
+         ServeStatus::bad_request, "", ""},
+        // more than the default arena holds, with and without the optimizer
+        {"large source", {.emit = Emit::asm_text, .path = "large.gn", .options = {"-O0"}, .source = large},
+         ServeStatus::ok, "", asm_text(large, {"-O0"})},
+        {"large source optimized", {.emit = Emit::asm_text, .path = "large.gn", .options = {}, .source = large},
+         ServeStatus::ok, "", std::nullopt},
+        {"source above the limit", {.emit = Emit::asm_text, .path = "huge.gn", .options = {},
+         .source = std::string(CompileServer::max_source_bytes + 1, ' ')}, ServeStatus::bad_request, "", ""},
+        {"after the large ones", {.emit = Emit::asm_text, .path = "small.gn", .options = {}, .source = small},
+         ServeStatus::ok, "", asm_text(small, {})},
+    };
+
+    size_t failures = 0;
+    // the library's own arena is too small for it, and says so
+    const Compilation in_default_arena = genesis_compile(large);
+    if (in_default_arena.ok() || in_default_arena.diagnostics().errors()[0].message
+                                 != "program too large for the arena of 4194304 bytes") {
+        std::cerr << "the large source fits the default arena" << std::endl;
+        failures++;
+    }
+    for (const Check &check: checks) {
+        const std::optional<ServeResponse> response = protocol::compile(socket_path, check.request);
+        if (!response.has_value()) {
+            std::cerr << check.name << ": no answer" << std::endl;
+            failures++;
+        } else if (response->status != check.status
+                   || (!check.diagnostics.empty() && response->diagnostics != check.diagnostics)
+                   || (check.output.has_value() && response->output != check.output.value())) {
+            std::cerr << check.name << ": status " << static_cast<int>(response->status) << ", diagnostics:\n"
+                      << response->diagnostics << "output of " << response->output.size() << " bytes" << std::endl;
+            failures++;
+        }
+    }
+
+    // the protocol parser drops connections that do not send a request
+    const std::vector<std::string> malformed = {
+        frame("geny/0") + frame("asm") + frame("x.gn") + frame("") + frame(small),
+        frame("geny/1") + frame("elf") + frame("x.gn") + frame("") + frame(small),
+        frame("geny/1") + frame("asm") + frame("x.gn"),
+        frame("geny/1") + frame("asm") + frame("x.gn") + frame("") + "\xff\xff\xff\xff",
+    };
+    for (size_t i = 0; i < malformed.size(); i++) {
+        if (send_raw(socket_path, malformed[i]).has_value()) {
+            std::cerr << "malformed request " << i << " was answered" << std::endl;
+            failures++;
+        }
+    }
+    const std::string well_formed = frame("geny/1") + frame("asm") + frame("x.gn")
+                                    + frame(std::string("-O0\0--unroll=1", 14)) + frame(small);
+    const std::optional<ServeResponse> response = send_raw(socket_path, well_formed);
+    if (!response.has_value() || response->status != ServeStatus::ok
+        || response->output != asm_text(small, {"-O0", "--unroll=1"})) {
+        std::cerr << "hand-framed request with two options was not compiled with them" << std::endl;
+        failures++;
+    }
+
+    if (harness::tools_available()) {
+        const std::optional<ServeResponse> exe = protocol::compile(
+            socket_path, {.emit = Emit::executable, .path = "small.gn", .options = {}, .source = small});
+        if (!exe.has_value() || exe->status != ServeStatus::ok || !exe->output.starts_with("\x7f" "ELF")) {
+            std::cerr << "exe: no executable" << std::endl;
+            failures++;
+        }
+    }
+
+    kill(getpid(), SIGTERM);
+    serving.join();
+    if (server_status != EXIT_SUCCESS || std::filesystem::exists(socket_path)) {
+        std::cerr << "server exited with " << server_status << " and left " << socket_path << std::endl;
+        failures++;
+    }
+    std::cout << checks.size() + malformed.size() + 1 << " requests" << std::endl;
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
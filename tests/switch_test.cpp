@@ -0,0 +1,182 @@
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "harness.hpp"
+
+// if/elif chains testing one variable against literals, which the generator
+// lowers to a jump table or a binary search (see Generator::gen_if_switch). Each
+// chain is built optimized, where negative literals fold and the chain is
+// lowered, and with -O0, where it stays a chain of tests. The optimized build
+// has to pick the expected lowering, and both have to take the arm of the first
+// test holding for every value around the tested ones and at the ends of int64.
+
+enum class Lowering { none, table, search };
+
+struct Test {
+    std::string op; // ==, <, <=, > or >=
+    int64_t value;
+    bool reversed = false; // `value op x` rather than `x op value`
+
+    [[nodiscard]] bool holds(const int64_t x) const {
+        const int64_t lhs = reversed ? value : x;
+        const int64_t rhs = reversed ? x : value;
+        return op == "==" ? lhs == rhs
+               : op == "<" ? lhs < rhs
+               : op == "<=" ? lhs <= rhs
+               : op == ">" ? lhs > rhs
+               : lhs >= rhs;
+    }
+};
+
+struct Chain {
+    std::string name;
+    std::vector<Test> tests;
+    bool has_else;
+    Lowering lowering;
+};
+
+constexpr int64_t min = INT64_MIN;
+constexpr int64_t max = INT64_MAX;
+
+const std::vector<Chain> chains = {
+    {"dense values", {{"==", 1}, {"==", 2}, {"==", 3}, {"==", 4}}, true, Lowering::table},
+    {"dense values without else", {{"==", 1}, {"==", 2}, {"==", 3}, {"==", 4}}, false, Lowering::table},
+    // 4 of 16 entries lead to an arm, exactly the density a table needs
+    {"quarter of the table used", {{"==", 0}, {"==", 1}, {"==", 2}, {"==", 15}}, true, Lowering::table},
+    {"under a quarter used", {{"==", 0}, {"==", 1}, {"==", 2}, {"==", 16}}, true, Lowering::search},
+    {"under a quarter used without else", {{"==", 0}, {"==", 1}, {"==", 2}, {"==", 16}}, false, Lowering::search},
+    {"too few tests", {{"==", 1}, {"==", 2}, {"==", 3}}, true, Lowering::none},
+    // the repeated values pick their first arm, leaving three cases
+    {"duplicate values", {{"==", 5}, {"==", 6}, {"==", 5}, {"==", 7}, {"==", 6}}, true, Lowering::search},
+    {"duplicate values in a table", {{"==", 8}, {"==", 9}, {"==", 8}, {"==", 10}, {"==", 11}}, false,
+     Lowering::table},
+    {"values far apart", {{"==", 10}, {"==", 20}, {"==", 30}, {"==", 1000}, {"==", 5000}}, true, Lowering::search},
+    {"negative values", {{"==", -3}, {"==", -1}, {"==", -2}, {"==", 0}, {"==", -4}}, true, Lowering::table},
+    {"both ends of int64", {{"==", min}, {"==", min + 1}, {"==", max}, {"==", max - 1}, {"==", 0}}, true,
+     Lowering::search},
+    {"both ends of int64 without else", {{"==", max}, {"==", min}, {"==", -1}, {"==", 1}}, false, Lowering::search},
+    {"table at INT64_MIN", {{"==", min}, {"==", min + 1}, {"==", min + 3}, {"==", min + 2}}, true, Lowering::table},
+    {"table at INT64_MAX", {{"==", max}, {"==", max - 2}, {"==", max - 1}, {"==", max - 3}}, false, Lowering::table},
+    {"overlapping ranges", {{"<", -5}, {"<=", 0}, {"==", 3}, {">", 100}, {">=", 50}}, true, Lowering::search},
+    {"overlapping ranges without else", {{">=", 50}, {"<", -5}, {">", 100}, {"==", -10}, {"<=", 0}}, false,
+     Lowering::search},
+    {"literal on the left", {{">", 10, true}, {">=", 20, true}, {"==", 30, true}, {"<", 40, true}}, true,
+     Lowering::search},
+    {"tests that never hold", {{"<", min}, {">", max}, {"==", 1}, {"==", 2}, {"==", 3}}, true, Lowering::search},
+    {"test that always holds", {{"==", 4}, {">=", min}, {"==", 1}, {"==", 2}}, true, Lowering::search},
+    {"ranges up to the ends", {{"<=", min + 1}, {">=", max - 1}, {"<", 0}, {">", 0}}, false, Lowering::search},
+};
+
+// The literal `value` as an expression; source literals cannot be negative.
+std::string literal(const int64_t value) {
+    if (value == min) {
+        return "(0 - 9223372036854775807 - 1)";
+    }
+    return value < 0 ? "(0 - " + std::to_string(-value) + ")" : std::to_string(value);
+}
+
+// Reads a count and then that many values, printing for each the number of the
+// arm it takes followed by 100.
+std::string source(const Chain &chain) {
+    std::stringstream out;
+    out << "let n = 0;\ninput(n);\nlet x = 0;\nwhile (n > 0) {\n    input(x);\n";
+    for (size_t i = 0; i < chain.tests.size(); i++) {
+        const Test &test = chain.tests[i];
+        const std::string cond = test.reversed ? literal(test.value) + " " + test.op + " x"
+                                               : "x " + test.op + " " + literal(test.value);
+        out << (i == 0 ? "    if (" : " elif (") << cond << ") {\n        print(" << i << ");\n    }";
+    }
+    if (chain.has_else) {
+        out << " else {\n        print(" << chain.tests.size() << ");\n    }";
+    }
+    out << "\n    print(100);\n    n = n - 1;\n}\n";
+    return out.str();
+}
+
+Lowering lowering(const std::string &asm_text) {
+    return asm_text.find("switch_table") != std::string::npos ? Lowering::table
+           : asm_text.find(";; switch") != std::string::npos ? Lowering::search
+           : Lowering::none;
+}
+
+std::string describe(const Lowering lowering) {
+    return lowering == Lowering::table ? "a jump table" : lowering == Lowering::search ? "a binary search" : "tests";
+}
+
+// Every tested value and its neighbours, the ends of int64 and a few others.
+std::vector<int64_t> values(const Chain &chain, std::mt19937_64 &rng) {
+    std::vector<int64_t> result = {min, min + 1, max, max - 1, -1, 0, 1};
+    for (const Test &test: chain.tests) {
+        for (const uint64_t delta: {uint64_t{0} - 1, uint64_t{0}, uint64_t{1}}) {
+            result.push_back(static_cast<int64_t>(static_cast<uint64_t>(test.value) + delta));
+        }
+    }
+    for (int i = 0; i < 8; i++) {
+        result.push_back(static_cast<int64_t>(rng() >> (rng() % 64)) * (i % 2 == 0 ? 1 : -1));
+    }
+    return result;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        std::cerr << "usage: geny_switch_test <io.asm>" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (!harness::tools_available()) {
+        std::cerr << "nasm or ld not found" << std::endl;
+        return harness::skip;
+    }
+    const harness::Sandbox sandbox(argv[1]);
+    std::mt19937_64 rng(20240715);
+
+    size_t failures = 0;
+    for (const Chain &chain: chains) {
+        const std::vector<int64_t> xs = values(chain, rng);
+        std::stringstream input;
+        std::stringstream expected;
+        input << xs.size() << "\n";
+        for (const int64_t x: xs) {
+            input << x << "\n";
+            size_t arm = 0;
+            while (arm < chain.tests.size() && !chain.tests[arm].holds(x)) {
+                arm++;
+            }
+            if (arm < chain.tests.size() || chain.has_else) {
+                expected << arm << "\n";
+            }
+            expected << "100\n";
+        }
+
+        for (const std::vector<std::string> &config: {std::vector<std::string>{}, {"-O0"}}) {
+            const std::string label = chain.name + " [" + harness::describe(config) + "]: ";
+            const Compilation compilation = genesis_compile(source(chain), genesis_options(
+                                                                harness::parse_flags(config, "switch.gn").value()));
+            if (!compilation.ok()) {
+                compilation.diagnostics().print(std::cerr, "switch.gn");
+                failures++;
+                continue;
+            }
+            if (config.empty() && lowering(compilation.asm_text()) != chain.lowering) {
+                std::cerr << label << "expected " << describe(chain.lowering) << ", got "
+                          << describe(lowering(compilation.asm_text())) << std::endl;
+                failures++;
+            }
+            const std::optional<harness::Run> run = sandbox.ok() ? sandbox.run(compilation.asm_text(), input.str())
+                                                                  : std::nullopt;
+            if (!run.has_value()) {
+                std::cerr << label << "nasm or ld failed" << std::endl;
+                failures++;
+            } else if (run->output != expected.str() || run->status != "exit 0") {
+                std::cerr << label << "expected:\n" << expected.str() << "got " << run->status << " after:\n"
+                          << run->output;
+                failures++;
+            }
+        }
+    }
+    std::cout << chains.size() << " chains" << std::endl;
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
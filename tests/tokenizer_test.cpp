@@ -0,0 +1,123 @@
+#include <algorithm>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "tokenization.hpp"
+
+// Tokenizer::tokenize_parallel against tokenize() on sources cut into many small
+// chunks, with `/* */` comments running across chunk boundaries and lexical
+// errors spread over several chunks. Token types, lines, columns, values and the
+// diagnostics have to be identical.
+
+// A random source of `lines` lines. Comments opened on one line are closed a
+// few lines later, so with small chunks they cross from one chunk into the next.
+std::string random_source(std::mt19937_64 &rng, const int lines, const bool unterminated) {
+    static const std::vector<std::string> words = {
+        "let", "x", "y1", "while", "if", "elif", "else", "print", "input", "fn", "return", "exit", "parallel",
+        "0", "42", "9223372036854775807", "99999999999999999999", "=", "==", "!=", "<", "<=", "<<", ">", ">=",
+        ">>", "+", "-", "*", "/", "%", "&", "&&", "|", "||", "^", "(", ")", "[", "]", "{", "}", ";", ",",
+        "@", "$", "!", "#", "// note", "/* a */", "/**/",
+    };
+    std::string source;
+    int comment_lines = 0; // lines left in an open `/* */` comment
+    for (int line = 0; line < lines; line++) {
+        const size_t count = rng() % 8;
+        for (size_t i = 0; i < count; i++) {
+            source += std::string(rng() % 3, ' ') + words[rng() % words.size()];
+            if (rng() % 4 == 0) {
+                source += '\t';
+            }
+        }
+        if (comment_lines > 0 && --comment_lines == 0) {
+            source += " */ @";
+        } else if (comment_lines == 0 && rng() % 6 == 0) {
+            source += " /* $";
+            comment_lines = 1 + static_cast<int>(rng() % 5);
+        }
+        source += '\n';
+    }
+    if (comment_lines > 0 && !unterminated) {
+        source += "*/\n";
+    } else if (comment_lines == 0 && unterminated) {
+        source += "x /* never closed\n";
+    }
+    return source;
+}
+
+struct Lexed {
+    std::vector<Token> tokens;
+    std::vector<Diagnostic> errors;
+};
+
+// The first token or diagnostic where `a` and `b` differ, or nothing.
+std::optional<std::string> difference(const Lexed &a, const Lexed &b) {
+    for (size_t i = 0; i < std::max(a.tokens.size(), b.tokens.size()); i++) {
+        if (i >= a.tokens.size() || i >= b.tokens.size()) {
+            return "token count " + std::to_string(a.tokens.size()) + " vs " + std::to_string(b.tokens.size());
+        }
+        const Token &x = a.tokens[i];
+        const Token &y = b.tokens[i];
+        if (x.type != y.type || x.line != y.line || x.column != y.column || x.value != y.value
+            || x.int_value != y.int_value) {
+            return "token " + std::to_string(i) + " at " + std::to_string(x.line) + ":" + std::to_string(x.column)
+                   + " vs " + std::to_string(y.line) + ":" + std::to_string(y.column);
+        }
+    }
+    for (size_t i = 0; i < std::max(a.errors.size(), b.errors.size()); i++) {
+        if (i >= a.errors.size() || i >= b.errors.size()) {
+            return "error count " + std::to_string(a.errors.size()) + " vs " + std::to_string(b.errors.size());
+        }
+        const Diagnostic &x = a.errors[i];
+        const Diagnostic &y = b.errors[i];
+        if (x.line != y.line || x.column != y.column || x.message != y.message) {
+            return "error " + std::to_string(i) + " " + std::to_string(x.line) + ":" + std::to_string(x.column) + " "
+                   + x.message + " vs " + std::to_string(y.line) + ":" + std::to_string(y.column) + " " + y.message;
+        }
+    }
+    return {};
+}
+
+int main() {
+    std::mt19937_64 rng(20240702);
+    size_t failures = 0;
+    size_t checks = 0;
+    for (int i = 0; i < 200; i++) {
+        const std::string source = random_source(rng, 1 + static_cast<int>(rng() % 60), i % 5 == 0);
+        // 0 keeps every error, 20 is geny's default limit
+        for (const size_t max_errors: {size_t{0}, size_t{20}}) {
+            Diagnostics serial_diagnostics(max_errors);
+            Tokenizer serial(source, serial_diagnostics);
+            const Lexed expected{serial.tokenize(), serial_diagnostics.errors()};
+
+            // tokenize() starts over every time
+            Diagnostics again_diagnostics(max_errors);
+            Tokenizer again(source, again_diagnostics);
+            again.tokenize();
+            again_diagnostics = Diagnostics(max_errors);
+            const Lexed second{again.tokenize(), again_diagnostics.errors()};
+            if (const auto diff = difference(expected, second)) {
+                std::cerr << "source " << i << ", second tokenize(): " << diff.value() << std::endl;
+                failures++;
+            }
+
+            for (const size_t threads: {2, 3, 5, 16}) {
+                for (const size_t chunk_bytes: {1, 8, 40}) {
+                    Diagnostics diagnostics(max_errors);
+                    Tokenizer parallel(source, diagnostics);
+                    const Lexed lexed{parallel.tokenize_parallel(threads, chunk_bytes), diagnostics.errors()};
+                    checks++;
+                    if (const auto diff = difference(expected, lexed)) {
+                        std::cerr << "source " << i << ", " << threads << " threads, chunks of " << chunk_bytes
+                                  << " bytes, max errors " << max_errors << ": " << diff.value() << std::endl;
+                        failures++;
+                    }
+                }
+            }
+        }
+    }
+    std::cout << checks - failures << " of " << checks << " parallel tokenizations matched" << std::endl;
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}